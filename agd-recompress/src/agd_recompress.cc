@@ -0,0 +1,248 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "args.hxx"
+#include "json.hpp"
+#include "libagd/src/compression.h"
+#include "libagd/src/filemap.h"
+#include "libagd/src/format.h"
+#include "libagd/src/parser.h"
+#include "liberr/errors.h"
+
+using namespace std;
+using namespace errors;
+using json = nlohmann::json;
+
+struct RecompressStats {
+  std::atomic_uint64_t files{0};
+  std::atomic_uint64_t skipped{0};
+  std::atomic_uint64_t bytes_in{0};
+  std::atomic_uint64_t bytes_out{0};
+};
+
+// reused between files by a worker
+struct RecompressBuffers {
+  agd::Buffer raw, index, data, compressed;
+};
+
+// rewrite one column file with the given compressor
+Status RecompressFile(const string& path, agd::RecordParser& parser,
+                      agd::ChunkCompressor& compressor, bool force,
+                      bool compact_index, RecompressBuffers& bufs,
+                      RecompressStats& stats) {
+  char* mapped;
+  uint64_t size;
+  ERR_RETURN_IF_ERROR(mmap_file(path, &mapped, &size));
+
+  agd::format::FileHeader header;
+  Status s = agd::format::ReadHeader(mapped, size, &header);
+  if (!s.ok()) {
+    unmap_file(mapped, size);
+    return InvalidArgument("File ", path, " is not an AGD chunk: ",
+                           s.error_message());
+  }
+  auto compression_type =
+      static_cast<agd::format::CompressionType>(header.compression_type);
+  auto index_encoding = header.GetIndexEncoding();
+  if (compression_type == compressor.type() && !force &&
+      (!compact_index ||
+       index_encoding != agd::format::IndexEncoding::RELATIVE_INDEX)) {
+    unmap_file(mapped, size);
+    stats.skipped++;
+    return Status::OK();
+  }
+
+  // checks the checksums and expands the index, so a corrupt chunk is not
+  // rewritten with fresh checksums
+  uint64_t first_ordinal;
+  uint32_t num_records;
+  string record_id;
+  s = parser.ParseNew(mapped, size, false, &bufs.raw, &first_ordinal,
+                      &num_records, record_id, false);
+  unmap_file(mapped, size);
+  if (!s.ok()) {
+    return Status(s.code(), absl::StrCat(path, ": ", s.error_message()));
+  }
+
+  // the quality and meta codecs and index encoding need the index and the
+  // data apart
+  const size_t index_size = num_records * sizeof(agd::format::RelativeIndex);
+  if (bufs.raw.size() < index_size) {
+    return OutOfRange("File ", path, " has ", num_records,
+                      " records, but only ", bufs.raw.size(), " bytes");
+  }
+  ERR_RETURN_IF_ERROR(bufs.index.WriteBuffer(bufs.raw.data(), index_size));
+  ERR_RETURN_IF_ERROR(bufs.data.WriteBuffer(bufs.raw.data() + index_size,
+                                            bufs.raw.size() - index_size));
+  auto& compressed = bufs.compressed;
+  ERR_RETURN_IF_ERROR(compressor.Compress(bufs.index, bufs.data, &compressed));
+
+  header.version_minor = agd::format::current_minor;
+  header._padding = 0;
+  header.segment_start = sizeof(header);
+  compressor.FillHeader(&header);
+
+  auto tmp_path = absl::StrCat(path, ".recompress");
+  std::ofstream out_file(tmp_path, std::ios::binary);
+  out_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out_file.write(compressed.data(), compressed.size());
+  out_file.close();
+  if (!out_file.good()) {
+    remove(tmp_path.c_str());
+    return Internal("Failed to write ", tmp_path);
+  }
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    remove(tmp_path.c_str());
+    return Internal("Failed to replace ", path, ", errno ", errno);
+  }
+
+  stats.files++;
+  stats.bytes_in += size;
+  stats.bytes_out += sizeof(header) + compressed.size();
+  return Status::OK();
+}
+
+int main(int argc, char** argv) {
+  args::ArgumentParser parser(
+      "agd-recompress",
+      "Recompress the columns of an AGD dataset in place with another codec.");
+  args::HelpFlag help(parser, "help", "Display this help menu", {'h', "help"});
+  args::ValueFlag<std::string> codec_arg(
+      parser, "codec",
+      "Target compression, <codec>[:<level>] optionally followed by "
+      ",<column>=<codec>[:<level>] overrides. Codecs are gzip, libdeflate, "
+      "zstd and none, plus quality[:bin] for the qual column and meta for "
+      "the meta column, e.g. zstd,qual=quality,meta=meta [zstd]",
+      {'c', "codec"});
+  args::ValueFlag<unsigned int> threads_arg(
+      parser, "threads",
+      absl::StrCat("Number of threads [", std::thread::hardware_concurrency(),
+                   "]"),
+      {'t', "threads"});
+  args::Flag force_arg(
+      parser, "force",
+      "Recompress files that already have the target compression type, e.g. "
+      "to change the level",
+      {'f', "force"});
+  args::Flag compact_index_arg(
+      parser, "compact index",
+      absl::StrCat("Store the record index of chunks whose records are "
+                   "(nearly) the same length as a single length or varint "
+                   "deltas. Needs readers of format version ",
+                   int(agd::format::current_major), ".",
+                   int(agd::format::current_minor)),
+      {"compact_index"});
+  args::Positional<std::string> dataset_arg(
+      parser, "dataset path",
+      "AGD dataset to recompress. Specify the metadata.json file.");
+
+  try {
+    parser.ParseCLI(argc, argv);
+  } catch (const args::Completion& e) {
+    std::cout << e.what();
+    return 0;
+  } catch (const args::Help&) {
+    std::cout << parser;
+    return 0;
+  } catch (const args::ParseError& e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return 1;
+  }
+
+  if (!dataset_arg) {
+    std::cerr << "An AGD metadata file is required\n" << parser;
+    return 1;
+  }
+
+  agd::ColumnCodecs codecs;
+  codecs.set_compact_index(args::get(compact_index_arg));
+  Status s = agd::ColumnCodecs::Parse(
+      codec_arg ? args::get(codec_arg) : std::string("zstd"), codecs);
+  if (!s.ok()) {
+    cout << s.error_message() << "\n";
+    return 1;
+  }
+
+  const auto& path = args::get(dataset_arg);
+  ifstream i(path);
+  if (!i.good()) {
+    cout << "Could not open " << path << "\n";
+    return 1;
+  }
+  json agd_metadata;
+  i >> agd_metadata;
+
+  string file_path_base = path.substr(0, path.find_last_of('/') + 1);
+
+  // every column file, with the index of its column
+  vector<string> columns;
+  for (const auto& col : agd_metadata["columns"]) {
+    columns.push_back(col.get<string>());
+  }
+  vector<pair<string, size_t>> files;
+  for (const auto& chunk : agd_metadata["records"]) {
+    for (size_t c = 0; c < columns.size(); c++) {
+      files.emplace_back(absl::StrCat(file_path_base,
+                                      chunk["path"].get<string>(), ".",
+                                      columns[c]),
+                         c);
+    }
+  }
+
+  unsigned int threads = std::thread::hardware_concurrency();
+  if (threads_arg) {
+    threads = std::max(1u, args::get(threads_arg));
+  }
+  cout << "[agd-recompress] Recompressing " << files.size() << " files with "
+       << threads << " threads\n";
+
+  auto start = std::chrono::steady_clock::now();
+  RecompressStats stats;
+  std::atomic_size_t next_file{0};
+  std::atomic_bool failed{false};
+  bool force = args::get(force_arg);
+  bool compact_index = args::get(compact_index_arg);
+
+  vector<thread> workers(threads);
+  for (auto& t : workers) {
+    t = thread([&]() {
+      vector<unique_ptr<agd::ChunkCompressor>> compressors;
+      Status ts = codecs.MakeCompressors(columns, compressors);
+      agd::RecordParser parser;
+      RecompressBuffers bufs;
+      while (ts.ok() && !failed) {
+        auto idx = next_file++;
+        if (idx >= files.size()) break;
+        const auto& file = files[idx];
+        ts = RecompressFile(file.first, parser,
+                            *compressors[file.second], force, compact_index,
+                            bufs, stats);
+      }
+      if (!ts.ok()) {
+        cout << "[agd-recompress] Error: " << ts.error_message() << "\n";
+        failed = true;
+      }
+    });
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+
+  auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            start)
+                  .count();
+  cout << "[agd-recompress] Recompressed " << stats.files << " files, skipped "
+       << stats.skipped << ", " << stats.bytes_in << " -> " << stats.bytes_out
+       << " bytes in " << secs << " seconds\n";
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "args.hxx"
+#include "json.hpp"
+#include "libagd/src/buffer.h"
+#include "libagd/src/filemap.h"
+#include "libagd/src/format.h"
+#include "libagd/src/parser.h"
+#include "liberr/errors.h"
+
+using namespace std;
+using namespace errors;
+using json = nlohmann::json;
+
+struct VerifyStats {
+  std::atomic_uint64_t files{0};
+  std::atomic_uint64_t unchecksummed{0};
+  std::atomic_uint64_t bad{0};
+  std::atomic_uint64_t bytes{0};
+};
+
+struct ChunkFile {
+  string path;
+  uint64_t first, last;
+};
+
+// decompress one column file, which checks its checksums, and check its
+// index against its data and its ordinals against the metadata
+Status VerifyFile(const ChunkFile& file, agd::RecordParser& parser,
+                  agd::Buffer& buf, VerifyStats& stats) {
+  char* mapped;
+  uint64_t size;
+  ERR_RETURN_IF_ERROR(mmap_file(file.path, &mapped, &size));
+
+  agd::format::FileHeader header;
+  Status s = agd::format::ReadHeader(mapped, size, &header);
+  uint64_t first_ordinal;
+  uint32_t num_records;
+  string record_id;
+  if (s.ok()) {
+    s = parser.ParseNew(mapped, size, true, &buf, &first_ordinal,
+                        &num_records, record_id, false);
+  }
+  unmap_file(mapped, size);
+  ERR_RETURN_IF_ERROR(s);
+
+  if (first_ordinal != file.first || first_ordinal + num_records != file.last) {
+    return OutOfRange("Chunk has records [", first_ordinal, ", ",
+                      first_ordinal + num_records, "), metadata says [",
+                      file.first, ", ", file.last, ")");
+  }
+  if (!header.HasChecksums()) {
+    stats.unchecksummed++;
+  }
+  stats.bytes += size;
+  return Status::OK();
+}
+
+int main(int argc, char** argv) {
+  args::ArgumentParser parser(
+      "agd-verify",
+      "Check the checksums and record indexes of every column file of an AGD "
+      "dataset.");
+  args::HelpFlag help(parser, "help", "Display this help menu", {'h', "help"});
+  args::ValueFlag<unsigned int> threads_arg(
+      parser, "threads",
+      absl::StrCat("Number of threads [", std::thread::hardware_concurrency(),
+                   "]"),
+      {'t', "threads"});
+  args::Positional<std::string> dataset_arg(
+      parser, "dataset path",
+      "AGD dataset to verify. Specify the metadata.json file.");
+
+  try {
+    parser.ParseCLI(argc, argv);
+  } catch (const args::Completion& e) {
+    std::cout << e.what();
+    return 0;
+  } catch (const args::Help&) {
+    std::cout << parser;
+    return 0;
+  } catch (const args::ParseError& e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return 1;
+  }
+
+  if (!dataset_arg) {
+    std::cerr << "An AGD metadata file is required\n" << parser;
+    return 1;
+  }
+
+  const auto& path = args::get(dataset_arg);
+  ifstream i(path);
+  if (!i.good()) {
+    cout << "Could not open " << path << "\n";
+    return 1;
+  }
+  json agd_metadata;
+  i >> agd_metadata;
+
+  string file_path_base = path.substr(0, path.find_last_of('/') + 1);
+
+  vector<ChunkFile> files;
+  for (const auto& chunk : agd_metadata["records"]) {
+    for (const auto& col : agd_metadata["columns"]) {
+      files.push_back({absl::StrCat(file_path_base,
+                                    chunk["path"].get<string>(), ".",
+                                    col.get<string>()),
+                       chunk["first"].get<uint64_t>(),
+                       chunk["last"].get<uint64_t>()});
+    }
+  }
+
+  unsigned int threads = std::thread::hardware_concurrency();
+  if (threads_arg) {
+    threads = std::max(1u, args::get(threads_arg));
+  }
+  cout << "[agd-verify] Verifying " << files.size() << " files with "
+       << threads << " threads\n";
+
+  auto start = std::chrono::steady_clock::now();
+  VerifyStats stats;
+  std::atomic_size_t next_file{0};
+  std::mutex out_mu;
+
+  vector<thread> workers(threads);
+  for (auto& t : workers) {
+    t = thread([&]() {
+      agd::RecordParser parser;
+      agd::Buffer buf;
+      while (true) {
+        auto idx = next_file++;
+        if (idx >= files.size()) break;
+        Status s = VerifyFile(files[idx], parser, buf, stats);
+        stats.files++;
+        if (!s.ok()) {
+          stats.bad++;
+          std::lock_guard<std::mutex> l(out_mu);
+          cout << "[agd-verify] BAD " << files[idx].path << ": "
+               << s.ToString() << "\n";
+        }
+      }
+    });
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+
+  auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            start)
+                  .count();
+  cout << "[agd-verify] Verified " << stats.files << " files, " << stats.bytes
+       << " bytes in " << secs << " seconds. " << stats.bad << " bad, "
+       << stats.unchecksummed << " without checksums (before format 0.3)\n";
+
+  return stats.bad > 0 ? 1 : 0;
+}
@@ -25,6 +25,11 @@ int main(int argc, char** argv) {
       parser, "ceph config file json",
       "Ceph config json path. If not provided, filesystem access is assumed.",
       {'c', "ceph_config"});
+  args::ValueFlag<std::string> io_engine_arg(
+      parser, "io engine",
+      "File I/O engine without Ceph, sync or io_uring. io_uring keeps the "
+      "column files of several chunks in flight, for NVMe and NFS [sync]",
+      {"io_engine"});
   args::Positional<std::string> agd_metadata_args(
       parser, "agd args", "AGD metadata of dataset to convert.");
 
@@ -60,7 +65,13 @@ int main(int argc, char** argv) {
                               ceph_json_path, 5);
     CheckStatus(s);
   } else {
-    auto s = FileSystemManager::Run(input_queue, 5, max_chunks, agd_meta_path);
+    agd::IoEngine io_engine = agd::IoEngine::SYNC;
+    if (io_engine_arg) {
+      Status s = agd::ParseIoEngine(args::get(io_engine_arg), &io_engine);
+      CheckStatus(s);
+    }
+    auto s = FileSystemManager::Run(input_queue, 5, max_chunks, agd_meta_path,
+                                    io_engine);
     CheckStatus(s);
   }
 
@@ -58,36 +58,74 @@ errors::Status BamBuilder::Run() {
     agd::AGDRecordReader base_reader(item.col_bufs[0]->data(), item.chunk_size);
     agd::AGDRecordReader qual_reader(item.col_bufs[1]->data(), item.chunk_size);
     agd::AGDRecordReader meta_reader(item.col_bufs[2]->data(), item.chunk_size);
-    agd::AGDResultReader aln_reader(item.col_bufs[3]->data(), item.chunk_size);
+    auto aln_type = item.record_types.size() > 3
+                        ? item.record_types[3]
+                        : agd::format::RecordType::STRUCTURED;
+    agd::AGDResultReader aln_reader(item.col_bufs[3]->data(), item.chunk_size,
+                                    nullptr, aln_type);
 
     Alignment result;
+    const agd::format::BinaryAlignment* bin_result;
     const char *meta, *base, *qual;
     const char* cigar;
     size_t meta_len, base_len, qual_len, cigar_len;
     //int ref_index, mate_ref_index;
     vector<uint32_t> cigar_vec;
     cigar_vec.reserve(20);  // should usually be enough
+    const uint32_t* cigar_ops;
+    size_t num_cigar_ops;
 
     Status s = Status::OK();
     while (s.ok()) {
       ERR_RETURN_IF_ERROR(meta_reader.GetNextRecord(&meta, &meta_len));
       ERR_RETURN_IF_ERROR(base_reader.GetNextRecord(&base, &base_len));
       ERR_RETURN_IF_ERROR(qual_reader.GetNextRecord(&qual, &qual_len));
-      Status aln_s = aln_reader.GetNextResult(result);
 
-      if (IsUnavailable(aln_s)) {  // a null alignment, skip it
-        continue;
+      int ref_index, position, next_ref_index, next_position, template_length;
+      uint16_t flag;
+      uint8_t mapq;
+      if (aln_reader.IsBinary()) {
+        // binary results already carry BAM packed cigar ops
+        Status aln_s = aln_reader.GetNextBinaryResult(&bin_result);
+        if (IsUnavailable(aln_s)) {  // a null alignment, skip it
+          continue;
+        }
+        ERR_RETURN_IF_ERROR(aln_s);
+        ref_index = bin_result->ref_index;
+        position = bin_result->position;
+        next_ref_index = bin_result->next_ref_index;
+        next_position = bin_result->next_position;
+        template_length = bin_result->template_length;
+        flag = bin_result->flag;
+        mapq = bin_result->mapping_quality;
+        cigar_ops = bin_result->cigar();
+        num_cigar_ops = bin_result->num_cigar_ops;
+      } else {
+        Status aln_s = aln_reader.GetNextResult(result);
+
+        if (IsUnavailable(aln_s)) {  // a null alignment, skip it
+          continue;
+        }
+
+        cigar = result.cigar().c_str();
+        cigar_len = result.cigar().length();
+        ERR_RETURN_IF_ERROR(ParseCigar(cigar, cigar_len, cigar_vec));
+        ref_index = result.position().ref_index();
+        position = result.position().position();
+        next_ref_index = result.next_position().ref_index();
+        next_position = result.next_position().position();
+        template_length = result.template_length();
+        flag = result.flag();
+        mapq = result.mapping_quality();
+        cigar_ops = cigar_vec.data();
+        num_cigar_ops = cigar_vec.size();
       }
 
       const char* occ = strchr(meta, ' ');
       if (occ) meta_len = occ - meta;
 
-      cigar = result.cigar().c_str();
-      cigar_len = result.cigar().length();
-      ERR_RETURN_IF_ERROR(ParseCigar(cigar, cigar_len, cigar_vec));
-
       size_t bamSize = BAMAlignment::size(
-          (unsigned)meta_len + 1, cigar_vec.size(), base_len, /*auxLen*/ 0);
+          (unsigned)meta_len + 1, num_cigar_ops, base_len, /*auxLen*/ 0);
       if ((buffer_size_ - scratch_pos_) < bamSize) {
         // full buffer, push to compress queue and get a new buffer
         // LOG(INFO) << "main is getting buf for compress";
@@ -114,21 +152,21 @@ errors::Status BamBuilder::Run() {
       BAMAlignment* bam = (BAMAlignment*)(scratch_ + scratch_pos_);
       bam->block_size = (int)bamSize - 4;
 
-      bam->refID = result.position().ref_index();
-      bam->pos = result.position().position();
+      bam->refID = ref_index;
+      bam->pos = position;
       bam->l_read_name = (_uint8)meta_len + 1;
-      bam->MAPQ = result.mapping_quality();
-      bam->next_refID = result.next_position().ref_index();
-      bam->next_pos = result.next_position().position();
-
-      int refLength = cigar_vec.size() > 0 ? 0 : base_len;
-      for (size_t i = 0; i < cigar_vec.size(); i++) {
-        refLength += BAMAlignment::CigarCodeToRefBase[cigar_vec[i] & 0xf] *
-                     (cigar_vec[i] >> 4);
+      bam->MAPQ = mapq;
+      bam->next_refID = next_ref_index;
+      bam->next_pos = next_position;
+
+      int refLength = num_cigar_ops > 0 ? 0 : base_len;
+      for (size_t i = 0; i < num_cigar_ops; i++) {
+        refLength += BAMAlignment::CigarCodeToRefBase[cigar_ops[i] & 0xf] *
+                     (cigar_ops[i] >> 4);
       }
 
-      if (agd::IsUnmapped(result.flag())) {
-        if (agd::IsNextUnmapped(result.flag())) {
+      if (agd::IsUnmapped(flag)) {
+        if (agd::IsNextUnmapped(flag)) {
           bam->bin = BAMAlignment::reg2bin(-1, 0);
         } else {
           bam->bin = BAMAlignment::reg2bin(bam->next_pos, bam->next_pos + 1);
@@ -137,13 +175,13 @@ errors::Status BamBuilder::Run() {
         bam->bin = BAMAlignment::reg2bin(bam->pos, bam->pos + refLength);
       }
 
-      bam->n_cigar_op = cigar_vec.size();
-      bam->FLAG = result.flag();
+      bam->n_cigar_op = num_cigar_ops;
+      bam->FLAG = flag;
       bam->l_seq = base_len;
-      bam->tlen = (int)result.template_length();
+      bam->tlen = template_length;
       memcpy(bam->read_name(), meta, meta_len);
       bam->read_name()[meta_len] = 0;
-      memcpy(bam->cigar(), &cigar_vec[0], cigar_vec.size() * 4);
+      memcpy(bam->cigar(), cigar_ops, num_cigar_ops * 4);
       BAMAlignment::encodeSeq(bam->seq(), base, base_len);
       memcpy(bam->qual(), qual, qual_len);
       for (unsigned i = 0; i < qual_len; i++) {
@@ -11,7 +11,8 @@
 using json = nlohmann::json;
 //using namespace std::chrono_literals;
 
-Status FileSystemManager::Run(agd::ReadQueueType* input_queue, size_t threads, size_t chunks, const std::string& agd_metadata_path) {
+Status FileSystemManager::Run(agd::ReadQueueType* input_queue, size_t threads, size_t chunks, const std::string& agd_metadata_path,
+                              agd::IoEngine io_engine) {
 
   std::ifstream i(agd_metadata_path);
   json agd_metadata;
@@ -22,7 +23,7 @@ Status FileSystemManager::Run(agd::ReadQueueType* input_queue, size_t threads, s
   agd::ObjectPool<agd::Buffer> buf_pool;
   std::unique_ptr<agd::AGDFileSystemReader> reader;
   ERR_RETURN_IF_ERROR(agd::AGDFileSystemReader::Create(
-      columns, input_queue, threads, buf_pool, reader));
+      columns, input_queue, threads, buf_pool, reader, true, io_engine));
 
   auto chunk_queue = reader->GetOutputQueue();
 
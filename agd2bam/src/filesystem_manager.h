@@ -2,11 +2,13 @@
 
 #include "json.hpp"
 #include "libagd/src/queue_defs.h"
+#include "libagd/src/uring.h"
 #include "liberr/errors.h"
 
 using json = nlohmann::json;
 
 class FileSystemManager {
  public:
-  static errors::Status Run(agd::ReadQueueType* input_queue, size_t threads, size_t chunks, const std::string& agd_metadata_path);
+  static errors::Status Run(agd::ReadQueueType* input_queue, size_t threads, size_t chunks, const std::string& agd_metadata_path,
+                            agd::IoEngine io_engine = agd::IoEngine::SYNC);
 };
\ No newline at end of file
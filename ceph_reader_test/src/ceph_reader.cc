@@ -1,32 +1,125 @@
+#include <chrono>
 #include <cstdlib>
 #include <cstdio>
+#include <fstream>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "absl/strings/str_split.h"
+#include "absl/time/time.h"
+#include "args.hxx"
+#include "json.hpp"
 #include "libagd/src/agd_ceph_reader.h"
+#include "libagd/src/object_store.h"
+
+using json = nlohmann::json;
 
 int main(int argc, char** argv) {
+  args::ArgumentParser parser(
+      "ceph_reader",
+      "Read the chunks of an AGD dataset with AGDCephReader and report its "
+      "throughput.");
+  args::HelpFlag help(parser, "help", "Display this help menu", {'h', "help"});
+  args::ValueFlag<std::string> file_store_arg(
+      parser, "file store",
+      "Read objects from the files in this directory instead of Ceph, e.g. "
+      "the dataset directory",
+      {"file_store"});
+  args::ValueFlag<int> latency_arg(
+      parser, "latency us",
+      "With --file_store, the latency of every read and stat, in "
+      "microseconds [0]",
+      {"latency_us"});
+  args::ValueFlag<std::string> columns_arg(
+      parser, "columns", "Comma separated columns to read [base,qual,meta]",
+      {"columns"});
+  args::ValueFlag<unsigned int> threads_arg(
+      parser, "threads", "Reader threads [1]", {'t', "threads"});
+  args::ValueFlag<unsigned int> window_arg(
+      parser, "window", "Outstanding reads per thread [16]", {"window"});
+  args::ValueFlag<unsigned int> small_object_arg(
+      parser, "small object KB",
+      "Objects up to this size are read without a stat [8192]",
+      {"small_object_kb"});
+  args::Positional<std::string> metadata_arg(
+      parser, "dataset",
+      "AGD metadata.json of the chunks to read. Without it, reads "
+      "testdataset_0");
+
+  try {
+    parser.ParseCLI(argc, argv);
+  } catch (const args::Completion& e) {
+    std::cout << e.what();
+    return 0;
+  } catch (const args::Help&) {
+    std::cout << parser;
+    return 0;
+  } catch (const args::ParseError& e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return 1;
+  }
 
   std::vector<std::string> columns = {"base", "qual", "meta"};
+  if (columns_arg) {
+    columns = absl::StrSplit(args::get(columns_arg), ',');
+  }
   const std::string cluster_name = "ragnar";
   const std::string user_name = "client.lauzhack";
   const std::string name_space = "lauzhack";
   const std::string ceph_conf_file = "/scratch/ceph_conf/lauzhack.conf";
+  const std::string pool = "lauzhack";
+
+  std::vector<std::string> chunks = {"testdataset_0"};
+  if (metadata_arg) {
+    std::ifstream i(args::get(metadata_arg));
+    json metadata;
+    i >> metadata;
+    chunks.clear();
+    for (const auto& chunk : metadata["records"]) {
+      chunks.push_back(chunk["path"].get<std::string>());
+    }
+  }
+
   std::unique_ptr<agd::AGDCephReader::InputQueueType> input_queue =
-    std::make_unique<agd::AGDCephReader::InputQueueType>(5);
-  size_t threads = 1;
+    std::make_unique<agd::AGDCephReader::InputQueueType>(chunks.size() + 1);
+  for (const auto& chunk : chunks) {
+    agd::AGDCephReader::InputQueueItem inputItem;
+    inputItem.objName = chunk;
+    inputItem.pool = pool;
+    input_queue->push(inputItem);
+  }
+  input_queue->close();
+
+  size_t threads = threads_arg ? args::get(threads_arg) : 1;
+  agd::CephReaderOptions options;
+  if (window_arg) options.window = args::get(window_arg);
+  if (small_object_arg) {
+    options.small_object_size = size_t(args::get(small_object_arg)) * 1024;
+  }
+
   agd::ObjectPool<agd::Buffer> buf_pool;
   std::unique_ptr<agd::AGDCephReader> reader;
 
-  agd::AGDCephReader::InputQueueItem inputItem;
-  inputItem.objName = "testdataset_0";
-  inputItem.pool = "lauzhack";
-  input_queue.get()->push(inputItem);
-
-  auto s = agd::AGDCephReader::Create(columns, cluster_name, user_name, name_space,
-                                      ceph_conf_file, input_queue.get(),
-                                      threads, buf_pool, reader);
+  auto start = std::chrono::steady_clock::now();
+  errors::Status s;
+  if (file_store_arg) {
+    std::unique_ptr<agd::ObjectStore> store;
+    s = agd::FileObjectStore::Create(
+        args::get(file_store_arg),
+        absl::Microseconds(latency_arg ? args::get(latency_arg) : 0), store);
+    if (s.ok()) {
+      s = agd::AGDCephReader::Create(columns, std::move(store),
+                                     input_queue.get(), threads, buf_pool,
+                                     reader, true, options);
+    }
+  } else {
+    s = agd::AGDCephReader::Create(columns, cluster_name, user_name,
+                                   name_space, ceph_conf_file,
+                                   input_queue.get(), threads, buf_pool,
+                                   reader, true, options);
+  }
 
   if (!s.ok()) {
     std::cerr << "[ceph_reader] AGDCephReader reader creation failed: "
@@ -35,7 +128,22 @@ int main(int argc, char** argv) {
   }
 
   auto chunk_queue = reader->GetOutputQueue();
+  size_t num_chunks = 0;
+  agd::AGDCephReader::OutputQueueItem item;
+  while (chunk_queue->pop(item)) {
+    num_chunks++;
+  }
   reader->Stop();
 
-  return EXIT_SUCCESS;
+  auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            start)
+                  .count();
+  auto bytes = agd::MetricsRegistry::Global()
+                   .GetCounter("ceph_reader_bytes")
+                   ->value();
+  std::cout << "[ceph_reader] Read " << num_chunks << " chunks, " << bytes
+            << " bytes in " << secs << " seconds, "
+            << bytes / secs / (1024 * 1024) << " MB/s\n";
+
+  return num_chunks == chunks.size() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
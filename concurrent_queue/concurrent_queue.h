@@ -3,10 +3,15 @@
 #include <queue>
 #include <utility>
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
 
 // a class wrapping STL queue
 // thread-safe, limited buffer capacity, blocks on push()
 // to a full queue.
+// end of stream: the producer(s) close() the queue when they are done,
+// consumers loop on `while (queue.pop(item))`, which returns false only once
+// the queue is closed and drained. A stage closes its output queue after its
+// last thread exits, so closing the head of a pipeline drains all of it.
 
 template <typename T>
 class ConcurrentQueue {
@@ -27,6 +32,10 @@ class ConcurrentQueue {
 
   // unblock the queue, notify all threads
   void unblock();
+  // mark end of stream, no more items can be pushed. Remaining items can
+  // still be popped, then pop() returns false without blocking
+  void close();
+  bool closed() const;
   // set blocking behavior
   void set_block();
 
@@ -37,6 +46,9 @@ class ConcurrentQueue {
   uint64_t num_pop_waits();
   uint64_t num_push_waits();
   uint64_t num_peek_waits();
+  // total time spent blocked in push() / pop()
+  absl::Duration push_wait_time() const;
+  absl::Duration pop_wait_time() const;
 
   // these are for iterating the queue to do the checkpointing
   // these are not threadsafe
@@ -53,10 +65,13 @@ class ConcurrentQueue {
   size_t capacity_;
   // block on calls to push, pop
   bool block_ = true;
+  bool closed_ = false;
   uint64_t num_pop_waits_ = 0;
   uint64_t num_push_waits_ = 0;
   uint64_t num_peek_waits_ = 0;
   uint64_t num_push_ = 0;
+  absl::Duration push_wait_time_;
+  absl::Duration pop_wait_time_;
 
 };
 
@@ -78,9 +93,9 @@ bool ConcurrentQueue<T>::peek(T& item) {
   {
     absl::MutexLock l(&mu_);
 
-    if (queue_.empty() && block_) {
+    if (queue_.empty() && block_ && !closed_) {
       num_peek_waits_++;
-      while (queue_.empty() && block_) {
+      while (queue_.empty() && block_ && !closed_) {
         // queue_pop_cv_.wait(l);
         queue_pop_cv_.Wait(&mu_);
       }
@@ -115,11 +130,13 @@ bool ConcurrentQueue<T>::pop(T& item) {
   {
     absl::MutexLock l(&mu_);
 
-    if (queue_.empty() && block_) {
+    if (queue_.empty() && block_ && !closed_) {
       num_pop_waits_++;
-      while (queue_.empty() && block_) {
+      auto start = absl::Now();
+      while (queue_.empty() && block_ && !closed_) {
         queue_pop_cv_.Wait(&mu_);
       }
+      pop_wait_time_ += absl::Now() - start;
     }
 
     if (!queue_.empty()) {
@@ -143,14 +160,17 @@ bool ConcurrentQueue<T>::push(const T& item) {
     absl::MutexLock l(&mu_);
     // we block until something pops and makes room for us
     // unless blocking is set to false
+    if (closed_) return false;
     if (queue_.size() == capacity_ && block_) {
       num_push_waits_++;
-      while (queue_.size() == capacity_ && block_) {
+      auto start = absl::Now();
+      while (queue_.size() == capacity_ && block_ && !closed_) {
         queue_push_cv_.Wait(&mu_);
       }
+      push_wait_time_ += absl::Now() - start;
     }
 
-    if (queue_.size() < capacity_) {
+    if (queue_.size() < capacity_ && !closed_) {
       queue_.push_back(item);
       pushed = true;
     }
@@ -174,14 +194,17 @@ bool ConcurrentQueue<T>::push(T&& item) {
     absl::MutexLock l(&mu_);
     // we block until something pops and makes room for us
     // unless blocking is set to false
+    if (closed_) return false;
     if (queue_.size() == capacity_ && block_) {
       num_push_waits_++;
-      while (queue_.size() == capacity_ && block_) {
+      auto start = absl::Now();
+      while (queue_.size() == capacity_ && block_ && !closed_) {
         queue_push_cv_.Wait(&mu_);
       }
+      push_wait_time_ += absl::Now() - start;
     }
 
-    if (queue_.size() < capacity_) {
+    if (queue_.size() < capacity_ && !closed_) {
       queue_.push_back(std::move(item));
       pushed = true;
     }
@@ -209,6 +232,23 @@ void ConcurrentQueue<T>::unblock() {
   queue_pop_cv_.SignalAll();
 }
 
+template <typename T>
+void ConcurrentQueue<T>::close() {
+  {
+    absl::MutexLock l(&mu_);
+    closed_ = true;
+  }
+
+  queue_push_cv_.SignalAll();
+  queue_pop_cv_.SignalAll();
+}
+
+template <typename T>
+bool ConcurrentQueue<T>::closed() const {
+  absl::MutexLock l(&mu_);
+  return closed_;
+}
+
 template <typename T>
 void ConcurrentQueue<T>::set_block() {
   absl::MutexLock l(&mu_);
@@ -247,3 +287,15 @@ template <typename T>
 uint64_t ConcurrentQueue<T>::num_peek_waits() {
   return num_peek_waits_;
 }
+
+template <typename T>
+absl::Duration ConcurrentQueue<T>::push_wait_time() const {
+  absl::MutexLock l(&mu_);
+  return push_wait_time_;
+}
+
+template <typename T>
+absl::Duration ConcurrentQueue<T>::pop_wait_time() const {
+  absl::MutexLock l(&mu_);
+  return pop_wait_time_;
+}
@@ -0,0 +1,101 @@
+// compares ConcurrentQueue and RingQueue throughput at increasing thread
+// counts, for two patterns:
+//  mpmc: half the threads push, half pop
+//  fanout: one thread pushes, the rest pop (e.g. many aligner threads popping
+//  small work items)
+// usage: queue_benchmark [items per run] [max threads] [capacity]
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "concurrent_queue.h"
+#include "ring_queue.h"
+
+template <typename Queue>
+double RunOnce(size_t producers, size_t consumers, uint64_t items,
+               size_t capacity) {
+  Queue queue(capacity);
+  std::atomic_uint64_t sum{0};
+  std::atomic_uint32_t running_producers{static_cast<uint32_t>(producers)};
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  for (size_t p = 0; p < producers; p++) {
+    threads.emplace_back([&, p]() {
+      for (uint64_t i = p; i < items; i += producers) {
+        queue.push(i);
+      }
+      if (running_producers.fetch_sub(1) == 1) queue.close();
+    });
+  }
+  for (size_t c = 0; c < consumers; c++) {
+    threads.emplace_back([&]() {
+      uint64_t item, local = 0;
+      while (queue.pop(item)) {
+        local += item;
+      }
+      sum += local;
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            start)
+                  .count();
+  if (sum.load() != items * (items - 1) / 2) {
+    std::cerr << "[queue_benchmark] Error: lost items\n";
+    exit(1);
+  }
+  return items / secs / 1e6;
+}
+
+int main(int argc, char** argv) {
+  uint64_t items = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+  size_t max_threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 128;
+  size_t capacity = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1024;
+
+  std::cout << "items " << items << ", capacity " << capacity
+            << ", Mitems/s (best of 3)\n";
+  std::cout << std::setw(8) << "threads" << std::setw(14) << "mpmc mutex"
+            << std::setw(14) << "mpmc ring" << std::setw(14) << "fanout mutex"
+            << std::setw(14) << "fanout ring" << "\n";
+
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    // one thread still needs a producer and a consumer
+    size_t producers = std::max<size_t>(threads / 2, 1);
+    size_t consumers = std::max<size_t>(threads - producers, 1);
+    size_t fanout_consumers = std::max<size_t>(threads - 1, 1);
+
+    double results[4] = {0, 0, 0, 0};
+    for (int rep = 0; rep < 3; rep++) {
+      results[0] = std::max(results[0],
+                            RunOnce<ConcurrentQueue<uint64_t>>(
+                                producers, consumers, items, capacity));
+      results[1] = std::max(results[1], RunOnce<RingQueue<uint64_t>>(
+                                            producers, consumers, items,
+                                            capacity));
+      results[2] = std::max(results[2],
+                            RunOnce<ConcurrentQueue<uint64_t>>(
+                                1, fanout_consumers, items, capacity));
+      results[3] = std::max(results[3], RunOnce<RingQueue<uint64_t>>(
+                                            1, fanout_consumers, items,
+                                            capacity));
+    }
+
+    std::cout << std::setw(8) << threads << std::fixed << std::setprecision(2);
+    for (auto r : results) {
+      std::cout << std::setw(14) << r;
+    }
+    std::cout << "\n";
+  }
+
+  return 0;
+}
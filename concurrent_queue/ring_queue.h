@@ -0,0 +1,381 @@
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <climits>
+#include <memory>
+#include <utility>
+#include "absl/time/clock.h"
+
+// a lock free bounded multi producer multi consumer queue, with the same
+// interface as ConcurrentQueue. Based on Dmitry Vyukov's bounded MPMC queue:
+// each slot has a sequence number that tells producers and consumers whether
+// it is free or full for their ticket, so push and pop are a single CAS on
+// the tail or head in the uncontended case. Blocked threads sleep on an
+// eventcount (futex) and are only woken when there are waiters, so the fast
+// path makes no syscalls. Each push or pop wakes at most one sleeping thread.
+// capacity is rounded up to a power of 2.
+// as with ConcurrentQueue, close() must happen after all pushes have
+// returned, e.g. the last producer thread to exit closes the queue.
+
+// lets threads sleep until a condition they checked may have changed, without
+// a mutex. Waiters call PrepareWait(), recheck their condition, then either
+// Wait() or CancelWait() if it already holds. Notifiers change the condition
+// and then Notify(), which wakes one waiter, or all of them (e.g. on close).
+// Notify() only makes a syscall if there are waiters that no earlier Notify()
+// is already waking, so a stream of pushes wakes a sleeping consumer once,
+// and a single push doesn't wake every blocked consumer to compete for it.
+class EventCount {
+ public:
+  uint32_t PrepareWait() {
+    state_.fetch_add(kWaiter, std::memory_order_seq_cst);
+    // the caller's recheck of its condition must not move above this
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return epoch_.load(std::memory_order_seq_cst);
+  }
+
+  void CancelWait() { Leave(); }
+
+  // sleep unless notified since PrepareWait() returned key
+  void Wait(uint32_t key) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAIT_PRIVATE,
+            key, nullptr, nullptr, 0);
+    Leave();
+  }
+
+  void Notify(bool all = false) {
+    // pairs with the fence in PrepareWait, either the waiter sees the
+    // changed condition or we see the waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t state = state_.load(std::memory_order_relaxed);
+    while (true) {
+      const uint64_t waiters = state & kWaiterMask;
+      const uint64_t signals = state >> kSignalShift;
+      if (waiters == 0 || (!all && signals >= waiters)) return;
+      const uint64_t next =
+          all ? waiters << kSignalShift | waiters : state + kSignal;
+      if (state_.compare_exchange_weak(state, next,
+                                       std::memory_order_seq_cst)) {
+        break;
+      }
+    }
+    // waiters between PrepareWait() and Wait() see the new epoch and return
+    // at once, the rest sleep until woken
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAKE_PRIVATE,
+            all ? INT_MAX : 1, nullptr, nullptr, 0);
+  }
+
+ private:
+  // waiters in the low half of state_, and how many of them are being woken
+  // in the high half
+  static constexpr uint64_t kWaiter = 1;
+  static constexpr uint64_t kWaiterMask = 0xffffffffULL;
+  static constexpr int kSignalShift = 32;
+  static constexpr uint64_t kSignal = 1ULL << kSignalShift;
+
+  // a waiter is done waiting, and consumes a signal if there is one
+  void Leave() {
+    uint64_t state = state_.load(std::memory_order_relaxed);
+    while (true) {
+      uint64_t next = state - kWaiter;
+      if (state >> kSignalShift > 0) next -= kSignal;
+      if (state_.compare_exchange_weak(state, next,
+                                       std::memory_order_seq_cst)) {
+        return;
+      }
+    }
+  }
+
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                "futex needs a plain 32 bit word");
+  alignas(64) std::atomic<uint32_t> epoch_{0};
+  std::atomic<uint64_t> state_{0};
+};
+
+template <typename T>
+class RingQueue {
+ public:
+  RingQueue(size_t capacity);
+  ~RingQueue() = default;
+
+  // return true if pushed, false otherwise
+  // will block until pushed if block_ is true
+  bool push(const T& item);
+  bool push(T&& item);
+  // return true if success and item is valid, false otherwise
+  bool pop(T& item);
+
+  // unblock the queue, notify all threads
+  void unblock();
+  // mark end of stream, no more items can be pushed. Remaining items can
+  // still be popped, then pop() returns false without blocking
+  void close();
+  bool closed() const;
+  // set blocking behavior
+  void set_block();
+
+  bool empty() const;
+  size_t capacity() const;
+  size_t size() const;
+
+  uint64_t num_pop_waits();
+  uint64_t num_push_waits();
+  // total time spent blocked in push() / pop()
+  absl::Duration push_wait_time() const;
+  absl::Duration pop_wait_time() const;
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  // retries before sleeping, items usually arrive within a few hundred ns
+  // when the queue is busy
+  static constexpr int kSpins = 64;
+  static void Pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+
+  template <typename U>
+  bool try_push(U&& item);
+  bool try_pop(T& item);
+
+  template <typename U>
+  bool push_impl(U&& item);
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+
+  // producers and consumers on separate cache lines
+  alignas(64) std::atomic<size_t> tail_{0};
+  alignas(64) std::atomic<size_t> head_{0};
+
+  alignas(64) std::atomic_bool block_{true};
+  std::atomic_bool closed_{false};
+
+  EventCount not_empty_;
+  EventCount not_full_;
+
+  std::atomic_uint64_t num_pop_waits_{0};
+  std::atomic_uint64_t num_push_waits_{0};
+  std::atomic_int64_t push_wait_ns_{0};
+  std::atomic_int64_t pop_wait_ns_{0};
+};
+
+template <typename T>
+RingQueue<T>::RingQueue(size_t capacity) {
+  size_t size = 2;
+  while (size < capacity) size <<= 1;
+  cells_.reset(new Cell[size]);
+  for (size_t i = 0; i < size; i++) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  mask_ = size - 1;
+}
+
+template <typename T>
+template <typename U>
+bool RingQueue<T>::try_push(U&& item) {
+  Cell* cell;
+  size_t pos = tail_.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &cells_[pos & mask_];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if (dif == 0) {
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (dif < 0) {
+      return false;  // full
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+  cell->data = std::forward<U>(item);
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+bool RingQueue<T>::try_pop(T& item) {
+  Cell* cell;
+  size_t pos = head_.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &cells_[pos & mask_];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+    if (dif == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (dif < 0) {
+      return false;  // empty
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+  item = std::move(cell->data);
+  cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+template <typename U>
+bool RingQueue<T>::push_impl(U&& item) {
+  if (closed_.load(std::memory_order_acquire)) return false;
+
+  bool pushed = try_push(std::forward<U>(item));
+  for (int i = 0; !pushed && i < kSpins; i++) {
+    Pause();
+    pushed = try_push(std::forward<U>(item));
+  }
+  if (!pushed) {
+    bool waited = false;
+    absl::Time start;
+    while (true) {
+      auto key = not_full_.PrepareWait();
+      if (try_push(std::forward<U>(item))) {
+        not_full_.CancelWait();
+        pushed = true;
+        break;
+      }
+      if (closed_.load() || !block_.load()) {
+        not_full_.CancelWait();
+        break;
+      }
+      if (!waited) {
+        num_push_waits_++;
+        start = absl::Now();
+        waited = true;
+      }
+      not_full_.Wait(key);
+    }
+    if (waited) {
+      push_wait_ns_ += absl::ToInt64Nanoseconds(absl::Now() - start);
+    }
+  }
+
+  // tell someone blocking on read they can now read from the queue
+  if (pushed) not_empty_.Notify();
+  return pushed;
+}
+
+template <typename T>
+bool RingQueue<T>::push(const T& item) {
+  return push_impl(item);
+}
+
+template <typename T>
+bool RingQueue<T>::push(T&& item) {
+  return push_impl(std::move(item));
+}
+
+template <typename T>
+bool RingQueue<T>::pop(T& item) {
+  bool popped = try_pop(item);
+  for (int i = 0; !popped && i < kSpins; i++) {
+    Pause();
+    popped = try_pop(item);
+  }
+  if (!popped) {
+    bool waited = false;
+    absl::Time start;
+    while (true) {
+      auto key = not_empty_.PrepareWait();
+      if (try_pop(item)) {
+        not_empty_.CancelWait();
+        popped = true;
+        break;
+      }
+      if (closed_.load() || !block_.load()) {
+        not_empty_.CancelWait();
+        break;
+      }
+      if (!waited) {
+        num_pop_waits_++;
+        start = absl::Now();
+        waited = true;
+      }
+      not_empty_.Wait(key);
+    }
+    if (waited) {
+      pop_wait_ns_ += absl::ToInt64Nanoseconds(absl::Now() - start);
+    }
+  }
+
+  // tell someone blocking on write they can now write to the queue
+  if (popped) not_full_.Notify();
+  return popped;
+}
+
+template <typename T>
+void RingQueue<T>::unblock() {
+  block_ = false;
+  not_empty_.Notify(true);
+  not_full_.Notify(true);
+}
+
+template <typename T>
+void RingQueue<T>::close() {
+  closed_ = true;
+  not_empty_.Notify(true);
+  not_full_.Notify(true);
+}
+
+template <typename T>
+bool RingQueue<T>::closed() const {
+  return closed_.load();
+}
+
+template <typename T>
+void RingQueue<T>::set_block() {
+  block_ = true;
+}
+
+template <typename T>
+bool RingQueue<T>::empty() const {
+  return size() == 0;
+}
+
+template <typename T>
+size_t RingQueue<T>::capacity() const {
+  return mask_ + 1;
+}
+
+template <typename T>
+size_t RingQueue<T>::size() const {
+  // approximate while there are concurrent pushes and pops
+  size_t tail = tail_.load(std::memory_order_relaxed);
+  size_t head = head_.load(std::memory_order_relaxed);
+  return tail > head ? tail - head : 0;
+}
+
+template <typename T>
+uint64_t RingQueue<T>::num_pop_waits() {
+  return num_pop_waits_.load();
+}
+
+template <typename T>
+uint64_t RingQueue<T>::num_push_waits() {
+  return num_push_waits_.load();
+}
+
+template <typename T>
+absl::Duration RingQueue<T>::push_wait_time() const {
+  return absl::Nanoseconds(push_wait_ns_.load());
+}
+
+template <typename T>
+absl::Duration RingQueue<T>::pop_wait_time() const {
+  return absl::Nanoseconds(pop_wait_ns_.load());
+}
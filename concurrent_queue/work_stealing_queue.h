@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "absl/synchronization/mutex.h"
+
+// a set of deques, one per worker thread, for splitting work between
+// threads. Workers pop from the front of their own deque and, when it is
+// empty, steal from the back of another worker's deque.
+// thread-safe, unbounded, blocks on pop() until an item is available in any
+// deque or the queue is closed. The count of available items is atomic, so
+// push and pop only take the shared mutex to sleep or wake sleepers.
+
+template <typename T>
+class WorkStealingQueue {
+ public:
+  WorkStealingQueue(size_t num_workers);
+  ~WorkStealingQueue() = default;
+
+  // push an item onto the deque of `worker`
+  void push(size_t worker, T&& item);
+
+  // pop from the deque of `worker`, stealing from others if it is empty.
+  // return true if success and item is valid, false if the queue has been
+  // closed and there is no more work
+  bool pop(size_t worker, T& item);
+
+  // mark end of stream, notify all threads. Remaining items can still be
+  // popped
+  void close();
+
+  bool empty() const;
+  size_t size() const;
+  size_t num_workers() const;
+
+  uint64_t num_steals() const;
+  uint64_t num_pop_waits() const;
+
+ private:
+  struct WorkerDeque {
+    absl::Mutex mu;
+    std::deque<T> items;
+  };
+
+  // reserve an available item without blocking
+  bool try_reserve();
+  // take an item reserved by pop(), own deque first
+  void take(size_t worker, T& item);
+
+  std::vector<std::unique_ptr<WorkerDeque>> deques_;
+
+  // items pushed and not yet reserved by a pop()
+  alignas(64) std::atomic<size_t> available_{0};
+  // pop() threads about to sleep or sleeping on pop_cv_
+  std::atomic<size_t> sleepers_{0};
+
+  // protects closed_, and sleeping on pop_cv_
+  absl::Mutex mu_;
+  absl::CondVar pop_cv_;
+  bool closed_ = false;
+
+  std::atomic_uint64_t num_steals_{0};
+  uint64_t num_pop_waits_ = 0;
+};
+
+template <typename T>
+WorkStealingQueue<T>::WorkStealingQueue(size_t num_workers) {
+  deques_.resize(num_workers > 0 ? num_workers : 1);
+  for (auto& d : deques_) {
+    d = std::make_unique<WorkerDeque>();
+  }
+}
+
+template <typename T>
+void WorkStealingQueue<T>::push(size_t worker, T&& item) {
+  auto& d = *deques_[worker % deques_.size()];
+  {
+    absl::MutexLock l(&d.mu);
+    d.items.push_back(std::move(item));
+  }
+  available_.fetch_add(1, std::memory_order_seq_cst);
+  // pairs with pop(), either it sees the item or we see it sleeping
+  if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+    absl::MutexLock l(&mu_);
+    pop_cv_.Signal();
+  }
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::pop(size_t worker, T& item) {
+  // reserve an item, it is guaranteed to be in one of the deques
+  if (!try_reserve()) {
+    absl::MutexLock l(&mu_);
+    sleepers_.fetch_add(1, std::memory_order_seq_cst);
+    bool waited = false;
+    while (!try_reserve()) {
+      if (closed_) {
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (!waited) {
+        num_pop_waits_++;
+        waited = true;
+      }
+      pop_cv_.Wait(&mu_);
+    }
+    sleepers_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  take(worker % deques_.size(), item);
+  return true;
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::try_reserve() {
+  size_t available = available_.load(std::memory_order_relaxed);
+  while (available > 0) {
+    if (available_.compare_exchange_weak(available, available - 1,
+                                         std::memory_order_seq_cst)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T>
+void WorkStealingQueue<T>::take(size_t worker, T& item) {
+  {
+    auto& d = *deques_[worker];
+    absl::MutexLock l(&d.mu);
+    if (!d.items.empty()) {
+      item = std::move(d.items.front());
+      d.items.pop_front();
+      return;
+    }
+  }
+
+  // steal from the back of the other deques, starting at our neighbour
+  while (true) {
+    for (size_t i = 1; i < deques_.size(); i++) {
+      auto& d = *deques_[(worker + i) % deques_.size()];
+      absl::MutexLock l(&d.mu);
+      if (!d.items.empty()) {
+        item = std::move(d.items.back());
+        d.items.pop_back();
+        num_steals_++;
+        return;
+      }
+    }
+    // the reserved item may have been taken from our own deque by a
+    // concurrent stealer, in which case theirs is still in a deque
+    auto& d = *deques_[worker];
+    absl::MutexLock l(&d.mu);
+    if (!d.items.empty()) {
+      item = std::move(d.items.front());
+      d.items.pop_front();
+      return;
+    }
+  }
+}
+
+template <typename T>
+void WorkStealingQueue<T>::close() {
+  {
+    absl::MutexLock l(&mu_);
+    closed_ = true;
+  }
+  pop_cv_.SignalAll();
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::empty() const {
+  return available_.load() == 0;
+}
+
+template <typename T>
+size_t WorkStealingQueue<T>::size() const {
+  return available_.load();
+}
+
+template <typename T>
+size_t WorkStealingQueue<T>::num_workers() const {
+  return deques_.size();
+}
+
+template <typename T>
+uint64_t WorkStealingQueue<T>::num_steals() const {
+  return num_steals_.load();
+}
+
+template <typename T>
+uint64_t WorkStealingQueue<T>::num_pop_waits() const {
+  return num_pop_waits_;
+}
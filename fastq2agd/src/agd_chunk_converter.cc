@@ -1,6 +1,8 @@
 
 #include "agd_chunk_converter.h"
 
+#include "libagd/src/compacted_bases.h"
+
 AGDChunkConverter::AGDChunkConverter() {
   base_bufpair_.data().reserve(1024 * 1024);
   base_bufpair_.index().reserve(1024 * 100);
@@ -10,6 +12,20 @@ AGDChunkConverter::AGDChunkConverter() {
   meta_bufpair_.index().reserve(1024 * 100);
 }
 
+Status AGDChunkConverter::Init(const agd::ColumnCodecs &codecs) {
+  compact_bases_ = codecs.compact_bases();
+  ERR_RETURN_IF_ERROR(
+      agd::ChunkCompressor::Create(codecs.Spec("base"), base_compressor_));
+  ERR_RETURN_IF_ERROR(
+      agd::ChunkCompressor::Create(codecs.Spec("qual"), qual_compressor_));
+  ERR_RETURN_IF_ERROR(
+      agd::ChunkCompressor::Create(codecs.Spec("meta"), meta_compressor_));
+  base_compressor_->set_compact_index(codecs.compact_index());
+  qual_compressor_->set_compact_index(codecs.compact_index());
+  meta_compressor_->set_compact_index(codecs.compact_index());
+  return Status::OK();
+}
+
 Status AGDChunkConverter::Convert(FastqChunk &fastq_chunk,
                                   FastqColumns *output_cols) {
   const char *base, *qual, *meta;
@@ -34,11 +50,7 @@ Status AGDChunkConverter::Convert(FastqChunk &fastq_chunk,
   }
 
   output_cols->chunk_size = fastq_chunk.NumRecords();
-  ERR_RETURN_IF_ERROR(CompressBuffer(base_bufpair_, output_cols->base));
-  ERR_RETURN_IF_ERROR(CompressBuffer(qual_bufpair_, output_cols->qual));
-  ERR_RETURN_IF_ERROR(CompressBuffer(meta_bufpair_, output_cols->meta));
-
-  return Status::OK();
+  return CompressColumns(output_cols);
 }
 
 Status AGDChunkConverter::ConvertPaired(FastqChunk &fastq_chunk_1,
@@ -76,26 +88,28 @@ Status AGDChunkConverter::ConvertPaired(FastqChunk &fastq_chunk_1,
   // output chunk size will be twice that of
   // input, because we interleave paired reads
   output_cols->chunk_size = fastq_chunk_1.NumRecords() * 2;
-  ERR_RETURN_IF_ERROR(base_builder.CompressChunk(output_cols->base.get()));
-  ERR_RETURN_IF_ERROR(qual_builder.CompressChunk(output_cols->qual.get()));
-  ERR_RETURN_IF_ERROR(meta_builder.CompressChunk(output_cols->meta.get()));
-  
-  /*ERR_RETURN_IF_ERROR(CompressBuffer(base_bufpair_, output_cols->base));
-  ERR_RETURN_IF_ERROR(CompressBuffer(qual_bufpair_, output_cols->qual));
-  ERR_RETURN_IF_ERROR(CompressBuffer(meta_bufpair_, output_cols->meta));*/
-
-  return Status::OK();
+  return CompressColumns(output_cols);
 }
 
-Status AGDChunkConverter::CompressBuffer(agd::BufferPair &buf_pair,
-                                         agd::ObjectPool<agd::Buffer>::ptr_type& buf) {
-  buf->reserve(buf_pair.data().size() + buf_pair.index().size());
-  agd::AppendingGZIPCompressor compressor(
-      *buf);  // destructor releases GZIP resources
-  ERR_RETURN_IF_ERROR(compressor.init());
-  auto &index = buf_pair.index();
-  ERR_RETURN_IF_ERROR(compressor.appendGZIP(index.data(), index.size()));
-  auto &data = buf_pair.data();
-  ERR_RETURN_IF_ERROR(compressor.appendGZIP(data.data(), data.size()));
+Status AGDChunkConverter::CompressColumns(FastqColumns *output_cols) {
+  agd::BufferPair *base_pair = &base_bufpair_;
+  output_cols->base_record_type = agd::format::RecordType::TEXT;
+  if (compact_bases_) {
+    // non ACGTN bases are stored as N
+    ERR_RETURN_IF_ERROR(agd::CompactBaseColumn(base_bufpair_.index(),
+                                               base_bufpair_.data(),
+                                               &compact_bufpair_, true));
+    base_pair = &compact_bufpair_;
+    output_cols->base_record_type = agd::format::RecordType::COMPACTED_BASES;
+  }
+  ERR_RETURN_IF_ERROR(base_compressor_->Compress(
+      base_pair->index(), base_pair->data(), output_cols->base.get()));
+  ERR_RETURN_IF_ERROR(qual_compressor_->Compress(
+      qual_bufpair_.index(), qual_bufpair_.data(), output_cols->qual.get()));
+  ERR_RETURN_IF_ERROR(meta_compressor_->Compress(
+      meta_bufpair_.index(), meta_bufpair_.data(), output_cols->meta.get()));
+  base_compressor_->FillHeader(&output_cols->base_header);
+  qual_compressor_->FillHeader(&output_cols->qual_header);
+  meta_compressor_->FillHeader(&output_cols->meta_header);
   return Status::OK();
-}
\ No newline at end of file
+}
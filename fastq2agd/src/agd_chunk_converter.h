@@ -12,6 +12,11 @@ struct FastqColumns {
   agd::ObjectPool<agd::Buffer>::ptr_type base;
   agd::ObjectPool<agd::Buffer>::ptr_type qual;
   agd::ObjectPool<agd::Buffer>::ptr_type meta;
+  agd::format::RecordType base_record_type;
+  // codec fields filled by the compressors
+  agd::format::FileHeader base_header;
+  agd::format::FileHeader qual_header;
+  agd::format::FileHeader meta_header;
   size_t chunk_size;
 };
 
@@ -21,6 +26,10 @@ class AGDChunkConverter {
  public:
   AGDChunkConverter();
 
+  // create the column compressors, call before converting. Bases are packed
+  // if codecs.compact_bases(), indexes encoded if codecs.compact_index()
+  Status Init(const agd::ColumnCodecs& codecs);
+
   // build columns, and compress to output bufs
   Status Convert(FastqChunk& fastq_chunk, FastqColumns* output_cols);
   
@@ -31,6 +40,14 @@ class AGDChunkConverter {
   agd::BufferPair base_bufpair_;
   agd::BufferPair qual_bufpair_;
   agd::BufferPair meta_bufpair_;
+  // packed bases, if compacting
+  agd::BufferPair compact_bufpair_;
+  bool compact_bases_ = false;
+
+  std::unique_ptr<agd::ChunkCompressor> base_compressor_;
+  std::unique_ptr<agd::ChunkCompressor> qual_compressor_;
+  std::unique_ptr<agd::ChunkCompressor> meta_compressor_;
 
-  Status CompressBuffer(agd::BufferPair& buf_pair, agd::ObjectPool<agd::Buffer>::ptr_type& buf);
+  // compresses the full columns into the output
+  Status CompressColumns(FastqColumns* output_cols);
 };
@@ -46,27 +46,32 @@ Status AGDWriter::Init(const std::string& output_dir) {
 }
 
 Status AGDWriter::Write(const OutputQueueItem& item) {
-  // combine with header and write chunk files
-  agd::format::FileHeader header;
-
-  header.record_type = agd::format::RecordType::TEXT;
-  header.compression_type = agd::format::CompressionType::GZIP;
-
-  memset(header.string_id, 0, sizeof(agd::format::FileHeader::string_id));
-  auto copy_size =
-      min(dataset_name_.size(), sizeof(agd::format::FileHeader::string_id));
-  strncpy(&header.string_id[0], dataset_name_.c_str(), copy_size);
-
-  header.first_ordinal = item.first_ordinal;
-  header.last_ordinal = item.first_ordinal + item.columns.chunk_size;
+  // combine with header and write chunk files. The codec fields of each
+  // column's header come from its compressor
+  auto column_header = [&](const agd::format::FileHeader& codec_header,
+                           agd::format::RecordType record_type) {
+    agd::format::FileHeader header = codec_header;
+    header.record_type = record_type;
+
+    memset(header.string_id, 0, sizeof(agd::format::FileHeader::string_id));
+    auto copy_size =
+        min(dataset_name_.size(), sizeof(agd::format::FileHeader::string_id));
+    strncpy(&header.string_id[0], dataset_name_.c_str(), copy_size);
+
+    header.first_ordinal = item.first_ordinal;
+    header.last_ordinal = item.first_ordinal + item.columns.chunk_size;
+    return header;
+  };
 
   auto bases_name = absl::StrCat(output_dir_, dataset_name_, "_",
-                                 header.first_ordinal, ".base");
+                                 item.first_ordinal, ".base");
   auto qual_name = absl::StrCat(output_dir_, dataset_name_, "_",
-                                header.first_ordinal, ".qual");
+                                item.first_ordinal, ".qual");
   auto meta_name = absl::StrCat(output_dir_, dataset_name_, "_",
-                                header.first_ordinal, ".meta");
+                                item.first_ordinal, ".meta");
 
+  auto header = column_header(item.columns.base_header,
+                              item.columns.base_record_type);
   std::ofstream bases_file(bases_name, std::ios::binary);
   bases_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
   bases_file.write(item.columns.base->data(), item.columns.base->size());
@@ -76,6 +81,8 @@ Status AGDWriter::Write(const OutputQueueItem& item) {
   }
   bases_file.close();
 
+  header = column_header(item.columns.qual_header,
+                         agd::format::RecordType::TEXT);
   std::ofstream qual_file(qual_name, std::ios::binary);
   qual_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
   qual_file.write(item.columns.qual->data(), item.columns.qual->size());
@@ -85,6 +92,8 @@ Status AGDWriter::Write(const OutputQueueItem& item) {
   }
   qual_file.close();
 
+  header = column_header(item.columns.meta_header,
+                         agd::format::RecordType::TEXT);
   std::ofstream meta_file(meta_name, std::ios::binary);
   meta_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
   meta_file.write(item.columns.meta->data(), item.columns.meta->size());
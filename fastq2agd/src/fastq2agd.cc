@@ -37,6 +37,23 @@ int main(int argc, char** argv) {
   args::ValueFlag<unsigned int> chunk_size_arg(parser, "chunksize",
                                                "AGD output chunk size [100000]",
                                                {'c', "chunksize"});
+  args::ValueFlag<std::string> codec_arg(
+      parser, "codec",
+      "Column compression, <codec>[:<level>] optionally followed by "
+      ",<column>=<codec>[:<level>] overrides. Codecs are gzip, libdeflate, "
+      "zstd and none, plus quality[:bin] for the qual column and meta for "
+      "the meta column, e.g. gzip,qual=quality,meta=meta [gzip]",
+      {"codec"});
+  args::Flag compact_bases_arg(
+      parser, "compact bases",
+      "Store bases packed 3 bits per base (COMPACTED_BASES) instead of text",
+      {"compact_bases"});
+  args::Flag compact_index_arg(
+      parser, "compact index",
+      "Store the record index of chunks whose records are (nearly) the same "
+      "length as a single length or varint deltas. Needs readers of format "
+      "version 0.2",
+      {"compact_index"});
   args::PositionalList<std::string> fastq_files(
       parser, "datasets",
       "FASTQ  dataset to convert. Provide one for single end, two for paired "
@@ -56,6 +73,17 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  agd::ColumnCodecs codecs;
+  codecs.set_compact_bases(args::get(compact_bases_arg));
+  codecs.set_compact_index(args::get(compact_index_arg));
+  if (codec_arg) {
+    Status cs = agd::ColumnCodecs::Parse(args::get(codec_arg), codecs);
+    if (!cs.ok()) {
+      cout << cs.error_message() << "\n";
+      return 0;
+    }
+  }
+
   unique_ptr<FastqManager> fastq_manager;
   QueueType chunk_queue(10);
 
@@ -184,10 +212,15 @@ int main(int argc, char** argv) {
   std::vector<std::thread> converter_threads(threads);
 
   for (auto& t : converter_threads) {
-    t = std::thread([&chunk_queue, &output_queue, &done, &buffer_pool]() {
+    t = std::thread([&chunk_queue, &output_queue, &done, &buffer_pool,
+                     &codecs]() {
       FastqQueueItem item;
       AGDChunkConverter converter;
-      Status s;
+      Status s = converter.Init(codecs);
+      if (!s.ok()) {
+        cout << "Could not create compressors: " << s.error_message() << "\n";
+        exit(0);
+      }
       while (!done) {
         FastqColumns output_cols;
         output_cols.base = std::move(buffer_pool.get());
@@ -1,5 +1,7 @@
 #include "agd_ceph_reader.h"
 
+#include <deque>
+
 #include "absl/strings/str_format.h"
 #include "parser.h"
 
@@ -14,181 +16,255 @@ Status AGDCephReader::Create(std::vector<std::string> columns,
                              const std::string& ceph_conf_file,
                              InputQueueType* input_queue, size_t threads,
                              ObjectPool<Buffer>& buf_pool,
-                             std::unique_ptr<AGDCephReader>& reader) {
-  reader.reset(new AGDCephReader(columns, buf_pool, input_queue));
-  return reader->Initialize(cluster_name, user_name, name_space, ceph_conf_file,
-                            threads);
+                             std::unique_ptr<AGDCephReader>& reader,
+                             bool unpack_bases,
+                             const CephReaderOptions& options) {
+  std::unique_ptr<ObjectStore> store;
+  ERR_RETURN_IF_ERROR(RadosObjectStore::Create(cluster_name, user_name,
+                                               name_space, ceph_conf_file,
+                                               store));
+  return Create(columns, std::move(store), input_queue, threads, buf_pool,
+                reader, unpack_bases, options);
 }
 
-Status AGDCephReader::setup_ceph_connection(const std::string& cluster_name,
-                                            const std::string& user_name,
-                                            const std::string& ceph_conf_file) {
-  int ret = 0;
-
-  ret = cluster_.init2(user_name.c_str(), cluster_name.c_str(), 0);
-  if (ret < 0) {
-    return Internal(
-        "[AGDCephReader] Couldn't intialize the cluster handle! error ", ret);
-  } else {
-    std::cout << absl::StreamFormat(
-        "[AGDCephReader] Created a cluster handle.\n");
-  }
-
-  ret = cluster_.conf_read_file(ceph_conf_file.c_str());
-  if (ret < 0) {
-    return Internal(
-        "[AGDCephReader] Couldn't read the Ceph configuration file! error ",
-        ret);
-  } else {
-    std::cout << absl::StreamFormat(
-        "[AGDCephReader] Read the Ceph configuration file.\n");
-  }
-
-  ret = cluster_.connect();
-  if (ret < 0) {
-    return Unavailable("[AGDCephReader] Couldn't connect to cluster! error ",
-                       ret);
-  } else {
-    std::cout << absl::StreamFormat(
-        "[AGDCephReader] Connected to the cluster.\n");
+Status AGDCephReader::Create(std::vector<std::string> columns,
+                             std::unique_ptr<ObjectStore> store,
+                             InputQueueType* input_queue, size_t threads,
+                             ObjectPool<Buffer>& buf_pool,
+                             std::unique_ptr<AGDCephReader>& reader,
+                             bool unpack_bases,
+                             const CephReaderOptions& options) {
+  if (options.window < columns.size() || options.small_object_size == 0 ||
+      options.piece_size == 0) {
+    return InvalidArgument("[AGDCephReader] window must cover the ",
+                           columns.size(),
+                           " columns of a chunk, and sizes must be nonzero");
   }
-
-  return Status::OK();
+  reader.reset(new AGDCephReader(columns, std::move(store), buf_pool,
+                                 input_queue, unpack_bases, options));
+  return reader->Initialize(threads);
 }
 
-void AGDCephReader::create_io_ctx(const InputQueueItem& item,
-                                  const std::string& name_space,
-                                  librados::IoCtx* io_ctx) {
-  int ret = cluster_.ioctx_create(item.pool.c_str(), *io_ctx);
-  if (ret < 0) {
-    std::cerr << absl::StreamFormat(
-        "[AGDCephReader] Couldn't set up ioctx! error %d. Thread exiting.\n",
-        ret);
-    exit(EXIT_FAILURE);
-  } else {
-    io_ctx->set_namespace(name_space);
-    std::cout << absl::StreamFormat(
-        "[AGDCephReader] Created ioctx for namespace %s.\n", name_space);
-  }
-}
+bool AGDCephReader::ReadChunks() {
+  RecordParser parser;
+  std::string record_id;
+  // waited on in the order started. Destroying an op waits for it, so on
+  // errors the buffers outlive the reads into them
+  std::deque<PendingOp> ops;
+  // pieces of large objects, by column and buffer, waiting for room in the
+  // window. They go before new chunks, so started chunks finish first
+  std::deque<std::pair<std::shared_ptr<ColumnRead>, size_t>> pieces;
+  bool input_open = true;
+  // the first read of a column is sized for the largest of its objects so
+  // far, with some slack, so buffers aren't all small_object_size. An object
+  // that fills its first read takes the stat path
+  const size_t small = options_.small_object_size;
+  std::vector<size_t> first_read(columns_.size(),
+                                 std::min<size_t>(small, 1024 * 1024));
+
+  std::vector<iovec> segments;
+
+  auto start_op = [&](PendingOp::Kind kind, std::shared_ptr<ColumnRead> col,
+                      size_t buf, uint64_t offset, size_t len) {
+    PendingOp p{kind, std::move(col), buf, offset, len, nullptr};
+    const auto& pool = p.column->chunk->item.pool;
+    if (kind == PendingOp::STAT) {
+      p.op = store_->Stat(pool, p.column->oid);
+    } else {
+      p.op = store_->Read(pool, p.column->oid,
+                          p.column->bufs[buf]->mutable_data(), len, offset);
+    }
+    ops.push_back(std::move(p));
+  };
 
-ceph::bufferlist AGDCephReader::read_file(const std::string& objId,
-                                          librados::IoCtx& io_ctx) {
-  int ret;
-  size_t file_size;
-  time_t pmtime;
-  ret = io_ctx.stat(objId, &file_size, &pmtime);
-  if (ret != 0) {
-    std::cerr << absl::StreamFormat(
-        "[AGDCephReader] io_ctx.stat() return %d for key %s\n", ret, objId);
-    exit(EXIT_FAILURE);
-  }
+  auto start_pieces = [&]() {
+    while (!pieces.empty() && ops.size() < options_.window) {
+      auto col = std::move(pieces.front().first);
+      const size_t buf = pieces.front().second;
+      pieces.pop_front();
+      const uint64_t offset =
+          col->bufs[0]->size() + (buf - 1) * options_.piece_size;
+      const size_t len = col->bufs[buf]->size();
+      start_op(PendingOp::PIECE, std::move(col), buf, offset, len);
+    }
+  };
 
-  std::cout << absl::StreamFormat("[AGDCephReader] filesize = %d.\n",
-                                  file_size);
+  // parse a column that has been read, and output its chunk if it was the
+  // last one
+  auto finish_column = [&](ColumnRead& col) {
+    read_time_->Observe(absl::ToInt64Microseconds(absl::Now() - col.start));
+    num_bytes_->Add(col.size);
+    first_read[col.column] = std::min(
+        small, std::max(first_read[col.column], col.size + col.size / 4 + 1));
+    auto& chunk = *col.chunk;
+    auto out_buf = buf_pool_->get();
+    uint64_t first_ordinal;
+    uint32_t num_records;
+
+    segments.clear();
+    for (auto& buf : col.bufs) {
+      segments.push_back({buf->mutable_data(), buf->size()});
+    }
+    ScopedLatency parse_latency(parse_time_);
+    Status s = parser.ParseNew(segments.data(), segments.size(), false,
+                               out_buf.get(), &first_ordinal, &num_records,
+                               record_id, unpack_bases_);
+    parse_latency.Stop();
+    col.bufs.clear();
+
+    if (!s.ok()) {
+      std::cerr << absl::StrFormat(
+          "[AGDCephReader] WARNING: Error decompressing chunk: %s\n",
+          s.error_message());
+      return false;
+    }
 
-  size_t data_read = 0;
-  size_t read_len;
-  size_t size_to_read = 4 * 1024 * 1024;  // 4 MB. I chose this arbitrarily.
+    chunk.item.col_bufs[col.column] = std::move(out_buf);
+    chunk.item.record_types[col.column] = parser.record_type();
+    if (col.column == 0) {
+      chunk.item.chunk_size = num_records;
+      chunk.item.first_ordinal = first_ordinal;
+    }
+    if (--chunk.columns_remaining == 0) {
+      std::cout << absl::StrFormat(
+          "[AGDCephReader] Parsed chunk with %d records.\n",
+          chunk.item.chunk_size);
+      num_chunks_->Add();
+      num_records_->Add(chunk.item.chunk_size);
+      chunk_latency_->Observe(
+          absl::ToInt64Microseconds(absl::Now() - chunk.start));
+      output_queue_->push(std::move(chunk.item));
+    }
+    return true;
+  };
 
-  librados::bufferlist read_buf;
-  while (data_read < file_size) {
-    read_len = std::min(size_to_read, file_size - data_read);
+  while (true) {
+    start_pieces();
+    // start chunks while the window has room. Wait for input only with
+    // nothing outstanding, though another thread can take the item between
+    // empty() and pop(), which just delays this one's outstanding reads
+    while (input_open && pieces.empty() &&
+           ops.size() + columns_.size() <= options_.window &&
+           (ops.empty() || !input_queue_->empty())) {
+      InputQueueItem item;
+      if (!input_queue_->pop(item)) {
+        input_open = false;
+        break;
+      }
+      std::cout << absl::StreamFormat(
+          "[AGDCephReader] input_queue = {%s, %s}\n", item.objName, item.pool);
 
-    std::cout << absl::StreamFormat(
-        "[AGDCephReader] Trying to read %d bytes from %s.\n", read_len, objId);
+      auto chunk = std::make_shared<ChunkState>();
+      chunk->start = absl::Now();
+      chunk->item.pool = std::move(item.pool);
+      // potentially strip filepath prefix from object name here
+      chunk->item.name = std::move(item.objName);
+      chunk->item.col_bufs.resize(columns_.size());
+      chunk->item.record_types.resize(columns_.size());
+      chunk->columns_remaining = columns_.size();
+
+      // we need to strip out any filepath that is irrelevant for ceph
+      std::string obj_base =
+          chunk->item.name.substr(chunk->item.name.find_last_of('/') + 1);
+      for (size_t i = 0; i < columns_.size(); i++) {
+        auto col = std::make_shared<ColumnRead>();
+        col->chunk = chunk;
+        col->column = i;
+        col->oid = absl::StrCat(obj_base, ".", columns_[i]);
+        col->bufs.push_back(buf_pool_->get());
+        col->bufs[0]->resize(first_read[i]);
+        col->start = absl::Now();
+        start_op(PendingOp::FIRST, std::move(col), 0, 0, first_read[i]);
+      }
+    }
+
+    if (ops.empty()) return true;
 
-    // Create I/O Completion.
-    librados::AioCompletion* read_completion =
-        librados::Rados::aio_create_completion();
-    ret =
-        io_ctx.aio_read(objId, read_completion, &read_buf, read_len, data_read);
+    PendingOp p = std::move(ops.front());
+    ops.pop_front();
+    const int64_t ret = p.op->Wait();
+    auto& col = *p.column;
     if (ret < 0) {
       std::cerr << absl::StreamFormat(
-          "[AGDCephReader] Couldn't start read object! error %d\n", ret);
-      exit(EXIT_FAILURE);
+          "[AGDCephReader] Couldn't %s object %s! error %d\n",
+          p.kind == PendingOp::STAT ? "stat" : "read", col.oid, ret);
+      return false;
     }
 
-    data_read += read_len;
+    switch (p.kind) {
+      case PendingOp::FIRST:
+        if (static_cast<size_t>(ret) < p.len) {
+          // the whole object, in one round trip
+          col.bufs[0]->resize(ret);
+          col.size = ret;
+          if (!finish_column(col)) return false;
+        } else {
+          start_op(PendingOp::STAT, p.column, 0, 0, 0);
+        }
+        break;
+
+      case PendingOp::STAT: {
+        const size_t first = col.bufs[0]->size();
+        if (static_cast<size_t>(ret) < first) {
+          std::cerr << absl::StreamFormat(
+              "[AGDCephReader] Object %s shrank to %d bytes while reading\n",
+              col.oid, ret);
+          return false;
+        }
+        col.size = ret;
+        // each piece into its own buffer, so the first read isn't grown and
+        // copied to fit the object
+        for (uint64_t offset = first; offset < static_cast<uint64_t>(ret);
+             offset += options_.piece_size) {
+          const size_t len =
+              std::min<uint64_t>(options_.piece_size, ret - offset);
+          col.bufs.push_back(buf_pool_->get());
+          col.bufs.back()->resize(len);
+        }
+        // started as the window has room
+        for (size_t i = 1; i < col.bufs.size(); i++) {
+          pieces.emplace_back(p.column, i);
+          col.reads_remaining++;
+        }
+        if (col.reads_remaining == 0 && !finish_column(col)) return false;
+        break;
+      }
 
-    // Wait for the request to complete, and check that it succeeded.
-    read_completion->wait_for_complete();
-    ret = read_completion->get_return_value();
-    if (ret < 0) {
-      std::cerr << absl::StreamFormat(
-          "[AGDCephReader] Couldn't read object! error %d\n", ret);
-      exit(EXIT_FAILURE);
+      case PendingOp::PIECE:
+        if (static_cast<size_t>(ret) != p.len) {
+          std::cerr << absl::StreamFormat(
+              "[AGDCephReader] Short read of object %s at %d, %d of %d "
+              "bytes\n",
+              col.oid, p.offset, ret, p.len);
+          return false;
+        }
+        if (--col.reads_remaining == 0 && !finish_column(col)) return false;
+        break;
     }
   }
-
-  return read_buf;
 }
 
-Status AGDCephReader::Initialize(const std::string& cluster_name,
-                                 const std::string& user_name,
-                                 const std::string& name_space,
-                                 const std::string& ceph_conf_file,
-                                 size_t threads) {
-  setup_ceph_connection(cluster_name, user_name, ceph_conf_file);
-
+Status AGDCephReader::Initialize(size_t threads) {
   output_queue_ = std::make_unique<OutputQueueType>(5);
 
-  auto read_and_parse_func = [this, name_space]() {
-    RecordParser parser;
-    std::string record_id;
+  auto& metrics = MetricsRegistry::Global();
+  num_chunks_ = metrics.GetCounter("ceph_reader_chunks");
+  num_records_ = metrics.GetCounter("ceph_reader_records");
+  num_bytes_ = metrics.GetCounter("ceph_reader_bytes");
+  chunk_latency_ = metrics.GetHistogram("ceph_reader_chunk_latency_us");
+  read_time_ = metrics.GetHistogram("ceph_reader_read_us");
+  parse_time_ = metrics.GetHistogram("ceph_reader_parse_us");
 
-    while (!done_) {
-      InputQueueItem item;
-      std::cout << absl::StreamFormat("[AGDCephReader] Trying to pop queue\n");
-      if (!input_queue_->pop(item)) continue;
-      std::cout << absl::StreamFormat(
-          "[AGDCephReader] input_queue = {%s, %s}\n", item.objName, item.pool);
-
-      librados::IoCtx io_ctx;
-      create_io_ctx(item, name_space, &io_ctx);
-
-      OutputQueueItem out_item;
-      out_item.pool = std::move(item.pool);
-      // potentially strip filepath prefix from object name here
-      out_item.name = std::move(item.objName);
-
-      for (const auto& col : columns_) {
-        // we need to strip out any filepath that is irrelevant for ceph
-        std::string obj_base =
-            out_item.name.substr(out_item.name.find_last_of('/') + 1);
-        std::string objId = absl::StrCat(obj_base, ".", col);
-        
-        auto read_buf = read_file(objId, io_ctx);
-        auto out_buf = buf_pool_->get();
-        uint64_t first_ordinal;
-        uint32_t num_records;
-
-        Status s = parser.ParseNew(read_buf.c_str(), read_buf.length(), false,
-                                   out_buf.get(), &first_ordinal, &num_records,
-                                   record_id);
-        std::cout << absl::StrFormat(
-            "[AGDCephReader] Parsed chunk with %d records.\n");
-
-        if (!s.ok()) {
-          std::cerr << absl::StrFormat(
-              "[AGDCephReader] WARNING: Error decompressing chunk: %s\n",
-              s.error_message());
-          return;
-        }
-
-        out_item.col_bufs.push_back(std::move(out_buf));
-        out_item.chunk_size = num_records;
-        out_item.first_ordinal = first_ordinal;
-      }
-
-      output_queue_->push(std::move(out_item));
-    }
-  };
-
-  // Make threads and assign read_and_parse_func to each.
+  // each thread reads and parses chunks
   read_and_parse_threads_.resize(threads);
+  running_threads_ = threads;
   for (auto& t : read_and_parse_threads_) {
-    t = std::thread(read_and_parse_func);
+    t = std::thread([this]() {
+      // on errors, closing the input unblocks the producer, whose pushes
+      // now fail
+      if (!ReadChunks()) input_queue_->close();
+      if (running_threads_.fetch_sub(1) == 1) output_queue_->close();
+    });
   }
 
   return Status::OK();
@@ -201,12 +277,6 @@ AGDCephReader::OutputQueueType* AGDCephReader::GetOutputQueue() {
 void AGDCephReader::Stop() {
   // this doesnt own input_queue_, should it really be stopping it?
   std::cout << absl::StreamFormat("[AGDCephReader] Stopping ...\n");
-  while (!input_queue_->empty()) std::this_thread::sleep_for(1ms);
-  // may already be unblocked by the owner, but its fine
-  input_queue_->unblock();
-
-  done_ = true;
-
   for (auto& t : read_and_parse_threads_) {
     t.join();
   }
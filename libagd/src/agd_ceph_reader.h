@@ -1,6 +1,6 @@
 #pragma once
 
-#include <rados/librados.hpp>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <thread>
@@ -9,15 +9,33 @@
 #include "buffer.h"
 #include "concurrent_queue/concurrent_queue.h"
 #include "liberr/errors.h"
+#include "metrics.h"
 #include "object_pool.h"
+#include "object_store.h"
 #include "queue_defs.h"
 
 using namespace errors;
 
 namespace agd {
 
+// how an AGDCephReader thread reads objects
+struct CephReaderOptions {
+  // reads each thread keeps outstanding, across the columns of several chunks
+  size_t window = 16;
+  // objects up to this size are read with a single read and no stat, once a
+  // thread has seen a few objects of their column. Larger objects take a
+  // stat, then their remaining pieces are read in parallel
+  size_t small_object_size = 8 * 1024 * 1024;
+  size_t piece_size = 4 * 1024 * 1024;
+};
+
 // read chunks from multiple columns from ceph and put them in a queue
-// input queue contains name, pool pairs of chunks to read
+// input queue contains name, pool pairs of chunks to read. Each thread keeps
+// a window of reads outstanding over the columns of the chunks it has
+// started, so its throughput is bound by bandwidth, not round trips, and
+// parses each column once it has all been read. Objects are read into pool
+// buffers and parsed in place. The output queue is closed once the input
+// queue is closed and all its chunks are read.
 class AGDCephReader {
  public:
   using InputQueueItem = agd::ReadQueueItem;
@@ -33,46 +51,96 @@ class AGDCephReader {
                        InputQueueType* input_queue,
                        size_t threads,
                        ObjectPool<Buffer>& buf_pool,
-                       std::unique_ptr<AGDCephReader>& reader);
+                       std::unique_ptr<AGDCephReader>& reader,
+                       bool unpack_bases = true,
+                       const CephReaderOptions& options = CephReaderOptions());
+
+  // read from any object store, e.g. a FileObjectStore for benchmarks
+  static Status Create(std::vector<std::string> columns,
+                       std::unique_ptr<ObjectStore> store,
+                       InputQueueType* input_queue, size_t threads,
+                       ObjectPool<Buffer>& buf_pool,
+                       std::unique_ptr<AGDCephReader>& reader,
+                       bool unpack_bases = true,
+                       const CephReaderOptions& options = CephReaderOptions());
 
   OutputQueueType* GetOutputQueue();
 
+  // wait for all chunks to be read, the input queue must be closed by its
+  // producer
   void Stop();
 
  private:
+  // a chunk whose columns are being read
+  struct ChunkState {
+    OutputQueueItem item;
+    size_t columns_remaining;
+    absl::Time start;
+  };
+
+  // one column object of a chunk. The first read, then for a large object
+  // one buffer per piece, parsed as segments rather than copied together
+  struct ColumnRead {
+    std::shared_ptr<ChunkState> chunk;
+    size_t column;
+    std::string oid;
+    std::vector<ObjectPool<Buffer>::ptr_type> bufs;
+    size_t size = 0;
+    size_t reads_remaining = 0;
+    absl::Time start;
+  };
+
+  // an outstanding read or stat of a column
+  struct PendingOp {
+    enum Kind { FIRST, STAT, PIECE };
+    Kind kind;
+    std::shared_ptr<ColumnRead> column;
+    // of bufs, read into
+    size_t buf;
+    uint64_t offset;
+    size_t len;
+    std::unique_ptr<ObjectStore::Op> op;
+  };
+
   AGDCephReader() = delete;
   AGDCephReader(std::vector<std::string>& columns,
-                ObjectPool<Buffer>& buf_pool,
-                InputQueueType* input_queue)
-      : columns_(columns), buf_pool_(&buf_pool), input_queue_(input_queue) {}
-
-  Status Initialize(const std::string& cluster_name,
-                    const std::string& user_name,
-                    const std::string& name_space,
-                    const std::string& ceph_conf_file,
-                    size_t threads);
-
-  Status setup_ceph_connection(const std::string& cluster_name,
-                               const std::string& user_name,
-                               const std::string& ceph_conf_file);
-  void create_io_ctx(const InputQueueItem& item,
-                     const std::string& name_space,
-                     librados::IoCtx* io_ctx);
-  ceph::bufferlist read_file(const std::string& objId,
-                             librados::IoCtx& io_ctx);
+                std::unique_ptr<ObjectStore> store,
+                ObjectPool<Buffer>& buf_pool, InputQueueType* input_queue,
+                bool unpack_bases, const CephReaderOptions& options)
+      : columns_(columns),
+        store_(std::move(store)),
+        buf_pool_(&buf_pool),
+        input_queue_(input_queue),
+        unpack_bases_(unpack_bases),
+        options_(options) {}
+
+  Status Initialize(size_t threads);
+
+  // read and parse chunks until the input queue is closed, false on errors
+  bool ReadChunks();
 
   std::vector<std::string> columns_;
+  std::unique_ptr<ObjectStore> store_;
   ObjectPool<Buffer>* buf_pool_;  // does not own
 
   InputQueueType* input_queue_;
+  // if false, COMPACTED_BASES columns are output packed
+  bool unpack_bases_;
+  CephReaderOptions options_;
 
   std::unique_ptr<OutputQueueType> output_queue_;
 
-  librados::Rados cluster_;
-
-  volatile bool done_ = false;
+  // the last thread to exit closes the output queue
+  std::atomic_uint32_t running_threads_{0};
 
   std::vector<std::thread> read_and_parse_threads_;
+
+  Counter* num_chunks_;
+  Counter* num_records_;
+  Counter* num_bytes_;
+  Histogram* chunk_latency_;
+  Histogram* read_time_;
+  Histogram* parse_time_;
 };
 
 }  // namespace agd
@@ -1,6 +1,7 @@
 #include "agd_ceph_writer.h"
 
 #include "absl/strings/str_format.h"
+#include "compacted_bases.h"
 #include "compression.h"
 
 using namespace std::chrono_literals;
@@ -14,89 +15,58 @@ Status AGDCephWriter::Create(std::vector<std::string> columns,
                              const std::string& ceph_conf_file,
                              InputQueueType* input_queue, size_t threads,
                              ObjectPool<Buffer>& buf_pool,
-                             std::unique_ptr<AGDCephWriter>& writer) {
-  writer.reset(new AGDCephWriter(columns, buf_pool, input_queue));
-  return writer->Initialize(cluster_name, user_name, name_space, ceph_conf_file,
-                            threads);
+                             const ColumnCodecs& codecs,
+                             std::unique_ptr<AGDCephWriter>& writer,
+                             const CephWriterOptions& options) {
+  std::unique_ptr<ObjectStore> store;
+  ERR_RETURN_IF_ERROR(RadosObjectStore::Create(cluster_name, user_name,
+                                               name_space, ceph_conf_file,
+                                               store));
+  return Create(columns, std::move(store), input_queue, threads, buf_pool,
+                codecs, writer, options);
 }
 
-Status AGDCephWriter::setup_ceph_connection(const std::string& cluster_name,
-                                            const std::string& user_name,
-                                            const std::string& ceph_conf_file) {
-  int ret = 0;
-
-  ret = cluster_.init2(user_name.c_str(), cluster_name.c_str(), 0);
-  if (ret < 0) {
-    return Internal(
-        "[AGDCephWriter] Couldn't intialize the cluster handle! error ", ret);
-  } else {
-    std::cout << absl::StreamFormat(
-        "[AGDCephWriter] Created a cluster handle.\n");
-  }
-
-  ret = cluster_.conf_read_file(ceph_conf_file.c_str());
-  if (ret < 0) {
-    return Internal(
-        "[AGDCephWriter] Couldn't read the Ceph configuration file! error ",
-        ret);
-  } else {
-    std::cout << absl::StreamFormat(
-        "[AGDCephWriter] Read the Ceph configuration file.\n");
-  }
-
-  ret = cluster_.connect();
-  if (ret < 0) {
-    return Unavailable("[AGDCephWriter] Couldn't connect to cluster! error ",
-                       ret);
-  } else {
-    std::cout << absl::StreamFormat(
-        "[AGDCephWriter] Connected to the cluster.\n");
+Status AGDCephWriter::Create(std::vector<std::string> columns,
+                             std::unique_ptr<ObjectStore> store,
+                             InputQueueType* input_queue, size_t threads,
+                             ObjectPool<Buffer>& buf_pool,
+                             const ColumnCodecs& codecs,
+                             std::unique_ptr<AGDCephWriter>& writer,
+                             const CephWriterOptions& options) {
+  if (options.window < columns.size()) {
+    return InvalidArgument("[AGDCephWriter] window must cover the ",
+                           columns.size(), " columns of a chunk");
   }
-
-  return Status::OK();
+  writer.reset(new AGDCephWriter(columns, std::move(store), codecs, buf_pool,
+                                 input_queue, options));
+  return writer->Initialize(threads);
 }
 
-void AGDCephWriter::create_io_ctx(const InputQueueItem& item,
-                                  const std::string& name_space,
-                                  librados::IoCtx* io_ctx) {
-  int ret = cluster_.ioctx_create(item.pool.c_str(), *io_ctx);
-  if (ret < 0) {
+bool AGDCephWriter::WriteChunks() {
+  std::vector<std::unique_ptr<ChunkCompressor>> compressors;
+  Status cs = codecs_.MakeCompressors(columns_, compressors);
+  if (!cs.ok()) {
     std::cerr << absl::StreamFormat(
-        "[AGDCephWriter] Couldn't set up ioctx! error %d. Thread exiting.\n",
-        ret);
-    exit(EXIT_FAILURE);
-  } else {
-    io_ctx->set_namespace(name_space);
-    std::cout << absl::StreamFormat(
-        "[AGDCephWriter] Created ioctx for namespace %s.\n", name_space);
+        "[AGDCephWriter] Error: couldn't create compressors: %s\n",
+        cs.error_message());
+    return false;
   }
-}
-
-Status AGDCephWriter::Initialize(const std::string& cluster_name,
-                                 const std::string& user_name,
-                                 const std::string& name_space,
-                                 const std::string& ceph_conf_file,
-                                 size_t threads) {
-  
-  output_queue_.reset(new OutputQueueType(30)); // is 5 big enough?
-
-  column_map_["base"] = {
-      agd::format::RecordType::TEXT,
-      agd::format::CompressionType::GZIP};  // todo store as compacted bases
-  column_map_["qual"] = {agd::format::RecordType::TEXT,
-                         agd::format::CompressionType::GZIP};
-  column_map_["meta"] = {agd::format::RecordType::TEXT,
-                         agd::format::CompressionType::GZIP};
-  column_map_["aln"] = {agd::format::RecordType::STRUCTURED,
-                        agd::format::CompressionType::GZIP};
-
-  setup_ceph_connection(cluster_name, user_name, ceph_conf_file);
-
-  auto compress_and_write_func = [this, name_space]() {
-    InputQueueItem item;
-    while (!done_) {
-      std::cout << absl::StreamFormat("[AGDCephWriter] Trying to pop queue\n");
-      if (!input_queue_->pop(item)) continue;
+  BufferPair compacted;
+  // completed in the order started. Destroying a write waits for it, so the
+  // buffers outlive the writes from them. A deque keeps the headers in place
+  std::deque<PendingWrite> writes;
+  bool input_open = true;
+
+  while (true) {
+    // compress and start chunks while the window has room. Wait for input
+    // only with nothing outstanding, so finished chunks aren't held back
+    while (input_open && writes.size() + columns_.size() <= options_.window &&
+           (writes.empty() || !input_queue_->empty())) {
+      InputQueueItem item;
+      if (!input_queue_->pop(item)) {
+        input_open = false;
+        break;
+      }
       std::cout << absl::StreamFormat(
           "[AGDCephWriter] input_queue = {%s, %d, %d, %s}\n", item.pool,
           item.chunk_size, item.first_ordinal, item.name);
@@ -105,62 +75,65 @@ Status AGDCephWriter::Initialize(const std::string& cluster_name,
         std::cerr << absl::StreamFormat(
             "[AGDCephWriter] expected %d columns, got %d\n", columns_.size(),
             item.col_buf_pairs.size());
-        return;
+        return false;
       }
 
-      // We use a single io_ctx per thread for writing all columns.
-      librados::IoCtx io_ctx;
-      create_io_ctx(item, name_space, &io_ctx);
+      auto chunk = std::make_shared<ChunkState>();
+      chunk->start = absl::Now();
+      chunk->item.objName = item.name;
+      chunk->item.pool = item.pool;
+      chunk->columns_remaining = columns_.size();
 
       auto name = item.name.substr(item.name.find_last_of("/") + 1,
                                    item.name.find_last_of("_"));
+      // Strip any file path prefix.
+      std::string obj_base = item.name.substr(item.name.find_last_of('/') + 1);
 
       for (size_t buf_idx = 0; buf_idx < columns_.size(); buf_idx++) {
         // Compress.
-        const auto& colbufpair = item.col_buf_pairs[buf_idx];
-        auto compress_buf = buf_pool_->get();
-        compress_buf->reserve(colbufpair->data().size() +
-                              colbufpair->index().size());
-        compress_buf->reset();
-        AppendingGZIPCompressor compressor(*compress_buf.get());
-        Status s = Status::OK();
-        s = compressor.init();
-        if (!s.ok()) {
-          std::cerr << absl::StreamFormat(
-              "[AGDCephWriter] Error: couldn't init compressor: %s\n",
-              s.error_message());
-          exit(EXIT_FAILURE);
-        }
-        s = compressor.appendGZIP(colbufpair->index().data(),
-                                  colbufpair->index().size());
-        if (!s.ok()) {
-          std::cerr << absl::StreamFormat(
-              "[AGDCephWriter] Error: couldn't compress data: %s\n",
-              s.error_message());
-          exit(EXIT_FAILURE);
+        ScopedLatency compress_latency(compress_time_);
+        BufferPair* colbufpair = item.col_buf_pairs[buf_idx].get();
+        bool is_text =
+            buf_idx >= item.record_types.size() ||
+            item.record_types[buf_idx] == agd::format::RecordType::TEXT;
+        if (compact_columns_[buf_idx] && is_text) {
+          Status s = CompactBaseColumn(colbufpair->index(), colbufpair->data(),
+                                       &compacted, true);
+          if (!s.ok()) {
+            std::cerr << absl::StreamFormat(
+                "[AGDCephWriter] Error: couldn't compact bases: %s\n",
+                s.error_message());
+            exit(EXIT_FAILURE);
+          }
+          colbufpair = &compacted;
+          if (buf_idx < item.record_types.size()) {
+            item.record_types[buf_idx] =
+                agd::format::RecordType::COMPACTED_BASES;
+          }
         }
-        s = compressor.appendGZIP(colbufpair->data().data(),
-                                  colbufpair->data().size());
+        writes.emplace_back();
+        auto& write = writes.back();
+        write.chunk = chunk;
+        write.buf = buf_pool_->get();
+        Status s = compressors[buf_idx]->Compress(
+            colbufpair->index(), colbufpair->data(), write.buf.get());
         if (!s.ok()) {
           std::cerr << absl::StreamFormat(
               "[AGDCephWriter] Error: couldn't compress data: %s\n",
               s.error_message());
           exit(EXIT_FAILURE);
         }
-        s = compressor.finish();
-        if (!s.ok()) {
-          std::cerr << absl::StreamFormat(
-              "[AGDCephWriter] Error: couldn't close compressor: %s\n",
-              s.error_message());
-          exit(EXIT_FAILURE);
-        }
+        compress_latency.Stop();
 
         // Write.
         const auto& colname = columns_[buf_idx];
-        agd::format::FileHeader header;
+        agd::format::FileHeader& header = write.header;
         const auto& types = column_map_[colname];
         header.record_type = types.type;
-        header.compression_type = types.compress_type;
+        compressors[buf_idx]->FillHeader(&header);
+        if (buf_idx < item.record_types.size()) {
+          header.record_type = item.record_types[buf_idx];
+        }
 
         memset(header.string_id, 0, sizeof(agd::format::FileHeader::string_id));
         auto copy_size =
@@ -170,32 +143,74 @@ Status AGDCephWriter::Initialize(const std::string& cluster_name,
         header.first_ordinal = item.first_ordinal;
         header.last_ordinal = item.first_ordinal + item.chunk_size;
 
-        // Send to Ceph. Strip any file path prefix. 
-        std::string obj_base =
-            item.name.substr(item.name.find_last_of('/') + 1);
-        std::string objId = absl::StrCat(obj_base, ".", colname);
-
-        librados::bufferlist bl =
-            bl.static_from_mem((char*)&header, sizeof(header));
-        bl.append(compress_buf->data(), compress_buf->size());
+        // Send to Ceph, straight from the header and compressed buffer.
+        write.oid = absl::StrCat(obj_base, ".", colname);
+        iovec segments[2] = {{&header, sizeof(header)},
+                             {write.buf->mutable_data(), write.buf->size()}};
         std::cout << absl::StreamFormat(
-            "Writing %d bytes to object %s in ceph\n", bl.length(), objId);
-        io_ctx.write_full(objId, bl);
+            "Writing %d bytes to object %s in ceph\n",
+            sizeof(header) + write.buf->size(), write.oid);
+        write.start = absl::Now();
+        write.op = store_->WriteFull(chunk->item.pool, write.oid, segments, 2);
+      }
+    }
 
-        num_written_++;
+    if (writes.empty()) return true;
 
-        OutputQueueItem output_item;
-        output_item.objName = std::move(item.name);
-        output_item.pool = std::move(item.pool);
-        output_queue_->push(output_item);
-      }
+    auto& write = writes.front();
+    const int64_t ret = write.op->Wait();
+    if (ret < 0) {
+      std::cerr << absl::StreamFormat(
+          "[AGDCephWriter] Error: couldn't write object %s! error %d\n",
+          write.oid, ret);
+      exit(EXIT_FAILURE);
+    }
+    write_time_->Observe(absl::ToInt64Microseconds(absl::Now() - write.start));
+    num_bytes_->Add(sizeof(write.header) + write.buf->size());
+    num_written_++;
+
+    auto& chunk = *write.chunk;
+    if (--chunk.columns_remaining == 0) {
+      num_chunks_->Add();
+      chunk_latency_->Observe(
+          absl::ToInt64Microseconds(absl::Now() - chunk.start));
+      output_queue_->push(std::move(chunk.item));
     }
-  };
+    writes.pop_front();
+  }
+}
+
+Status AGDCephWriter::Initialize(size_t threads) {
+  output_queue_.reset(new OutputQueueType(30)); // is 5 big enough?
 
-  // Make threads and assign compress_and_write_func to each.
+  column_map_["base"] = {codecs_.compact_bases()
+                             ? agd::format::RecordType::COMPACTED_BASES
+                             : agd::format::RecordType::TEXT};
+  column_map_["qual"] = {agd::format::RecordType::TEXT};
+  column_map_["meta"] = {agd::format::RecordType::TEXT};
+  column_map_["aln"] = {agd::format::RecordType::STRUCTURED};
+  for (const auto& col : columns_) {
+    compact_columns_.push_back(column_map_[col].type ==
+                               agd::format::RecordType::COMPACTED_BASES);
+  }
+
+  auto& metrics = MetricsRegistry::Global();
+  num_chunks_ = metrics.GetCounter("ceph_writer_chunks");
+  num_bytes_ = metrics.GetCounter("ceph_writer_bytes");
+  chunk_latency_ = metrics.GetHistogram("ceph_writer_chunk_latency_us");
+  compress_time_ = metrics.GetHistogram("ceph_writer_compress_us");
+  write_time_ = metrics.GetHistogram("ceph_writer_write_us");
+
+  // each thread compresses chunks and writes them
   compress_and_write_threads_.resize(threads);
+  running_threads_ = threads;
   for (auto& t : compress_and_write_threads_) {
-    t = std::thread(compress_and_write_func);
+    t = std::thread([this]() {
+      // on errors, closing the input unblocks the producer, whose pushes
+      // now fail
+      if (!WriteChunks()) input_queue_->close();
+      if (running_threads_.fetch_sub(1) == 1) output_queue_->close();
+    });
   }
 
   return Status::OK();
@@ -204,12 +219,6 @@ Status AGDCephWriter::Initialize(const std::string& cluster_name,
 void AGDCephWriter::Stop() {
   // this doesnt own input_queue_, should it really be stopping it?
   std::cout << absl::StreamFormat("[AGDCephWriter] Stopping ...\n");
-  while (!input_queue_->empty()) std::this_thread::sleep_for(1ms);
-  // may already be unblocked by the owner, but its fine
-  input_queue_->unblock();
-
-  done_ = true;
-
   for (auto& t : compress_and_write_threads_) {
     t.join();
   }
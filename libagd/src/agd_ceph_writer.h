@@ -1,6 +1,7 @@
 #pragma once
 
-#include <rados/librados.hpp>
+#include <atomic>
+#include <deque>
 #include <memory>
 #include <string>
 #include <thread>
@@ -8,17 +9,31 @@
 
 #include "absl/container/flat_hash_map.h"
 #include "buffer.h"
+#include "compression.h"
 #include "concurrent_queue/concurrent_queue.h"
 #include "format.h"
 #include "liberr/errors.h"
+#include "metrics.h"
 #include "object_pool.h"
+#include "object_store.h"
 #include "queue_defs.h"
 
 using namespace errors;
 
 namespace agd {
 
-// Writes chunks to ceph.
+// how an AGDCephWriter thread writes objects
+struct CephWriterOptions {
+  // column objects each thread keeps being written while it compresses the
+  // next chunks
+  size_t window = 16;
+};
+
+// Writes chunks to ceph. Each thread compresses chunks and writes their
+// columns asynchronously, keeping a window of writes outstanding, so
+// compression overlaps the round trips. A chunk is pushed to the output queue
+// once all its columns are written. The output queue is closed once the input
+// queue is closed and all its chunks are written.
 class AGDCephWriter {
  public:
   using InputQueueItem = agd::WriteQueueItem;
@@ -34,54 +49,95 @@ class AGDCephWriter {
                        InputQueueType* input_queue,
                        size_t threads,
                        ObjectPool<Buffer>& buf_pool,
-                       std::unique_ptr<AGDCephWriter>& writer);
+                       const ColumnCodecs& codecs,
+                       std::unique_ptr<AGDCephWriter>& writer,
+                       const CephWriterOptions& options = CephWriterOptions());
+
+  // write to any object store, e.g. a FileObjectStore for benchmarks
+  static Status Create(std::vector<std::string> columns,
+                       std::unique_ptr<ObjectStore> store,
+                       InputQueueType* input_queue, size_t threads,
+                       ObjectPool<Buffer>& buf_pool,
+                       const ColumnCodecs& codecs,
+                       std::unique_ptr<AGDCephWriter>& writer,
+                       const CephWriterOptions& options = CephWriterOptions());
 
   uint32_t GetNumWritten() { return num_written_.load(); };
 
   OutputQueueType* GetOutputQueue() { return output_queue_.get(); }
 
+  // wait for all chunks to be written, the input queue must be closed by its
+  // producer
   void Stop();
 
  private:
   AGDCephWriter() = delete;
   AGDCephWriter(std::vector<std::string>& columns,
+                std::unique_ptr<ObjectStore> store,
+                const ColumnCodecs& codecs,
                 ObjectPool<Buffer>& buf_pool,
-                InputQueueType* input_queue)
-      : columns_(columns), buf_pool_(&buf_pool), input_queue_(input_queue) {}
-
-  Status Initialize(const std::string& cluster_name,
-                    const std::string& user_name,
-                    const std::string& name_space,
-                    const std::string& ceph_conf_file,
-                    size_t threads);
-
-  Status setup_ceph_connection(const std::string& cluster_name,
-                               const std::string& user_name,
-                               const std::string& ceph_conf_file);
-  void create_io_ctx(const InputQueueItem& item,
-                     const std::string& name_space,
-                     librados::IoCtx* io_ctx);
+                InputQueueType* input_queue,
+                const CephWriterOptions& options)
+      : columns_(columns),
+        store_(std::move(store)),
+        codecs_(codecs),
+        buf_pool_(&buf_pool),
+        input_queue_(input_queue),
+        options_(options) {}
+
+  Status Initialize(size_t threads);
+
+  // a chunk whose columns are being written
+  struct ChunkState {
+    OutputQueueItem item;
+    size_t columns_remaining;
+    absl::Time start;
+  };
+
+  // an outstanding write of a column object. The header and compressed
+  // column are written from here
+  struct PendingWrite {
+    std::shared_ptr<ChunkState> chunk;
+    std::string oid;
+    format::FileHeader header;
+    ObjectPool<Buffer>::ptr_type buf;
+    absl::Time start;
+    std::unique_ptr<ObjectStore::Op> op;
+  };
+
+  // the loop of each thread, until the input queue is closed and drained.
+  // False on errors
+  bool WriteChunks();
 
   struct FormatValue {
     format::RecordType type;
-    format::CompressionType compress_type;
   };
 
   absl::flat_hash_map<absl::string_view, FormatValue> column_map_;
+  // text columns packed to COMPACTED_BASES before compression, by index
+  std::vector<bool> compact_columns_;
 
   std::vector<std::string> columns_;
+  std::unique_ptr<ObjectStore> store_;
+  ColumnCodecs codecs_;
   ObjectPool<Buffer>* buf_pool_;  // does not own
 
   InputQueueType* input_queue_;
+  CephWriterOptions options_;
 
   std::unique_ptr<OutputQueueType> output_queue_;
 
-  librados::Rados cluster_;
-
-  volatile bool done_ = false;
+  // the last thread to exit closes the output queue
+  std::atomic_uint32_t running_threads_{0};
 
   std::vector<std::thread> compress_and_write_threads_;
   std::atomic_uint32_t num_written_{0};
+
+  Counter* num_chunks_;
+  Counter* num_bytes_;
+  Histogram* chunk_latency_;
+  Histogram* compress_time_;
+  Histogram* write_time_;
 };
 
 }  // namespace agd
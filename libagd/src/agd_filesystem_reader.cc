@@ -2,6 +2,9 @@
 #include "agd_filesystem_reader.h"
 #include "filemap.h"
 #include "parser.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <thread>
 #include <chrono>
 
@@ -12,40 +15,87 @@ namespace agd {
 Status AGDFileSystemReader::Create(
     std::vector<std::string> columns, InputQueueType* input_queue,
     size_t threads, ObjectPool<Buffer>& buf_pool,
-    std::unique_ptr<AGDFileSystemReader>& reader) {
-  reader.reset(new AGDFileSystemReader(columns, buf_pool, input_queue));
+    std::unique_ptr<AGDFileSystemReader>& reader, bool unpack_bases,
+    IoEngine io_engine) {
+  reader.reset(new AGDFileSystemReader(columns, buf_pool, input_queue,
+                                       unpack_bases, io_engine));
   return reader->Initialize(threads);
 }
 
+std::shared_ptr<AGDFileSystemReader::ChunkState> AGDFileSystemReader::NewChunk(
+    InputQueueItem& item) {
+  auto chunk = std::make_shared<ChunkState>();
+  chunk->start = absl::Now();
+  chunk->item.name = item.objName;
+  chunk->item.col_bufs.resize(columns_.size());
+  chunk->item.record_types.resize(columns_.size());
+  chunk->columns_remaining = columns_.size();
+  return chunk;
+}
+
+void AGDFileSystemReader::FinishColumns(ChunkState& chunk, uint32_t columns) {
+  if (chunk.columns_remaining.fetch_sub(columns) != columns) return;
+  if (chunk.failed) {
+    std::cout << "[AGDFSReader] WARNING: dropping chunk " << chunk.item.name
+              << ", a column could not be read\n";
+    num_failed_chunks_->Add();
+    return;
+  }
+  std::cout << "[AGDFSReader] parsed chunk with : " << chunk.item.chunk_size
+            << " records.\n";
+  num_chunks_->Add();
+  num_records_->Add(chunk.item.chunk_size);
+  chunk_latency_->Observe(absl::ToInt64Microseconds(absl::Now() - chunk.start));
+  output_queue_->push(std::move(chunk.item));
+}
+
 Status AGDFileSystemReader::Initialize(size_t threads) {
 
+  if (io_engine_ == IoEngine::IO_URING) {
+    const unsigned slots = kUringChunks * columns_.size();
+    ERR_RETURN_IF_ERROR(IoUring::Create(slots, ring_));
+    ring_->EnableFixedBuffers(slots);
+  }
+
   output_queue_ = std::make_unique<OutputQueueType>(5);
-  inter_queue_ = std::make_unique<InterQueueType>(5);
+  // enough column tasks to keep all parsers busy on a few chunks
+  inter_queue_ = std::make_unique<InterQueueType>(5 * columns_.size());
 
-  auto reader_func = [this]() {
-    while (!done_) {
-      InputQueueItem item;
-      if (!input_queue_->pop(item)) continue;
+  auto& metrics = MetricsRegistry::Global();
+  num_chunks_ = metrics.GetCounter("fs_reader_chunks");
+  num_failed_chunks_ = metrics.GetCounter("fs_reader_failed_chunks");
+  num_records_ = metrics.GetCounter("fs_reader_records");
+  num_bytes_ = metrics.GetCounter("fs_reader_bytes");
+  chunk_latency_ = metrics.GetHistogram("fs_reader_chunk_latency_us");
+  parse_time_ = metrics.GetHistogram("fs_reader_parse_us");
 
-      InterQueueItem out_item;
-      out_item.mapped_files.reserve(columns_.size());
-      for (const auto& col : columns_) {
-        auto filepath = absl::StrCat(item.objName, ".", col);
+  auto reader_func = [this]() {
+    InputQueueItem item;
+    while (input_queue_->pop(item)) {
+      auto chunk = NewChunk(item);
+      for (size_t i = 0; i < columns_.size(); i++) {
+        auto filepath = absl::StrCat(item.objName, ".", columns_[i]);
 
         std::cout << "[AGDFSReader] reader mapping file: " << filepath << "\n";
-        std::pair<char*, uint64_t> mapped_file;
-        Status s = mmap_file(filepath, &mapped_file.first, &mapped_file.second);
+        InterQueueItem out_item;
+        Status s = mmap_file(filepath, &out_item.mapped_file.first,
+                             &out_item.mapped_file.second);
 
         if (!s.ok()) {
-          std::cout << "[AGDFSReader] WARNING: Could not map file. Thread exiting.\n";
-          return;
+          std::cout << "[AGDFSReader] WARNING: Could not map file "
+                    << filepath << ": " << s.error_message() << "\n";
+          // the columns not handed to the parsers are done
+          chunk->failed = true;
+          FinishColumns(*chunk, columns_.size() - i);
+          break;
         }
-        out_item.mapped_files.push_back(mapped_file);
-      }
+        num_bytes_->Add(out_item.mapped_file.second);
 
-      std::cout << "[AGDFSReader] pushing to inter_queue_: \n";
-      out_item.name = std::move(item.objName);
-      inter_queue_->push(std::move(out_item));
+        // parsers can start on this column while we map the next
+        out_item.chunk = chunk;
+        out_item.column = i;
+        inter_queue_->push(std::move(out_item));
+      }
     }
   };
 
@@ -54,66 +104,195 @@ Status AGDFileSystemReader::Initialize(size_t threads) {
     RecordParser parser;
     std::string record_id;
     //std::cout << "[AGDFSReader] parser thread starting.\n";
-    while (!parser_done_) {
-      InterQueueItem item;
-      if (!inter_queue_->pop(item)) continue;
-
-      OutputQueueItem out_item;
-      out_item.name = std::move(item.name);
-      for (auto& col_file : item.mapped_files) {
+    InterQueueItem item;
+    while (inter_queue_->pop(item)) {
+      auto& chunk = *item.chunk;
+      auto col_file = item.mapped_file;
+      if (item.file_buf) {
+        col_file = {item.file_buf->mutable_data(), item.file_buf->size()};
+      }
 
-        auto buf = buf_pool_->get();
-        uint64_t first_ordinal;
-        uint32_t num_records;
+      auto buf = buf_pool_->get();
+      uint64_t first_ordinal;
+      uint32_t num_records;
 
-        Status s = parser.ParseNew(col_file.first, col_file.second, false, buf.get(), &first_ordinal, &num_records, record_id);
-        std::cout << "[AGDFSReader] parsed chunk with : " << num_records << " records.\n";
+      ScopedLatency parse_latency(parse_time_);
+      Status s = parser.ParseNew(col_file.first, col_file.second, false, buf.get(), &first_ordinal, &num_records, record_id, unpack_bases_);
+      parse_latency.Stop();
+      if (item.file_buf) {
+        item.file_buf.reset();
+      } else {
         unmap_file(col_file.first, col_file.second);
+      }
 
-        if (!s.ok()) {
-          std::cout << "[AGDFSReader] WARNING: Error decompressing chunk: " << s.error_message() << "\n";
-          return;
+      if (!s.ok()) {
+        std::cout << "[AGDFSReader] WARNING: Error decompressing chunk "
+                  << chunk.item.name << "." << columns_[item.column] << ": "
+                  << s.error_message() << "\n";
+        chunk.failed = true;
+      } else {
+        // each column has its own slot, no lock needed
+        chunk.item.col_bufs[item.column] = std::move(buf);
+        chunk.item.record_types[item.column] = parser.record_type();
+        if (item.column == 0) {
+          chunk.item.chunk_size = num_records;
+          chunk.item.first_ordinal = first_ordinal;
         }
-        out_item.col_bufs.push_back(std::move(buf));
-        out_item.chunk_size = num_records;
-        out_item.first_ordinal = first_ordinal;
       }
-
-      std::cout << "[AGDFSReader] pushing to output queue.\n";
-      output_queue_->push(std::move(out_item));
+      FinishColumns(chunk);
+      item.chunk.reset();
     }
   };
 
   // make threads
   // use one reader for now
-  read_thread_ = std::thread(reader_func);
+  read_thread_ = std::thread([this, reader_func]() {
+    if (ring_) {
+      UringReadLoop();
+    } else {
+      reader_func();
+    }
+    // after an error, closing the input unblocks the producer, which is
+    // already done otherwise
+    input_queue_->close();
+    inter_queue_->close();
+  });
   parse_threads_.resize(threads);
+  running_parsers_ = threads;
   for (auto& t : parse_threads_) {
-    t = std::thread(parser_func);
+    t = std::thread([this, parser_func]() {
+      parser_func();
+      if (running_parsers_.fetch_sub(1) == 1) output_queue_->close();
+    });
   }
 
   return Status::OK();
 }
 
 
+void AGDFileSystemReader::UringReadLoop() {
+  // a column file being read, user_data of its requests is its index
+  struct ColumnRead {
+    std::shared_ptr<ChunkState> chunk;
+    size_t column;
+    int fd = -1;
+    ObjectPool<Buffer>::ptr_type buf;
+    uint64_t done = 0;
+  };
+  std::vector<ColumnRead> reads(ring_->entries());
+  std::vector<size_t> free_reads;
+  for (size_t i = reads.size(); i > 0; i--) {
+    free_reads.push_back(i - 1);
+  }
+  size_t in_flight = 0;
+  bool input_open = true;
+
+  // large files are read in pieces of at most 1GB
+  auto queue_read = [this, &reads](size_t idx) {
+    auto& r = reads[idx];
+    const int slot = ring_->FixedSlot(r.buf->mutable_data(), r.buf->capacity());
+    const uint64_t size =
+        std::min<uint64_t>(r.buf->size() - r.done, 1u << 30);
+    ring_->PrepareRead(r.fd, r.buf->mutable_data() + r.done, size, r.done,
+                       idx, slot);
+  };
+
+  while (true) {
+    // start the next chunks while there's room, wait for input only when
+    // nothing is in flight
+    while (input_open && free_reads.size() >= columns_.size() &&
+           (in_flight == 0 || !input_queue_->empty())) {
+      InputQueueItem item;
+      if (!input_queue_->pop(item)) {
+        input_open = false;
+        break;
+      }
+      auto chunk = NewChunk(item);
+      for (size_t i = 0; i < columns_.size(); i++) {
+        auto filepath = absl::StrCat(item.objName, ".", columns_[i]);
+        const int fd = open(filepath.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+          std::cout << "[AGDFSReader] WARNING: Could not open file "
+                    << filepath << "\n";
+          if (fd >= 0) close(fd);
+          // the columns not started are done
+          chunk->failed = true;
+          FinishColumns(*chunk, columns_.size() - i);
+          break;
+        }
+        size_t idx = free_reads.back();
+        free_reads.pop_back();
+        auto& r = reads[idx];
+        r.chunk = chunk;
+        r.column = i;
+        r.fd = fd;
+        r.done = 0;
+        r.buf = buf_pool_->get();
+        r.buf->reserve(st.st_size);
+        r.buf->resize(st.st_size);
+        in_flight++;
+        queue_read(idx);
+      }
+    }
+
+    if (in_flight == 0) break;
+
+    Status s = ring_->Submit(1);
+    if (!s.ok()) {
+      // requests already in the kernel can still complete into the buffers,
+      // so they are leaked rather than returned to the pool
+      std::cout << "[AGDFSReader] WARNING: " << s.error_message()
+                << ". Thread exiting.\n";
+      for (auto& r : reads) {
+        r.buf.release();
+      }
+      return;
+    }
+
+    uint64_t idx;
+    int32_t res;
+    while (ring_->NextCompletion(&idx, &res)) {
+      auto& r = reads[idx];
+      if (res > 0) {
+        r.done += res;
+        if (r.done < r.buf->size()) {
+          queue_read(idx);
+          continue;
+        }
+      } else if (r.done < r.buf->size()) {
+        std::cout << "[AGDFSReader] WARNING: Could not read file "
+                  << r.chunk->item.name << "." << columns_[r.column]
+                  << ", result " << res << "\n";
+        r.chunk->failed = true;
+      }
+      close(r.fd);
+      in_flight--;
+      if (r.chunk->failed) {
+        // the chunk is dropped, don't parse the rest of it
+        FinishColumns(*r.chunk);
+      } else {
+        num_bytes_->Add(r.buf->size());
+        InterQueueItem out_item;
+        out_item.chunk = std::move(r.chunk);
+        out_item.column = r.column;
+        out_item.file_buf = std::move(r.buf);
+        inter_queue_->push(std::move(out_item));
+      }
+      r.chunk.reset();
+      r.buf.reset();
+      free_reads.push_back(idx);
+    }
+  }
+}
+
 AGDFileSystemReader::OutputQueueType* AGDFileSystemReader::GetOutputQueue() {
   return output_queue_.get();
 }
 
 void AGDFileSystemReader::Stop() {
-  // this doesnt own input_queue_, should it really be stopping it?
   std::cout << "[AGDFSReader] Stopping ...\n";
-  while (!input_queue_->empty()) std::this_thread::sleep_for(1ms);
-  // may already be unblocked by the owner, but its fine
-  input_queue_->unblock();
-
-  done_ = true;
   read_thread_.join();
-
-  while (!inter_queue_->empty()) std::this_thread::sleep_for(1ms);
-  inter_queue_->unblock();
-
-  parser_done_ = true;
   for (auto& t : parse_threads_) {
     t.join();
   }
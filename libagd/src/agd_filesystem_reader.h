@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
@@ -8,14 +10,24 @@
 #include "queue_defs.h"
 #include "concurrent_queue/concurrent_queue.h"
 #include "liberr/errors.h"
+#include "metrics.h"
 #include "object_pool.h"
+#include "uring.h"
 
 using namespace errors;
 
 namespace agd {
 
 // read chunks from multiple columns from FS and put them in a queue
-// input queue contains names of chunks to read
+// input queue contains names of chunks to read. One thread maps the column
+// files, parser threads decompress columns independently so the columns of a
+// chunk are decompressed in parallel. Chunks with a column that can't be read
+// or parsed are dropped with a warning, counted in fs_reader_failed_chunks.
+// The output queue is closed once the input queue is closed and all its
+// chunks are read.
+// With IoEngine::IO_URING the read thread instead keeps the column files of
+// several chunks in flight at once, read into pool buffers, and hands each
+// column to the parsers as its read completes.
 class AGDFileSystemReader {
  public:
   using InputQueueItem = agd::ReadQueueItem;
@@ -26,39 +38,80 @@ class AGDFileSystemReader {
   static Status Create(std::vector<std::string> columns,
                        InputQueueType* input_queue, size_t threads,
                        ObjectPool<Buffer>& buf_pool,
-                       std::unique_ptr<AGDFileSystemReader>& reader);
+                       std::unique_ptr<AGDFileSystemReader>& reader,
+                       bool unpack_bases = true,
+                       IoEngine io_engine = IoEngine::SYNC);
 
   OutputQueueType* GetOutputQueue();
 
+  // wait for all chunks to be read, the input queue must be closed by its
+  // producer
   void Stop();
 
  private:
+  // columns of a chunk are decompressed in parallel, the parser thread that
+  // finishes the last column pushes the chunk, or drops it if a column failed
+  struct ChunkState {
+    OutputQueueItem item;
+    std::atomic_uint32_t columns_remaining{0};
+    std::atomic_bool failed{false};
+    absl::Time start;
+  };
+
+  // one column file of a chunk, mapped, or read into file_buf by io_uring
   struct InterQueueItem {
-    std::vector<std::pair<char*, uint64_t>> mapped_files;
-    std::string name;
+    std::shared_ptr<ChunkState> chunk;
+    size_t column;
+    std::pair<char*, uint64_t> mapped_file;
+    ObjectPool<Buffer>::ptr_type file_buf;
   };
-  using InterQueueType = ConcurrentQueue<InterQueueItem>;
+  using InterQueueType = StageQueue<InterQueueItem>;
 
   AGDFileSystemReader() = delete;
   AGDFileSystemReader(std::vector<std::string>& columns,
-                      ObjectPool<Buffer>& buf_pool, InputQueueType* input_queue)
-      : columns_(columns), buf_pool_(&buf_pool), input_queue_(input_queue) {}
+                      ObjectPool<Buffer>& buf_pool, InputQueueType* input_queue,
+                      bool unpack_bases, IoEngine io_engine)
+      : columns_(columns),
+        buf_pool_(&buf_pool),
+        input_queue_(input_queue),
+        unpack_bases_(unpack_bases),
+        io_engine_(io_engine) {}
 
   Status Initialize(size_t threads);
 
+  // chunks whose columns are read at once by the io_uring engine
+  static constexpr size_t kUringChunks = 4;
+
+  std::shared_ptr<ChunkState> NewChunk(InputQueueItem& item);
+  // count down columns of chunk, the last one pushes or drops the chunk
+  void FinishColumns(ChunkState& chunk, uint32_t columns = 1);
+  // the read thread of the io_uring engine
+  void UringReadLoop();
+
   std::vector<std::string> columns_;
   ObjectPool<Buffer>* buf_pool_;  // does not own
 
   InputQueueType* input_queue_;
+  // if false, COMPACTED_BASES columns are output packed
+  bool unpack_bases_;
+  IoEngine io_engine_;
+  std::unique_ptr<IoUring> ring_;
 
   std::unique_ptr<OutputQueueType> output_queue_;
   std::unique_ptr<InterQueueType> inter_queue_;
 
-  volatile bool done_ = false;
-  volatile bool parser_done_ = false;
+  // the last parser thread to exit closes the output queue
+  std::atomic_uint32_t running_parsers_{0};
 
   std::vector<std::thread> parse_threads_;
   std::thread read_thread_;
+
+  Counter* num_chunks_;
+  Counter* num_failed_chunks_;
+  Counter* num_records_;
+  Counter* num_bytes_;
+  Histogram* chunk_latency_;
+  Histogram* parse_time_;
 };
 
 }  // namespace agd
@@ -1,70 +1,149 @@
 
 #include "agd_filesystem_writer.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
 #include <fstream>
 
+#include "compacted_bases.h"
 #include "compression.h"
 
 using namespace std::chrono_literals;
 
 namespace agd {
 
+namespace {
+
+// files are written here and renamed into place once complete, so a reader,
+// or a resumed run, never takes a partly written file for a chunk
+std::string TempName(const std::string& file_name) {
+  return absl::StrCat(file_name, ".tmp");
+}
+
+// false if the file couldn't be moved into place, it is then removed
+bool CommitFile(const std::string& temp_name, const std::string& file_name) {
+  if (rename(temp_name.c_str(), file_name.c_str()) != 0) {
+    std::cout << "[AGDFSWriter] Failed to rename " << temp_name << " to "
+              << file_name << ", errno " << errno << "\n";
+    unlink(temp_name.c_str());
+    return false;
+  }
+  return true;
+}
+
+void LogFailedChunk(const std::string& name) {
+  std::cout << "[AGDFSWriter] Error: not all columns of " << name
+            << " were written, the chunk is not acknowledged\n";
+}
+
+}  // namespace
+
 Status AGDFileSystemWriter::Create(
     std::vector<std::string> columns, InputQueueType* input_queue,
-    size_t threads, ObjectPool<Buffer>& buf_pool,
-    std::unique_ptr<AGDFileSystemWriter>& writer) {
-  writer.reset(new AGDFileSystemWriter(columns, buf_pool, input_queue));
+    size_t threads, ObjectPool<Buffer>& buf_pool, const ColumnCodecs& codecs,
+    std::unique_ptr<AGDFileSystemWriter>& writer, IoEngine io_engine) {
+  writer.reset(new AGDFileSystemWriter(columns, codecs, buf_pool, input_queue,
+                                       io_engine));
   return writer->Initialize(threads);
 }
 
+void AGDFileSystemWriter::FinishHeader(InterQueueItem& item, size_t column) {
+  auto pos = item.name.find_last_of("/") + 1;
+  auto pos2 = item.name.find_last_of("_");
+  auto name = item.name.substr(pos, pos2 - pos);
+
+  auto& header = item.headers[column];
+  header.record_type = column_map_[columns_[column]].type;
+  if (column < item.record_types.size()) {
+    header.record_type = item.record_types[column];
+  }
+
+  memset(header.string_id, 0, sizeof(agd::format::FileHeader::string_id));
+  auto copy_size =
+      std::min({name.size(), sizeof(agd::format::FileHeader::string_id)});
+  strncpy(&header.string_id[0], name.c_str(), copy_size);
+
+  header.first_ordinal = item.first_ordinal;
+  header.last_ordinal = item.first_ordinal + item.chunk_size;
+}
+
 Status AGDFileSystemWriter::Initialize(size_t threads) {
+
+  if (io_engine_ == IoEngine::IO_URING) {
+    // a header and a data write per column
+    const unsigned slots = kUringChunks * columns_.size() * 2;
+    ERR_RETURN_IF_ERROR(IoUring::Create(slots, ring_));
+    ring_->EnableFixedBuffers(kUringChunks * columns_.size());
+  }
   
   output_queue_.reset(new OutputQueueType(30)); // is 5 big enough?
 
-  column_map_["base"] = {
-      agd::format::RecordType::TEXT,
-      agd::format::CompressionType::GZIP};  // todo store as compacted bases
-  column_map_["qual"] = {agd::format::RecordType::TEXT,
-                         agd::format::CompressionType::GZIP};
-  column_map_["meta"] = {agd::format::RecordType::TEXT,
-                         agd::format::CompressionType::GZIP};
-  column_map_["aln"] = {agd::format::RecordType::STRUCTURED,
-                        agd::format::CompressionType::GZIP};
+  column_map_["base"] = {codecs_.compact_bases()
+                             ? agd::format::RecordType::COMPACTED_BASES
+                             : agd::format::RecordType::TEXT};
+  column_map_["qual"] = {agd::format::RecordType::TEXT};
+  column_map_["meta"] = {agd::format::RecordType::TEXT};
+  column_map_["aln"] = {agd::format::RecordType::STRUCTURED};
+  for (const auto& col : columns_) {
+    compact_columns_.push_back(column_map_[col].type ==
+                               agd::format::RecordType::COMPACTED_BASES);
+  }
   inter_queue_ = std::make_unique<InterQueueType>(5);
 
+  auto& metrics = MetricsRegistry::Global();
+  num_chunks_ = metrics.GetCounter("fs_writer_chunks");
+  num_bytes_ = metrics.GetCounter("fs_writer_bytes");
+  chunk_latency_ = metrics.GetHistogram("fs_writer_chunk_latency_us");
+  compress_time_ = metrics.GetHistogram("fs_writer_compress_us");
+  write_time_ = metrics.GetHistogram("fs_writer_write_us");
+
   auto compress_func = [this]() {
-    while (!compress_done_) {
-      InputQueueItem item;
-      if (!input_queue_->pop(item)) continue;
+    std::vector<std::unique_ptr<ChunkCompressor>> compressors;
+    Status cs = codecs_.MakeCompressors(columns_, compressors);
+    if (!cs.ok()) {
+      std::cout << "[AGDFSWriter] Error: couldn't create compressors: "
+                << cs.error_message() << "\n";
+      return false;
+    }
+    BufferPair compacted;
+
+    InputQueueItem item;
+    while (input_queue_->pop(item)) {
 
       InterQueueItem out_item;
+      out_item.start = absl::Now();
       if (item.col_buf_pairs.size() != columns_.size()) {
         std::cout << "[AGDFSWriter] expected " << columns_.size()
                   << " columns, got " << item.col_buf_pairs.size() << "\n";
-        return;
+        return false;
       }
 
       out_item.col_bufs.reserve(columns_.size());
-      for (auto& col : item.col_buf_pairs) {
-        auto compress_buf = buf_pool_->get();
-        compress_buf->reserve(col->data().size() + col->index().size());
-        compress_buf->reset();
-        AppendingGZIPCompressor compressor(*compress_buf.get());
-        Status s = Status::OK();
-        s = compressor.init();
-        if (!s.ok()) {
-          std::cout << "[AGDFSWriter] Error: couldn't init compressor: "
-                    << s.error_message() << "\n";
-          exit(0);
+      for (size_t i = 0; i < columns_.size(); i++) {
+        BufferPair* col = item.col_buf_pairs[i].get();
+        ScopedLatency compress_latency(compress_time_);
+        bool is_text = i >= item.record_types.size() ||
+                       item.record_types[i] == agd::format::RecordType::TEXT;
+        if (compact_columns_[i] && is_text) {
+          Status s =
+              CompactBaseColumn(col->index(), col->data(), &compacted, true);
+          if (!s.ok()) {
+            std::cout << "[AGDFSWriter] Error: couldn't compact bases: "
+                      << s.error_message() << "\n";
+            exit(0);
+          }
+          col = &compacted;
+          if (i < item.record_types.size()) {
+            item.record_types[i] = agd::format::RecordType::COMPACTED_BASES;
+          }
         }
-        s = compressor.appendGZIP(col->index().data(), col->index().size());
-        if (!s.ok()) {
-          std::cout << "[AGDFSWriter] Error: couldn't compress data: "
-                    << s.error_message() << "\n";
-          exit(0);
-        }
-        s = compressor.appendGZIP(col->data().data(), col->data().size());
+        auto compress_buf = buf_pool_->get();
+        Status s = compressors[i]->Compress(col->index(), col->data(),
+                                            compress_buf.get());
         if (!s.ok()) {
           std::cout << "[AGDFSWriter] Error: couldn't compress data: "
                     << s.error_message() << "\n";
@@ -72,95 +151,251 @@ Status AGDFileSystemWriter::Initialize(size_t threads) {
         }
 
         out_item.col_bufs.push_back(std::move(compress_buf));
+        out_item.headers.emplace_back();
+        compressors[i]->FillHeader(&out_item.headers.back());
       }
 
       // std::cout << "[AGDFSReader] pushing to inter_queue_: \n";
       out_item.name = std::move(item.name);
+      out_item.record_types = std::move(item.record_types);
       out_item.chunk_size = item.chunk_size;
       out_item.first_ordinal = item.first_ordinal;
-      inter_queue_->push(std::move(out_item));
+      // fails if the write thread failed
+      if (!inter_queue_->push(std::move(out_item))) return false;
     }
+    return true;
   };
 
   auto writer_func = [this]() {
     // std::cout << "[AGDFSReader] parser thread starting.\n";
-    while (!done_) {
-      InterQueueItem item;
-      if (!inter_queue_->pop(item)) continue;
+    InterQueueItem item;
+    while (inter_queue_->pop(item)) {
 
+      bool written = true;
       size_t buf_idx = 0;
-      auto pos = item.name.find_last_of("/") + 1;
-      auto pos2 = item.name.find_last_of("_");
-      auto name = item.name.substr(pos, pos2 - pos);
-
-      std::cout << "[AGDFSWriter] dataset name is " << name << "\n";
       for (auto& col : columns_) {
         auto& buf = item.col_bufs[buf_idx];
 
-        agd::format::FileHeader header;
-
-        const auto& types = column_map_[col];
-        header.record_type = types.type;
-        header.compression_type = types.compress_type;
-
-        memset(header.string_id, 0, sizeof(agd::format::FileHeader::string_id));
-        auto copy_size =
-            std::min({name.size(), sizeof(agd::format::FileHeader::string_id)});
-        strncpy(&header.string_id[0], name.c_str(), copy_size);
-
-        header.first_ordinal = item.first_ordinal;
-        header.last_ordinal = item.first_ordinal + item.chunk_size;
+        FinishHeader(item, buf_idx);
+        const auto& header = item.headers[buf_idx];
 
         auto file_name = absl::StrCat(item.name, ".", col);
+        auto temp_name = TempName(file_name);
         std::cout << "[AGDFSWriter] writing file " << file_name << "\n";
 
-        std::ofstream out_file(file_name, std::ios::binary);
+        ScopedLatency write_latency(write_time_);
+        std::ofstream out_file(temp_name, std::ios::binary);
         out_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
         out_file.write(buf->data(), buf->size());
+        out_file.close();
 
         if (!out_file.good()) {
           std::cout << "[AGDFSWriter] Failed to write bases file " << file_name
                     << "\n";
+          unlink(temp_name.c_str());
+          written = false;
+        } else if (!CommitFile(temp_name, file_name)) {
+          written = false;
         }
-        out_file.close();
+        write_latency.Stop();
+        num_bytes_->Add(sizeof(header) + buf->size());
         num_written_++;
         buf_idx++;
-
+      }
+      // only chunks with all columns in place are done
+      if (written) {
         OutputQueueItem output_item;
-        output_item.objName = std::move(item.name);
+        output_item.objName = item.name;
         output_queue_->push(output_item);
+      } else {
+        LogFailedChunk(item.name);
       }
+      num_chunks_->Add();
+      chunk_latency_->Observe(
+          absl::ToInt64Microseconds(absl::Now() - item.start));
     }
   };
 
   // make threads
   // use one reader for now
-  write_thread_ = std::thread(writer_func);
+  write_thread_ = std::thread([this, writer_func]() {
+    if (ring_) {
+      UringWriteLoop();
+    } else {
+      writer_func();
+    }
+    // after an error, closing the input unblocks the compressors, which are
+    // already done otherwise
+    inter_queue_->close();
+    output_queue_->close();
+  });
   compress_threads_.resize(threads);
+  running_compressors_ = threads;
   for (auto& t : compress_threads_) {
-    t = std::thread(compress_func);
+    t = std::thread([this, compress_func]() {
+      // on errors, closing the input unblocks the producer, whose pushes
+      // now fail
+      if (!compress_func()) input_queue_->close();
+      if (running_compressors_.fetch_sub(1) == 1) inter_queue_->close();
+    });
   }
 
   return Status::OK();
 }
 
-void AGDFileSystemWriter::Stop() {
-  // this doesnt own input_queue_, should it really be stopping it?
-  std::cout << "[AGDFSWriter] Stopping ...\n";
+void AGDFileSystemWriter::UringWriteLoop() {
+  const size_t num_columns = columns_.size();
+  // user_data of a request is (chunk slot * columns + column) * 2 + part,
+  // part 0 writes the header and 1 the data
+  struct ChunkWrite {
+    InterQueueItem item;
+    std::vector<int> fds;
+    std::vector<bool> failed;
+    std::vector<uint64_t> done;
+    std::vector<uint8_t> parts_remaining;
+    size_t columns_remaining;
+  };
+  std::vector<ChunkWrite> chunks(kUringChunks);
+  std::vector<size_t> free_chunks;
+  for (size_t i = chunks.size(); i > 0; i--) {
+    free_chunks.push_back(i - 1);
+  }
+  size_t in_flight = 0;
+  bool input_open = true;
+
+  // large buffers are written in pieces of at most 1GB
+  auto queue_write = [&](uint64_t id) {
+    auto& c = chunks[id / (2 * num_columns)];
+    const size_t column = (id / 2) % num_columns;
+    const uint64_t done = c.done[id % (2 * num_columns)];
+    if (id % 2 == 0) {
+      ring_->PrepareWrite(
+          c.fds[column],
+          reinterpret_cast<const char*>(&c.item.headers[column]) + done,
+          sizeof(format::FileHeader) - done, done, id);
+    } else {
+      auto& buf = c.item.col_bufs[column];
+      const int slot = ring_->FixedSlot(buf->mutable_data(), buf->capacity());
+      ring_->PrepareWrite(
+          c.fds[column], buf->data() + done,
+          std::min<uint64_t>(buf->size() - done, 1u << 30),
+          sizeof(format::FileHeader) + done, id, slot);
+    }
+  };
+
+  auto finish_column = [&](ChunkWrite& c, size_t column) {
+    auto file_name = absl::StrCat(c.item.name, ".", columns_[column]);
+    if (c.fds[column] >= 0) {
+      if (close(c.fds[column]) != 0) c.failed[column] = true;
+      if (c.failed[column]) {
+        unlink(TempName(file_name).c_str());
+      } else if (!CommitFile(TempName(file_name), file_name)) {
+        c.failed[column] = true;
+      }
+    } else {
+      c.failed[column] = true;
+    }
+    num_bytes_->Add(sizeof(format::FileHeader) +
+                    c.item.col_bufs[column]->size());
+    num_written_++;
+    if (--c.columns_remaining == 0) {
+      // only chunks with all columns in place are done
+      if (std::find(c.failed.begin(), c.failed.end(), true) ==
+          c.failed.end()) {
+        OutputQueueItem output_item;
+        output_item.objName = c.item.name;
+        output_queue_->push(output_item);
+      } else {
+        LogFailedChunk(c.item.name);
+      }
+      num_chunks_->Add();
+      chunk_latency_->Observe(
+          absl::ToInt64Microseconds(absl::Now() - c.item.start));
+      c.item = InterQueueItem();
+      free_chunks.push_back(&c - chunks.data());
+    }
+  };
+
+  while (true) {
+    // start the next chunks while there's room, wait for input only when
+    // nothing is in flight
+    while (input_open && !free_chunks.empty() &&
+           (in_flight == 0 || !inter_queue_->empty())) {
+      const size_t slot = free_chunks.back();
+      auto& c = chunks[slot];
+      if (!inter_queue_->pop(c.item)) {
+        input_open = false;
+        break;
+      }
+      free_chunks.pop_back();
+      c.fds.assign(num_columns, -1);
+      c.failed.assign(num_columns, false);
+      c.done.assign(2 * num_columns, 0);
+      c.parts_remaining.assign(num_columns, 2);
+      c.columns_remaining = num_columns;
+      for (size_t i = 0; i < num_columns; i++) {
+        FinishHeader(c.item, i);
+        auto file_name = absl::StrCat(c.item.name, ".", columns_[i]);
+        std::cout << "[AGDFSWriter] writing file " << file_name << "\n";
+        c.fds[i] = open(TempName(file_name).c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (c.fds[i] < 0) {
+          std::cout << "[AGDFSWriter] Failed to write file " << file_name
+                    << "\n";
+          finish_column(c, i);
+          continue;
+        }
+        const uint64_t id = (slot * num_columns + i) * 2;
+        queue_write(id);
+        queue_write(id + 1);
+        in_flight += 2;
+      }
+    }
 
-  while (!input_queue_->empty()) std::this_thread::sleep_for(1ms);
-  // may already be unblocked by the owner, but its fine
-  input_queue_->unblock();
+    if (in_flight == 0) {
+      if (!input_open) break;
+      continue;
+    }
+
+    Status s = ring_->Submit(1);
+    if (!s.ok()) {
+      std::cout << "[AGDFSWriter] Error: " << s.error_message()
+                << ". Thread exiting.\n";
+      return;
+    }
 
-  compress_done_ = true;
+    uint64_t id;
+    int32_t res;
+    while (ring_->NextCompletion(&id, &res)) {
+      auto& c = chunks[id / (2 * num_columns)];
+      const size_t column = (id / 2) % num_columns;
+      auto& done = c.done[id % (2 * num_columns)];
+      const uint64_t size = id % 2 == 0 ? sizeof(format::FileHeader)
+                                        : c.item.col_bufs[column]->size();
+      if (res > 0) {
+        done += res;
+        if (done < size) {
+          queue_write(id);
+          continue;
+        }
+      } else if (done < size) {
+        std::cout << "[AGDFSWriter] Failed to write file " << c.item.name
+                  << "." << columns_[column] << ", result " << res << "\n";
+        c.failed[column] = true;
+      }
+      in_flight--;
+      if (--c.parts_remaining[column] == 0) {
+        finish_column(c, column);
+      }
+    }
+  }
+}
+
+void AGDFileSystemWriter::Stop() {
+  std::cout << "[AGDFSWriter] Stopping ...\n";
   for (auto& t : compress_threads_) {
     t.join();
   }
-
-  while (!inter_queue_->empty()) std::this_thread::sleep_for(1ms);
-  inter_queue_->unblock();
-
-  done_ = true;
   write_thread_.join();
 }
 
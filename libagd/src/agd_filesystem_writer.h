@@ -6,18 +6,26 @@
 
 #include "absl/container/flat_hash_map.h"
 #include "buffer_pair.h"
+#include "compression.h"
 #include "concurrent_queue/concurrent_queue.h"
 #include "format.h"
 #include "liberr/errors.h"
+#include "metrics.h"
 #include "object_pool.h"
 #include "queue_defs.h"
+#include "uring.h"
 
 using namespace errors;
 
 namespace agd {
 
 // read chunks from multiple columsn from FS and put them in a queue
-// input queue contains names of chunks to read
+// input queue contains names of chunks to read. A chunk is pushed to the
+// output queue once all its column files are in place, chunks that failed to
+// write are left out. The output queue is closed once the input queue is
+// closed and all its chunks are written.
+// With IoEngine::IO_URING the write thread keeps the column files of several
+// chunks in flight at once instead of writing one file at a time.
 class AGDFileSystemWriter {
  public:
   using InputQueueItem = agd::WriteQueueItem;
@@ -28,54 +36,85 @@ class AGDFileSystemWriter {
   static Status Create(std::vector<std::string> columns,
                        InputQueueType* input_queue, size_t threads,
                        ObjectPool<Buffer>& buf_pool,
-                       std::unique_ptr<AGDFileSystemWriter>& writer);
+                       const ColumnCodecs& codecs,
+                       std::unique_ptr<AGDFileSystemWriter>& writer,
+                       IoEngine io_engine = IoEngine::SYNC);
 
   uint32_t GetNumWritten() { return num_written_.load(); };
 
   OutputQueueType* GetOutputQueue() { return output_queue_.get(); }
 
+  // wait for all chunks to be written, the input queue must be closed by its
+  // producer
   void Stop();
 
  private:
   struct InterQueueItem {
     std::vector<ObjectPool<Buffer>::ptr_type> col_bufs;
+    std::vector<format::RecordType> record_types;
+    // codec fields filled by the compressor
+    std::vector<format::FileHeader> headers;
     uint32_t chunk_size;
     uint64_t first_ordinal;
     std::string name;
+    absl::Time start;
   };
-  using InterQueueType = ConcurrentQueue<InterQueueItem>;
+  using InterQueueType = StageQueue<InterQueueItem>;
 
   AGDFileSystemWriter() = delete;
   AGDFileSystemWriter(std::vector<std::string>& columns,
-                      ObjectPool<Buffer>& buf_pool, InputQueueType* input_queue)
-      : columns_(columns), buf_pool_(&buf_pool), input_queue_(input_queue) {}
+                      const ColumnCodecs& codecs, ObjectPool<Buffer>& buf_pool,
+                      InputQueueType* input_queue, IoEngine io_engine)
+      : columns_(columns),
+        codecs_(codecs),
+        buf_pool_(&buf_pool),
+        input_queue_(input_queue),
+        io_engine_(io_engine) {}
 
   Status Initialize(size_t threads);
 
+  // chunks whose columns are written at once by the io_uring engine
+  static constexpr size_t kUringChunks = 4;
+
+  // complete item.headers[column] for the column file
+  void FinishHeader(InterQueueItem& item, size_t column);
+  // the write thread of the io_uring engine
+  void UringWriteLoop();
+
   struct FormatValue {
     format::RecordType type;
-    format::CompressionType compress_type;
   };
 
   // this could really just be an array but whatever
   absl::flat_hash_map<absl::string_view, FormatValue> column_map_;
+  // text columns packed to COMPACTED_BASES before compression, by index
+  std::vector<bool> compact_columns_;
 
   std::vector<std::string> columns_;
+  ColumnCodecs codecs_;
   ObjectPool<Buffer>* buf_pool_;  // does not own
 
   InputQueueType* input_queue_;
-  
+  IoEngine io_engine_;
+  std::unique_ptr<IoUring> ring_;
+
   std::unique_ptr<OutputQueueType> output_queue_;
 
   std::unique_ptr<InterQueueType> inter_queue_;
 
-  volatile bool done_ = false;
-  volatile bool compress_done_ = false;
+  // the last compress thread to exit closes the inter queue
+  std::atomic_uint32_t running_compressors_{0};
 
   std::vector<std::thread> compress_threads_;
   std::thread write_thread_;
 
   std::atomic_uint32_t num_written_{0};
+
+  Counter* num_chunks_;
+  Counter* num_bytes_;
+  Histogram* chunk_latency_;
+  Histogram* compress_time_;
+  Histogram* write_time_;
 };
 
 }  // namespace agd
\ No newline at end of file
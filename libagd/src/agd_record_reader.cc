@@ -1,5 +1,7 @@
 #include "agd_record_reader.h"
 
+#include "index_encoding.h"
+
 namespace agd {
 
 using namespace errors;
@@ -13,16 +15,15 @@ AGDRecordReader::AGDRecordReader(const char* resource, size_t num_records)
   index_ = reinterpret_cast<const RelativeIndex*>(base_data);
   cur_data_ = data_ = base_data + idx_offset;
   //cur_record_ = 0;
-  InitializeIndex();
 }
 
+AGDRecordReader::AGDRecordReader(const RelativeIndex* index, const char* data,
+                                 size_t num_records)
+    : index_(index), data_(data), cur_data_(data), num_records_(num_records) {}
+
 void AGDRecordReader::InitializeIndex() {
-  absolute_index_.clear();
-  size_t current = 0;
-  for (size_t i = 0; i < num_records_; ++i) {
-    absolute_index_.push_back(current);
-    current += index_[i];
-  }
+  absolute_index_.resize(num_records_);
+  AbsoluteIndex(index_, num_records_, absolute_index_.data());
 }
 
 void AGDRecordReader::Reset() {
@@ -50,23 +51,35 @@ Status AGDRecordReader::GetNextRecord(const char** data, size_t* size) {
 
 Status AGDRecordReader::GetRecordAt(size_t index, const char** data,
                                     size_t* size) {
-  if (index < num_records_) {
-    *size = (size_t)index_[index];
-    *data = data_ + absolute_index_[index];
-  } else {
+  if (index >= num_records_) {
     return OutOfRange("agd record random access out of range");
   }
+  if (absolute_index_.size() != num_records_) {
+    InitializeIndex();
+  }
+  *size = (size_t)index_[index];
+  *data = data_ + absolute_index_[index];
   cur_record_ = index + 1;
-  cur_data_ = data_ + absolute_index_[index + 1];
+  cur_data_ = *data + *size;
   return Status::OK();
 }
 
 AGDResultReader::AGDResultReader(const char* resource, size_t num_records, 
-      AGDRecordReader* metadata) : AGDRecordReader(resource, num_records), metadata_(metadata) {
+      AGDRecordReader* metadata, RecordType record_type) : AGDRecordReader(resource, num_records),
+      record_type_(record_type), metadata_(metadata) {
     Alignment result;
     Status s = PeekNextResult(result);
     start_position_ = result.position();
-    GetResultAtIndex(num_records - 1, result);
+    // walk to the last record rather than GetResultAtIndex, whose absolute
+    // index only random access should pay for
+    const char* data;
+    size_t len;
+    for (size_t i = 0; i + 1 < num_records; i++) {
+      GetNextRecord(&data, &len);
+    }
+    if (PeekNextRecord(&data, &len).ok() && len > 0) {
+      ParseResult(data, len, result);
+    }
     end_position_ = result.position();
     AGDRecordReader::Reset();
     if (metadata_)
@@ -153,6 +166,30 @@ AGDResultReader::AGDResultReader(const char* resource, size_t num_records,
     return Status::OK();
   }
 
+    Status AGDResultReader::ParseResult(const char* data, size_t len, Alignment& result) {
+      if (record_type_ != RecordType::BINARY_ALIGNMENT) {
+        result.ParseFromArray(data, len);
+        return Status::OK();
+      }
+
+      auto bin = reinterpret_cast<const BinaryAlignment*>(data);
+      if (len < sizeof(BinaryAlignment) || len != bin->size()) {
+        return Internal("Binary alignment record of size ", len, " is corrupt");
+      }
+      result.set_flag(bin->flag);
+      result.set_mapping_quality(bin->mapping_quality);
+      result.set_template_length(bin->template_length);
+      result.mutable_position()->set_position(bin->position);
+      result.mutable_position()->set_ref_index(bin->ref_index);
+      result.mutable_next_position()->set_position(bin->next_position);
+      result.mutable_next_position()->set_ref_index(bin->next_ref_index);
+      result.mutable_position()->clear_contig();
+      result.mutable_next_position()->clear_contig();
+      UnpackCigar(bin->cigar(), bin->num_cigar_ops, cigar_scratch_);
+      result.set_cigar(cigar_scratch_);
+      return Status::OK();
+    }
+
     Status AGDResultReader::GetNextResult(Alignment& result) {
       const char* data;
       size_t len;
@@ -160,8 +197,7 @@ AGDResultReader::AGDResultReader(const char* resource, size_t num_records,
       if (len == 0) {
         return errors::Unavailable("Empty result");
       }
-      result.ParseFromArray(data, len);
-      return Status::OK();
+      return ParseResult(data, len, result);
     }
 
     Status AGDResultReader::PeekNextResult(Alignment& result) {
@@ -171,8 +207,7 @@ AGDResultReader::AGDResultReader(const char* resource, size_t num_records,
       if (len == 0) {
         return errors::Unavailable("Empty result");
       }
-      result.ParseFromArray(data, len);
-      return Status::OK();
+      return ParseResult(data, len, result);
     }
 
 
@@ -183,7 +218,23 @@ AGDResultReader::AGDResultReader(const char* resource, size_t num_records,
       if (len == 0) {
         return errors::Unavailable("Empty result");
       }
-      result.ParseFromArray(data, len);
+      return ParseResult(data, len, result);
+    }
+
+    Status AGDResultReader::GetNextBinaryResult(const BinaryAlignment** result) {
+      if (record_type_ != RecordType::BINARY_ALIGNMENT) {
+        return InvalidArgument("Result column is not a binary alignment column");
+      }
+      const char* data;
+      size_t len;
+      ERR_RETURN_IF_ERROR(GetNextRecord(&data, &len));
+      if (len == 0) {
+        return errors::Unavailable("Empty result");
+      }
+      *result = reinterpret_cast<const BinaryAlignment*>(data);
+      if (len < sizeof(BinaryAlignment) || len != (*result)->size()) {
+        return Internal("Binary alignment record of size ", len, " is corrupt");
+      }
       return Status::OK();
     }
 }  // namespace agd
@@ -20,12 +20,18 @@ class AGDRecordReader {
  public:
   AGDRecordReader(const char* resource, size_t num_records);
 
+  // view over a range of records within a chunk. index and data point at the
+  // first record of the range in the chunk's index and data
+  AGDRecordReader(const format::RelativeIndex* index, const char* data,
+                  size_t num_records);
+
   void Reset();
   int NumRecords() { return num_records_; }
 
   Status GetNextRecord(const char** data, size_t* size);
   Status PeekNextRecord(const char** data, size_t* size);
 
+  // the first call builds the absolute index of the chunk
   Status GetRecordAt(size_t index, const char** data, size_t* size);
 
   size_t GetCurrentIndex() { return cur_record_; }
@@ -34,6 +40,7 @@ class AGDRecordReader {
   const format::RelativeIndex* index_;
   const char *data_, *cur_data_;
   size_t cur_record_ = 0;
+  // record offsets in data_, built on the first random access
   std::vector<size_t> absolute_index_;
 
   void InitializeIndex();
@@ -50,7 +57,11 @@ class AGDResultReader : public AGDRecordReader {
     // metadata column is required to disambiguate results that mapped to 
     // the same position.
     // if null is passed, GetResultAtLocation will not work.
-    AGDResultReader(const char* resource, size_t num_records, AGDRecordReader* metadata=nullptr);
+    // record_type is the type from the chunk header, STRUCTURED (protobuf) or
+    // BINARY_ALIGNMENT. Binary results are converted to Alignment on the
+    // Alignment accessors, with empty contig names.
+    AGDResultReader(const char* resource, size_t num_records, AGDRecordReader* metadata=nullptr,
+        format::RecordType record_type=format::RecordType::STRUCTURED);
 
     // Get the result at specified GenomeLocation. Uses a binary search
     // for log(n) performance. metadata may be used to disambiguate reads
@@ -65,9 +76,15 @@ class AGDResultReader : public AGDRecordReader {
     Status PeekNextResult(Alignment& result);
 
     // Get a result at a specific index offset in the chunk
-    // uses the Absolute index created on construction
+    // builds the absolute index on the first call, see GetRecordAt
     Status GetResultAtIndex(size_t index, Alignment& result);
 
+    // Get next result without any conversion, only valid for
+    // BINARY_ALIGNMENT columns. result points into the chunk buffer.
+    Status GetNextBinaryResult(const format::BinaryAlignment** result);
+
+    bool IsBinary() const { return record_type_ == format::RecordType::BINARY_ALIGNMENT; }
+
     // is this location possibly contained
     // i.e. start_location_ <= location <= end_location_
     bool IsPossiblyContained(Position& position) {
@@ -77,6 +94,10 @@ class AGDResultReader : public AGDRecordReader {
 
   private:
 
+    Status ParseResult(const char* data, size_t len, Alignment& result);
+
+    format::RecordType record_type_;
+    std::string cigar_scratch_;
     Position start_position_;
     Position end_position_;
     AGDRecordReader* metadata_;
@@ -25,6 +25,20 @@ void AlignmentResultBuilder::AppendAlignmentResult(const Alignment& result) {
   ColumnBuilder::AppendRecord(&scratch_[0], size);
 }
 
+void AlignmentResultBuilder::AppendBinaryAlignment(
+    const format::BinaryAlignment& result, const uint32_t* cigar,
+    const size_t num_ops) {
+  BinaryAlignment record = result;
+  record.num_cigar_ops = static_cast<uint32_t>(num_ops);
+  data_->AppendBuffer(reinterpret_cast<const char*>(&record), sizeof(record));
+  if (num_ops > 0)
+    data_->AppendBuffer(reinterpret_cast<const char*>(cigar),
+                        num_ops * sizeof(uint32_t));
+  format::RelativeIndex size =
+      static_cast<format::RelativeIndex>(record.size());
+  index_->AppendBuffer(reinterpret_cast<const char*>(&size), sizeof(size));
+}
+
 void ColumnBuilder::SetBufferPair(BufferPair* data) {
   data->reset();
   data_ = &data->data();
@@ -51,6 +51,12 @@ class AlignmentResultBuilder : public ColumnBuilder {
   // This is the only one we should use now
 
   void AppendAlignmentResult(const Alignment& result);
+
+  // append a BINARY_ALIGNMENT record, written directly into the buffer pair
+  // without going through protobuf. result.num_cigar_ops is overwritten with
+  // num_ops
+  void AppendBinaryAlignment(const format::BinaryAlignment& result,
+                             const uint32_t* cigar, const std::size_t num_ops);
   // sometimes we want to append an empty result
   // e.g. not all reads will generate X secondary alignments (so some columns
   // will have gaps)
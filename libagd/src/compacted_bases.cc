@@ -0,0 +1,303 @@
+#include "compacted_bases.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace agd {
+
+using namespace errors;
+using format::BaseAlphabet;
+using format::RelativeIndex;
+
+namespace {
+
+constexpr size_t kBasesPerWord = format::BinaryBases::compression;
+constexpr size_t kBaseWidth = format::BinaryBases::base_width;
+constexpr uint8_t kInvalid = 0xff;
+// bit 0 of each 3 bit code in a word
+constexpr uint64_t kCodeLowBits = 0x1249249249249249ull;
+// 3 bit code in each byte
+constexpr uint64_t kByteCodes = 0x0707070707070707ull;
+
+// words packed per block, so codes fit in a small stack buffer
+constexpr size_t kBlockWords = 16;
+
+const char kCodeChars[8] = {'A', 'C', 'T', 'G', 'N', 0, 0, 0};
+
+std::array<uint8_t, 256> MakeCodeTable() {
+  std::array<uint8_t, 256> table;
+  table.fill(kInvalid);
+  const std::pair<char, BaseAlphabet> bases[] = {
+      {'A', BaseAlphabet::A}, {'C', BaseAlphabet::C}, {'G', BaseAlphabet::G},
+      {'T', BaseAlphabet::T}, {'N', BaseAlphabet::N}};
+  for (const auto& b : bases) {
+    table[static_cast<uint8_t>(b.first)] = b.second;
+    table[static_cast<uint8_t>(b.first | 0x20)] = b.second;  // lower case
+  }
+  return table;
+}
+
+const std::array<uint8_t, 256> kCodeTable = MakeCodeTable();
+
+// convert characters to 3 bit codes, returns the number converted before the
+// first invalid character
+size_t ToCodesScalar(const char* bases, size_t n, uint8_t* codes) {
+  for (size_t i = 0; i < n; i++) {
+    auto code = kCodeTable[static_cast<uint8_t>(bases[i])];
+    if (code == kInvalid) return i;
+    codes[i] = code;
+  }
+  return n;
+}
+
+// gather the 3 bit codes of 8 bytes into 24 bits
+uint64_t PackCodesScalar(uint64_t x) {
+  x = (x | (x >> 5)) & 0x003f003f003f003full;
+  x = (x | (x >> 10)) & 0x00000fff00000fffull;
+  return (x | (x >> 20)) & 0xffffffull;
+}
+
+uint64_t PackWordScalar(const uint8_t* codes) {
+  uint64_t lo, mid, hi = 0;
+  memcpy(&lo, codes, 8);
+  memcpy(&mid, codes + 8, 8);
+  memcpy(&hi, codes + 16, 5);
+  return PackCodesScalar(lo) | PackCodesScalar(mid) << 24 |
+         PackCodesScalar(hi) << 48;
+}
+
+// writes the bases of word before its END code, returns how many. Writes
+// exactly that many characters
+size_t UnpackWordScalar(uint64_t word, size_t count, char* out) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = kCodeChars[(word >> (i * kBaseWidth)) & 0x7];
+  }
+  return count;
+}
+
+#if defined(__x86_64__)
+
+bool UseAvx2() {
+  static const bool use =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+  return use;
+}
+
+// the low nibbles of A, C, T, G, N (1, 3, 4, 7, 14) are distinct in both
+// cases, so a nibble lookup gives the code, and a second lookup gives the
+// upper case character that nibble must come from
+__attribute__((target("avx2,bmi2"))) size_t ToCodesAvx2(const char* bases,
+                                                         size_t n,
+                                                         uint8_t* codes) {
+  const __m256i code_lut = _mm256_setr_epi8(
+      -1, 0, -1, 1, 2, -1, -1, 3, -1, -1, -1, -1, -1, -1, 4, -1,  //
+      -1, 0, -1, 1, 2, -1, -1, 3, -1, -1, -1, -1, -1, -1, 4, -1);
+  const __m256i char_lut = _mm256_setr_epi8(
+      -1, 'A', -1, 'C', 'T', -1, -1, 'G', -1, -1, -1, -1, -1, -1, 'N', -1,
+      -1, 'A', -1, 'C', 'T', -1, -1, 'G', -1, -1, -1, -1, -1, -1, 'N', -1);
+  const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+  const __m256i upper_mask = _mm256_set1_epi8(static_cast<char>(0xdf));
+
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i c =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bases + i));
+    __m256i nibble = _mm256_and_si256(c, nibble_mask);
+    __m256i valid = _mm256_cmpeq_epi8(_mm256_and_si256(c, upper_mask),
+                                      _mm256_shuffle_epi8(char_lut, nibble));
+    if (_mm256_movemask_epi8(valid) != -1) break;
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(codes + i),
+                        _mm256_shuffle_epi8(code_lut, nibble));
+  }
+  return i + ToCodesScalar(bases + i, n - i, codes + i);
+}
+
+__attribute__((target("avx2,bmi2"))) uint64_t PackWordAvx2(
+    const uint8_t* codes) {
+  uint64_t lo, mid, hi = 0;
+  memcpy(&lo, codes, 8);
+  memcpy(&mid, codes + 8, 8);
+  memcpy(&hi, codes + 16, 5);
+  return _pext_u64(lo, kByteCodes) | _pext_u64(mid, kByteCodes) << 24 |
+         _pext_u64(hi, kByteCodes) << 48;
+}
+
+// spreads the codes of a word into bytes and translates all of them with one
+// shuffle. Writes 32 bytes to out, of which the first count are bases
+__attribute__((target("avx2,bmi2"))) void UnpackWordAvx2(uint64_t word,
+                                                          char* out) {
+  const __m256i char_lut = _mm256_setr_epi8(
+      'A', 'C', 'T', 'G', 'N', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  //
+      'A', 'C', 'T', 'G', 'N', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  __m256i codes = _mm256_setr_epi64x(
+      _pdep_u64(word, kByteCodes), _pdep_u64(word >> 24, kByteCodes),
+      _pdep_u64(word >> 48, kByteCodes), 0);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out),
+                      _mm256_shuffle_epi8(char_lut, codes));
+}
+
+#endif
+
+size_t ToCodes(const char* bases, size_t n, uint8_t* codes) {
+#if defined(__x86_64__)
+  if (UseAvx2()) return ToCodesAvx2(bases, n, codes);
+#endif
+  return ToCodesScalar(bases, n, codes);
+}
+
+// number of bases before the END code of word, or kBasesPerWord if it has
+// none. Codes 5 and 6 are not bases
+Status WordLength(uint64_t word, size_t* count) {
+  uint64_t end = word & (word >> 1) & (word >> 2) & kCodeLowBits;
+  size_t n = end ? __builtin_ctzll(end) / kBaseWidth : kBasesPerWord;
+  uint64_t bad = (word >> 2) & (word ^ (word >> 1)) & kCodeLowBits;
+  if (n < kBasesPerWord) bad &= (1ull << (n * kBaseWidth)) - 1;
+  if (bad) {
+    return ObjNotFound("Base alphabet for type ",
+                       (word >> __builtin_ctzll(bad)) & 0x7, " not found");
+  }
+  *count = n;
+  return Status::OK();
+}
+
+}  // namespace
+
+Status PackBases(const char* bases, size_t num_bases, Buffer* output,
+                 bool lenient) {
+  const size_t num_words = num_bases / kBasesPerWord + 1;
+  const size_t start = output->size();
+  output->resize(start + num_words * sizeof(uint64_t));
+  char* out = output->mutable_data() + start;
+
+  // room for the 8 byte loads of the last word
+  uint8_t codes[kBlockWords * kBasesPerWord + 8];
+  for (size_t w = 0; w < num_words; w += kBlockWords) {
+    const size_t block_words = std::min(kBlockWords, num_words - w);
+    const size_t first = w * kBasesPerWord;
+    const size_t n =
+        std::min(block_words * kBasesPerWord, num_bases - first);
+
+    size_t done = ToCodes(bases + first, n, codes);
+    while (done < n) {
+      if (!lenient) {
+        output->resize(start);
+        return InvalidArgument(
+            "Unable to convert the following base character: ",
+            std::string(&bases[first + done], 1),
+            " are you sure this column is base pair data?");
+      }
+      codes[done++] = BaseAlphabet::N;
+      done += ToCodes(bases + first + done, n - done, codes + done);
+    }
+    // the END code goes in the last word, followed by zeros
+    memset(codes + n, 0, sizeof(codes) - n);
+    if (first + n == num_bases && n < block_words * kBasesPerWord) {
+      codes[n] = BaseAlphabet::END;
+    }
+
+    for (size_t i = 0; i < block_words; i++) {
+      uint64_t word;
+#if defined(__x86_64__)
+      if (UseAvx2()) {
+        word = PackWordAvx2(codes + i * kBasesPerWord);
+      } else {
+        word = PackWordScalar(codes + i * kBasesPerWord);
+      }
+#else
+      word = PackWordScalar(codes + i * kBasesPerWord);
+#endif
+      memcpy(out + (w + i) * sizeof(uint64_t), &word, sizeof(word));
+    }
+  }
+  return Status::OK();
+}
+
+Status UnpackBases(const char* packed, size_t packed_size, char* output,
+                   size_t* num_bases) {
+  if (packed_size % sizeof(uint64_t) != 0) {
+    return InvalidArgument("Size of record ", packed_size,
+                           " is not a multiple of ", sizeof(uint64_t));
+  }
+  const size_t num_words = packed_size / sizeof(uint64_t);
+  size_t length = 0;
+  for (size_t w = 0; w < num_words; w++) {
+    uint64_t word;
+    memcpy(&word, packed + w * sizeof(uint64_t), sizeof(word));
+    size_t count = 0;
+    ERR_RETURN_IF_ERROR(WordLength(word, &count));
+#if defined(__x86_64__)
+    if (UseAvx2()) {
+      // a 32 byte store only fits in output before the last word
+      if (w + 2 <= num_words) {
+        UnpackWordAvx2(word, output + length);
+      } else {
+        char scratch[32];
+        UnpackWordAvx2(word, scratch);
+        memcpy(output + length, scratch, count);
+      }
+    } else {
+      UnpackWordScalar(word, count, output + length);
+    }
+#else
+    UnpackWordScalar(word, count, output + length);
+#endif
+    length += count;
+    if (count < kBasesPerWord) break;
+  }
+  *num_bases = length;
+  return Status::OK();
+}
+
+Status CompactBaseColumn(const Buffer& index, const Buffer& data,
+                         BufferPair* output, bool lenient) {
+  const size_t num_records = index.size() / sizeof(RelativeIndex);
+  auto records = reinterpret_cast<const RelativeIndex*>(index.data());
+  auto& out_index = output->index();
+  auto& out_data = output->data();
+  out_index.resize(num_records * sizeof(RelativeIndex));
+  out_data.reset();
+  out_data.reserve(data.size() / kBasesPerWord * sizeof(uint64_t) +
+                   num_records * sizeof(uint64_t));
+
+  auto out_records = reinterpret_cast<RelativeIndex*>(out_index.mutable_data());
+  const char* bases = data.data();
+  for (size_t i = 0; i < num_records; i++) {
+    size_t before = out_data.size();
+    ERR_RETURN_IF_ERROR(PackBases(bases, records[i], &out_data, lenient));
+    out_records[i] = static_cast<RelativeIndex>(out_data.size() - before);
+    bases += records[i];
+  }
+  return Status::OK();
+}
+
+Status ExpandBaseColumn(const RelativeIndex* records, size_t num_records,
+                        const char* packed, Buffer* index, Buffer* data) {
+  size_t packed_size = 0;
+  for (size_t i = 0; i < num_records; i++) {
+    packed_size += records[i];
+  }
+  index->resize(num_records * sizeof(RelativeIndex));
+  data->resize(MaxUnpackedBases(packed_size));
+
+  auto out_records = reinterpret_cast<RelativeIndex*>(index->mutable_data());
+  char* out = data->mutable_data();
+  size_t length = 0;
+  for (size_t i = 0; i < num_records; i++) {
+    size_t n;
+    ERR_RETURN_IF_ERROR(UnpackBases(packed, records[i], out + length, &n));
+    out_records[i] = static_cast<RelativeIndex>(n);
+    length += n;
+    packed += records[i];
+  }
+  data->resize(length);
+  return Status::OK();
+}
+
+}  // namespace agd
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+
+#include "buffer.h"
+#include "buffer_pair.h"
+#include "format.h"
+#include "liberr/errors.h"
+
+namespace agd {
+
+// Packing and unpacking of COMPACTED_BASES records. A record is a run of
+// uint64 words (format::BinaryBases), each holding 21 bases of 3 bits, first
+// base in the lowest bits, terminated by a BaseAlphabet::END code, so a record
+// of n bases takes (n / 21 + 1) words, about 2.6x smaller than text.
+// On x86 CPUs with AVX2 and BMI2 the kernels classify 32 characters per
+// instruction and pack/unpack a word with pext/pdep, selected at runtime so
+// the library still runs on older CPUs.
+
+// size in bytes of a packed record of num_bases
+inline std::size_t PackedBasesSize(std::size_t num_bases) {
+  return (num_bases / format::BinaryBases::compression + 1) *
+         sizeof(format::BinaryBases);
+}
+
+// upper bound on the bases in a packed record of packed_size bytes
+inline std::size_t MaxUnpackedBases(std::size_t packed_size) {
+  return packed_size / sizeof(format::BinaryBases) *
+         format::BinaryBases::compression;
+}
+
+// append one packed record for bases to output. Characters other than ACGTN
+// (either case) are an error, or stored as N if lenient
+Status PackBases(const char* bases, std::size_t num_bases, Buffer* output,
+                 bool lenient = false);
+
+// unpack one record into output, which must have room for
+// MaxUnpackedBases(packed_size) characters
+Status UnpackBases(const char* packed, std::size_t packed_size, char* output,
+                   std::size_t* num_bases);
+
+// convert a TEXT base column to COMPACTED_BASES, overwriting output
+Status CompactBaseColumn(const Buffer& index, const Buffer& data,
+                         BufferPair* output, bool lenient = false);
+
+// convert the records of a COMPACTED_BASES column to TEXT, overwriting
+// index and data
+Status ExpandBaseColumn(const format::RelativeIndex* records,
+                        std::size_t num_records, const char* packed,
+                        Buffer* index, Buffer* data);
+
+}  // namespace agd
@@ -1,4 +1,15 @@
 #include "compression.h"
+
+#include <libdeflate.h>
+#include <zstd.h>
+
+#include <algorithm>
+
+#include "absl/strings/numbers.h"
+#include "crc32c.h"
+#include "index_encoding.h"
+#include "meta_codec.h"
+#include "quality_codec.h"
 #include "util.h"
 
 namespace agd {
@@ -36,8 +47,22 @@ Status resize_output(z_stream &strm, vector<char> &output, size_t extend_len) {
 
 }  // namespace
 
+size_t gzipUncompressedSize(const char *segment, const size_t segment_size) {
+  // 10 byte header, 8 byte trailer of CRC32 and ISIZE, both little endian
+  if (segment_size < 18 || static_cast<unsigned char>(segment[0]) != 0x1f ||
+      static_cast<unsigned char>(segment[1]) != 0x8b) {
+    return 0;
+  }
+  auto trailer = reinterpret_cast<const unsigned char *>(segment) +
+                 segment_size - 4;
+  return static_cast<size_t>(trailer[0]) |
+         static_cast<size_t>(trailer[1]) << 8 |
+         static_cast<size_t>(trailer[2]) << 16 |
+         static_cast<size_t>(trailer[3]) << 24;
+}
+
 Status decompressGZIP(const char *segment, const std::size_t segment_size,
-                      Buffer *output) {
+                      Buffer *output, std::size_t size_hint) {
   // TODO this only supports decompress write, not appending
   // this is an easy change to make, but requires some more "math"
   output->reset();  // just to be sure, in case the caller didn't do it
@@ -56,7 +81,13 @@ Status decompressGZIP(const char *segment, const std::size_t segment_size,
 
   auto s = Status::OK();
 
-  auto init_size = segment_size * 3;
+  // ISIZE is exact for the single member streams we write, so the one shot
+  // inflate below normally succeeds without growing the buffer
+  auto init_size = gzipUncompressedSize(segment, segment_size);
+  // deflate can't do better than ~1032:1, anything more is a bad trailer
+  if (init_size == 0 || init_size / 1032 > segment_size) {
+    init_size = size_hint > 0 ? size_hint : segment_size * reserve_factor;
+  }
   output->resize(init_size);
   // First, try to decompress as much as possible in a single step
   strm.avail_out = output->size();
@@ -67,8 +98,9 @@ Status decompressGZIP(const char *segment, const std::size_t segment_size,
 
   if (status != Z_STREAM_END) {
     if (status == Z_OK || status == Z_BUF_ERROR) {
-      // Do normal decompression because we couldn't do it in one shot
-      output->extend_size(extend_length);
+      // Do normal decompression because we couldn't do it in one shot.
+      // Grow geometrically, each extension may copy the whole buffer
+      output->extend_size(std::max(extend_length, output->size()));
       strm.next_out =
           reinterpret_cast<unsigned char *>(&(*output)[strm.total_out]);
       strm.avail_out = output->size() - strm.total_out;
@@ -77,10 +109,12 @@ Status decompressGZIP(const char *segment, const std::size_t segment_size,
         switch (status) {
           case Z_BUF_ERROR:
           case Z_OK:
-            output->extend_size(extend_length);
-            strm.next_out =
-                reinterpret_cast<unsigned char *>(&(*output)[strm.total_out]);
-            strm.avail_out = output->size() - strm.total_out;
+            if (strm.avail_out == 0) {
+              output->extend_size(std::max(extend_length, output->size()));
+              strm.next_out = reinterpret_cast<unsigned char *>(
+                  &(*output)[strm.total_out]);
+              strm.avail_out = output->size() - strm.total_out;
+            }
           case Z_STREAM_END:
             break;
           default:  // an error
@@ -247,14 +281,14 @@ Status AppendingGZIPCompressor::init() {
   stream_.opaque = Z_NULL;
   done_ = false;
 
-  int status = deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+  int status = deflateInit2(&stream_, level_, Z_DEFLATED,
                             window_bits | ENABLE_ZLIB_GZIP_COMPRESS,
                             9,  // higher memory, better speed
                             Z_DEFAULT_STRATEGY);
   // int status = deflateInit(&stream_, Z_DEFAULT_COMPRESSION);
   if (status != Z_OK) {
     return Internal("deflateInit() didn't return Z_OK. Return ", status,
-                    " with 2nd param ", Z_DEFAULT_COMPRESSION);
+                    " with 2nd param ", level_);
   }
   return Status::OK();
 }
@@ -313,14 +347,15 @@ Status AppendingGZIPCompressor::finish() {
       return Internal("deflateEnd() didn't receive Z_OK. Got: ", status);
     }
     output_.resize(stream_.total_out);
+    done_ = true;
   }
   return Status::OK();
 }
 
 AppendingGZIPCompressor::~AppendingGZIPCompressor() { finish(); }
 
-AppendingGZIPCompressor::AppendingGZIPCompressor(Buffer &output)
-    : output_(output) {}
+AppendingGZIPCompressor::AppendingGZIPCompressor(Buffer &output, int level)
+    : output_(output), level_(level) {}
 
 void AppendingGZIPCompressor::ensure_extend_capacity(size_t capacity) {
   size_t avail_capacity = output_.capacity() - output_.size();
@@ -333,4 +368,585 @@ void AppendingGZIPCompressor::ensure_extend_capacity(size_t capacity) {
   stream_.next_out = const_cast<unsigned char *>(
       reinterpret_cast<const unsigned char *>(&output_[sz]));
 }
+
+namespace {
+
+class GzipChunkCompressor : public ChunkCompressor {
+ public:
+  explicit GzipChunkCompressor(int level) : level_(level) {}
+
+  format::CompressionType type() const override {
+    return format::CompressionType::GZIP;
+  }
+
+  Status CompressChunk(const Buffer &index, const Buffer &data,
+                       Buffer *output) override {
+    const Buffer &idx = PrepareIndex(index);
+    output->reserve(idx.size() + data.size());
+    output->reset();
+    AppendingGZIPCompressor compressor(*output, level_);
+    ERR_RETURN_IF_ERROR(compressor.init());
+    ERR_RETURN_IF_ERROR(compressor.appendGZIP(idx.data(), idx.size()));
+    ERR_RETURN_IF_ERROR(compressor.appendGZIP(data.data(), data.size()));
+    return compressor.finish();
+  }
+
+ private:
+  int level_;
+};
+
+class LibdeflateChunkCompressor : public ChunkCompressor {
+ public:
+  explicit LibdeflateChunkCompressor(libdeflate_compressor *compressor)
+      : compressor_(compressor) {}
+  ~LibdeflateChunkCompressor() override {
+    libdeflate_free_compressor(compressor_);
+  }
+
+  format::CompressionType type() const override {
+    return format::CompressionType::GZIP;
+  }
+
+  Status CompressChunk(const Buffer &index, const Buffer &data,
+                       Buffer *output) override {
+    // libdeflate only compresses whole buffers
+    const Buffer &idx = PrepareIndex(index);
+    ERR_RETURN_IF_ERROR(scratch_.WriteBuffer(idx.data(), idx.size()));
+    ERR_RETURN_IF_ERROR(scratch_.AppendBuffer(data.data(), data.size()));
+    auto bound = libdeflate_gzip_compress_bound(compressor_, scratch_.size());
+    output->reset();
+    output->resize(bound);
+    auto size = libdeflate_gzip_compress(compressor_, scratch_.data(),
+                                         scratch_.size(),
+                                         output->mutable_data(), bound);
+    if (size == 0) {
+      return Internal("libdeflate could not compress ", scratch_.size(),
+                      " bytes into ", bound);
+    }
+    output->resize(size);
+    return Status::OK();
+  }
+
+ private:
+  libdeflate_compressor *compressor_;
+  Buffer scratch_;
+};
+
+class ZstdChunkCompressor : public ChunkCompressor {
+ public:
+  explicit ZstdChunkCompressor(int level) : ctx_(ZSTD_createCCtx()) {
+    ZSTD_CCtx_setParameter(ctx_, ZSTD_c_compressionLevel, level);
+  }
+  ~ZstdChunkCompressor() override { ZSTD_freeCCtx(ctx_); }
+
+  format::CompressionType type() const override {
+    return format::CompressionType::ZSTD;
+  }
+
+  Status CompressChunk(const Buffer &index, const Buffer &data,
+                       Buffer *output) override {
+    const Buffer &idx = PrepareIndex(index);
+    auto total = idx.size() + data.size();
+    ZSTD_CCtx_reset(ctx_, ZSTD_reset_session_only);
+    // records the size in the frame header so readers can size their output
+    ZSTD_CCtx_setPledgedSrcSize(ctx_, total);
+    output->reset();
+    output->resize(ZSTD_compressBound(total));
+
+    ZSTD_outBuffer out = {output->mutable_data(), output->size(), 0};
+    ZSTD_inBuffer in = {idx.data(), idx.size(), 0};
+    while (in.pos < in.size) {
+      auto ret = ZSTD_compressStream2(ctx_, &out, &in, ZSTD_e_continue);
+      if (ZSTD_isError(ret)) {
+        return Internal("zstd compression failed: ", ZSTD_getErrorName(ret));
+      }
+    }
+    in = {data.data(), data.size(), 0};
+    size_t remaining;
+    do {
+      remaining = ZSTD_compressStream2(ctx_, &out, &in, ZSTD_e_end);
+      if (ZSTD_isError(remaining)) {
+        return Internal("zstd compression failed: ",
+                        ZSTD_getErrorName(remaining));
+      }
+    } while (remaining != 0);
+
+    output->resize(out.pos);
+    return Status::OK();
+  }
+
+ private:
+  ZSTD_CCtx *ctx_;
+};
+
+class QualityChunkCompressor : public ChunkCompressor {
+ public:
+  explicit QualityChunkCompressor(bool binned)
+      : binned_(binned), encoder_(binned) {}
+
+  format::CompressionType type() const override {
+    return format::CompressionType::QUALITY;
+  }
+
+  Status CompressChunk(const Buffer &index, const Buffer &data,
+                       Buffer *output) override {
+    return encoder_.Encode(index, data, output);
+  }
+
+  // binned chunks decode to the binned scores
+  uint32_t DataCrc(const Buffer &index, const Buffer &data) override {
+    if (!binned_) return ChunkCompressor::DataCrc(index, data);
+    uint32_t crc = Crc32c(index.data(), index.size());
+    char binned[4096];
+    for (size_t i = 0; i < data.size(); i += sizeof(binned)) {
+      const size_t n = std::min(sizeof(binned), data.size() - i);
+      for (size_t j = 0; j < n; j++) {
+        binned[j] = BinQuality(data.data()[i + j]);
+      }
+      crc = Crc32c(binned, n, crc);
+    }
+    return crc;
+  }
+
+ private:
+  bool binned_;
+  QualityEncoder encoder_;
+};
+
+class MetaChunkCompressor : public ChunkCompressor {
+ public:
+  explicit MetaChunkCompressor(int level) : encoder_(level) {}
+
+  format::CompressionType type() const override {
+    return format::CompressionType::META;
+  }
+
+  Status CompressChunk(const Buffer &index, const Buffer &data,
+                       Buffer *output) override {
+    return encoder_.Encode(index, data, output);
+  }
+
+ private:
+  MetaEncoder encoder_;
+};
+
+class NullChunkCompressor : public ChunkCompressor {
+ public:
+  format::CompressionType type() const override {
+    return format::CompressionType::UNCOMPRESSED;
+  }
+
+  Status CompressChunk(const Buffer &index, const Buffer &data,
+                       Buffer *output) override {
+    const Buffer &idx = PrepareIndex(index);
+    ERR_RETURN_IF_ERROR(output->WriteBuffer(idx.data(), idx.size()));
+    return output->AppendBuffer(data.data(), data.size());
+  }
+};
+
+}  // namespace
+
+Status ChunkCompressor::Compress(const Buffer &index, const Buffer &data,
+                                 Buffer *output) {
+  data_crc_ = DataCrc(index, data);
+  ERR_RETURN_IF_ERROR(CompressChunk(index, data, output));
+  payload_crc_ = Crc32c(output->data(), output->size());
+  return Status::OK();
+}
+
+uint32_t ChunkCompressor::DataCrc(const Buffer &index, const Buffer &data) {
+  return Crc32c(data.data(), data.size(), Crc32c(index.data(), index.size()));
+}
+
+void ChunkCompressor::FillHeader(format::FileHeader *header) const {
+  header->compression_type = type();
+  header->index_encoding = index_encoding_;
+  header->payload_crc32c = payload_crc_;
+  header->data_crc32c = data_crc_;
+}
+
+const Buffer &ChunkCompressor::PrepareIndex(const Buffer &index) {
+  index_encoding_ = compact_index_ ? EncodeIndex(index, &encoded_index_)
+                                   : format::RELATIVE_INDEX;
+  return index_encoding_ == format::RELATIVE_INDEX ? index : encoded_index_;
+}
+
+Status ChunkCompressor::Create(absl::string_view spec,
+                               std::unique_ptr<ChunkCompressor> &compressor) {
+  auto colon = spec.find(':');
+  auto codec = spec.substr(0, colon);
+  bool has_level = colon != absl::string_view::npos;
+  if (codec == "quality") {
+    auto option = has_level ? spec.substr(colon + 1) : absl::string_view();
+    if (has_level && option != "bin") {
+      return InvalidArgument("quality codec option must be 'bin', got '",
+                             option, "'");
+    }
+    compressor.reset(new QualityChunkCompressor(has_level));
+    return Status::OK();
+  }
+
+  int level = 0;
+  if (has_level && !absl::SimpleAtoi(spec.substr(colon + 1), &level)) {
+    return InvalidArgument("Bad compression level in codec spec '", spec,
+                           "'");
+  }
+
+  if (codec == "gzip") {
+    if (has_level && (level < 1 || level > 9)) {
+      return InvalidArgument("gzip level must be 1-9, got ", level);
+    }
+    compressor.reset(
+        new GzipChunkCompressor(has_level ? level : Z_DEFAULT_COMPRESSION));
+  } else if (codec == "libdeflate") {
+    if (has_level && (level < 1 || level > 12)) {
+      return InvalidArgument("libdeflate level must be 1-12, got ", level);
+    }
+    auto c = libdeflate_alloc_compressor(has_level ? level : 6);
+    if (c == nullptr) {
+      return Internal("Could not allocate libdeflate compressor");
+    }
+    compressor.reset(new LibdeflateChunkCompressor(c));
+  } else if (codec == "zstd") {
+    if (has_level && (level < 1 || level > ZSTD_maxCLevel())) {
+      return InvalidArgument("zstd level must be 1-", ZSTD_maxCLevel(),
+                             ", got ", level);
+    }
+    compressor.reset(new ZstdChunkCompressor(has_level ? level : 3));
+  } else if (codec == "meta") {
+    if (has_level && (level < 1 || level > ZSTD_maxCLevel())) {
+      return InvalidArgument("meta level must be 1-", ZSTD_maxCLevel(),
+                             ", got ", level);
+    }
+    compressor.reset(new MetaChunkCompressor(has_level ? level : 3));
+  } else if (codec == "none") {
+    compressor.reset(new NullChunkCompressor());
+  } else {
+    return InvalidArgument(
+        "Unknown codec '", codec,
+        "', expected gzip, libdeflate, zstd, quality, meta or none");
+  }
+  return Status::OK();
+}
+
+namespace {
+
+size_t SegmentsSize(const iovec *segments, size_t num_segments) {
+  size_t size = 0;
+  for (size_t i = 0; i < num_segments; i++) {
+    size += segments[i].iov_len;
+  }
+  return size;
+}
+
+// copy size bytes starting at offset of the segments to dst
+void CopySegments(const iovec *segments, size_t num_segments, size_t offset,
+                  size_t size, char *dst) {
+  for (size_t i = 0; i < num_segments && size > 0; i++) {
+    const size_t len = segments[i].iov_len;
+    if (offset >= len) {
+      offset -= len;
+      continue;
+    }
+    const size_t n = std::min(len - offset, size);
+    memcpy(dst, static_cast<const char *>(segments[i].iov_base) + offset, n);
+    dst += n;
+    size -= n;
+    offset = 0;
+  }
+}
+
+// zlib inflate, fed one segment at a time
+Status decompressGZIPSegments(const iovec *segments, size_t num_segments,
+                              Buffer *output, size_t init_size) {
+  z_stream strm = {0};
+  int status = inflateInit2(&strm, window_bits | ENABLE_ZLIB_GZIP);
+  if (status != Z_OK) {
+    return Internal("inflateInit2 failed with error: ", status);
+  }
+
+  output->resize(std::max<size_t>(init_size, 1));
+  strm.next_out = reinterpret_cast<unsigned char *>(output->mutable_data());
+  strm.avail_out = output->size();
+  size_t next_segment = 0;
+  auto s = Status::OK();
+  while (s.ok()) {
+    if (strm.avail_in == 0 && next_segment < num_segments) {
+      strm.next_in = static_cast<unsigned char *>(
+          segments[next_segment].iov_base);
+      strm.avail_in = segments[next_segment].iov_len;
+      next_segment++;
+    }
+    if (strm.avail_out == 0) {
+      output->extend_size(std::max(extend_length, output->size()));
+      strm.next_out =
+          reinterpret_cast<unsigned char *>(&(*output)[strm.total_out]);
+      strm.avail_out = output->size() - strm.total_out;
+    }
+    status = inflate(&strm, Z_NO_FLUSH);
+    if (status == Z_STREAM_END) break;
+    if (status == Z_BUF_ERROR && strm.avail_in == 0 &&
+        next_segment == num_segments) {
+      s = OutOfRange("Truncated gzip payload");
+    } else if (status != Z_OK && status != Z_BUF_ERROR) {
+      s = Internal("inflate(Z_NO_FLUSH) returned code ", status,
+                   " with message '", strm.msg == NULL ? "" : strm.msg, "'");
+    }
+  }
+
+  auto total_out = strm.total_out;
+  inflateEnd(&strm);
+  if (s.ok()) output->resize(total_out);
+  return s;
+}
+
+}  // namespace
+
+struct ChunkDecompressor::Contexts {
+  ~Contexts() {
+    if (deflate) libdeflate_free_decompressor(deflate);
+    if (zstd) ZSTD_freeDCtx(zstd);
+  }
+  // created on first use
+  libdeflate_decompressor *deflate = nullptr;
+  ZSTD_DCtx *zstd = nullptr;
+  std::unique_ptr<QualityDecoder> quality;
+  std::unique_ptr<MetaDecoder> meta;
+  // payloads of segments for codecs that need them contiguous
+  Buffer gathered{0, 1024 * 1024};
+};
+
+ChunkDecompressor::ChunkDecompressor() : contexts_(new Contexts()) {}
+
+ChunkDecompressor::~ChunkDecompressor() = default;
+
+ChunkDecompressor::ChunkDecompressor(ChunkDecompressor &&) = default;
+
+ChunkDecompressor &ChunkDecompressor::operator=(ChunkDecompressor &&) = default;
+
+Status ChunkDecompressor::Decompress(format::CompressionType type,
+                                     const char *segment, size_t segment_size,
+                                     Buffer *output, size_t size_hint) {
+  output->reset();
+  switch (type) {
+    case format::CompressionType::UNCOMPRESSED:
+      return output->WriteBuffer(segment, segment_size);
+
+    case format::CompressionType::GZIP: {
+      // libdeflate needs the exact output size, which our single member
+      // streams record in their trailer
+      auto size = gzipUncompressedSize(segment, segment_size);
+      if (size > 0 && size / 1032 <= segment_size) {
+        if (!contexts_->deflate) {
+          contexts_->deflate = libdeflate_alloc_decompressor();
+        }
+        output->resize(size);
+        size_t out_size = 0;
+        auto ret = libdeflate_gzip_decompress(contexts_->deflate, segment,
+                                              segment_size,
+                                              output->mutable_data(), size,
+                                              &out_size);
+        if (ret == LIBDEFLATE_SUCCESS && out_size == size) {
+          return Status::OK();
+        }
+      }
+      // no usable size, let zlib grow the output as it goes
+      return decompressGZIP(segment, segment_size, output, size_hint);
+    }
+
+    case format::CompressionType::ZSTD: {
+      if (!contexts_->zstd) {
+        contexts_->zstd = ZSTD_createDCtx();
+      }
+      auto size = ZSTD_getFrameContentSize(segment, segment_size);
+      if (size == ZSTD_CONTENTSIZE_ERROR) {
+        return InvalidArgument("Chunk payload is not a zstd frame");
+      }
+      if (size != ZSTD_CONTENTSIZE_UNKNOWN) {
+        output->resize(size);
+        auto ret = ZSTD_decompressDCtx(contexts_->zstd, output->mutable_data(),
+                                       size, segment, segment_size);
+        if (ZSTD_isError(ret)) {
+          return Internal("zstd decompression failed: ",
+                          ZSTD_getErrorName(ret));
+        }
+        output->resize(ret);
+        return Status::OK();
+      }
+
+      // size not in the frame header, stream and grow
+      ZSTD_DCtx_reset(contexts_->zstd, ZSTD_reset_session_only);
+      output->resize(size_hint > 0 ? size_hint : segment_size * reserve_factor);
+      ZSTD_inBuffer in = {segment, segment_size, 0};
+      ZSTD_outBuffer out = {output->mutable_data(), output->size(), 0};
+      while (true) {
+        auto ret = ZSTD_decompressStream(contexts_->zstd, &out, &in);
+        if (ZSTD_isError(ret)) {
+          return Internal("zstd decompression failed: ",
+                          ZSTD_getErrorName(ret));
+        }
+        if (ret == 0) break;  // end of frame
+        if (out.pos == out.size) {
+          output->resize(output->size() * 2);
+          out.dst = output->mutable_data();
+          out.size = output->size();
+        } else if (in.pos == in.size) {
+          return OutOfRange("Truncated zstd frame");
+        }
+      }
+      output->resize(out.pos);
+      return Status::OK();
+    }
+
+    case format::CompressionType::QUALITY:
+      if (!contexts_->quality) {
+        contexts_->quality.reset(new QualityDecoder());
+      }
+      return contexts_->quality->Decode(segment, segment_size, output);
+
+    case format::CompressionType::META:
+      if (!contexts_->meta) {
+        contexts_->meta.reset(new MetaDecoder());
+      }
+      return contexts_->meta->Decode(segment, segment_size, output);
+
+    default:
+      return InvalidArgument("Compressed type '", type,
+                             "' doesn't match to any valid or supported "
+                             "compression enum type");
+  }
+}
+
+Status ChunkDecompressor::Decompress(format::CompressionType type,
+                                     const iovec *segments,
+                                     size_t num_segments, Buffer *output,
+                                     size_t size_hint) {
+  if (num_segments == 1) {
+    return Decompress(type, static_cast<const char *>(segments[0].iov_base),
+                      segments[0].iov_len, output, size_hint);
+  }
+  const size_t payload_size = SegmentsSize(segments, num_segments);
+  output->reset();
+  switch (type) {
+    case format::CompressionType::UNCOMPRESSED:
+      output->resize(payload_size);
+      CopySegments(segments, num_segments, 0, payload_size,
+                   output->mutable_data());
+      return Status::OK();
+
+    case format::CompressionType::GZIP: {
+      // the magic and ISIZE, at the places gzipUncompressedSize reads them
+      char ends[18];
+      size_t size = 0;
+      if (payload_size >= sizeof(ends)) {
+        CopySegments(segments, num_segments, 0, 2, ends);
+        CopySegments(segments, num_segments, payload_size - 4, 4,
+                     ends + sizeof(ends) - 4);
+        size = gzipUncompressedSize(ends, sizeof(ends));
+      }
+      if (size == 0 || size / 1032 > payload_size) {
+        size = size_hint > 0 ? size_hint : payload_size * reserve_factor;
+      }
+      return decompressGZIPSegments(segments, num_segments, output, size);
+    }
+
+    case format::CompressionType::ZSTD: {
+      if (!contexts_->zstd) {
+        contexts_->zstd = ZSTD_createDCtx();
+      }
+      // a frame header is at most 18 bytes
+      char frame_header[18];
+      const size_t header_size =
+          std::min(payload_size, sizeof(frame_header));
+      CopySegments(segments, num_segments, 0, header_size, frame_header);
+      auto size = ZSTD_getFrameContentSize(frame_header, header_size);
+      if (size == ZSTD_CONTENTSIZE_ERROR) {
+        return InvalidArgument("Chunk payload is not a zstd frame");
+      }
+      if (size == ZSTD_CONTENTSIZE_UNKNOWN) {
+        size = size_hint > 0 ? size_hint : payload_size * reserve_factor;
+      }
+
+      ZSTD_DCtx_reset(contexts_->zstd, ZSTD_reset_session_only);
+      output->resize(std::max<size_t>(size, 1));
+      ZSTD_outBuffer out = {output->mutable_data(), output->size(), 0};
+      size_t next_segment = 0;
+      ZSTD_inBuffer in = {nullptr, 0, 0};
+      while (true) {
+        if (in.pos == in.size && next_segment < num_segments) {
+          in = {segments[next_segment].iov_base,
+                segments[next_segment].iov_len, 0};
+          next_segment++;
+        }
+        auto ret = ZSTD_decompressStream(contexts_->zstd, &out, &in);
+        if (ZSTD_isError(ret)) {
+          return Internal("zstd decompression failed: ",
+                          ZSTD_getErrorName(ret));
+        }
+        if (ret == 0) break;  // end of frame
+        if (out.pos == out.size) {
+          output->resize(output->size() * 2);
+          out.dst = output->mutable_data();
+          out.size = output->size();
+        } else if (in.pos == in.size && next_segment == num_segments) {
+          return OutOfRange("Truncated zstd frame");
+        }
+      }
+      output->resize(out.pos);
+      return Status::OK();
+    }
+
+    default: {
+      auto &gathered = contexts_->gathered;
+      gathered.resize(payload_size);
+      CopySegments(segments, num_segments, 0, payload_size,
+                   gathered.mutable_data());
+      return Decompress(type, gathered.data(), gathered.size(), output,
+                        size_hint);
+    }
+  }
+}
+
+Status ColumnCodecs::Parse(absl::string_view arg, ColumnCodecs &codecs) {
+  ColumnCodecs parsed;
+  parsed.compact_bases_ = codecs.compact_bases_;
+  parsed.compact_index_ = codecs.compact_index_;
+  std::unique_ptr<ChunkCompressor> check;
+  size_t start = 0;
+  while (start <= arg.size()) {
+    auto end = arg.find(',', start);
+    if (end == absl::string_view::npos) end = arg.size();
+    auto part = arg.substr(start, end - start);
+    start = end + 1;
+    if (part.empty()) continue;
+
+    auto eq = part.find('=');
+    auto spec = eq == absl::string_view::npos ? part : part.substr(eq + 1);
+    ERR_RETURN_IF_ERROR(ChunkCompressor::Create(spec, check));
+    if (eq == absl::string_view::npos) {
+      parsed.default_spec_ = std::string(spec);
+    } else {
+      parsed.specs_[std::string(part.substr(0, eq))] = std::string(spec);
+    }
+  }
+  codecs = std::move(parsed);
+  return Status::OK();
+}
+
+const std::string &ColumnCodecs::Spec(absl::string_view column) const {
+  auto it = specs_.find(column);
+  return it == specs_.end() ? default_spec_ : it->second;
+}
+
+Status ColumnCodecs::MakeCompressors(
+    const std::vector<std::string> &columns,
+    std::vector<std::unique_ptr<ChunkCompressor>> &compressors) const {
+  compressors.resize(columns.size());
+  for (size_t i = 0; i < columns.size(); i++) {
+    ERR_RETURN_IF_ERROR(ChunkCompressor::Create(Spec(columns[i]), compressors[i]));
+    compressors[i]->set_compact_index(compact_index_);
+  }
+  return Status::OK();
+}
+
 }  // namespace agd
@@ -1,9 +1,15 @@
 #pragma once
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
 #include "buffer.h"
+#include "format.h"
 #include "liberr/errors.h"
 
+#include <sys/uio.h>
 #include <zlib.h>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace agd {
@@ -13,15 +19,22 @@ using namespace errors;
 Status decompressGZIP(const char *segment, const std::size_t segment_size,
                       std::vector<char> &output);
 
+// output is sized from the gzip trailer if possible, otherwise from
+// size_hint (if nonzero), and grown as needed
 Status decompressGZIP(const char *segment, const std::size_t segment_size,
-                      Buffer *output);
+                      Buffer *output, std::size_t size_hint = 0);
+
+// the uncompressed size recorded in the trailer of a single member gzip
+// stream (ISIZE, mod 2^32), or 0 if segment is not gzip
+std::size_t gzipUncompressedSize(const char *segment,
+                                 const std::size_t segment_size);
 
 Status compressGZIP(const char *segment, const std::size_t segment_size,
                     std::vector<char> &output);
 
 class AppendingGZIPCompressor {
  public:
-  AppendingGZIPCompressor(Buffer &output);
+  AppendingGZIPCompressor(Buffer &output, int level = Z_DEFAULT_COMPRESSION);
 
   ~AppendingGZIPCompressor();
 
@@ -37,8 +50,122 @@ class AppendingGZIPCompressor {
   z_stream stream_ = {0};
   bool done_ = false;
   Buffer &output_;
+  int level_;
 
   void ensure_extend_capacity(std::size_t capacity);
 };
 
+// Chunk codecs. A codec is named by a spec "<codec>[:<level>]":
+//   gzip        zlib, readable by every AGD reader
+//   libdeflate  same gzip format, faster to compress and decompress
+//   zstd        much faster to decompress, ratio similar to gzip
+//   none        uncompressed
+//   quality     context model coder for quality scores, "quality:bin" bins
+//               scores to 8 levels first (lossy)
+//   meta        tokenizes read names and codes each field against the
+//               previous name, level is the zstd level of the token streams
+// gzip and libdeflate chunks are both CompressionType::GZIP, readers
+// decompress them with libdeflate.
+
+// compresses the index and data of a column chunk into an AGD file payload.
+// Not thread safe, use one per thread.
+class ChunkCompressor {
+ public:
+  static Status Create(absl::string_view spec,
+                       std::unique_ptr<ChunkCompressor> &compressor);
+  virtual ~ChunkCompressor() = default;
+
+  // for the file header
+  virtual format::CompressionType type() const = 0;
+
+  // compress index followed by data, overwriting output, and checksum both
+  Status Compress(const Buffer &index, const Buffer &data, Buffer *output);
+
+  // store the index in the smallest encoding of index_encoding.h. Applies to
+  // the general purpose codecs, quality and meta code lengths themselves
+  void set_compact_index(bool compact) { compact_index_ = compact; }
+
+  // index encoding of the last Compress output, for the header
+  format::IndexEncoding index_encoding() const { return index_encoding_; }
+
+  // set the compression type, index encoding and checksums of the last
+  // Compress output in header
+  void FillHeader(format::FileHeader *header) const;
+
+ protected:
+  virtual Status CompressChunk(const Buffer &index, const Buffer &data,
+                               Buffer *output) = 0;
+
+  // checksum of what the chunk decompresses to, index followed by data.
+  // Lossy codecs checksum their decoded output instead of their input
+  virtual uint32_t DataCrc(const Buffer &index, const Buffer &data);
+
+  // index, or its encoding if compact_index is set, and sets index_encoding
+  const Buffer &PrepareIndex(const Buffer &index);
+
+ private:
+  bool compact_index_ = false;
+  format::IndexEncoding index_encoding_ = format::RELATIVE_INDEX;
+  Buffer encoded_index_{0, 64 * 1024};
+  uint32_t payload_crc_ = 0, data_crc_ = 0;
+};
+
+// decompresses AGD file payloads of any supported compression type, keeps
+// codec state between calls. Not thread safe, use one per thread.
+class ChunkDecompressor {
+ public:
+  ChunkDecompressor();
+  ~ChunkDecompressor();
+  ChunkDecompressor(ChunkDecompressor &&);
+  ChunkDecompressor &operator=(ChunkDecompressor &&);
+
+  // output is sized from the size recorded in the payload if there is one,
+  // otherwise from size_hint (if nonzero), and grown as needed
+  Status Decompress(format::CompressionType type, const char *segment,
+                    std::size_t segment_size, Buffer *output,
+                    std::size_t size_hint = 0);
+
+  // the payload as a list of segments, e.g. the pieces an object was read
+  // in. gzip, zstd and uncompressed payloads stream from the segments, the
+  // other codecs need the payload contiguous and gather it into a scratch
+  // buffer first
+  Status Decompress(format::CompressionType type, const iovec *segments,
+                    std::size_t num_segments, Buffer *output,
+                    std::size_t size_hint = 0);
+
+ private:
+  struct Contexts;
+  std::unique_ptr<Contexts> contexts_;
+};
+
+// a codec spec per column, parsed from "<spec>[,<column>=<spec>...]",
+// e.g. "zstd:3,meta=gzip", and whether writers pack base columns and indexes
+class ColumnCodecs {
+ public:
+  static Status Parse(absl::string_view arg, ColumnCodecs &codecs);
+
+  const std::string &Spec(absl::string_view column) const;
+
+  // store TEXT base columns as COMPACTED_BASES, packed before compression.
+  // Characters other than ACGTN are stored as N
+  void set_compact_bases(bool compact) { compact_bases_ = compact; }
+  bool compact_bases() const { return compact_bases_; }
+
+  // compressors store constant or near constant length indexes compactly,
+  // see ChunkCompressor::set_compact_index
+  void set_compact_index(bool compact) { compact_index_ = compact; }
+  bool compact_index() const { return compact_index_; }
+
+  // one compressor per column, in order
+  Status MakeCompressors(
+      const std::vector<std::string> &columns,
+      std::vector<std::unique_ptr<ChunkCompressor>> &compressors) const;
+
+ private:
+  std::string default_spec_ = "gzip";
+  absl::flat_hash_map<std::string, std::string> specs_;
+  bool compact_bases_ = false;
+  bool compact_index_ = false;
+};
+
 }  // namespace agd
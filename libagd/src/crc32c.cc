@@ -0,0 +1,158 @@
+#include "crc32c.h"
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+namespace agd {
+
+namespace {
+
+// reflected Castagnoli polynomial
+constexpr uint32_t kPolynomial = 0x82f63b78;
+
+std::array<uint32_t, 256> MakeTable() {
+  std::array<uint32_t, 256> table;
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (crc & 1 ? kPolynomial : 0);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+uint32_t Crc32cTable(const uint8_t* p, size_t n, uint32_t crc) {
+  static const std::array<uint32_t, 256> table = MakeTable();
+  for (size_t i = 0; i < n; i++) {
+    crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+
+bool UseHardware() {
+  static const bool use = __builtin_cpu_supports("sse4.2");
+  return use;
+}
+
+// crc32 has a latency of 3 cycles and a throughput of 1, so large buffers are
+// done as 3 interleaved streams of kStride bytes, combined by shifting the
+// crc of the earlier stream over the zeros of the later
+constexpr size_t kStride = 4096;
+
+// (unfinalized) crc of crc followed by kStride zero bytes, which is linear
+// in crc, so a table per byte of crc gives it
+struct ShiftTable {
+  uint32_t table[4][256];
+
+  ShiftTable() {
+    const std::vector<uint8_t> zeros(kStride, 0);
+    uint32_t bits[32];
+    for (int b = 0; b < 32; b++) {
+      bits[b] = Crc32cTable(zeros.data(), zeros.size(), 1u << b);
+    }
+    for (int k = 0; k < 4; k++) {
+      for (uint32_t v = 0; v < 256; v++) {
+        uint32_t crc = 0;
+        for (int b = 0; b < 8; b++) {
+          if (v & (1u << b)) crc ^= bits[k * 8 + b];
+        }
+        table[k][v] = crc;
+      }
+    }
+  }
+
+  uint32_t Shift(uint32_t crc) const {
+    return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+           table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+  }
+};
+
+__attribute__((target("sse4.2"))) uint32_t Crc32cHardware(const uint8_t* p,
+                                                          size_t n,
+                                                          uint32_t crc) {
+  for (; n > 0 && reinterpret_cast<uintptr_t>(p) % 8 != 0; n--) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  if (n >= 3 * kStride) {
+    static const ShiftTable shift;
+    for (; n >= 3 * kStride; n -= 3 * kStride, p += 3 * kStride) {
+      uint64_t c0 = crc, c1 = 0, c2 = 0;
+      for (size_t i = 0; i < kStride; i += 8) {
+        uint64_t w0, w1, w2;
+        memcpy(&w0, p + i, sizeof(w0));
+        memcpy(&w1, p + kStride + i, sizeof(w1));
+        memcpy(&w2, p + 2 * kStride + i, sizeof(w2));
+        c0 = _mm_crc32_u64(c0, w0);
+        c1 = _mm_crc32_u64(c1, w1);
+        c2 = _mm_crc32_u64(c2, w2);
+      }
+      crc = shift.Shift(shift.Shift(static_cast<uint32_t>(c0)) ^
+                        static_cast<uint32_t>(c1)) ^
+            static_cast<uint32_t>(c2);
+    }
+  }
+  uint64_t crc64 = crc;
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+  for (; n > 0; n--) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  return crc;
+}
+
+#elif defined(__aarch64__)
+
+bool UseHardware() {
+  static const bool use = getauxval(AT_HWCAP) & HWCAP_CRC32;
+  return use;
+}
+
+__attribute__((target("+crc"))) uint32_t Crc32cHardware(const uint8_t* p,
+                                                        size_t n,
+                                                        uint32_t crc) {
+  for (; n > 0 && reinterpret_cast<uintptr_t>(p) % 8 != 0; n--) {
+    crc = __crc32cb(crc, *p++);
+  }
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    crc = __crc32cd(crc, word);
+  }
+  for (; n > 0; n--) {
+    crc = __crc32cb(crc, *p++);
+  }
+  return crc;
+}
+
+#endif
+
+}  // namespace
+
+uint32_t Crc32c(const char* data, size_t size, uint32_t crc) {
+  auto p = reinterpret_cast<const uint8_t*>(data);
+  crc = ~crc;
+#if defined(__x86_64__) || defined(__aarch64__)
+  if (UseHardware()) {
+    return ~Crc32cHardware(p, size, crc);
+  }
+#endif
+  return ~Crc32cTable(p, size, crc);
+}
+
+}  // namespace agd
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace agd {
+
+// CRC32C (Castagnoli) of size bytes, continuing from the crc of preceding
+// bytes, so Crc32c(b, n, Crc32c(a, m)) is the crc of a followed by b. Uses
+// the SSE4.2 or ARMv8 CRC instructions when the CPU has them, selected at
+// runtime, and a table otherwise.
+uint32_t Crc32c(const char* data, std::size_t size, uint32_t crc = 0);
+
+}  // namespace agd
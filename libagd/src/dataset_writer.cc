@@ -12,6 +12,7 @@
 #include <iomanip>
 #include <iostream>
 
+#include "compacted_bases.h"
 #include "compression.h"
 #include <filesystem>
 
@@ -37,10 +38,11 @@ void CreateDirIfNotExist(const std::string& output_dir) {
 Status DatasetWriter::CreateDatasetWriter(
     size_t compress_threads, size_t write_threads, const std::string& name,
     const std::string& path, const std::vector<std::string>& columns,
-    std::unique_ptr<DatasetWriter>& writer, ObjectPool<Buffer>* buf_pool) {
+    std::unique_ptr<DatasetWriter>& writer, ObjectPool<Buffer>* buf_pool,
+    const ColumnCodecs& codecs) {
   CreateDirIfNotExist(path);
 
-  writer.reset(new DatasetWriter(path, name, columns));
+  writer.reset(new DatasetWriter(path, name, columns, codecs));
 
   ERR_RETURN_IF_ERROR(writer->Init(compress_threads, write_threads, buf_pool));
 
@@ -50,15 +52,16 @@ Status DatasetWriter::CreateDatasetWriter(
 Status DatasetWriter::Init(size_t compress_threads, size_t write_threads,
                            ObjectPool<Buffer>* buf_pool) {
   // todo put this kind of stuff in the format.h file
-  column_map_["base"] = {
-      agd::format::RecordType::TEXT,
-      agd::format::CompressionType::GZIP};  // todo store as compacted bases
-  column_map_["qual"] = {agd::format::RecordType::TEXT,
-                         agd::format::CompressionType::GZIP};
-  column_map_["meta"] = {agd::format::RecordType::TEXT,
-                         agd::format::CompressionType::GZIP};
-  column_map_["aln"] = {agd::format::RecordType::STRUCTURED,
-                        agd::format::CompressionType::GZIP};
+  column_map_["base"] = {codecs_.compact_bases()
+                             ? agd::format::RecordType::COMPACTED_BASES
+                             : agd::format::RecordType::TEXT};
+  column_map_["qual"] = {agd::format::RecordType::TEXT};
+  column_map_["meta"] = {agd::format::RecordType::TEXT};
+  column_map_["aln"] = {agd::format::RecordType::STRUCTURED};
+  for (const auto& col : columns_) {
+    compact_columns_.push_back(column_map_[col].type ==
+                               agd::format::RecordType::COMPACTED_BASES);
+  }
 
   buf_pool_ = buf_pool;
 
@@ -93,6 +96,7 @@ Status DatasetWriter::WriteChunks(
     item.chunk_size = chunk_size;
     item.first_ordinal = first_ordinal;
     item.column = absl::string_view(columns_[i]);
+    item.column_index = i;
     chunk_queue_->push(std::move(item));
   }
 
@@ -107,57 +111,55 @@ Status DatasetWriter::WriteChunks(
 }
 
 void DatasetWriter::compress_func() {
-  while (!done_) {
-    ChunkQueueItem item;
-    if (!chunk_queue_->pop(item)) continue;
+  std::vector<std::unique_ptr<ChunkCompressor>> compressors;
+  Status s = codecs_.MakeCompressors(columns_, compressors);
+  if (!s.ok()) {
+    std::cout << "Error: couldn't create compressors: " << s.error_message()
+              << "\n";
+    exit(0);
+  }
+  BufferPair compacted;
+
+  ChunkQueueItem item;
+  while (chunk_queue_->pop(item)) {
+    BufferPair* col = item.buf.get();
+    if (compact_columns_[item.column_index]) {
+      s = CompactBaseColumn(col->index(), col->data(), &compacted, true);
+      if (!s.ok()) {
+        std::cout << "Error: couldn't compact bases: " << s.error_message()
+                  << "\n";
+        exit(0);
+      }
+      col = &compacted;
+    }
 
     // compress the buffer into a fresh pool buffer
     auto compress_buf = buf_pool_->get();
-    compress_buf->reserve(item.buf->data().size() + item.buf->index().size());
-
-    compress_buf->reset();
-    AppendingGZIPCompressor compressor(*compress_buf.get());
-    Status s = Status::OK();
-    s = compressor.init();
-    if (!s.ok()) {
-      std::cout << "Error: couldn't init compressor\n";
-      exit(0);
-    }
-    s = compressor.appendGZIP(item.buf->index().data(),
-                              item.buf->index().size());
+    auto& compressor = compressors[item.column_index];
+    s = compressor->Compress(col->index(), col->data(), compress_buf.get());
     if (!s.ok()) {
-      std::cout << "Error: couldn't init compressor\n";
-      exit(0);
-    }
-    s = compressor.appendGZIP(item.buf->data().data(), item.buf->data().size());
-    if (!s.ok()) {
-      std::cout << "Error: couldn't init compressor\n";
-      exit(0);
-    }
-    s = compressor.finish();
-    if (!s.ok()) {
-      std::cout << "Error: couldn't init compressor\n";
+      std::cout << "Error: couldn't compress chunk: " << s.error_message()
+                << "\n";
       exit(0);
     }
     WriteQueueItem write_item;
     write_item.buf = std::move(compress_buf);
     write_item.chunk_size = item.chunk_size;
     write_item.column = item.column;
+    compressor->FillHeader(&write_item.header);
     write_item.first_ordinal = item.first_ordinal;
     write_queue_->push(std::move(write_item));
   }
 }
 
 void DatasetWriter::write_func() {
-  while (!write_done_) {
-    WriteQueueItem item;
-    if (!write_queue_->pop(item)) continue;
+  WriteQueueItem item;
+  while (write_queue_->pop(item)) {
 
-    agd::format::FileHeader header;
+    agd::format::FileHeader header = item.header;
 
     const auto& types = column_map_[item.column];
     header.record_type = types.type;
-    header.compression_type = types.compress_type;
 
     memset(header.string_id, 0, sizeof(agd::format::FileHeader::string_id));
     auto copy_size =
@@ -183,20 +185,14 @@ void DatasetWriter::write_func() {
 
 void DatasetWriter::Stop() {
   std::cout << "stopping dataset writer\n";
-  while (!chunk_queue_->empty()) {
-    std::this_thread::sleep_for(1ms);
-  }
-  chunk_queue_->unblock();
-  done_ = true;
+  stopped_ = true;
+  // threads drain the queues before exiting
+  chunk_queue_->close();
   for (auto& t : compress_threads_) {
     t.join();
   }
-  while (!write_queue_->empty()) {
-    std::this_thread::sleep_for(1ms);
-  }
 
-  write_queue_->unblock();
-  write_done_ = true;
+  write_queue_->close();
   for (auto& t : write_threads_) {
     t.join();
   }
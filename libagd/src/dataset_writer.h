@@ -7,6 +7,7 @@
 #include <unordered_map>
 
 #include "buffer_pair.h"
+#include "compression.h"
 #include "concurrent_queue/concurrent_queue.h"
 #include "format.h"
 #include "json.hpp"
@@ -30,7 +31,7 @@ typedef std::vector<nlohmann::json> RecordVec;
 class DatasetWriter {
  public:
   DatasetWriter() = delete;
-  ~DatasetWriter() { if (!done_) Stop(); }
+  ~DatasetWriter() { if (!stopped_) Stop(); }
 
   static Status CreateDatasetWriter(size_t compress_threads,
                                     size_t write_threads,
@@ -38,7 +39,8 @@ class DatasetWriter {
                                     const std::string& path,
                                     const std::vector<std::string>& columns,
                                     std::unique_ptr<DatasetWriter>& writer,
-                                    ObjectPool<Buffer>* buf_pool);
+                                    ObjectPool<Buffer>* buf_pool,
+                                    const ColumnCodecs& codecs = ColumnCodecs());
 
   // write a chunk for each present column
   // currently not thread safe, but can be made thread safe
@@ -48,6 +50,7 @@ class DatasetWriter {
   // write out the metadata json file (after adding all chunks)
   Status WriteMetadata();
 
+  // write all chunks added so far and stop the threads
   void Stop();
 
   absl::string_view Name() const { return name_; }
@@ -55,29 +58,33 @@ class DatasetWriter {
 
  private:
   DatasetWriter(const std::string& path, const std::string& name,
-                const std::vector<std::string>& columns)
-      : path_(path), name_(name), columns_(columns) {}
+                const std::vector<std::string>& columns,
+                const ColumnCodecs& codecs)
+      : path_(path), name_(name), columns_(columns), codecs_(codecs) {}
 
   Status Init(size_t compress_threads, size_t write_threads, ObjectPool<Buffer>* buf_pool);
 
 
   struct FormatValue {
     format::RecordType type;
-    format::CompressionType compress_type;
   };
 
   // this could really just be an array but whatever
   absl::flat_hash_map<absl::string_view, FormatValue> column_map_;
+  // text columns packed to COMPACTED_BASES before compression, by index
+  std::vector<bool> compact_columns_;
 
   std::string path_;
   std::string name_;
   std::vector<std::string> columns_;
+  ColumnCodecs codecs_;
 
   struct ChunkQueueItem {
     ObjectPool<BufferPair>::ptr_type buf;
     size_t chunk_size;
     uint64_t first_ordinal;
     absl::string_view column;
+    size_t column_index;
   };
   
   struct WriteQueueItem {
@@ -85,6 +92,8 @@ class DatasetWriter {
     size_t chunk_size;
     uint64_t first_ordinal;
     absl::string_view column;
+    // codec fields filled by the compressor
+    format::FileHeader header;
   };
 
   std::vector<std::thread> compress_threads_;
@@ -97,8 +106,7 @@ class DatasetWriter {
 
   void write_func();
   void compress_func();
-  volatile bool done_ = false;
-  volatile bool write_done_ = false;
+  bool stopped_ = false;
 
   ObjectPool<Buffer>* buf_pool_;
   RecordVec records_;
@@ -7,6 +7,7 @@
 // inheritors are responsible for init of the queue
 class InputFetcher {
  public:
+  virtual ~InputFetcher() = default;
   virtual errors::Status Run() = 0;
   virtual void Stop() = 0;
   agd::ReadQueueType* GetInputQueue() { return input_queue_.get(); }
@@ -11,16 +11,24 @@ using namespace errors;
 Status mmap_file(const std::string& file_path, char** file_ptr,
                  uint64_t* file_size) {
   const int fd = open(file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Internal("Unable to open file ", file_path);
+  }
   struct stat st;
-  if (stat(file_path.c_str(), &st) != 0) {
+  if (fstat(fd, &st) != 0) {
+    close(fd);
     return Internal("Unable to stat file ", file_path);
   }
   auto size = st.st_size;
 
   char* mapped = (char*)mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping keeps its own reference to the file
+  close(fd);
   if (mapped == MAP_FAILED) {
     return Internal("Unable to map file ", file_path, ", returned ", mapped);
   }
+  // start reading the file in now, the whole thing will be decompressed
+  madvise(mapped, size, MADV_WILLNEED);
 
   *file_ptr = mapped;
   *file_size = size;
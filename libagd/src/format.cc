@@ -1,4 +1,5 @@
 #include "format.h"
+#include <algorithm>
 #include <array>
 #include <cstring>
 #include "liberr/errors.h"
@@ -26,8 +27,65 @@ const std::array<BaseMap, 5> base_map{{
     BaseMap(BaseAlphabet::T, 'T'),
     BaseMap(BaseAlphabet::N, 'N'),
 }};
+// BAM cigar op codes, index is the op value in a packed cigar
+const char cigar_op_chars[] = "MIDNSHP=X";
+const uint32_t num_cigar_op_chars = sizeof(cigar_op_chars) - 1;
 }  // namespace
 
+static_assert(sizeof(FileHeader) == min_header_size + 2 * sizeof(uint32_t),
+              "checksums follow the minor version 2 header");
+
+Status ReadHeader(const char *chunk, size_t length, FileHeader *header) {
+  if (length < min_header_size) {
+    return OutOfRange("AGD chunk of ", length,
+                      " bytes is shorter than a header");
+  }
+  memset(reinterpret_cast<char *>(header), 0, sizeof(FileHeader));
+  memcpy(reinterpret_cast<char *>(header), chunk,
+         std::min(length, sizeof(FileHeader)));
+  if (header->segment_start < min_header_size ||
+      header->segment_start > length) {
+    return OutOfRange("AGD chunk header has a segment start of ",
+                      header->segment_start, " in a chunk of ", length,
+                      " bytes");
+  }
+  if (!header->HasChecksums()) {
+    header->payload_crc32c = 0;
+    header->data_crc32c = 0;
+  }
+  return Status::OK();
+}
+
+Status PackCigar(const char *cigar, const size_t cigar_len,
+                 vector<uint32_t> &ops) {
+  ops.clear();
+  uint32_t op_len = 0;
+  for (size_t i = 0; i < cigar_len; i++) {
+    char c = cigar[i];
+    if (c >= '0' && c <= '9') {
+      op_len = op_len * 10 + (c - '0');
+      continue;
+    }
+    auto op = strchr(cigar_op_chars, c);
+    if (op == nullptr || c == '\0') {
+      return InvalidArgument("Invalid cigar op ", string(&c, 1), " in cigar ",
+                             string(cigar, cigar_len));
+    }
+    ops.push_back(op_len << 4 | static_cast<uint32_t>(op - cigar_op_chars));
+    op_len = 0;
+  }
+  return Status::OK();
+}
+
+void UnpackCigar(const uint32_t *ops, const size_t num_ops, string &cigar) {
+  cigar.clear();
+  for (size_t i = 0; i < num_ops; i++) {
+    cigar.append(to_string(ops[i] >> 4));
+    auto op = ops[i] & 0xf;
+    cigar.push_back(op < num_cigar_op_chars ? cigar_op_chars[op] : '?');
+  }
+}
+
 Status append(const BinaryBases *bases, const std::size_t record_size_in_bytes,
               Buffer &data, Buffer &lengths) {
   if (record_size_in_bytes % sizeof(uint64_t) != 0) {
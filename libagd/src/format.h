@@ -18,6 +18,7 @@
 #include <cstdint>
 #include <vector>
 #include <array>
+#include <string>
 #include "buffer.h"
 #include "liberr/status.h"
 
@@ -30,7 +31,17 @@ namespace format {
   const uint32_t MAX_INDEX_SIZE = UINT32_MAX;
 
   const uint8_t current_major = 0;
-  const uint8_t current_minor = 1;
+  // 2: index_encoding
+  // 3: payload and data checksums
+  const uint8_t current_minor = 3;
+
+  // how the record index at the start of the payload is stored, see
+  // index_encoding.h
+  enum IndexEncoding {
+    RELATIVE_INDEX = 0,
+    CONSTANT_LENGTH = 1,
+    VARINT_DELTA = 2
+  };
 
   struct __attribute__((packed)) FileHeader {
     uint8_t version_major;
@@ -38,25 +49,53 @@ namespace format {
     uint8_t record_type;
     uint8_t compression_type;
     uint16_t segment_start;
-    uint16_t _padding;
+    uint8_t index_encoding;  // from minor version 2, padding before
+    uint8_t _padding;
     uint64_t first_ordinal;
     uint64_t last_ordinal;
     char string_id[32]; // FIXME: just make it static for now
+    // from minor version 3, CRC32C (crc32c.h) of the payload after
+    // segment_start, and of the decompressed payload with its index expanded
+    uint32_t payload_crc32c;
+    uint32_t data_crc32c;
 
     FileHeader() : version_major(current_major), version_minor(current_minor),
-                   segment_start(sizeof(FileHeader)) {}
+                   segment_start(sizeof(FileHeader)),
+                   index_encoding(RELATIVE_INDEX), _padding(0),
+                   payload_crc32c(0), data_crc32c(0) {}
+
+    IndexEncoding GetIndexEncoding() const {
+      return version_minor >= 2 ? static_cast<IndexEncoding>(index_encoding)
+                                : RELATIVE_INDEX;
+    }
+
+    bool HasChecksums() const {
+      return version_minor >= 3 && segment_start >= sizeof(FileHeader);
+    }
   };
 
+  // header size of chunks before minor version 3
+  const std::size_t min_header_size = 56;
+
+  // copy the header of a chunk of length bytes. Readers must use this rather
+  // than casting, older headers are shorter. Fields newer than the chunk's
+  // version are zero
+  Status ReadHeader(const char *chunk, std::size_t length, FileHeader *header);
+
   enum CompressionType {
     UNCOMPRESSED = 0,
     BZIP2 = 1,
-    GZIP = 2
+    GZIP = 2,
+    ZSTD = 3,
+    QUALITY = 4,  // quality_codec.h
+    META = 5      // meta_codec.h
   };
 
   enum RecordType {
     TEXT = 0,
     STRUCTURED = 1,
-    COMPACTED_BASES = 2
+    COMPACTED_BASES = 2,
+    BINARY_ALIGNMENT = 3
   };
 
   enum BaseAlphabet {
@@ -92,6 +131,35 @@ namespace format {
 
   Status append(const BinaryBases *bases, const std::size_t record_size_in_bytes, Buffer &data, Buffer &lengths);
 
+  // Fixed layout alignment record, stored in RecordType::BINARY_ALIGNMENT
+  // columns in place of a serialized Alignment protobuf. The record is
+  // immediately followed by num_cigar_ops uint32 cigar ops, packed as in BAM
+  // (op_len << 4 | op), so a record is sizeof(BinaryAlignment) + 4 * ops bytes.
+  // Positions are 0-based within the contig, ref indexes are -1 if unmapped.
+  struct __attribute__((packed)) BinaryAlignment {
+    int64_t position;
+    int64_t next_position;
+    int64_t template_length;
+    int32_t ref_index;
+    int32_t next_ref_index;
+    uint16_t flag;
+    uint8_t mapping_quality;
+    uint8_t _padding;
+    uint32_t num_cigar_ops;
+
+    const uint32_t* cigar() const {
+      return reinterpret_cast<const uint32_t*>(this + 1);
+    }
+
+    std::size_t size() const {
+      return sizeof(BinaryAlignment) + num_cigar_ops * sizeof(uint32_t);
+    }
+  };
+
+  // convert between a text cigar ("10S90M") and BAM packed cigar ops
+  Status PackCigar(const char *cigar, const std::size_t cigar_len, std::vector<uint32_t> &ops);
+  void UnpackCigar(const uint32_t *ops, const std::size_t num_ops, std::string &cigar);
+
   // if warning is set true, a warning will be output on non-ACTGN chars and converted to N
   Status IntoBases(const char *fastq_base, const std::size_t fastq_base_size, std::vector<BinaryBases> &bases, bool warning = false);
 
@@ -0,0 +1,214 @@
+#include "index_encoding.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace agd {
+
+using namespace errors;
+using format::RelativeIndex;
+
+namespace {
+
+inline uint64_t ZigZag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+inline size_t VarintSize(uint64_t v) {
+  size_t size = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    size++;
+  }
+  return size;
+}
+
+inline char* PutVarint(char* out, uint64_t v) {
+  while (v >= 0x80) {
+    *out++ = static_cast<char>(v | 0x80);
+    v >>= 7;
+  }
+  *out++ = static_cast<char>(v);
+  return out;
+}
+
+// moves the data after an encoded index of encoded_size bytes to follow a
+// RelativeIndex per record, and copies the index in front of it
+void RewritePayload(const RelativeIndex* index, size_t num_records,
+                    size_t encoded_size, Buffer* payload) {
+  const size_t data_size = payload->size() - encoded_size;
+  const size_t index_size = num_records * sizeof(RelativeIndex);
+  payload->resize(index_size + data_size);
+  char* p = payload->mutable_data();
+  memmove(p + index_size, p + encoded_size, data_size);
+  memcpy(p, index, index_size);
+}
+
+void AbsoluteIndexScalar(const RelativeIndex* index, size_t num_records,
+                         size_t offset, size_t* absolute) {
+  for (size_t i = 0; i < num_records; i++) {
+    absolute[i] = offset;
+    offset += index[i];
+  }
+}
+
+#if defined(__x86_64__)
+
+bool UseAvx2() {
+  static const bool use = __builtin_cpu_supports("avx2");
+  return use;
+}
+
+// 4 records per step, widened to 64 bits. An in register inclusive scan
+// minus the lengths gives the offsets within the step
+__attribute__((target("avx2"))) void AbsoluteIndexAvx2(
+    const RelativeIndex* index, size_t num_records, size_t* absolute) {
+  static_assert(sizeof(size_t) == sizeof(uint64_t), "64 bit offsets");
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i carry = zero;
+  size_t i = 0;
+  for (; i + 4 <= num_records; i += 4) {
+    __m256i x = _mm256_cvtepu32_epi64(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(index + i)));
+    // [x0, x0+x1 | x2, x2+x3]
+    __m256i s = _mm256_add_epi64(x, _mm256_slli_si256(x, 8));
+    // carry x0+x1 into the upper lane
+    __m256i t = _mm256_blend_epi32(
+        _mm256_permute4x64_epi64(s, _MM_SHUFFLE(1, 1, 0, 0)), zero, 0x0F);
+    s = _mm256_add_epi64(s, t);
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(absolute + i),
+        _mm256_add_epi64(carry, _mm256_sub_epi64(s, x)));
+    carry = _mm256_add_epi64(
+        carry, _mm256_permute4x64_epi64(s, _MM_SHUFFLE(3, 3, 3, 3)));
+  }
+  AbsoluteIndexScalar(index + i, num_records - i,
+                      _mm256_extract_epi64(carry, 0), absolute + i);
+}
+
+#endif
+
+}  // namespace
+
+format::IndexEncoding EncodeIndex(const Buffer& index, Buffer* output) {
+  const size_t num_records = index.size() / sizeof(RelativeIndex);
+  auto records = reinterpret_cast<const RelativeIndex*>(index.data());
+  if (num_records == 0) {
+    return format::IndexEncoding::RELATIVE_INDEX;
+  }
+
+  bool constant = true;
+  size_t varint_size = 0;
+  RelativeIndex prev = 0;
+  for (size_t i = 0; i < num_records; i++) {
+    constant &= records[i] == records[0];
+    varint_size += VarintSize(
+        ZigZag(static_cast<int64_t>(records[i]) - static_cast<int64_t>(prev)));
+    prev = records[i];
+  }
+
+  if (constant) {
+    output->WriteBuffer(index.data(), sizeof(RelativeIndex));
+    return format::IndexEncoding::CONSTANT_LENGTH;
+  }
+  if (varint_size >= index.size()) {
+    return format::IndexEncoding::RELATIVE_INDEX;
+  }
+
+  output->resize(varint_size);
+  char* out = output->mutable_data();
+  prev = 0;
+  for (size_t i = 0; i < num_records; i++) {
+    out = PutVarint(out, ZigZag(static_cast<int64_t>(records[i]) -
+                                static_cast<int64_t>(prev)));
+    prev = records[i];
+  }
+  return format::IndexEncoding::VARINT_DELTA;
+}
+
+Status ExpandIndex(format::IndexEncoding encoding, size_t num_records,
+                   Buffer* payload, Buffer* scratch) {
+  switch (encoding) {
+    case format::IndexEncoding::RELATIVE_INDEX:
+      return Status::OK();
+
+    case format::IndexEncoding::CONSTANT_LENGTH: {
+      RelativeIndex length;
+      if (payload->size() < sizeof(length)) {
+        return OutOfRange("Constant length index payload of ",
+                          payload->size(), " bytes is too short");
+      }
+      memcpy(&length, payload->data(), sizeof(length));
+      const size_t data_size = payload->size() - sizeof(length);
+      if (static_cast<uint64_t>(length) * num_records != data_size) {
+        return OutOfRange(num_records, " records of length ", length,
+                          " don't match the ", data_size, " bytes of data");
+      }
+      scratch->resize(num_records * sizeof(RelativeIndex));
+      auto index = reinterpret_cast<RelativeIndex*>(scratch->mutable_data());
+      std::fill_n(index, num_records, length);
+      RewritePayload(index, num_records, sizeof(length), payload);
+      return Status::OK();
+    }
+
+    case format::IndexEncoding::VARINT_DELTA: {
+      scratch->resize(num_records * sizeof(RelativeIndex));
+      auto index = reinterpret_cast<RelativeIndex*>(scratch->mutable_data());
+      auto in = reinterpret_cast<const uint8_t*>(payload->data());
+      const auto end = in + payload->size();
+      int64_t prev = 0;
+      uint64_t data_size = 0;
+      for (size_t i = 0; i < num_records; i++) {
+        uint64_t v = 0;
+        for (int shift = 0;; shift += 7) {
+          if (in == end || shift >= 64) {
+            return OutOfRange("Truncated varint index at record ", i);
+          }
+          uint8_t b = *in++;
+          v |= static_cast<uint64_t>(b & 0x7f) << shift;
+          if (!(b & 0x80)) break;
+        }
+        prev += UnZigZag(v);
+        if (prev < 0 || prev > UINT32_MAX) {
+          return OutOfRange("Corrupt varint index at record ", i);
+        }
+        index[i] = prev;
+        data_size += prev;
+      }
+      const size_t encoded_size = in - reinterpret_cast<const uint8_t*>(
+                                           payload->data());
+      if (data_size != payload->size() - encoded_size) {
+        return OutOfRange("Varint index covers ", data_size,
+                          " bytes, but data is ",
+                          payload->size() - encoded_size, " bytes");
+      }
+      RewritePayload(index, num_records, encoded_size, payload);
+      return Status::OK();
+    }
+
+    default:
+      return InvalidArgument("Unknown index encoding ", int(encoding));
+  }
+}
+
+void AbsoluteIndex(const RelativeIndex* index, size_t num_records,
+                   size_t* absolute) {
+#if defined(__x86_64__)
+  if (UseAvx2()) {
+    AbsoluteIndexAvx2(index, num_records, absolute);
+    return;
+  }
+#endif
+  AbsoluteIndexScalar(index, num_records, 0, absolute);
+}
+
+}  // namespace agd
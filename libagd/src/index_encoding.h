@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+#include "buffer.h"
+#include "format.h"
+#include "liberr/errors.h"
+
+namespace agd {
+
+// Compact encodings of the record index at the start of a chunk payload
+// (FileHeader::index_encoding, chunks from version_minor 2). Writers encode
+// the index before compressing, RecordParser expands it back, so readers
+// always see a RelativeIndex per record.
+//   CONSTANT_LENGTH  one RelativeIndex, the length of every record
+//   VARINT_DELTA     per record, the zigzag varint difference from the
+//                    previous record's length (the first from 0)
+
+// the smallest encoding of index. Writes the encoded index to output, unless
+// the result is RELATIVE_INDEX, where index is used as is
+format::IndexEncoding EncodeIndex(const Buffer& index, Buffer* output);
+
+// rewrite payload, an index of num_records in encoding followed by the
+// record data, to a RelativeIndex per record followed by the data.
+// scratch holds the decoded index of VARINT_DELTA payloads
+Status ExpandIndex(format::IndexEncoding encoding, std::size_t num_records,
+                   Buffer* payload, Buffer* scratch);
+
+// absolute[i] is the offset of record i in the data, the sum of the first i
+// record lengths. Vectorized with AVX2 where available
+void AbsoluteIndex(const format::RelativeIndex* index, std::size_t num_records,
+                   std::size_t* absolute);
+
+}  // namespace agd
@@ -1,4 +1,3 @@
-
 #include "local_fetcher.h"
 
 #include <fstream>
@@ -10,31 +9,36 @@ using json = nlohmann::json;
 errors::Status LocalFetcher::Run() {
 
   input_queue_ = std::make_unique<agd::ReadQueueType>(5);
-  std::ifstream i(agd_meta_path_.data());
-  i >> agd_metadata_;
-  i.close();
-
-  const auto& records = agd_metadata_["records"];
-
-  max_records_ = records.size();
 
-  auto run_func = [this]() {
+  // read all datasets first, so chunks can be tracked as soon as they flow
+  max_records_ = 0;
+  for (size_t d = 0; d < agd_meta_paths_.size(); d++) {
+    const auto& agd_meta_path = agd_meta_paths_[d];
+    std::ifstream i(agd_meta_path.data());
+    if (!i.good()) {
+      return errors::Internal("Couldn't open file ", agd_meta_path);
+    }
+    json agd_metadata;
+    i >> agd_metadata;
+    i.close();
 
-    const auto& records = agd_metadata_["records"];
+    const auto& records = agd_metadata["records"];
 
     auto file_path_base =
-        agd_meta_path_.substr(0, agd_meta_path_.find_last_of('/') + 1);
+        agd_meta_path.substr(0, agd_meta_path.find_last_of('/') + 1);
 
     std::cout << "[LocalFetcher] base path is " << file_path_base << "\n";
 
     std::string pool("");
 
     try {
-      pool = agd_metadata_["pool"];
+      pool = agd_metadata["pool"];
     } catch (...) {
       // no pool exists, its fine
     }
 
+    items_.emplace_back();
+    size_t skipped = 0;
     for (const auto& rec : records) {
       agd::ReadQueueItem item;
 
@@ -46,13 +50,78 @@ errors::Status LocalFetcher::Run() {
             absl::StrCat(file_path_base, rec["path"].get<std::string>());
       }
       item.pool = pool;
-      std::cout << "[LocalFetcher] chunk path / obj name is: " << item.objName
-                << ", pool name is: " << item.pool << "\n";
+      if (resume_ && resume_->Done(item)) {
+        skipped++;
+        continue;
+      }
+      pending_[item.objName].push_back(d);
+      items_.back().push_back(std::move(item));
+    }
+    if (resume_) {
+      std::cout << "[LocalFetcher] Resuming " << agd_meta_path << ", "
+                << skipped << " of " << records.size()
+                << " chunks already done\n";
+    }
+    remaining_.push_back(items_.back().size());
+    max_records_ += items_.back().size();
+  }
+
+  // nothing to wait for
+  for (size_t d = 0; d < remaining_.size(); d++) {
+    if (remaining_[d] == 0 && dataset_done_) dataset_done_(agd_meta_paths_[d]);
+  }
 
-      input_queue_->push(std::move(item));
+  auto run_func = [this]() {
+
+    // round robin over the datasets
+    for (size_t next = 0, pushed = 0; pushed < size_t(max_records_); next++) {
+      for (auto& items : items_) {
+        if (next >= items.size()) continue;
+        auto& item = items[next];
+        std::cout << "[LocalFetcher] chunk path / obj name is: "
+                  << item.objName << ", pool name is: " << item.pool << "\n";
+
+        if (!input_queue_->push(std::move(item))) {
+          // the pipeline failed and closed its input
+          std::cout << "[LocalFetcher] Input queue closed, the pipeline "
+                       "failed\n";
+          return;
+        }
+        pushed++;
+      }
     }
+    // all chunks fetched, lets the pipeline drain and stop
+    input_queue_->close();
   };
 
   fetch_thread_ = std::thread(run_func);
   return errors::Status::OK();
 }
+
+void LocalFetcher::ChunkWritten(const std::string& obj_name) {
+  auto it = pending_.find(obj_name);
+  if (it == pending_.end()) {
+    std::cout << "[LocalFetcher] Written chunk " << obj_name
+              << " was not fetched\n";
+    return;
+  }
+  const size_t d = it->second.front();
+  it->second.erase(it->second.begin());
+  if (it->second.empty()) pending_.erase(it);
+
+  if (--remaining_[d] == 0) {
+    std::cout << "[LocalFetcher] All chunks of " << agd_meta_paths_[d]
+              << " written\n";
+    if (dataset_done_) dataset_done_(agd_meta_paths_[d]);
+  }
+}
+
+std::vector<std::string> LocalFetcher::Incomplete() const {
+  std::vector<std::string> incomplete;
+  for (size_t d = 0; d < agd_meta_paths_.size(); d++) {
+    if (d >= remaining_.size() || remaining_[d] > 0) {
+      incomplete.push_back(agd_meta_paths_[d]);
+    }
+  }
+  return incomplete;
+}
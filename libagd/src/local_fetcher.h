@@ -1,24 +1,62 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
 #include "liberr/errors.h"
 #include "fetcher.h"
-#include <thread>
 #include "json.hpp"
+#include "resume_filter.h"
 
 using json = nlohmann::json;
 
-// fill a agd read queue from a local agd metadata file
+// fill a agd read queue from local agd metadata files. The chunks of several
+// datasets are interleaved, so they share one pipeline, and the fetcher
+// tracks which datasets have been completely written
 class LocalFetcher : public InputFetcher {
  public:
+  // called with the metadata path of a dataset once all its chunks are
+  // written
+  using DatasetDone = std::function<void(const std::string& agd_meta_path)>;
+
   LocalFetcher(const std::string& agd_meta_path)
-      : agd_meta_path_(agd_meta_path) {}
+      : agd_meta_paths_({agd_meta_path}) {}
+
+  // with resume, chunks it finds done are skipped, and count as written
+  LocalFetcher(std::vector<std::string> agd_meta_paths,
+               DatasetDone dataset_done,
+               std::unique_ptr<agd::ResumeFilter> resume = nullptr)
+      : agd_meta_paths_(std::move(agd_meta_paths)),
+        dataset_done_(std::move(dataset_done)),
+        resume_(std::move(resume)) {}
 
   errors::Status Run() override;
-  void Stop() override { fetch_thread_.join(); };
+  void Stop() override {
+    if (fetch_thread_.joinable()) fetch_thread_.join();
+  };
 
   uint32_t MaxRecords() const override { return max_records_; }
+
+  // chunk obj_name of a dataset was written, from a single thread
+  void ChunkWritten(const std::string& obj_name);
+
+  // metadata paths of the datasets not completely written
+  std::vector<std::string> Incomplete() const;
+
  private:
 
-  std::string agd_meta_path_;
+  std::vector<std::string> agd_meta_paths_;
+  DatasetDone dataset_done_;
+  std::unique_ptr<agd::ResumeFilter> resume_;
   std::thread fetch_thread_;
-  json agd_metadata_;
+  // queue items of each dataset
+  std::vector<std::vector<agd::ReadQueueItem>> items_;
+  // chunks of each dataset not yet written
+  std::vector<size_t> remaining_;
+  // datasets of each chunk name not yet written. Ceph datasets in the same
+  // pool can share chunk names
+  absl::flat_hash_map<std::string, std::vector<size_t>> pending_;
   int max_records_ = -1;
-};
\ No newline at end of file
+};
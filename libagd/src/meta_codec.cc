@@ -0,0 +1,415 @@
+#include "meta_codec.h"
+
+#include <zstd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "format.h"
+
+namespace agd {
+
+using namespace errors;
+
+namespace {
+
+constexpr uint8_t kVersion = 1;
+
+struct __attribute__((packed)) MetaHeader {
+  uint8_t version;
+  uint8_t num_streams;
+  uint16_t _padding;
+  uint32_t num_records;
+  uint64_t data_size;
+};
+
+struct __attribute__((packed)) StreamSizes {
+  uint32_t raw;
+  uint32_t compressed;
+};
+
+// token ops, one byte per token, followed by the separator byte if it
+// differs from the previous name's
+enum TokenOp : uint8_t {
+  kMatch = 0,   // same text and separator as the previous name's token
+  kDelta = 1,   // numeric, zigzag varint difference in the number stream
+  kNumber = 2,  // numeric, varint in the number stream
+  kString = 3,  // varint length and bytes in the string stream
+};
+constexpr uint8_t kNewSeparator = 0x80;
+// separator byte of the last token of a name
+constexpr uint8_t kEndOfName = 0;
+
+// streams: ops, strings, then numbers per token position, positions past the
+// last share its stream
+constexpr size_t kOpStream = 0;
+constexpr size_t kStringStream = 1;
+constexpr size_t kNumberStreams = 16;
+constexpr size_t kNumStreams = 2 + kNumberStreams;
+
+size_t NumberStream(size_t position) {
+  return 2 + std::min(position, kNumberStreams - 1);
+}
+
+// longer digit runs may not fit in a uint64 and are coded as strings
+constexpr size_t kMaxDigits = 18;
+
+inline bool IsSeparator(char c) {
+  return c == ':' || c == ' ' || c == '/' || c == '#';
+}
+
+struct Token {
+  uint32_t start;  // offset of the text in its name (encoder) or output
+  uint32_t length;
+  uint8_t separator;
+  bool numeric;
+  uint64_t value;
+};
+
+// a name of n separators is n + 1 tokens, the last ending with kEndOfName.
+// Digit runs without a leading zero are numeric, so printing the value gives
+// back the same text
+void Tokenize(const char* name, size_t length, std::vector<Token>* tokens) {
+  tokens->clear();
+  size_t start = 0;
+  while (true) {
+    size_t end = start;
+    while (end < length && !IsSeparator(name[end])) end++;
+
+    Token t;
+    t.start = start;
+    t.length = end - start;
+    t.separator = end < length ? name[end] : kEndOfName;
+    t.numeric = t.length > 0 && t.length <= kMaxDigits &&
+                (t.length == 1 || name[start] != '0');
+    t.value = 0;
+    for (size_t i = start; t.numeric && i < end; i++) {
+      if (name[i] < '0' || name[i] > '9') {
+        t.numeric = false;
+      } else {
+        t.value = t.value * 10 + (name[i] - '0');
+      }
+    }
+    tokens->push_back(t);
+
+    if (end == length) break;
+    start = end + 1;
+  }
+}
+
+void PutVarint(std::vector<char>& stream, uint64_t v) {
+  while (v >= 0x80) {
+    stream.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  stream.push_back(static_cast<char>(v));
+}
+
+inline uint64_t ZigZag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// bounds checked reads of a decoded stream
+class StreamReader {
+ public:
+  explicit StreamReader(const std::vector<char>& stream)
+      : pos_(reinterpret_cast<const uint8_t*>(stream.data())),
+        end_(pos_ + stream.size()) {}
+
+  bool Byte(uint8_t* b) {
+    if (pos_ == end_) return false;
+    *b = *pos_++;
+    return true;
+  }
+
+  bool Varint(uint64_t* v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (pos_ == end_) return false;
+      uint8_t b = *pos_++;
+      *v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  }
+
+  bool Bytes(size_t n, const char** bytes) {
+    if (static_cast<size_t>(end_ - pos_) < n) return false;
+    *bytes = reinterpret_cast<const char*>(pos_);
+    pos_ += n;
+    return true;
+  }
+
+ private:
+  const uint8_t* pos_;
+  const uint8_t* end_;
+};
+
+// digits of v, returns the end of the written text
+char* WriteNumber(uint64_t v, char* out) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v > 0);
+  while (n > 0) *out++ = digits[--n];
+  return out;
+}
+
+}  // namespace
+
+MetaEncoder::MetaEncoder(int level)
+    : level_(level), ctx_(ZSTD_createCCtx()), streams_(kNumStreams) {}
+
+MetaEncoder::~MetaEncoder() { ZSTD_freeCCtx(ctx_); }
+
+Status MetaEncoder::Encode(const Buffer& index, const Buffer& data,
+                           Buffer* output) {
+  const size_t num_records = index.size() / sizeof(format::RelativeIndex);
+  auto records = reinterpret_cast<const format::RelativeIndex*>(index.data());
+  size_t data_size = 0;
+  for (size_t i = 0; i < num_records; i++) {
+    data_size += records[i];
+  }
+  if (data_size != data.size()) {
+    return InvalidArgument("Meta chunk index covers ", data_size,
+                           " bytes, but data is ", data.size(), " bytes");
+  }
+  if (data_size > UINT32_MAX) {
+    return InvalidArgument("Meta chunk of ", data_size,
+                           " bytes is too large for the meta codec");
+  }
+
+  for (auto& stream : streams_) {
+    stream.clear();
+  }
+  auto& ops = streams_[kOpStream];
+  auto& strings = streams_[kStringStream];
+
+  std::vector<Token> tokens, prev_tokens;
+  const char* prev_name = nullptr;
+  const char* name = data.data();
+  for (size_t r = 0; r < num_records; name += records[r], r++) {
+    Tokenize(name, records[r], &tokens);
+    for (size_t i = 0; i < tokens.size(); i++) {
+      const Token& t = tokens[i];
+      const Token* p = i < prev_tokens.size() ? &prev_tokens[i] : nullptr;
+      if (p && p->separator == t.separator && p->length == t.length &&
+          memcmp(prev_name + p->start, name + t.start, t.length) == 0) {
+        ops.push_back(kMatch);
+        continue;
+      }
+
+      uint8_t op;
+      if (t.numeric && p && p->numeric) {
+        op = kDelta;
+        PutVarint(streams_[NumberStream(i)],
+                  ZigZag(static_cast<int64_t>(t.value - p->value)));
+      } else if (t.numeric) {
+        op = kNumber;
+        PutVarint(streams_[NumberStream(i)], t.value);
+      } else {
+        op = kString;
+        PutVarint(strings, t.length);
+        strings.insert(strings.end(), name + t.start,
+                       name + t.start + t.length);
+      }
+      if (p && p->separator == t.separator) {
+        ops.push_back(op);
+      } else {
+        ops.push_back(op | kNewSeparator);
+        ops.push_back(t.separator);
+      }
+    }
+    std::swap(tokens, prev_tokens);
+    prev_name = name;
+  }
+
+  MetaHeader header = {};
+  header.version = kVersion;
+  header.num_streams = kNumStreams;
+  header.num_records = num_records;
+  header.data_size = data_size;
+
+  const size_t table_size = kNumStreams * sizeof(StreamSizes);
+  size_t bound = sizeof(header) + table_size;
+  for (const auto& stream : streams_) {
+    bound += stream.empty() ? 0 : ZSTD_compressBound(stream.size());
+  }
+  output->reset();
+  output->resize(bound);
+  char* out = output->mutable_data();
+  memcpy(out, &header, sizeof(header));
+  auto sizes = reinterpret_cast<StreamSizes*>(out + sizeof(header));
+  size_t pos = sizeof(header) + table_size;
+  for (size_t i = 0; i < kNumStreams; i++) {
+    const auto& stream = streams_[i];
+    if (stream.size() > UINT32_MAX) {
+      return InvalidArgument("Meta stream ", i, " of ", stream.size(),
+                             " bytes is too large for the meta codec");
+    }
+    StreamSizes s = {static_cast<uint32_t>(stream.size()), 0};
+    if (!stream.empty()) {
+      auto ret = ZSTD_compressCCtx(ctx_, out + pos, bound - pos, stream.data(),
+                                   stream.size(), level_);
+      if (ZSTD_isError(ret)) {
+        return Internal("zstd compression of meta stream ", i,
+                        " failed: ", ZSTD_getErrorName(ret));
+      }
+      s.compressed = ret;
+      pos += ret;
+    }
+    memcpy(&sizes[i], &s, sizeof(s));
+  }
+  output->resize(pos);
+  return Status::OK();
+}
+
+MetaDecoder::MetaDecoder() : ctx_(ZSTD_createDCtx()), streams_(kNumStreams) {}
+
+MetaDecoder::~MetaDecoder() { ZSTD_freeDCtx(ctx_); }
+
+Status MetaDecoder::Decode(const char* payload, size_t size, Buffer* output) {
+  MetaHeader header;
+  if (size < sizeof(header)) {
+    return OutOfRange("Meta payload of ", size, " bytes is too short");
+  }
+  memcpy(&header, payload, sizeof(header));
+  if (header.version != kVersion) {
+    return InvalidArgument("Unsupported meta codec version ",
+                           int(header.version));
+  }
+  const size_t table_size = header.num_streams * sizeof(StreamSizes);
+  if (header.num_streams != kNumStreams ||
+      sizeof(header) + table_size > size || header.data_size > UINT32_MAX ||
+      (header.num_records == 0 && header.data_size > 0)) {
+    return InvalidArgument("Corrupt meta payload header");
+  }
+
+  size_t pos = sizeof(header) + table_size;
+  for (size_t i = 0; i < kNumStreams; i++) {
+    StreamSizes s;
+    memcpy(&s, payload + sizeof(header) + i * sizeof(s), sizeof(s));
+    if (s.compressed > size - pos) {
+      return OutOfRange("Truncated meta payload");
+    }
+    if (s.raw > 0 && ZSTD_getFrameContentSize(payload + pos, s.compressed) !=
+                         s.raw) {
+      return InvalidArgument("Corrupt meta stream ", i);
+    }
+    auto& stream = streams_[i];
+    stream.resize(s.raw);
+    if (s.raw > 0) {
+      auto ret = ZSTD_decompressDCtx(ctx_, stream.data(), s.raw,
+                                     payload + pos, s.compressed);
+      if (ZSTD_isError(ret) || ret != s.raw) {
+        return InvalidArgument("Corrupt meta stream ", i);
+      }
+    }
+    pos += s.compressed;
+  }
+
+  const size_t index_size = header.num_records * sizeof(format::RelativeIndex);
+  output->reset();
+  output->resize(index_size + header.data_size);
+  auto records =
+      reinterpret_cast<format::RelativeIndex*>(output->mutable_data());
+  char* const data = output->mutable_data() + index_size;
+  char* const data_end = data + header.data_size;
+  // the longest a number prints
+  constexpr size_t kMaxNumberLength = 20;
+
+  StreamReader ops(streams_[kOpStream]);
+  StreamReader strings(streams_[kStringStream]);
+  std::vector<StreamReader> numbers;
+  for (size_t i = 0; i < kNumberStreams; i++) {
+    numbers.emplace_back(streams_[2 + i]);
+  }
+
+  auto corrupt = []() { return InvalidArgument("Corrupt meta payload"); };
+  std::vector<Token> tokens, prev_tokens;
+  char* out = data;
+  for (size_t r = 0; r < header.num_records; r++) {
+    char* name = out;
+    tokens.clear();
+    for (size_t i = 0;; i++) {
+      const Token* p = i < prev_tokens.size() ? &prev_tokens[i] : nullptr;
+      uint8_t op;
+      if (!ops.Byte(&op)) return corrupt();
+
+      const uint8_t type = op & ~kNewSeparator;
+      Token t;
+      t.start = out - data;
+      switch (type) {
+        case kMatch:
+          if (!p || (op & kNewSeparator) ||
+              p->length > static_cast<size_t>(data_end - out)) {
+            return corrupt();
+          }
+          t = *p;
+          t.start = out - data;
+          memcpy(out, data + p->start, p->length);
+          break;
+        case kDelta:
+        case kNumber: {
+          uint64_t v;
+          if (!numbers[NumberStream(i) - 2].Varint(&v)) return corrupt();
+          if (type == kDelta) {
+            if (!p || !p->numeric) return corrupt();
+            t.value = p->value + UnZigZag(v);
+          } else {
+            t.value = v;
+          }
+          char digits[kMaxNumberLength];
+          t.length = WriteNumber(t.value, digits) - digits;
+          if (t.length > static_cast<size_t>(data_end - out)) {
+            return corrupt();
+          }
+          memcpy(out, digits, t.length);
+          t.numeric = true;
+          break;
+        }
+        case kString: {
+          uint64_t length;
+          const char* bytes;
+          if (!strings.Varint(&length) || !strings.Bytes(length, &bytes) ||
+              length > static_cast<size_t>(data_end - out)) {
+            return corrupt();
+          }
+          memcpy(out, bytes, length);
+          t.length = length;
+          t.numeric = false;
+          break;
+        }
+        default:
+          return corrupt();
+      }
+      out += t.length;
+
+      if (op & kNewSeparator) {
+        if (!ops.Byte(&t.separator)) return corrupt();
+      } else if (type != kMatch) {
+        if (!p) return corrupt();
+        t.separator = p->separator;
+      }
+      tokens.push_back(t);
+      if (t.separator == kEndOfName) break;
+      if (out == data_end) return corrupt();
+      *out++ = t.separator;
+    }
+    records[r] = out - name;
+    std::swap(tokens, prev_tokens);
+  }
+  if (out != data_end) {
+    return InvalidArgument("Meta records decode to ", out - data,
+                           " bytes, expected ", header.data_size);
+  }
+  return Status::OK();
+}
+
+}  // namespace agd
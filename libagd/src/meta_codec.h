@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "buffer.h"
+#include "liberr/errors.h"
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+namespace agd {
+
+// Codec for read name (meta) columns (CompressionType::META). Names are split
+// into tokens on ':', ' ', '/' and '#', and each token is coded against the
+// token at the same position in the previous name: unchanged, a numeric
+// delta, a new number or a new string. Illumina names mostly differ only in
+// the tile/x/y fields, so a name costs a few bytes before entropy coding.
+// The token ops, the numbers of each position and the strings go to separate
+// streams, each compressed with zstd.
+//
+// Payload: a MetaHeader, a (raw size, compressed size) pair per stream, then
+// the compressed streams. Decodes to the usual index followed by data.
+
+// stream buffers and the zstd context are kept between chunks, not thread
+// safe
+class MetaEncoder {
+ public:
+  explicit MetaEncoder(int level);
+  ~MetaEncoder();
+
+  // index and data of a column chunk, overwrites output
+  errors::Status Encode(const Buffer& index, const Buffer& data,
+                        Buffer* output);
+
+ private:
+  int level_;
+  ZSTD_CCtx_s* ctx_;
+  std::vector<std::vector<char>> streams_;
+};
+
+class MetaDecoder {
+ public:
+  MetaDecoder();
+  ~MetaDecoder();
+
+  errors::Status Decode(const char* payload, std::size_t size,
+                        Buffer* output);
+
+ private:
+  ZSTD_DCtx_s* ctx_;
+  std::vector<std::vector<char>> streams_;
+};
+
+}  // namespace agd
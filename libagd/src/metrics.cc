@@ -0,0 +1,300 @@
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+
+#include "absl/strings/str_cat.h"
+#include "json.hpp"
+
+namespace agd {
+
+using json = nlohmann::json;
+using namespace std::chrono_literals;
+
+void Histogram::Observe(uint64_t v) {
+  size_t bucket = v == 0 ? 0 : 64 - __builtin_clzll(v);
+  if (bucket >= kNumBuckets) bucket = kNumBuckets - 1;
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(v, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+  Snapshot snap;
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    snap.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+  }
+  snap.count = count_.load(std::memory_order_relaxed);
+  snap.sum = sum_.load(std::memory_order_relaxed);
+  return snap;
+}
+
+uint64_t Histogram::Snapshot::Quantile(double q) const {
+  uint64_t total = 0;
+  for (auto b : buckets) total += b;
+  if (total == 0) return 0;
+  uint64_t rank = static_cast<uint64_t>(q * total);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    seen += buckets[i];
+    if (seen > rank) return BucketBound(i);
+  }
+  return BucketBound(kNumBuckets - 1);
+}
+
+MetricsRegistry& MetricsRegistry::Global() {
+  static MetricsRegistry* registry = new MetricsRegistry();
+  return *registry;
+}
+
+Counter* MetricsRegistry::GetCounter(const std::string& name) {
+  absl::MutexLock l(&mu_);
+  auto& c = counters_[name];
+  if (!c) c = std::make_unique<Counter>();
+  return c.get();
+}
+
+Histogram* MetricsRegistry::GetHistogram(const std::string& name) {
+  absl::MutexLock l(&mu_);
+  auto& h = histograms_[name];
+  if (!h) h = std::make_unique<Histogram>();
+  return h.get();
+}
+
+void MetricsRegistry::AddQueue(const std::string& name, QueueProbe&& probe) {
+  absl::MutexLock l(&mu_);
+  probe.occupancy = std::make_unique<Histogram>();
+  queues_[name] = std::move(probe);
+}
+
+void MetricsRegistry::UnregisterQueue(const std::string& name) {
+  absl::MutexLock l(&mu_);
+  queues_.erase(name);
+}
+
+void MetricsRegistry::Sample() {
+  absl::MutexLock l(&mu_);
+  for (auto& q : queues_) {
+    q.second.occupancy->Observe(q.second.size());
+  }
+}
+
+std::string MetricsRegistry::ToJsonLine() {
+  absl::MutexLock l(&mu_);
+  auto now = absl::Now();
+  double secs = absl::ToDoubleSeconds(now - last_json_time_);
+  last_json_time_ = now;
+
+  json j;
+  j["time"] = absl::ToUnixMillis(now);
+  j["interval_secs"] = secs;
+
+  for (const auto& c : counters_) {
+    auto value = c.second->value();
+    auto& last = last_counter_values_[c.first];
+    j["counters"][c.first] = {{"value", value},
+                              {"rate", secs > 0 ? (value - last) / secs : 0.0}};
+    last = value;
+  }
+
+  for (const auto& h : histograms_) {
+    auto snap = h.second->snapshot();
+    j["histograms"][h.first] = {
+        {"count", snap.count},
+        {"mean", snap.count ? double(snap.sum) / snap.count : 0.0},
+        {"p50", snap.Quantile(0.5)},
+        {"p99", snap.Quantile(0.99)}};
+  }
+
+  for (const auto& q : queues_) {
+    const auto& probe = q.second;
+    auto occupancy = probe.occupancy->snapshot();
+    j["queues"][q.first] = {
+        {"size", probe.size()},
+        {"capacity", probe.capacity},
+        {"mean_occupancy",
+         occupancy.count ? double(occupancy.sum) / occupancy.count : 0.0},
+        {"push_waits", probe.push_waits()},
+        {"push_wait_ms", absl::ToDoubleMilliseconds(probe.push_wait_time())},
+        {"pop_waits", probe.pop_waits()},
+        {"pop_wait_ms", absl::ToDoubleMilliseconds(probe.pop_wait_time())}};
+  }
+
+  return j.dump();
+}
+
+namespace {
+
+void AppendHistogram(std::string& out, const std::string& name,
+                     const std::string& labels,
+                     const Histogram::Snapshot& snap) {
+  // stop at the last non empty bucket, +Inf covers the rest
+  size_t num_buckets = Histogram::kNumBuckets;
+  while (num_buckets > 0 && snap.buckets[num_buckets - 1] == 0) num_buckets--;
+
+  uint64_t cumulative = 0;
+  std::string sep = labels.empty() ? "" : ",";
+  for (size_t i = 0; i < num_buckets; i++) {
+    cumulative += snap.buckets[i];
+    // buckets are exclusive of their bound, le is inclusive
+    absl::StrAppend(&out, name, "_bucket{", labels, sep, "le=\"",
+                    Histogram::BucketBound(i) - 1, "\"} ", cumulative, "\n");
+  }
+  absl::StrAppend(&out, name, "_bucket{", labels, sep, "le=\"+Inf\"} ",
+                  snap.count, "\n");
+  std::string braces = labels.empty() ? "" : absl::StrCat("{", labels, "}");
+  absl::StrAppend(&out, name, "_sum", braces, " ", snap.sum, "\n");
+  absl::StrAppend(&out, name, "_count", braces, " ", snap.count, "\n");
+}
+
+}  // namespace
+
+std::string MetricsRegistry::ToPrometheus() {
+  absl::MutexLock l(&mu_);
+  std::string out;
+
+  for (const auto& c : counters_) {
+    auto name = absl::StrCat("viralign_", c.first, "_total");
+    absl::StrAppend(&out, "# TYPE ", name, " counter\n", name, " ",
+                    c.second->value(), "\n");
+  }
+
+  for (const auto& h : histograms_) {
+    auto name = absl::StrCat("viralign_", h.first);
+    absl::StrAppend(&out, "# TYPE ", name, " histogram\n");
+    AppendHistogram(out, name, "", h.second->snapshot());
+  }
+
+  if (!queues_.empty()) {
+    absl::StrAppend(&out, "# TYPE viralign_queue_size gauge\n",
+                    "# TYPE viralign_queue_capacity gauge\n",
+                    "# TYPE viralign_queue_push_waits_total counter\n",
+                    "# TYPE viralign_queue_push_wait_seconds_total counter\n",
+                    "# TYPE viralign_queue_pop_waits_total counter\n",
+                    "# TYPE viralign_queue_pop_wait_seconds_total counter\n",
+                    "# TYPE viralign_queue_occupancy histogram\n");
+  }
+  for (const auto& q : queues_) {
+    const auto& probe = q.second;
+    auto label = absl::StrCat("queue=\"", q.first, "\"");
+    absl::StrAppend(
+        &out, "viralign_queue_size{", label, "} ", probe.size(), "\n",
+        "viralign_queue_capacity{", label, "} ", probe.capacity, "\n",
+        "viralign_queue_push_waits_total{", label, "} ", probe.push_waits(),
+        "\n", "viralign_queue_push_wait_seconds_total{", label, "} ",
+        absl::ToDoubleSeconds(probe.push_wait_time()), "\n",
+        "viralign_queue_pop_waits_total{", label, "} ", probe.pop_waits(),
+        "\n", "viralign_queue_pop_wait_seconds_total{", label, "} ",
+        absl::ToDoubleSeconds(probe.pop_wait_time()), "\n");
+    AppendHistogram(out, "viralign_queue_occupancy", label,
+                    probe.occupancy->snapshot());
+  }
+
+  return out;
+}
+
+errors::Status MetricsReporter::Create(
+    MetricsRegistry* registry, const std::string& json_path, int port,
+    int interval_secs, std::unique_ptr<MetricsReporter>& reporter) {
+  reporter.reset(new MetricsReporter(registry, json_path,
+                                     interval_secs > 0 ? interval_secs : 10));
+  return reporter->Init(port);
+}
+
+errors::Status MetricsReporter::Init(int port) {
+  if (port > 0) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) {
+      return errors::Internal("Could not create metrics socket, errno ",
+                              errno);
+    }
+    int one = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) !=
+            0 ||
+        listen(listen_fd_, 8) != 0) {
+      close(listen_fd_);
+      listen_fd_ = -1;
+      return errors::Unavailable("Could not listen for metrics on port ", port,
+                                 ", errno ", errno);
+    }
+
+    http_thread_ = std::thread([this]() {
+      while (!done_) {
+        pollfd pfd = {listen_fd_, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        int fd = accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0) continue;
+        // any request gets the metrics, we don't care about the path
+        char req[1024];
+        auto unused = read(fd, req, sizeof(req));
+        (void)unused;
+        auto body = registry_->ToPrometheus();
+        auto resp = absl::StrCat(
+            "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: ",
+            body.size(), "\r\n\r\n", body);
+        size_t sent = 0;
+        while (sent < resp.size()) {
+          auto ret = write(fd, resp.data() + sent, resp.size() - sent);
+          if (ret <= 0) break;
+          sent += ret;
+        }
+        close(fd);
+      }
+    });
+    std::cout << "[Metrics] Serving metrics on 127.0.0.1:" << port << "\n";
+  }
+
+  sample_thread_ = std::thread([this]() {
+    std::ofstream json_out;
+    if (!json_path_.empty()) {
+      json_out.open(json_path_, std::ios::app);
+      if (!json_out.good()) {
+        std::cout << "[Metrics] Could not open " << json_path_
+                  << ", not writing metrics\n";
+      }
+    }
+    // sample occupancy often enough to see bursts
+    const auto sample_period = 100ms;
+    auto next_dump = std::chrono::steady_clock::now() +
+                     std::chrono::seconds(interval_secs_);
+    while (!done_) {
+      std::this_thread::sleep_for(sample_period);
+      registry_->Sample();
+      if (json_out.good() && std::chrono::steady_clock::now() >= next_dump) {
+        json_out << registry_->ToJsonLine() << "\n";
+        json_out.flush();
+        next_dump += std::chrono::seconds(interval_secs_);
+      }
+    }
+    if (json_out.good()) {
+      json_out << registry_->ToJsonLine() << "\n";
+    }
+  });
+
+  return errors::Status::OK();
+}
+
+void MetricsReporter::Stop() {
+  if (done_) return;
+  done_ = true;
+  if (sample_thread_.joinable()) sample_thread_.join();
+  if (http_thread_.joinable()) http_thread_.join();
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+  }
+}
+
+}  // namespace agd
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "liberr/errors.h"
+
+namespace agd {
+
+// Pipeline telemetry. Stages get counters and histograms from the global
+// registry by name once, and update them with relaxed atomics on the hot
+// path. Owners of queues register them to have their occupancy sampled and
+// their push/pop waits reported. A MetricsReporter dumps the registry as
+// JSON lines and/or serves it in Prometheus text format.
+
+class Counter {
+ public:
+  void Add(uint64_t v = 1) { value_.fetch_add(v, std::memory_order_relaxed); }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic_uint64_t value_{0};
+};
+
+// power of 2 buckets, bucket i counts values in [2^(i-1), 2^i), bucket 0
+// counts zeros
+class Histogram {
+ public:
+  static constexpr size_t kNumBuckets = 48;
+
+  void Observe(uint64_t v);
+
+  struct Snapshot {
+    std::array<uint64_t, kNumBuckets> buckets;
+    uint64_t count;
+    uint64_t sum;
+    // upper bound of the bucket containing quantile q
+    uint64_t Quantile(double q) const;
+  };
+  Snapshot snapshot() const;
+
+  // exclusive upper bound of bucket i
+  static uint64_t BucketBound(size_t i) { return i == 0 ? 1 : 1ULL << i; }
+
+ private:
+  std::array<std::atomic_uint64_t, kNumBuckets> buckets_{};
+  std::atomic_uint64_t count_{0};
+  std::atomic_uint64_t sum_{0};
+};
+
+// measures the time from construction to Stop() or destruction into a
+// histogram, in microseconds
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(Histogram* hist) : hist_(hist), start_(absl::Now()) {}
+  ~ScopedLatency() { Stop(); }
+  void Stop() {
+    if (hist_) {
+      hist_->Observe(absl::ToInt64Microseconds(absl::Now() - start_));
+      hist_ = nullptr;
+    }
+  }
+
+ private:
+  Histogram* hist_;
+  absl::Time start_;
+};
+
+class MetricsRegistry {
+ public:
+  static MetricsRegistry& Global();
+
+  // returned pointers are valid for the life of the registry
+  Counter* GetCounter(const std::string& name);
+  Histogram* GetHistogram(const std::string& name);
+
+  // sample the queue in Sample(), until unregistered. Works with any queue
+  // backend, e.g. ConcurrentQueue or RingQueue
+  template <typename Queue>
+  void RegisterQueue(const std::string& name, Queue* queue) {
+    QueueProbe probe;
+    probe.size = [queue]() { return queue->size(); };
+    probe.capacity = queue->capacity();
+    probe.push_waits = [queue]() { return queue->num_push_waits(); };
+    probe.pop_waits = [queue]() { return queue->num_pop_waits(); };
+    probe.push_wait_time = [queue]() { return queue->push_wait_time(); };
+    probe.pop_wait_time = [queue]() { return queue->pop_wait_time(); };
+    AddQueue(name, std::move(probe));
+  }
+  void UnregisterQueue(const std::string& name);
+
+  // record current queue occupancies
+  void Sample();
+
+  // one JSON object with all metrics, counter rates are per second since the
+  // previous call
+  std::string ToJsonLine();
+  std::string ToPrometheus();
+
+ private:
+  struct QueueProbe {
+    std::function<size_t()> size;
+    size_t capacity;
+    std::function<uint64_t()> push_waits;
+    std::function<uint64_t()> pop_waits;
+    std::function<absl::Duration()> push_wait_time;
+    std::function<absl::Duration()> pop_wait_time;
+    std::unique_ptr<Histogram> occupancy;
+  };
+
+  void AddQueue(const std::string& name, QueueProbe&& probe);
+
+  absl::Mutex mu_;
+  std::map<std::string, std::unique_ptr<Counter>> counters_;
+  std::map<std::string, std::unique_ptr<Histogram>> histograms_;
+  std::map<std::string, QueueProbe> queues_;
+
+  // for rates in ToJsonLine()
+  std::map<std::string, uint64_t> last_counter_values_;
+  absl::Time last_json_time_ = absl::Now();
+};
+
+// unregisters queues from the global registry when it goes out of scope, use
+// in the scope that owns the queues
+class ScopedQueueMetrics {
+ public:
+  ~ScopedQueueMetrics() {
+    for (const auto& name : names_) {
+      MetricsRegistry::Global().UnregisterQueue(name);
+    }
+  }
+
+  template <typename Queue>
+  void Add(const std::string& name, Queue* queue) {
+    MetricsRegistry::Global().RegisterQueue(name, queue);
+    names_.push_back(name);
+  }
+
+ private:
+  std::vector<std::string> names_;
+};
+
+// periodically samples the registry and appends a JSON line to json_path (if
+// not empty), and serves Prometheus text on 127.0.0.1:port (if port > 0)
+class MetricsReporter {
+ public:
+  static errors::Status Create(MetricsRegistry* registry,
+                               const std::string& json_path, int port,
+                               int interval_secs,
+                               std::unique_ptr<MetricsReporter>& reporter);
+  ~MetricsReporter() { Stop(); }
+
+  void Stop();
+
+ private:
+  MetricsReporter(MetricsRegistry* registry, const std::string& json_path,
+                  int interval_secs)
+      : registry_(registry),
+        json_path_(json_path),
+        interval_secs_(interval_secs) {}
+
+  errors::Status Init(int port);
+
+  MetricsRegistry* registry_;
+  std::string json_path_;
+  int interval_secs_;
+  int listen_fd_ = -1;
+
+  volatile bool done_ = false;
+  std::thread sample_thread_;
+  std::thread http_thread_;
+};
+
+}  // namespace agd
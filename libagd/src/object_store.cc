@@ -0,0 +1,297 @@
+#include "object_store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <future>
+#include <iostream>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+
+namespace agd {
+
+using namespace errors;
+
+namespace {
+
+// an op that failed to start
+class DoneOp : public ObjectStore::Op {
+ public:
+  explicit DoneOp(int64_t result) : result_(result) {}
+  int64_t Wait() override { return result_; }
+
+ private:
+  int64_t result_;
+};
+
+class RadosReadOp : public ObjectStore::Op {
+ public:
+  explicit RadosReadOp(char* dst)
+      : completion_(librados::Rados::aio_create_completion()), dst_(dst) {}
+
+  ~RadosReadOp() override {
+    if (started_) completion_->wait_for_complete();
+    completion_->release();
+  }
+
+  int64_t Wait() override {
+    completion_->wait_for_complete();
+    int ret = completion_->get_return_value();
+    // librados reads into the buffer given to it unless it has to reassemble
+    // the reply, only then is there a copy
+    if (ret > 0 && !bl_.is_provided_buffer(dst_)) {
+      bl_.begin().copy(ret, dst_);
+    }
+    return ret;
+  }
+
+  librados::AioCompletion* completion() { return completion_; }
+  librados::bufferlist* bl() { return &bl_; }
+  void set_started() { started_ = true; }
+
+ private:
+  librados::AioCompletion* completion_;
+  bool started_ = false;
+  librados::bufferlist bl_;
+  char* dst_;
+};
+
+class RadosStatOp : public ObjectStore::Op {
+ public:
+  RadosStatOp() : completion_(librados::Rados::aio_create_completion()) {}
+
+  ~RadosStatOp() override {
+    if (started_) completion_->wait_for_complete();
+    completion_->release();
+  }
+
+  int64_t Wait() override {
+    completion_->wait_for_complete();
+    int ret = completion_->get_return_value();
+    return ret < 0 ? ret : static_cast<int64_t>(size_);
+  }
+
+  librados::AioCompletion* completion() { return completion_; }
+  uint64_t* size() { return &size_; }
+  time_t* mtime() { return &mtime_; }
+  void set_started() { started_ = true; }
+
+ private:
+  librados::AioCompletion* completion_;
+  bool started_ = false;
+  uint64_t size_ = 0;
+  time_t mtime_;
+};
+
+class RadosWriteOp : public ObjectStore::Op {
+ public:
+  RadosWriteOp() : completion_(librados::Rados::aio_create_completion()) {}
+
+  ~RadosWriteOp() override {
+    if (started_) completion_->wait_for_complete();
+    completion_->release();
+  }
+
+  int64_t Wait() override {
+    completion_->wait_for_complete();
+    return completion_->get_return_value();
+  }
+
+  librados::AioCompletion* completion() { return completion_; }
+  librados::bufferlist* bl() { return &bl_; }
+  void set_started() { started_ = true; }
+
+ private:
+  librados::AioCompletion* completion_;
+  bool started_ = false;
+  librados::bufferlist bl_;
+};
+
+// runs on its own thread, the future's destructor waits for it
+class FutureOp : public ObjectStore::Op {
+ public:
+  explicit FutureOp(std::future<int64_t> result) : result_(std::move(result)) {}
+  int64_t Wait() override { return result_.get(); }
+
+ private:
+  std::future<int64_t> result_;
+};
+
+}  // namespace
+
+Status RadosObjectStore::Create(const std::string& cluster_name,
+                                const std::string& user_name,
+                                const std::string& name_space,
+                                const std::string& ceph_conf_file,
+                                std::unique_ptr<ObjectStore>& store) {
+  std::unique_ptr<RadosObjectStore> rados(new RadosObjectStore(name_space));
+  int ret = rados->cluster_.init2(user_name.c_str(), cluster_name.c_str(), 0);
+  if (ret < 0) {
+    return Internal("Couldn't initialize the cluster handle! error ", ret);
+  }
+  ret = rados->cluster_.conf_read_file(ceph_conf_file.c_str());
+  if (ret < 0) {
+    return Internal("Couldn't read the Ceph configuration file ",
+                    ceph_conf_file, "! error ", ret);
+  }
+  ret = rados->cluster_.connect();
+  if (ret < 0) {
+    return Unavailable("Couldn't connect to cluster! error ", ret);
+  }
+  std::cout << "[RadosObjectStore] Connected to cluster " << cluster_name
+            << "\n";
+  store = std::move(rados);
+  return Status::OK();
+}
+
+librados::IoCtx* RadosObjectStore::GetIoCtx(const std::string& pool,
+                                            int* ret) {
+  absl::MutexLock l(&mu_);
+  auto& io_ctx = io_ctxs_[pool];
+  if (!io_ctx) {
+    auto ctx = std::make_unique<librados::IoCtx>();
+    *ret = cluster_.ioctx_create(pool.c_str(), *ctx);
+    if (*ret < 0) {
+      std::cout << "[RadosObjectStore] Couldn't set up ioctx for pool " << pool
+                << "! error " << *ret << "\n";
+      io_ctxs_.erase(pool);
+      return nullptr;
+    }
+    ctx->set_namespace(name_space_);
+    io_ctx = std::move(ctx);
+  }
+  return io_ctx.get();
+}
+
+std::unique_ptr<ObjectStore::Op> RadosObjectStore::Read(
+    const std::string& pool, const std::string& oid, char* dst,
+    std::size_t len, uint64_t offset) {
+  int ret = 0;
+  auto io_ctx = GetIoCtx(pool, &ret);
+  if (!io_ctx) return std::make_unique<DoneOp>(ret);
+
+  auto op = std::make_unique<RadosReadOp>(dst);
+  op->bl()->push_back(ceph::buffer::create_static(len, dst));
+  ret = io_ctx->aio_read(oid, op->completion(), op->bl(), len, offset);
+  if (ret < 0) return std::make_unique<DoneOp>(ret);
+  op->set_started();
+  return op;
+}
+
+std::unique_ptr<ObjectStore::Op> RadosObjectStore::Stat(
+    const std::string& pool, const std::string& oid) {
+  int ret = 0;
+  auto io_ctx = GetIoCtx(pool, &ret);
+  if (!io_ctx) return std::make_unique<DoneOp>(ret);
+
+  auto op = std::make_unique<RadosStatOp>();
+  ret = io_ctx->aio_stat(oid, op->completion(), op->size(), op->mtime());
+  if (ret < 0) return std::make_unique<DoneOp>(ret);
+  op->set_started();
+  return op;
+}
+
+std::unique_ptr<ObjectStore::Op> RadosObjectStore::WriteFull(
+    const std::string& pool, const std::string& oid, const iovec* segments,
+    std::size_t num_segments) {
+  int ret = 0;
+  auto io_ctx = GetIoCtx(pool, &ret);
+  if (!io_ctx) return std::make_unique<DoneOp>(ret);
+
+  // the segments are sent from where they are, not copied into the list
+  auto op = std::make_unique<RadosWriteOp>();
+  for (size_t i = 0; i < num_segments; i++) {
+    if (segments[i].iov_len == 0) continue;
+    op->bl()->push_back(ceph::buffer::create_static(
+        segments[i].iov_len, static_cast<char*>(segments[i].iov_base)));
+  }
+  ret = io_ctx->aio_write_full(oid, op->completion(), *op->bl());
+  if (ret < 0) return std::make_unique<DoneOp>(ret);
+  op->set_started();
+  return op;
+}
+
+Status FileObjectStore::Create(const std::string& root, absl::Duration latency,
+                               std::unique_ptr<ObjectStore>& store) {
+  struct stat st;
+  if (stat(root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+    return ObjNotFound("Object store directory ", root, " does not exist");
+  }
+  store.reset(new FileObjectStore(root, latency));
+  return Status::OK();
+}
+
+std::unique_ptr<ObjectStore::Op> FileObjectStore::Read(
+    const std::string& pool, const std::string& oid, char* dst,
+    std::size_t len, uint64_t offset) {
+  auto path = absl::StrCat(root_, "/", oid);
+  auto latency = latency_;
+  return std::make_unique<FutureOp>(
+      std::async(std::launch::async, [path, dst, len, offset, latency]() {
+        absl::SleepFor(latency);
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return static_cast<int64_t>(-errno);
+        int64_t done = 0;
+        while (done < static_cast<int64_t>(len)) {
+          ssize_t ret = pread(fd, dst + done, len - done, offset + done);
+          if (ret < 0 && errno == EINTR) continue;
+          if (ret < 0) {
+            done = -errno;
+            break;
+          }
+          if (ret == 0) break;
+          done += ret;
+        }
+        close(fd);
+        return done;
+      }));
+}
+
+std::unique_ptr<ObjectStore::Op> FileObjectStore::Stat(
+    const std::string& pool, const std::string& oid) {
+  auto path = absl::StrCat(root_, "/", oid);
+  auto latency = latency_;
+  return std::make_unique<FutureOp>(
+      std::async(std::launch::async, [path, latency]() {
+        absl::SleepFor(latency);
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return static_cast<int64_t>(-errno);
+        return static_cast<int64_t>(st.st_size);
+      }));
+}
+
+std::unique_ptr<ObjectStore::Op> FileObjectStore::WriteFull(
+    const std::string& pool, const std::string& oid, const iovec* segments,
+    std::size_t num_segments) {
+  auto path = absl::StrCat(root_, "/", oid);
+  auto latency = latency_;
+  std::vector<iovec> iov(segments, segments + num_segments);
+  return std::make_unique<FutureOp>(std::async(
+      std::launch::async, [path, iov = std::move(iov), latency]() {
+        absl::SleepFor(latency);
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return static_cast<int64_t>(-errno);
+        int64_t ret = 0;
+        for (const auto& segment : iov) {
+          auto data = static_cast<const char*>(segment.iov_base);
+          size_t done = 0;
+          while (done < segment.iov_len) {
+            ssize_t n = write(fd, data + done, segment.iov_len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+              ret = -errno;
+              break;
+            }
+            done += n;
+          }
+          if (ret < 0) break;
+        }
+        if (close(fd) != 0 && ret == 0) ret = -errno;
+        return ret;
+      }));
+}
+
+}  // namespace agd
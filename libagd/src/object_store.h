@@ -0,0 +1,108 @@
+#pragma once
+
+#include <rados/librados.hpp>
+#include <sys/uio.h>
+
+#include <memory>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "liberr/errors.h"
+
+namespace agd {
+
+// Asynchronous reads and writes of objects in pools, as AGDCephReader and
+// AGDCephWriter need them. RadosObjectStore is the real thing,
+// FileObjectStore stands in for it with files and an injectable latency, to
+// benchmark readers and writers without a cluster. Safe to use from multiple
+// threads.
+class ObjectStore {
+ public:
+  // an outstanding read, stat or write
+  class Op {
+   public:
+    virtual ~Op() = default;
+    // block until complete. The bytes read, for a stat the object size, for
+    // a write 0, or a negative errno
+    virtual int64_t Wait() = 0;
+  };
+
+  virtual ~ObjectStore() = default;
+
+  // start reading up to len bytes at offset of object oid into dst, which
+  // must stay valid until the op completes or is destroyed
+  virtual std::unique_ptr<Op> Read(const std::string& pool,
+                                   const std::string& oid, char* dst,
+                                   std::size_t len, uint64_t offset) = 0;
+
+  // start getting the size of object oid
+  virtual std::unique_ptr<Op> Stat(const std::string& pool,
+                                   const std::string& oid) = 0;
+
+  // start replacing object oid with the concatenated segments, which must
+  // stay valid until the op completes or is destroyed
+  virtual std::unique_ptr<Op> WriteFull(const std::string& pool,
+                                        const std::string& oid,
+                                        const iovec* segments,
+                                        std::size_t num_segments) = 0;
+};
+
+class RadosObjectStore : public ObjectStore {
+ public:
+  static errors::Status Create(const std::string& cluster_name,
+                               const std::string& user_name,
+                               const std::string& name_space,
+                               const std::string& ceph_conf_file,
+                               std::unique_ptr<ObjectStore>& store);
+
+  std::unique_ptr<Op> Read(const std::string& pool, const std::string& oid,
+                           char* dst, std::size_t len,
+                           uint64_t offset) override;
+  std::unique_ptr<Op> Stat(const std::string& pool,
+                           const std::string& oid) override;
+  std::unique_ptr<Op> WriteFull(const std::string& pool,
+                                const std::string& oid, const iovec* segments,
+                                std::size_t num_segments) override;
+
+ private:
+  explicit RadosObjectStore(const std::string& name_space)
+      : name_space_(name_space) {}
+
+  // the IoCtx of pool, created on first use. nullptr if it can't be
+  librados::IoCtx* GetIoCtx(const std::string& pool, int* ret);
+
+  std::string name_space_;
+  librados::Rados cluster_;
+
+  absl::Mutex mu_;
+  absl::flat_hash_map<std::string, std::unique_ptr<librados::IoCtx>> io_ctxs_
+      ABSL_GUARDED_BY(mu_);
+};
+
+// objects are the files <root>/<oid>, pools are ignored. Every op takes
+// at least latency, like a round trip to a cluster
+class FileObjectStore : public ObjectStore {
+ public:
+  static errors::Status Create(const std::string& root, absl::Duration latency,
+                               std::unique_ptr<ObjectStore>& store);
+
+  std::unique_ptr<Op> Read(const std::string& pool, const std::string& oid,
+                           char* dst, std::size_t len,
+                           uint64_t offset) override;
+  std::unique_ptr<Op> Stat(const std::string& pool,
+                           const std::string& oid) override;
+  std::unique_ptr<Op> WriteFull(const std::string& pool,
+                                const std::string& oid, const iovec* segments,
+                                std::size_t num_segments) override;
+
+ private:
+  FileObjectStore(const std::string& root, absl::Duration latency)
+      : root_(root), latency_(latency) {}
+
+  std::string root_;
+  absl::Duration latency_;
+};
+
+}  // namespace agd
@@ -3,8 +3,11 @@
 #include <cstdint>
 #include <utility>
 #include "absl/synchronization/mutex.h"
+#include "compacted_bases.h"
 #include "compression.h"
+#include "crc32c.h"
 #include "format.h"
+#include "index_encoding.h"
 #include "util.h"
 
 namespace agd {
@@ -91,6 +94,18 @@ void init_table_locked() {
   }
 }
 
+// rough gzip expansion of each record type, to size the output buffer when
+// the stream doesn't record its uncompressed size
+size_t expected_expansion(format::RecordType record_type) {
+  switch (record_type) {
+    case format::RecordType::COMPACTED_BASES:
+      // already packed 3 bits per base
+      return 2;
+    default:
+      return 4;
+  }
+}
+
 void init_table() {
   if (table_needs_init_) {
     absl::MutexLock l(&base_table_mu_);
@@ -115,48 +130,104 @@ Status RecordParser::ParseNew(const char *data, const std::size_t length,
                               const bool verify, Buffer *result_buffer,
                               uint64_t *first_ordinal, uint32_t *num_records,
                               string &record_id, bool unpack) {
+  iovec segment{const_cast<char *>(data), length};
+  return ParseNew(&segment, 1, verify, result_buffer, first_ordinal,
+                  num_records, record_id, unpack);
+}
+
+Status RecordParser::ParseNew(const iovec *segments,
+                              const std::size_t num_segments,
+                              const bool verify, Buffer *result_buffer,
+                              uint64_t *first_ordinal, uint32_t *num_records,
+                              string &record_id, bool unpack) {
   using namespace errors;
   using namespace format;
   reset();
 
-  if (length < sizeof(FileHeader)) {
-    return Internal("AGDReader::FillBuffer: needed min length ",
-                    sizeof(FileHeader), ", but only received ", length);
+  size_t length = 0;
+  for (size_t i = 0; i < num_segments; i++) {
+    length += segments[i].iov_len;
+  }
+
+  // the header, gathered if it spans segments
+  FileHeader header;
+  const char *header_data =
+      num_segments > 0 ? static_cast<const char *>(segments[0].iov_base)
+                       : nullptr;
+  char header_bytes[sizeof(FileHeader)];
+  if (num_segments > 1 && segments[0].iov_len < sizeof(FileHeader)) {
+    size_t copied = 0;
+    for (size_t i = 0; i < num_segments && copied < sizeof(header_bytes);
+         i++) {
+      size_t n = std::min(segments[i].iov_len, sizeof(header_bytes) - copied);
+      memcpy(header_bytes + copied, segments[i].iov_base, n);
+      copied += n;
+    }
+    header_data = header_bytes;
   }
-  auto file_header = reinterpret_cast<const FileHeader *>(data);
-  auto record_type = static_cast<RecordType>(file_header->record_type);
+  ERR_RETURN_IF_ERROR(ReadHeader(header_data, length, &header));
+  auto record_type = static_cast<RecordType>(header.record_type);
   switch (record_type) {
     case RecordType::TEXT:
     case RecordType::STRUCTURED:
     case RecordType::COMPACTED_BASES:
+    case RecordType::BINARY_ALIGNMENT:
       break;
     default:
-      return Internal("Invalid record type ", file_header->record_type);
+      return Internal("Invalid record type ", header.record_type);
   }
 
-  auto payload_start = data + file_header->segment_start;
-  auto payload_size = length - file_header->segment_start;
+  record_type_ = record_type;
 
-  Status status;
-  auto compression_type =
-      static_cast<CompressionType>(file_header->compression_type);
-  switch (compression_type) {
-    case CompressionType::GZIP:
-      status = decompressGZIP(payload_start, payload_size, result_buffer);
-      break;
-    case CompressionType::UNCOMPRESSED:
-      status = result_buffer->WriteBuffer(payload_start, payload_size);
-      break;
-    default:
-      status = errors::InvalidArgument(
-          "Compressed type '", file_header->compression_type,
-          "' doesn't match to any valid or supported compression enum type");
-      break;
+  // the segments of the payload, after the header
+  payload_segments_.clear();
+  size_t skip = header.segment_start;
+  for (size_t i = 0; i < num_segments; i++) {
+    if (skip >= segments[i].iov_len) {
+      skip -= segments[i].iov_len;
+      continue;
+    }
+    payload_segments_.push_back(
+        {static_cast<char *>(segments[i].iov_base) + skip,
+         segments[i].iov_len - skip});
+    skip = 0;
+  }
+  if (payload_segments_.empty()) {
+    payload_segments_.push_back({nullptr, 0});
+  }
+  const size_t payload_size = length - header.segment_start;
+
+  // hardware CRC32C runs at several GB/s, cheap next to decompression
+  uint32_t payload_crc = 0;
+  if (header.HasChecksums()) {
+    for (const auto &segment : payload_segments_) {
+      payload_crc = Crc32c(static_cast<const char *>(segment.iov_base),
+                           segment.iov_len, payload_crc);
+    }
   }
+  if (header.HasChecksums() && payload_crc != header.payload_crc32c) {
+    return DataLoss("Chunk payload checksum mismatch, the chunk is truncated ",
+                    "or corrupt");
+  }
+
   const size_t index_size =
-      file_header->last_ordinal - file_header->first_ordinal;
+      header.last_ordinal - header.first_ordinal;
   const size_t index_size_bytes = index_size * sizeof(RelativeIndex);
+
+  auto compression_type =
+      static_cast<CompressionType>(header.compression_type);
+  Status status = decompressor_.Decompress(
+      compression_type, payload_segments_.data(), payload_segments_.size(),
+      result_buffer,
+      index_size_bytes + payload_size * expected_expansion(record_type));
   ERR_RETURN_IF_ERROR(status);
+  ERR_RETURN_IF_ERROR(ExpandIndex(header.GetIndexEncoding(), index_size,
+                                  result_buffer, &index_scratch_));
+  if (header.HasChecksums() &&
+      Crc32c(result_buffer->data(), result_buffer->size()) !=
+          header.data_crc32c) {
+    return DataLoss("Decompressed chunk checksum mismatch");
+  }
 
   /*if (result_buffer->size() < index_size * 2) {
     return Internal("FillBuffer: expected at least ", index_size*2, " bytes, but
@@ -186,22 +257,9 @@ Status RecordParser::ParseNew(const char *data, const std::size_t length,
   }
 
   if (unpack && record_type == RecordType::COMPACTED_BASES) {
-    conversion_scratch_.reset();
-    index_scratch_.reset();
-
-    RelativeIndex current_record_length;
-    const char *start_ptr = &(*result_buffer)[index_size_bytes];
-    const BinaryBases *bases;
-
-    for (uint64_t i = 0; i < index_size; ++i) {
-      current_record_length = records[i];
-      bases = reinterpret_cast<const BinaryBases *>(start_ptr);
-      start_ptr += current_record_length;
-
-      ERR_RETURN_IF_ERROR(append(bases,
-                                 static_cast<size_t>(current_record_length),
-                                 conversion_scratch_, index_scratch_));
-    }
+    ERR_RETURN_IF_ERROR(ExpandBaseColumn(
+        records, index_size, &(*result_buffer)[index_size_bytes],
+        &index_scratch_, &conversion_scratch_));
 
     // append everything in converted_records to the index
     result_buffer->reserve(index_scratch_.size() + conversion_scratch_.size());
@@ -209,13 +267,14 @@ Status RecordParser::ParseNew(const char *data, const std::size_t length,
         result_buffer->WriteBuffer(&index_scratch_[0], index_scratch_.size()));
     ERR_RETURN_IF_ERROR(result_buffer->AppendBuffer(
         &conversion_scratch_[0], conversion_scratch_.size()));
+    record_type_ = RecordType::TEXT;
   }
 
-  *first_ordinal = file_header->first_ordinal;
+  *first_ordinal = header.first_ordinal;
   *num_records = index_size;
   record_id.assign(
-      &file_header->string_id[0],
-      strnlen(&file_header->string_id[0], sizeof(file_header->string_id)));
+      &header.string_id[0],
+      strnlen(&header.string_id[0], sizeof(header.string_id)));
   return Status::OK();
 }
 
@@ -3,6 +3,7 @@
 #include "format.h"
 #include "liberr/errors.h"
 #include "buffer.h"
+#include "compression.h"
 #include <vector>
 #include <array>
 #include <string>
@@ -48,12 +49,24 @@ namespace agd {
     Status ParseNew(const char* data, const std::size_t length, const bool verify, Buffer *result_buffer, 
         uint64_t *first_ordinal, uint32_t *num_records, std::string &record_id, bool unpack=true);
 
+    // a chunk file in segments, e.g. the pieces it was read in, decompressed
+    // from the segments without gathering them
+    Status ParseNew(const iovec* segments, std::size_t num_segments, const bool verify, Buffer *result_buffer,
+        uint64_t *first_ordinal, uint32_t *num_records, std::string &record_id, bool unpack=true);
+
+    // record type of the buffer filled by the last ParseNew, as in the chunk
+    // header, except unpacked COMPACTED_BASES are TEXT
+    format::RecordType record_type() const { return record_type_; }
+
   private:
 
     void reset();
 
     Buffer conversion_scratch_, index_scratch_;
+    std::vector<iovec> payload_segments_;
+    ChunkDecompressor decompressor_;
     const format::RelativeIndex *records = nullptr;
+    format::RecordType record_type_ = format::RecordType::TEXT;
   };
 
 }  //  namespace agd
@@ -0,0 +1,383 @@
+#include "quality_codec.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "format.h"
+
+namespace agd {
+
+using namespace errors;
+
+namespace {
+
+constexpr uint8_t kVersion = 1;
+
+struct __attribute__((packed)) QualityHeader {
+  uint8_t version;
+  uint8_t binned;
+  uint8_t order;
+  uint8_t _padding;
+  uint16_t num_symbols;
+  uint16_t _padding2;
+  uint32_t num_records;
+  uint64_t data_size;
+};
+
+// order-2 contexts are (num_symbols + 1)^2 models, order-1 beyond this
+constexpr size_t kMaxOrder2Symbols = 64;
+
+// carryless range coder (Subbotin), totals must stay below kBot
+constexpr uint32_t kTop = 1u << 24;
+constexpr uint32_t kBot = 1u << 16;
+
+class RangeEncoder {
+ public:
+  // appends to output from its current size
+  explicit RangeEncoder(Buffer* output)
+      : output_(output), pos_(output->size()) {}
+
+  void Encode(uint32_t cum, uint32_t freq, uint32_t total) {
+    range_ /= total;
+    low_ += cum * range_;
+    range_ *= freq;
+    while ((low_ ^ (low_ + range_)) < kTop ||
+           (range_ < kBot && ((range_ = -low_ & (kBot - 1)), true))) {
+      Put(low_ >> 24);
+      low_ <<= 8;
+      range_ <<= 8;
+    }
+  }
+
+  void Finish() {
+    for (int i = 0; i < 4; i++) {
+      Put(low_ >> 24);
+      low_ <<= 8;
+    }
+    output_->resize(pos_);
+  }
+
+ private:
+  void Put(uint32_t byte) {
+    if (pos_ == output_->size()) {
+      output_->resize(pos_ * 2 + 1024);
+    }
+    output_->mutable_data()[pos_++] = static_cast<char>(byte);
+  }
+
+  Buffer* output_;
+  size_t pos_;
+  uint32_t low_ = 0;
+  uint32_t range_ = 0xffffffff;
+};
+
+class RangeDecoder {
+ public:
+  RangeDecoder(const char* input, size_t size) : input_(input), size_(size) {
+    for (int i = 0; i < 4; i++) {
+      code_ = (code_ << 8) | Get();
+    }
+  }
+
+  uint32_t GetFreq(uint32_t total) {
+    range_ /= total;
+    uint32_t freq = (code_ - low_) / range_;
+    return freq < total ? freq : total - 1;
+  }
+
+  void Decode(uint32_t cum, uint32_t freq) {
+    low_ += cum * range_;
+    range_ *= freq;
+    while ((low_ ^ (low_ + range_)) < kTop ||
+           (range_ < kBot && ((range_ = -low_ & (kBot - 1)), true))) {
+      code_ = (code_ << 8) | Get();
+      low_ <<= 8;
+      range_ <<= 8;
+    }
+  }
+
+  // true if the decoder read past the end of the input
+  bool overrun() const { return pos_ > size_; }
+
+ private:
+  uint32_t Get() {
+    return pos_ < size_ ? static_cast<uint8_t>(input_[pos_++]) : (pos_++, 0);
+  }
+
+  const char* input_;
+  size_t size_;
+  size_t pos_ = 0;
+  uint32_t code_ = 0;
+  uint32_t low_ = 0;
+  uint32_t range_ = 0xffffffff;
+};
+
+// adaptive frequencies of num_symbols symbols in each of num_contexts
+// contexts, stored in the caller's vectors so they are reused between chunks
+class ContextModel {
+ public:
+  static constexpr uint32_t kIncrement = 16;
+  static constexpr uint32_t kMaxTotal = kBot - kIncrement;
+
+  ContextModel(std::vector<uint16_t>& freqs, std::vector<uint32_t>& totals,
+               size_t num_contexts, size_t num_symbols)
+      : freqs_(freqs), totals_(totals), num_symbols_(num_symbols) {
+    freqs_.assign(num_contexts * num_symbols, 1);
+    totals_.assign(num_contexts, num_symbols);
+  }
+
+  void Encode(RangeEncoder& encoder, size_t context, size_t symbol) {
+    const uint16_t* f = &freqs_[context * num_symbols_];
+    uint32_t cum = 0;
+    for (size_t i = 0; i < symbol; i++) cum += f[i];
+    encoder.Encode(cum, f[symbol], totals_[context]);
+    Update(context, symbol);
+  }
+
+  size_t Decode(RangeDecoder& decoder, size_t context) {
+    const uint16_t* f = &freqs_[context * num_symbols_];
+    uint32_t target = decoder.GetFreq(totals_[context]);
+    uint32_t cum = 0;
+    size_t symbol = 0;
+    while (cum + f[symbol] <= target) {
+      cum += f[symbol++];
+    }
+    decoder.Decode(cum, f[symbol]);
+    Update(context, symbol);
+    return symbol;
+  }
+
+ private:
+  void Update(size_t context, size_t symbol) {
+    uint16_t* f = &freqs_[context * num_symbols_];
+    f[symbol] += kIncrement;
+    totals_[context] += kIncrement;
+    if (totals_[context] > kMaxTotal) {
+      uint32_t total = 0;
+      for (size_t i = 0; i < num_symbols_; i++) {
+        f[i] = (f[i] + 1) / 2;
+        total += f[i];
+      }
+      totals_[context] = total;
+    }
+  }
+
+  std::vector<uint16_t>& freqs_;
+  std::vector<uint32_t>& totals_;
+  size_t num_symbols_;
+};
+
+size_t NumContexts(size_t num_symbols, uint8_t order) {
+  return order == 2 ? (num_symbols + 1) * (num_symbols + 1) : num_symbols + 1;
+}
+
+// record lengths, one flag per record for "same as previous", new lengths
+// follow as 4 raw bytes
+class LengthCoder {
+ public:
+  LengthCoder() : model_(freqs_, totals_, 1, 2) {}
+
+  void Encode(RangeEncoder& encoder, uint32_t length) {
+    bool same = length == last_;
+    model_.Encode(encoder, 0, same ? 0 : 1);
+    if (!same) {
+      for (int i = 0; i < 4; i++) {
+        encoder.Encode((length >> (i * 8)) & 0xff, 1, 256);
+      }
+      last_ = length;
+    }
+  }
+
+  uint32_t Decode(RangeDecoder& decoder) {
+    if (model_.Decode(decoder, 0) == 1) {
+      uint32_t length = 0;
+      for (int i = 0; i < 4; i++) {
+        uint32_t byte = decoder.GetFreq(256);
+        decoder.Decode(byte, 1);
+        length |= byte << (i * 8);
+      }
+      last_ = length;
+    }
+    return last_;
+  }
+
+ private:
+  std::vector<uint16_t> freqs_;
+  std::vector<uint32_t> totals_;
+  ContextModel model_;
+  uint32_t last_ = 0;
+};
+
+}  // namespace
+
+char BinQuality(char qual) {
+  int q = qual - 33;
+  if (q < 2) return qual;  // no call, or not phred+33
+  if (q < 10) return 33 + 6;
+  if (q < 20) return 33 + 15;
+  if (q < 25) return 33 + 22;
+  if (q < 30) return 33 + 27;
+  if (q < 35) return 33 + 33;
+  if (q < 40) return 33 + 37;
+  return 33 + 40;
+}
+
+Status QualityEncoder::Encode(const Buffer& index, const Buffer& data,
+                              Buffer* output) {
+  const size_t num_records = index.size() / sizeof(format::RelativeIndex);
+  auto records = reinterpret_cast<const format::RelativeIndex*>(index.data());
+  size_t data_size = 0;
+  for (size_t i = 0; i < num_records; i++) {
+    data_size += records[i];
+  }
+  if (data_size != data.size()) {
+    return InvalidArgument("Quality chunk index covers ", data_size,
+                           " bytes, but data is ", data.size(), " bytes");
+  }
+  // lets the decoder bound the record count of a corrupt header by its size
+  if (num_records > data_size) {
+    return InvalidArgument("Quality chunk has ", num_records,
+                           " records but only ", data_size, " scores");
+  }
+
+  // dense symbol for each (binned) score character, most frequent first so
+  // the models find common scores sooner
+  uint64_t counts[256] = {0};
+  const auto* chars = reinterpret_cast<const uint8_t*>(data.data());
+  for (size_t i = 0; i < data.size(); i++) {
+    counts[chars[i]]++;
+  }
+  uint64_t binned_counts[256] = {0};
+  for (int c = 0; c < 256; c++) {
+    auto b = binned_ ? static_cast<uint8_t>(BinQuality(static_cast<char>(c)))
+                     : c;
+    binned_counts[b] += counts[c];
+  }
+  std::vector<char> symbol_chars;
+  for (int c = 0; c < 256; c++) {
+    if (binned_counts[c] > 0) symbol_chars.push_back(static_cast<char>(c));
+  }
+  std::stable_sort(symbol_chars.begin(), symbol_chars.end(),
+                   [&binned_counts](char a, char b) {
+                     return binned_counts[static_cast<uint8_t>(a)] >
+                            binned_counts[static_cast<uint8_t>(b)];
+                   });
+  uint8_t binned_symbol[256];
+  for (size_t i = 0; i < symbol_chars.size(); i++) {
+    binned_symbol[static_cast<uint8_t>(symbol_chars[i])] = i;
+  }
+  uint8_t symbol_of[256];
+  for (int c = 0; c < 256; c++) {
+    if (counts[c] > 0) {
+      symbol_of[c] = binned_symbol[static_cast<uint8_t>(
+          binned_ ? BinQuality(static_cast<char>(c)) : c)];
+    }
+  }
+
+  const size_t num_symbols = symbol_chars.size();
+  QualityHeader header = {};
+  header.version = kVersion;
+  header.binned = binned_;
+  header.order = num_symbols <= kMaxOrder2Symbols ? 2 : 1;
+  header.num_symbols = num_symbols;
+  header.num_records = num_records;
+  header.data_size = data_size;
+
+  output->reset();
+  // most chunks compress to well under half, the encoder grows as needed
+  output->reserve(sizeof(header) + num_symbols + data.size() / 2 +
+                  num_records / 4 + 1024);
+  ERR_RETURN_IF_ERROR(
+      output->WriteBuffer(reinterpret_cast<const char*>(&header),
+                          sizeof(header)));
+  ERR_RETURN_IF_ERROR(output->AppendBuffer(symbol_chars.data(), num_symbols));
+
+  RangeEncoder encoder(output);
+  LengthCoder lengths;
+  for (size_t i = 0; i < num_records; i++) {
+    lengths.Encode(encoder, records[i]);
+  }
+
+  ContextModel model(freqs_, totals_, NumContexts(num_symbols, header.order),
+                     std::max<size_t>(num_symbols, 1));
+  const size_t start = num_symbols;  // context at the start of a record
+  size_t pos = 0;
+  for (size_t i = 0; i < num_records; i++) {
+    size_t q1 = start, q2 = start;
+    for (size_t j = 0; j < records[i]; j++) {
+      size_t symbol = symbol_of[chars[pos++]];
+      size_t context = header.order == 2 ? q1 * (num_symbols + 1) + q2 : q1;
+      model.Encode(encoder, context, symbol);
+      q2 = q1;
+      q1 = symbol;
+    }
+  }
+  encoder.Finish();
+  return Status::OK();
+}
+
+Status QualityDecoder::Decode(const char* payload, size_t size,
+                              Buffer* output) {
+  QualityHeader header;
+  if (size < sizeof(header)) {
+    return OutOfRange("Quality payload of ", size, " bytes is too short");
+  }
+  memcpy(&header, payload, sizeof(header));
+  if (header.version != kVersion) {
+    return InvalidArgument("Unsupported quality codec version ",
+                           int(header.version));
+  }
+  // sizes are checked before the output is sized for them. Records average
+  // at least one score, see Encode
+  if ((header.order != 1 && header.order != 2) ||
+      sizeof(header) + header.num_symbols > size ||
+      header.data_size > UINT32_MAX || header.num_records > header.data_size) {
+    return InvalidArgument("Corrupt quality payload header");
+  }
+  const size_t num_symbols = header.num_symbols;
+  const char* symbol_chars = payload + sizeof(header);
+  const size_t coded_start = sizeof(header) + num_symbols;
+
+  const size_t index_size = header.num_records * sizeof(format::RelativeIndex);
+  output->reset();
+  output->resize(index_size + header.data_size);
+  auto records =
+      reinterpret_cast<format::RelativeIndex*>(output->mutable_data());
+  char* out = output->mutable_data() + index_size;
+
+  RangeDecoder decoder(payload + coded_start, size - coded_start);
+  LengthCoder lengths;
+  size_t data_size = 0;
+  for (size_t i = 0; i < header.num_records; i++) {
+    records[i] = lengths.Decode(decoder);
+    data_size += records[i];
+  }
+  if (data_size != header.data_size) {
+    return InvalidArgument("Quality record lengths sum to ", data_size,
+                           ", expected ", header.data_size);
+  }
+
+  ContextModel model(freqs_, totals_, NumContexts(num_symbols, header.order),
+                     std::max<size_t>(num_symbols, 1));
+  const size_t start = num_symbols;
+  size_t pos = 0;
+  for (size_t i = 0; i < header.num_records; i++) {
+    size_t q1 = start, q2 = start;
+    for (size_t j = 0; j < records[i]; j++) {
+      size_t context = header.order == 2 ? q1 * (num_symbols + 1) + q2 : q1;
+      size_t symbol = model.Decode(decoder, context);
+      if (symbol >= num_symbols) {
+        return InvalidArgument("Corrupt quality payload");
+      }
+      out[pos++] = symbol_chars[symbol];
+      q2 = q1;
+      q1 = symbol;
+    }
+  }
+  if (decoder.overrun()) {
+    return OutOfRange("Truncated quality payload");
+  }
+  return Status::OK();
+}
+
+}  // namespace agd
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "buffer.h"
+#include "liberr/errors.h"
+
+namespace agd {
+
+// Codec for quality score columns (CompressionType::QUALITY). Quality strings
+// are coded with an adaptive order-2 context model (the previous two scores
+// of the read) and a range coder, order-1 if the chunk uses more than 64
+// distinct scores. Record lengths are coded as "same as the previous record"
+// flags, which costs almost nothing for fixed length reads.
+// Optionally scores are first binned to the 8 Illumina levels, which is lossy
+// but much smaller.
+//
+// Payload: a QualityHeader, the num_symbols score characters, then the range
+// coded stream. Decodes to the usual index followed by data.
+
+// Illumina 8 level binning of a phred+33 score
+char BinQuality(char qual);
+
+// model state is kept between chunks to avoid reallocating, not thread safe
+class QualityEncoder {
+ public:
+  explicit QualityEncoder(bool binned) : binned_(binned) {}
+
+  // index and data of a column chunk, overwrites output
+  errors::Status Encode(const Buffer& index, const Buffer& data,
+                        Buffer* output);
+
+ private:
+  bool binned_;
+  std::vector<uint16_t> freqs_;
+  std::vector<uint32_t> totals_;
+};
+
+class QualityDecoder {
+ public:
+  errors::Status Decode(const char* payload, std::size_t size,
+                        Buffer* output);
+
+ private:
+  std::vector<uint16_t> freqs_;
+  std::vector<uint32_t> totals_;
+};
+
+}  // namespace agd
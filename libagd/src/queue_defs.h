@@ -3,6 +3,8 @@
 #include "buffer.h"
 #include "buffer_pair.h"
 #include "concurrent_queue/concurrent_queue.h"
+#include "concurrent_queue/ring_queue.h"
+#include "format.h"
 #include "object_pool.h"
 
 namespace agd {
@@ -10,6 +12,14 @@ namespace agd {
 // there is some redundancy in data between types, but having different names
 // makes everything more explicit and easier to understand
 
+// queue between pipeline stages. ConcurrentQueue (mutex + condvars) is the
+// default backend. RingQueue is lock free and has the same interface; a
+// stage's queue can be switched to it with the Backend parameter of its
+// alias below, e.g. ChunkQueue<RingQueue>, once queue_benchmark shows it
+// helps for that stage's producer and consumer counts
+template <typename T, template <typename> class Backend = ConcurrentQueue>
+using StageQueue = Backend<T>;
+
 // filename or ceph object (name + pool)
 // AGDFSReader will ignore pool
 struct ReadQueueItem {
@@ -17,34 +27,46 @@ struct ReadQueueItem {
   std::string objName;
 };
 
-using ReadQueueType = ConcurrentQueue<ReadQueueItem>;
+template <template <typename> class Backend = ConcurrentQueue>
+using ReadQueue = StageQueue<ReadQueueItem, Backend>;
+using ReadQueueType = ReadQueue<>;
 
 // bufs containing decompressed columns for processing
 struct ChunkQueueItem {
   std::string pool;
   std::vector<ObjectPool<Buffer>::ptr_type> col_bufs;
+  // record type of each column, as read from the chunk headers
+  std::vector<format::RecordType> record_types;
   uint32_t chunk_size;
   uint64_t first_ordinal;
   std::string name;
 };
 
-using ChunkQueueType = ConcurrentQueue<ChunkQueueItem>;
+template <template <typename> class Backend = ConcurrentQueue>
+using ChunkQueue = StageQueue<ChunkQueueItem, Backend>;
+using ChunkQueueType = ChunkQueue<>;
 
 // buf pair (data, index) to be written to columns
 struct WriteQueueItem {
   std::string pool;
   std::vector<ObjectPool<BufferPair>::ptr_type> col_buf_pairs;
+  // optional, overrides the writer's default record type for each column
+  std::vector<format::RecordType> record_types;
   uint32_t chunk_size;
   uint64_t first_ordinal;
   std::string name;  // full path without ext, e.g. path/to/dataset/test_1000
 };
-using WriteQueueType = ConcurrentQueue<WriteQueueItem>;
+template <template <typename> class Backend = ConcurrentQueue>
+using WriteQueue = StageQueue<WriteQueueItem, Backend>;
+using WriteQueueType = WriteQueue<>;
 
 // name (+ pool) to signal this chunk's processing is complete
 struct OutputQueueItem {
   std::string pool;
   std::string objName;
 };
-using OutputQueueType = ConcurrentQueue<OutputQueueItem>;
+template <template <typename> class Backend = ConcurrentQueue>
+using OutputQueue = StageQueue<OutputQueueItem, Backend>;
+using OutputQueueType = OutputQueue<>;
 
 }  // namespace agd
@@ -6,16 +6,26 @@
 
 using json = nlohmann::json;
 using namespace errors;
-using namespace sw::redis;
 
 Status RedisFetcher::Create(const std::string& addr,
                             const std::string& queue_name,
-                            std::unique_ptr<InputFetcher>& fetcher) {
-  auto nf = new RedisFetcher(queue_name);
-  auto full_addr = absl::StrCat("tcp://", addr);
-  std::cout << "[RedisFetcher] Creating and connecting to " << full_addr << "\n";
-
-  nf->redis_.reset(new Redis(full_addr));
+                            const std::string& worker_id,
+                            std::unique_ptr<InputFetcher>& fetcher,
+                            std::unique_ptr<agd::ResumeFilter> resume,
+                            const std::string& return_queue, size_t batch,
+                            absl::Duration lease) {
+  if (batch == 0 || lease <= absl::ZeroDuration()) {
+    return InvalidArgument("[RedisFetcher] batch and lease must be nonzero");
+  }
+  auto nf = new RedisFetcher(batch, lease);
+  std::cout << "[RedisFetcher] Creating and connecting to tcp://" << addr
+            << " as worker " << worker_id << "\n";
+
+  nf->queue_.reset(new RedisWorkQueue(addr, queue_name, worker_id, lease));
+  nf->lease_queue_.reset(
+      new RedisWorkQueue(addr, queue_name, worker_id, lease));
+  nf->resume_ = std::move(resume);
+  nf->return_queue_ = return_queue;
 
   std::cout << "[RedisFetcher] Connection success.\n";
   
@@ -24,46 +34,102 @@ Status RedisFetcher::Create(const std::string& addr,
   return Status::OK();
 }
 
+RedisFetcher::~RedisFetcher() {
+  Stop();
+  if (lease_thread_.joinable()) {
+    lease_done_.Notify();
+    lease_thread_.join();
+    try {
+      lease_queue_->Release();
+    } catch (const sw::redis::Error& e) {
+      std::cout << "[RedisFetcher] Couldn't release lease: " << e.what()
+                << "\n";
+    }
+  }
+}
+
 Status RedisFetcher::Run() {
 
   std::cout << "[RedisFetcher] Running ...\n";
 
   auto loop_func = [this]() {
-    json j;
-    std::string test;
     while (!done_) {
-      agd::ReadQueueItem item;
-      // issue LPOP command
-      std::cout << "[RedisFetcher] Issuing LPOP ...\n";
-
-      auto response = redis_->blpop({queue_name_});
-
-      if (response) {
-        std::cout << "[RedisFetcher] The reply is: " << response.value().first << " and " << response.value().second << "\n";
+      // claim a batch, waiting periodically to check for Stop()
+      std::vector<std::string> claimed;
+      try {
+        claimed = queue_->Claim(batch_, absl::Seconds(1));
+      } catch (const sw::redis::Error& e) {
+        std::cout << "[RedisFetcher] Couldn't claim work, retrying: "
+                  << e.what() << "\n";
+        absl::SleepFor(absl::Seconds(1));
+        continue;
       }
 
-      if (!response) {
-        std::cout << "[RedisFetcher] received NIL reply, exiting ...\n";
-        done_ = false;
-      } else {
+      std::vector<std::string> done;
+      for (const auto& value : claimed) {
         // parse string to json
-        j = json::parse(response.value().second);
+        json j = json::parse(value);
+        agd::ReadQueueItem item;
         item.objName = j["obj_name"];
         item.pool = j["pool"];  // will be empty if data is in FS
+        if (resume_ && resume_->Done(item)) {
+          std::cout << "[RedisFetcher] chunk " << item.objName
+                    << " already done, skipping\n";
+          done.push_back(std::move(item.objName));
+          continue;
+        }
         std::cout << "[RedisFetcher] pull queue item with name: "
                   << item.objName << " and pool: " << item.pool << "\n";
-        input_queue_->push(std::move(item));
+        if (!input_queue_->push(std::move(item))) {
+          // the pipeline failed and closed its input. The rest of the batch
+          // stays claimed and is requeued once this worker's lease expires
+          std::cout << "[RedisFetcher] Input queue closed, the pipeline "
+                       "failed\n";
+          done_ = true;
+          break;
+        }
       }
 
+      // like RedisPusher, unacked chunks would wait for this worker to exit
+      while (!done.empty()) {
+        try {
+          queue_->Ack(done, return_queue_);
+          break;
+        } catch (const sw::redis::Error& e) {
+          std::cout << "[RedisFetcher] Couldn't ack done chunks, retrying: "
+                    << e.what() << "\n";
+          absl::SleepFor(absl::Seconds(1));
+        }
+      }
     }
+    input_queue_->close();
+  };
+
+  // renew well before the lease expires, and requeue the work of workers
+  // that let theirs expire
+  auto lease_func = [this]() {
+    do {
+      try {
+        lease_queue_->RenewLease();
+        auto requeued = lease_queue_->ReapExpired();
+        if (requeued > 0) {
+          std::cout << "[RedisFetcher] Requeued " << requeued
+                    << " items of expired workers\n";
+        }
+      } catch (const sw::redis::Error& e) {
+        std::cout << "[RedisFetcher] Couldn't renew lease: " << e.what()
+                  << "\n";
+      }
+    } while (!lease_done_.WaitForNotificationWithTimeout(lease_ / 3));
   };
 
   loop_thread_ = std::thread(loop_func);
+  lease_thread_ = std::thread(lease_func);
 
   return Status::OK();
 }
 
 void RedisFetcher::Stop() {
-  done_ = false;
-  loop_thread_.join();
+  done_ = true;
+  if (loop_thread_.joinable()) loop_thread_.join();
 }
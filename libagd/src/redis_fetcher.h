@@ -1,16 +1,31 @@
 #pragma once 
 
 #include <thread>
+#include "absl/synchronization/notification.h"
 #include "fetcher.h"
-#include "src/sw/redis++/redis++.h"
+#include "redis_work_queue.h"
+#include "resume_filter.h"
 
-// maintains a connection to a redis queue, fetches items, and puts them in an
-// AGD input queue
+// maintains a connection to a redis queue, claims items in batches, and puts
+// them in an AGD input queue. Claimed items stay in this worker's processing
+// list until RedisPusher acks them, and are requeued if this worker dies, see
+// RedisWorkQueue
 class RedisFetcher : public InputFetcher {
  public:
+  // worker_id names the processing list and lease of this worker, the
+  // RedisPusher acking its chunks must use the same. With resume, chunks it
+  // finds done are acked to return_queue right away rather than aligned
   static errors::Status Create(const std::string& addr, const std::string& queue_name,
-                               std::unique_ptr<InputFetcher>& fetcher);
+                               const std::string& worker_id,
+                               std::unique_ptr<InputFetcher>& fetcher,
+                               std::unique_ptr<agd::ResumeFilter> resume = nullptr,
+                               const std::string& return_queue = "",
+                               size_t batch = 4,
+                               absl::Duration lease = absl::Seconds(30));
 
+  // keeps the lease until destroyed, so fetched chunks can still be acked
+  // after Stop()
+  ~RedisFetcher() override;
 
   errors::Status Run() override;
 
@@ -21,12 +36,20 @@ class RedisFetcher : public InputFetcher {
 
  private:
   
-  RedisFetcher(const std::string& queue_name) : queue_name_(queue_name) {
+  RedisFetcher(size_t batch, absl::Duration lease) : batch_(batch), lease_(lease) {
     input_queue_ = std::make_unique<agd::ReadQueueType>(5);
   };
 
-  std::unique_ptr<sw::redis::Redis> redis_;
-  std::string queue_name_;
+  // claims, and renews the lease and reaps expired ones, each on its own
+  // connection
+  std::unique_ptr<RedisWorkQueue> queue_;
+  std::unique_ptr<RedisWorkQueue> lease_queue_;
+  std::unique_ptr<agd::ResumeFilter> resume_;
+  std::string return_queue_;
+  size_t batch_;
+  absl::Duration lease_;
   std::thread loop_thread_;
+  std::thread lease_thread_;
+  absl::Notification lease_done_;
   volatile bool done_ = false;
-};
\ No newline at end of file
+};
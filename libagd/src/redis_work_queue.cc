@@ -0,0 +1,131 @@
+#include "redis_work_queue.h"
+
+#include <unistd.h>
+
+#include <iterator>
+#include <random>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+
+using namespace sw::redis;
+
+namespace {
+
+// the current time in ms, from the server clock
+#define LUA_NOW_MS \
+  "local t = redis.call('TIME')\n" \
+  "local now = t[1] * 1000 + math.floor(t[2] / 1000)\n"
+
+// KEYS: leases. ARGV: worker, lease ms
+const char kRenewScript[] = LUA_NOW_MS
+    "redis.call('ZADD', KEYS[1], now + tonumber(ARGV[2]), ARGV[1])\n";
+
+// KEYS: queue, processing list, leases. ARGV: max items, worker, lease ms
+const char kClaimScript[] = LUA_NOW_MS
+    "redis.call('ZADD', KEYS[3], now + tonumber(ARGV[3]), ARGV[2])\n"
+    "local items = {}\n"
+    "for i = 1, tonumber(ARGV[1]) do\n"
+    "  local item = redis.call('LMOVE', KEYS[1], KEYS[2], 'LEFT', 'RIGHT')\n"
+    "  if not item then break end\n"
+    "  items[i] = item\n"
+    "end\n"
+    "return items\n";
+
+// KEYS: queue, leases. ARGV: processing list prefix. Moving from the tail
+// to the head keeps the requeued items in order
+const char kReapScript[] = LUA_NOW_MS
+    "local n = 0\n"
+    "for _, worker in ipairs(redis.call('ZRANGEBYSCORE', KEYS[2], '-inf', "
+    "now)) do\n"
+    "  local list = ARGV[1] .. worker\n"
+    "  while redis.call('LMOVE', list, KEYS[1], 'RIGHT', 'LEFT') do\n"
+    "    n = n + 1\n"
+    "  end\n"
+    "  redis.call('ZREM', KEYS[2], worker)\n"
+    "end\n"
+    "return n\n";
+
+// KEYS: processing list, return queue. ARGV: chunk names
+const char kAckScript[] =
+    "local wanted = {}\n"
+    "for _, name in ipairs(ARGV) do wanted[name] = true end\n"
+    "local acked = {}\n"
+    "for _, item in ipairs(redis.call('LRANGE', KEYS[1], 0, -1)) do\n"
+    "  local name = cjson.decode(item)['obj_name']\n"
+    "  if wanted[name] then\n"
+    "    wanted[name] = nil\n"
+    "    redis.call('LREM', KEYS[1], 1, item)\n"
+    "    acked[#acked + 1] = name\n"
+    "  end\n"
+    "end\n"
+    "if #acked > 0 then redis.call('RPUSH', KEYS[2], unpack(acked)) end\n"
+    "return acked\n";
+
+// KEYS: processing list, leases. ARGV: worker
+const char kReleaseScript[] =
+    "if redis.call('LLEN', KEYS[1]) == 0 then\n"
+    "  redis.call('ZREM', KEYS[2], ARGV[1])\n"
+    "end\n";
+
+}  // namespace
+
+RedisWorkQueue::RedisWorkQueue(const std::string& addr,
+                               const std::string& queue_name,
+                               const std::string& worker_id,
+                               absl::Duration lease)
+    : redis_(new Redis(absl::StrCat("tcp://", addr))),
+      queue_(queue_name),
+      processing_(absl::StrCat(queue_name, ":processing:", worker_id)),
+      leases_(absl::StrCat(queue_name, ":leases")),
+      worker_id_(worker_id),
+      lease_ms_(absl::StrCat(absl::ToInt64Milliseconds(lease))) {}
+
+std::string RedisWorkQueue::NewWorkerId() {
+  char host[256] = {0};
+  gethostname(host, sizeof(host) - 1);
+  std::random_device rd;
+  return absl::StrFormat("%s-%d-%08x", host, getpid(), rd());
+}
+
+std::vector<std::string> RedisWorkQueue::Claim(size_t max_items,
+                                               absl::Duration timeout) {
+  std::vector<std::string> items;
+  const auto max = absl::StrCat(max_items);
+  redis_->eval(kClaimScript, {queue_, processing_, leases_},
+               {max, worker_id_, lease_ms_}, std::back_inserter(items));
+  if (!items.empty()) return items;
+
+  // the queue is empty, wait for an item, still moved atomically
+  auto item = redis_->command<OptionalString>(
+      "BLMOVE", queue_, processing_, "LEFT", "RIGHT",
+      absl::StrCat(absl::ToDoubleSeconds(timeout)));
+  if (item) items.push_back(std::move(*item));
+  return items;
+}
+
+void RedisWorkQueue::RenewLease() {
+  redis_->eval<OptionalString>(kRenewScript, {leases_},
+                               {worker_id_, lease_ms_});
+}
+
+long long RedisWorkQueue::ReapExpired() {
+  return redis_->eval<long long>(
+      kReapScript, {queue_, leases_},
+      {absl::StrCat(queue_, ":processing:")});
+}
+
+std::vector<std::string> RedisWorkQueue::Ack(
+    const std::vector<std::string>& names, const std::string& return_queue) {
+  std::vector<std::string> acked;
+  if (names.empty()) return acked;
+  const std::string keys[] = {processing_, return_queue};
+  redis_->eval(kAckScript, std::begin(keys), std::end(keys), names.begin(),
+               names.end(), std::back_inserter(acked));
+  return acked;
+}
+
+void RedisWorkQueue::Release() {
+  redis_->eval<OptionalString>(kReleaseScript, {processing_, leases_},
+                               {worker_id_});
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "src/sw/redis++/redis++.h"
+
+// The reliable work queue protocol on a redis list, shared by RedisFetcher
+// and RedisPusher. A worker claims items by moving them atomically from the
+// queue to its own processing list, and holds a lease it renews while it
+// runs. An item is acked, removed from the processing list, once the results
+// of its chunk are written. Any worker requeues the processing lists of
+// workers whose lease expired, because they died, so no chunk is lost.
+//
+// Keys, for queue name q and worker id w:
+//   q                 pending items, json {"obj_name", "pool"} from
+//                     viralign-push
+//   q:processing:w    items claimed by w and not acked
+//   q:leases          workers, scored by the expiry of their lease in ms
+//
+// Lease times are taken from the redis server clock, so workers' clocks
+// don't matter. Needs redis 6.2 for LMOVE and BLMOVE. Not thread safe, use
+// one per thread.
+class RedisWorkQueue {
+ public:
+  // connect to redis at <host>:<port>
+  RedisWorkQueue(const std::string& addr, const std::string& queue_name,
+                 const std::string& worker_id,
+                 absl::Duration lease = absl::Seconds(30));
+
+  // a worker id unique to this process, also across container restarts
+  static std::string NewWorkerId();
+
+  // claim up to max_items items, waiting up to timeout for one if the queue
+  // is empty, and renew the lease. Empty if none came
+  std::vector<std::string> Claim(size_t max_items, absl::Duration timeout);
+
+  void RenewLease();
+
+  // requeue the items of workers whose lease expired, at the head of the
+  // queue. Returns how many
+  long long ReapExpired();
+
+  // remove the items of chunk names from the processing list and push the
+  // names to return_queue, in one round trip and atomically. Returns the
+  // names acked. Items that are not there were requeued after the lease
+  // expired, their names aren't pushed and whoever finishes the requeued
+  // items returns them
+  std::vector<std::string> Ack(const std::vector<std::string>& names,
+                               const std::string& return_queue);
+
+  // drop the lease if every claimed item was acked. Otherwise the lease
+  // expires and the rest are requeued
+  void Release();
+
+  const std::string& worker_id() const { return worker_id_; }
+
+ private:
+  std::unique_ptr<sw::redis::Redis> redis_;
+  std::string queue_;
+  std::string processing_;
+  std::string leases_;
+  std::string worker_id_;
+  std::string lease_ms_;
+};
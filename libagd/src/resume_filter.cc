@@ -0,0 +1,109 @@
+#include "resume_filter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "crc32c.h"
+
+namespace agd {
+
+using namespace errors;
+
+namespace {
+
+// reads length bytes at offset into buf, returns bytes read or < 0 on errors
+using ReadFunc = std::function<int64_t(char*, size_t, uint64_t)>;
+
+// the header of a chunk of size bytes, and if verify_payload, the payload
+// checked against the header's checksum
+Status CheckChunk(const std::string& name, int64_t size, const ReadFunc& read,
+                  bool verify_payload, format::FileHeader* header) {
+  char buf[sizeof(format::FileHeader)] = {0};
+  int64_t ret = read(buf, sizeof(buf), 0);
+  if (ret < 0) {
+    return Internal("Couldn't read header of ", name, ", error ", ret);
+  }
+  if (ret < static_cast<int64_t>(format::min_header_size)) size = ret;
+  ERR_RETURN_IF_ERROR(format::ReadHeader(buf, size, header));
+  if (!verify_payload) return Status::OK();
+
+  if (!header->HasChecksums()) {
+    return DataLoss(name, " has no checksums, it can't be verified");
+  }
+  std::vector<char> block(1 << 20);
+  uint32_t crc = 0;
+  for (int64_t offset = header->segment_start; offset < size;) {
+    const size_t length = std::min<int64_t>(block.size(), size - offset);
+    ret = read(block.data(), length, offset);
+    if (ret <= 0) {
+      return Internal("Couldn't read ", name, " at ", offset, ", error ", ret);
+    }
+    crc = Crc32c(block.data(), ret, crc);
+    offset += ret;
+  }
+  if (crc != header->payload_crc32c) {
+    return DataLoss(name, " is truncated or corrupt");
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
+Status ResumeFilter::ReadChunk(const ReadQueueItem& item,
+                               const std::string& column, bool verify_payload,
+                               format::FileHeader* header) {
+  if (item.pool.empty()) {
+    auto path = absl::StrCat(item.objName, ".", column);
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return ObjNotFound("Couldn't open ", path, ", errno ", errno);
+    struct stat st;
+    Status s;
+    if (fstat(fd, &st) == 0) {
+      auto read = [fd](char* buf, size_t length, uint64_t offset) -> int64_t {
+        const ssize_t ret = pread(fd, buf, length, offset);
+        return ret < 0 ? -errno : ret;
+      };
+      s = CheckChunk(path, st.st_size, read, verify_payload, header);
+    } else {
+      s = Internal("Couldn't stat ", path, ", errno ", errno);
+    }
+    close(fd);
+    return s;
+  }
+
+  if (!store_) return Unavailable("No object store for pool ", item.pool);
+  // objects are named without the path, like AGDCephReader reads them
+  auto oid = absl::StrCat(
+      item.objName.substr(item.objName.find_last_of('/') + 1), ".", column);
+  const int64_t size = store_->Stat(item.pool, oid)->Wait();
+  if (size < 0) return ObjNotFound("Couldn't stat ", oid, ", error ", size);
+  auto read = [&](char* buf, size_t length, uint64_t offset) {
+    return store_->Read(item.pool, oid, buf, length, offset)->Wait();
+  };
+  return CheckChunk(oid, size, read, verify_payload, header);
+}
+
+bool ResumeFilter::Done(const ReadQueueItem& item) {
+  format::FileHeader header, ref_header;
+  if (!ReadChunk(item, ref_column_, false, &ref_header).ok()) return false;
+  Status s = ReadChunk(item, column_, true, &header);
+  if (!s.ok()) {
+    if (IsDataLoss(s)) {
+      std::cout << "[ResumeFilter] Redoing " << item.objName << ": "
+                << s.error_message() << "\n";
+    }
+    return false;
+  }
+  return header.first_ordinal == ref_header.first_ordinal &&
+         header.last_ordinal == ref_header.last_ordinal;
+}
+
+}  // namespace agd
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "format.h"
+#include "liberr/errors.h"
+#include "object_store.h"
+#include "queue_defs.h"
+
+namespace agd {
+
+// For resuming interrupted runs, whether a chunk already has an output
+// column for the same records as its reference column, whose payload matches
+// its checksum. AGDFileSystemWriter only renames a file into place once it is
+// written, and Ceph replaces objects atomically, but a file can still be
+// truncated or corrupt, e.g. after a crash before it reached the disk.
+// Columns written without checksums can't be verified and are redone.
+class ResumeFilter {
+ public:
+  // store reads the chunks of Ceph pools, without it they are never done
+  explicit ResumeFilter(const std::string& column,
+                        const std::string& ref_column = "base",
+                        std::unique_ptr<ObjectStore> store = nullptr)
+      : column_(column), ref_column_(ref_column), store_(std::move(store)) {}
+
+  // true if the chunk of item has a complete column. Missing, unreadable or
+  // unverifiable columns are not done
+  bool Done(const ReadQueueItem& item);
+
+ private:
+  // read the header of a column of the chunk, and verify the payload
+  // against it if verify_payload
+  errors::Status ReadChunk(const ReadQueueItem& item, const std::string& column,
+                           bool verify_payload, format::FileHeader* header);
+
+  std::string column_;
+  std::string ref_column_;
+  std::unique_ptr<ObjectStore> store_;
+};
+
+}  // namespace agd
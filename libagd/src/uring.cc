@@ -0,0 +1,233 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace agd {
+
+using namespace errors;
+
+namespace {
+
+int SysSetup(unsigned entries, io_uring_params* params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int SysEnter(int fd, unsigned to_submit, unsigned min_complete,
+             unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 nullptr, 0);
+}
+
+int SysRegister(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+template <typename T>
+T* RingField(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+}  // namespace
+
+Status ParseIoEngine(absl::string_view name, IoEngine* engine) {
+  if (name == "sync") {
+    *engine = IoEngine::SYNC;
+  } else if (name == "io_uring") {
+    *engine = IoEngine::IO_URING;
+  } else {
+    return InvalidArgument("Unknown I/O engine ", name,
+                           ", expected sync or io_uring");
+  }
+  return Status::OK();
+}
+
+Status IoUring::Create(unsigned entries, std::unique_ptr<IoUring>& ring) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = SysSetup(entries, &params);
+  if (fd < 0) {
+    return Internal("io_uring_setup failed, errno ", errno);
+  }
+
+  std::unique_ptr<IoUring> r(new IoUring());
+  r->fd_ = fd;
+
+  r->sq_ring_size_ =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  r->cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    r->sq_ring_size_ = r->cq_ring_size_ =
+        std::max(r->sq_ring_size_, r->cq_ring_size_);
+  }
+
+  void* sq = mmap(nullptr, r->sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) {
+    return Internal("Could not map io_uring submission ring, errno ", errno);
+  }
+  r->sq_ring_ = sq;
+
+  void* cq = sq;
+  if (!single_mmap) {
+    cq = mmap(nullptr, r->cq_ring_size_, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) {
+      return Internal("Could not map io_uring completion ring, errno ",
+                      errno);
+    }
+    r->cq_ring_ = cq;
+  }
+
+  r->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, r->sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return Internal("Could not map io_uring submission entries, errno ",
+                    errno);
+  }
+  r->sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  r->sq_head_ = RingField<unsigned>(sq, params.sq_off.head);
+  r->sq_tail_ = RingField<unsigned>(sq, params.sq_off.tail);
+  r->sq_array_ = RingField<unsigned>(sq, params.sq_off.array);
+  r->sq_mask_ = *RingField<unsigned>(sq, params.sq_off.ring_mask);
+  r->sq_entries_ = params.sq_entries;
+  r->cq_head_ = RingField<unsigned>(cq, params.cq_off.head);
+  r->cq_tail_ = RingField<unsigned>(cq, params.cq_off.tail);
+  r->cqes_ = RingField<io_uring_cqe>(cq, params.cq_off.cqes);
+  r->cq_mask_ = *RingField<unsigned>(cq, params.cq_off.ring_mask);
+
+  ring = std::move(r);
+  return Status::OK();
+}
+
+IoUring::~IoUring() {
+  if (sqes_) munmap(sqes_, sqes_size_);
+  if (cq_ring_) munmap(cq_ring_, cq_ring_size_);
+  if (sq_ring_) munmap(sq_ring_, sq_ring_size_);
+  if (fd_ >= 0) close(fd_);
+}
+
+void IoUring::EnableFixedBuffers(unsigned slots) {
+  io_uring_rsrc_register reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.nr = slots;
+  reg.flags = IORING_RSRC_REGISTER_SPARSE;
+  if (SysRegister(fd_, IORING_REGISTER_BUFFERS2, &reg, sizeof(reg)) < 0) {
+    std::cout << "[IoUring] Registered buffers not available (errno " << errno
+              << "), using unregistered buffers\n";
+    return;
+  }
+  fixed_.assign(slots, iovec{nullptr, 0});
+  next_fixed_ = 0;
+}
+
+int IoUring::FixedSlot(char* data, std::size_t capacity) {
+  for (size_t i = 0; i < fixed_.size(); i++) {
+    if (fixed_[i].iov_base == data && fixed_[i].iov_len >= capacity) {
+      return i;
+    }
+  }
+  if (fixed_.empty()) return -1;
+
+  // the kernel keeps a replaced buffer registered until submitted requests
+  // using it complete, so submit queued requests before replacing a slot
+  if (to_submit_ > 0 && !Submit().ok()) return -1;
+  const size_t slot = next_fixed_;
+  iovec iov{data, capacity};
+  io_uring_rsrc_update2 update;
+  memset(&update, 0, sizeof(update));
+  update.offset = slot;
+  update.data = reinterpret_cast<uint64_t>(&iov);
+  update.nr = 1;
+  if (SysRegister(fd_, IORING_REGISTER_BUFFERS_UPDATE, &update,
+                  sizeof(update)) < 0) {
+    // usually RLIMIT_MEMLOCK, don't pin any more
+    std::cout << "[IoUring] Could not register buffer (errno " << errno
+              << "), using unregistered buffers\n";
+    fixed_.clear();
+    return -1;
+  }
+  fixed_[slot] = iov;
+  next_fixed_ = (slot + 1) % fixed_.size();
+  return slot;
+}
+
+io_uring_sqe* IoUring::NextSqe() {
+  const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  const unsigned tail = *sq_tail_;
+  if (tail - head >= sq_entries_) return nullptr;
+  const unsigned idx = tail & sq_mask_;
+  io_uring_sqe* sqe = &sqes_[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[idx] = idx;
+  return sqe;
+}
+
+bool IoUring::PrepareRead(int fd, char* buf, uint32_t size, uint64_t offset,
+                          uint64_t user_data, int buf_slot) {
+  io_uring_sqe* sqe = NextSqe();
+  if (!sqe) return false;
+  sqe->opcode = buf_slot < 0 ? IORING_OP_READ : IORING_OP_READ_FIXED;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = size;
+  sqe->off = offset;
+  sqe->buf_index = buf_slot < 0 ? 0 : buf_slot;
+  sqe->user_data = user_data;
+  __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+  to_submit_++;
+  return true;
+}
+
+bool IoUring::PrepareWrite(int fd, const char* buf, uint32_t size,
+                           uint64_t offset, uint64_t user_data, int buf_slot) {
+  io_uring_sqe* sqe = NextSqe();
+  if (!sqe) return false;
+  sqe->opcode = buf_slot < 0 ? IORING_OP_WRITE : IORING_OP_WRITE_FIXED;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = size;
+  sqe->off = offset;
+  sqe->buf_index = buf_slot < 0 ? 0 : buf_slot;
+  sqe->user_data = user_data;
+  __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+  to_submit_++;
+  return true;
+}
+
+Status IoUring::Submit(unsigned min_complete) {
+  while (true) {
+    int ret = SysEnter(fd_, to_submit_, min_complete,
+                       min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if (ret >= 0) {
+      to_submit_ -= std::min<unsigned>(ret, to_submit_);
+      return Status::OK();
+    }
+    if (errno != EINTR) {
+      return Internal("io_uring_enter failed, errno ", errno);
+    }
+  }
+}
+
+bool IoUring::NextCompletion(uint64_t* user_data, int32_t* res) {
+  const unsigned head = *cq_head_;
+  if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) return false;
+  const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+  *user_data = cqe.user_data;
+  *res = cqe.res;
+  __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+}  // namespace agd
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "liberr/errors.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace agd {
+
+// how AGDFileSystemReader and AGDFileSystemWriter do file I/O.
+//   SYNC      mmap reads, ofstream writes, one file at a time
+//   IO_URING  reads and writes of the columns of several chunks in flight at
+//             once through an io_uring, see IoUring
+enum class IoEngine { SYNC, IO_URING };
+
+// "sync" or "io_uring"
+errors::Status ParseIoEngine(absl::string_view name, IoEngine* engine);
+
+// A minimal io_uring (Linux 5.6+) on the raw syscalls, for one thread.
+// Queue reads and writes with PrepareRead/PrepareWrite, Submit them, and take
+// completions with NextCompletion. Buffers can be registered with the kernel
+// (FixedSlot) so it doesn't pin their pages for each request.
+class IoUring {
+ public:
+  static errors::Status Create(unsigned entries,
+                               std::unique_ptr<IoUring>& ring);
+  ~IoUring();
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  // reserve slots for registered buffers (Linux 5.19+). If the kernel
+  // can't, FixedSlot always returns -1 and requests use unregistered buffers
+  void EnableFixedBuffers(unsigned slots);
+
+  // the registered buffer slot covering [data, data + capacity), registering
+  // it in place of the least recently registered one if needed. Pool buffers
+  // are reused, so after a few chunks this rarely registers anything.
+  // -1 if fixed buffers are disabled
+  int FixedSlot(char* data, std::size_t capacity);
+
+  // queue a read or write of size bytes at offset of fd, returned with
+  // user_data by NextCompletion. buf_slot is a FixedSlot covering buf, or -1.
+  // false if the submission queue is full
+  bool PrepareRead(int fd, char* buf, uint32_t size, uint64_t offset,
+                   uint64_t user_data, int buf_slot = -1);
+  bool PrepareWrite(int fd, const char* buf, uint32_t size, uint64_t offset,
+                    uint64_t user_data, int buf_slot = -1);
+
+  // submit all queued requests and wait until at least min_complete
+  // completions are available
+  errors::Status Submit(unsigned min_complete = 0);
+
+  // take an available completion, res is the syscall result or -errno
+  bool NextCompletion(uint64_t* user_data, int32_t* res);
+
+  unsigned entries() const { return sq_entries_; }
+
+ private:
+  IoUring() = default;
+
+  io_uring_sqe* NextSqe();
+
+  int fd_ = -1;
+  void* sq_ring_ = nullptr;
+  std::size_t sq_ring_size_ = 0;
+  void* cq_ring_ = nullptr;
+  std::size_t cq_ring_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  std::size_t sqes_size_ = 0;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_array_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  io_uring_cqe* cqes_;
+  unsigned cq_mask_;
+
+  unsigned to_submit_ = 0;
+
+  // registered buffers by slot, replaced round robin
+  std::vector<iovec> fixed_;
+  std::size_t next_fixed_ = 0;
+};
+
+}  // namespace agd
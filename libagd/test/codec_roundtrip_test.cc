@@ -0,0 +1,315 @@
+// Compresses column chunks with every codec spec, writes them as AGD chunk
+// files and parses them back with RecordParser, which also verifies the
+// payload and data checksums. Lossy codecs must return what they promise,
+// e.g. the binned scores for quality:bin. Each chunk is written with every
+// index encoding its records allow, and parsed both whole and split into
+// random segments, as AGDCephReader reads large objects in pieces. Corrupt
+// quality headers must be rejected. Exits nonzero on any mismatch.
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "libagd/src/buffer.h"
+#include "libagd/src/buffer_pair.h"
+#include "libagd/src/compacted_bases.h"
+#include "libagd/src/compression.h"
+#include "libagd/src/format.h"
+#include "libagd/src/parser.h"
+#include "libagd/src/quality_codec.h"
+#include "liberr/errors.h"
+
+using namespace agd;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond, msg)                                              \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      std::cerr << "FAILED: " << #cond << ": " << msg << "\n";        \
+      failures++;                                                     \
+      return;                                                         \
+    }                                                                 \
+  } while (0)
+
+std::mt19937 rng(42);
+
+std::vector<std::string> RandomRecords(const std::string& alphabet,
+                                       size_t num_records, size_t min_len,
+                                       size_t max_len) {
+  std::vector<std::string> records(num_records);
+  for (auto& r : records) {
+    size_t len = min_len + rng() % (max_len - min_len + 1);
+    for (size_t i = 0; i < len; i++) {
+      r.push_back(alphabet[rng() % alphabet.size()]);
+    }
+  }
+  return records;
+}
+
+std::string QualityAlphabet() {
+  std::string alphabet;
+  for (char c = '#'; c <= 'J'; c++) alphabet.push_back(c);
+  return alphabet;
+}
+
+std::vector<std::string> ReadNames(size_t num_records) {
+  std::vector<std::string> names;
+  for (size_t i = 0; i < num_records; i++) {
+    names.push_back("SRR1234567." + std::to_string(1000 + i * 3) + " " +
+                    std::to_string(rng() % 2000) + "/1");
+  }
+  return names;
+}
+
+// Illumina names, @instrument:run:flowcell:lane:tile:x:y with a comment.
+// Lane and tile change partway through, x and y are not sorted
+std::vector<std::string> IlluminaNames(size_t num_records) {
+  std::vector<std::string> names;
+  const int tiles[] = {1101, 1102, 2101};
+  for (size_t i = 0; i < num_records; i++) {
+    const size_t lane = 1 + i * 2 / num_records;
+    const int tile = tiles[i * 3 / num_records];
+    names.push_back("@M01234:57:000000000-ABCDE:" + std::to_string(lane) +
+                    ":" + std::to_string(tile) + ":" +
+                    std::to_string(1000 + rng() % 28000) + ":" +
+                    std::to_string(1000 + rng() % 28000) + " 1:N:0:ATCACG");
+  }
+  return names;
+}
+
+// the header compression type of a codec spec. There is no BZIP2 writer
+format::CompressionType SpecType(const std::string& spec) {
+  const std::string codec = spec.substr(0, spec.find(':'));
+  if (codec == "gzip" || codec == "libdeflate") return format::GZIP;
+  if (codec == "zstd") return format::ZSTD;
+  if (codec == "quality") return format::QUALITY;
+  if (codec == "meta") return format::META;
+  return format::UNCOMPRESSED;
+}
+
+// an AGD chunk file of records, compressed with spec, as COMPACTED_BASES if
+// compact_bases
+void WriteChunk(const std::string& spec, bool compact_index,
+                bool compact_bases, const std::vector<std::string>& records,
+                std::string* file, format::FileHeader* header) {
+  Buffer index, data, payload;
+  for (const auto& r : records) {
+    format::RelativeIndex len = r.size();
+    index.AppendBuffer(reinterpret_cast<const char*>(&len), sizeof(len));
+    data.AppendBuffer(r.data(), r.size());
+  }
+  BufferPair compacted;
+  if (compact_bases) {
+    Status s = CompactBaseColumn(index, data, &compacted);
+    if (!s.ok()) {
+      std::cerr << "FAILED: compact bases: " << s.error_message() << "\n";
+      failures++;
+      return;
+    }
+  }
+
+  std::unique_ptr<ChunkCompressor> compressor;
+  Status s = ChunkCompressor::Create(spec, compressor);
+  if (!s.ok()) {
+    std::cerr << "FAILED: create " << spec << ": " << s.error_message()
+              << "\n";
+    failures++;
+    return;
+  }
+  compressor->set_compact_index(compact_index);
+  s = compact_bases
+          ? compressor->Compress(compacted.index(), compacted.data(), &payload)
+          : compressor->Compress(index, data, &payload);
+  if (!s.ok()) {
+    std::cerr << "FAILED: compress " << spec << ": " << s.error_message()
+              << "\n";
+    failures++;
+    return;
+  }
+
+  compressor->FillHeader(header);
+  header->record_type = compact_bases ? format::RecordType::COMPACTED_BASES
+                                      : format::RecordType::TEXT;
+  header->first_ordinal = 1000;
+  header->last_ordinal = 1000 + records.size();
+  memset(header->string_id, 0, sizeof(header->string_id));
+  strncpy(header->string_id, "test", sizeof(header->string_id));
+
+  file->assign(reinterpret_cast<const char*>(header), sizeof(*header));
+  file->append(payload.data(), payload.size());
+}
+
+// file in num_segments random pieces, some smaller than the header
+std::vector<iovec> RandomSplit(std::string& file, size_t num_segments) {
+  std::vector<size_t> cuts;
+  for (size_t i = 1; i < num_segments; i++) {
+    // half the cuts within the first bytes, to split the header too
+    cuts.push_back(rng() % 2 ? rng() % (2 * sizeof(format::FileHeader))
+                             : rng() % file.size());
+  }
+  cuts.push_back(0);
+  cuts.push_back(file.size());
+  std::sort(cuts.begin(), cuts.end());
+  std::vector<iovec> segments;
+  for (size_t i = 1; i < cuts.size(); i++) {
+    // empty pieces too
+    segments.push_back({&file[cuts[i - 1]], cuts[i] - cuts[i - 1]});
+  }
+  return segments;
+}
+
+// records of a parsed chunk
+void CheckParsed(const std::string& what, const Buffer& parsed,
+                 uint64_t first_ordinal, uint32_t num_records,
+                 const std::vector<std::string>& expected) {
+  CHECK(first_ordinal == 1000, what);
+  CHECK(num_records == expected.size(), what);
+  auto index = reinterpret_cast<const format::RelativeIndex*>(parsed.data());
+  const char* data = parsed.data() + num_records * sizeof(*index);
+  for (size_t i = 0; i < expected.size(); i++) {
+    CHECK(std::string(data, index[i]) == expected[i],
+          what << ", record " << i);
+    data += index[i];
+  }
+  CHECK(data == parsed.data() + parsed.size(), what << ", trailing data");
+}
+
+// records written with spec parse back to expected. With compact_index the
+// index must be written in encoding, else as RELATIVE_INDEX
+void Roundtrip(const std::string& spec, bool compact_index,
+               format::IndexEncoding encoding,
+               const std::vector<std::string>& records,
+               const std::vector<std::string>& expected,
+               bool compact_bases = false) {
+  const std::string what = spec + (compact_index ? ", compact index" : "") +
+                           (compact_bases ? ", compacted bases" : "");
+  std::string file;
+  format::FileHeader header;
+  WriteChunk(spec, compact_index, compact_bases, records, &file, &header);
+  if (file.empty()) return;
+  CHECK(header.compression_type == SpecType(spec), what);
+  CHECK(header.GetIndexEncoding() ==
+            (compact_index ? encoding : format::RELATIVE_INDEX),
+        what << ", index encoding " << int(header.index_encoding));
+
+  RecordParser parser;
+  Buffer parsed;
+  uint64_t first_ordinal;
+  uint32_t num_records;
+  std::string record_id;
+  Status s = parser.ParseNew(file.data(), file.size(), true, &parsed,
+                             &first_ordinal, &num_records, record_id);
+  CHECK(s.ok(), what << ": " << s.error_message());
+  CheckParsed(what, parsed, first_ordinal, num_records, expected);
+  CHECK(record_id == "test", what);
+  CHECK(parser.record_type() == format::RecordType::TEXT, what);
+
+  for (size_t num_segments : {2, 3, 8, 32}) {
+    auto segments = RandomSplit(file, num_segments);
+    const std::string split =
+        what + ", " + std::to_string(num_segments) + " segments";
+    s = parser.ParseNew(segments.data(), segments.size(), true, &parsed,
+                        &first_ordinal, &num_records, record_id);
+    CHECK(s.ok(), split << ": " << s.error_message());
+    CheckParsed(split, parsed, first_ordinal, num_records, expected);
+  }
+}
+
+// a quality payload with a corrupt or truncated header must be rejected
+// before the decoder sizes its output from it
+void CorruptQualityHeader(const std::vector<std::string>& records) {
+  Buffer index, data, payload, decoded;
+  for (const auto& r : records) {
+    format::RelativeIndex len = r.size();
+    index.AppendBuffer(reinterpret_cast<const char*>(&len), sizeof(len));
+    data.AppendBuffer(r.data(), r.size());
+  }
+  QualityEncoder encoder(false);
+  Status s = encoder.Encode(index, data, &payload);
+  CHECK(s.ok(), "encode: " << s.error_message());
+
+  QualityDecoder decoder;
+  // num_records and data_size, after version, binned, order and num_symbols
+  const size_t num_records_offset = 8, data_size_offset = 12;
+  std::string corrupt(payload.data(), payload.size());
+  const uint64_t data_size = uint64_t(1) << 40;
+  memcpy(&corrupt[data_size_offset], &data_size, sizeof(data_size));
+  s = decoder.Decode(corrupt.data(), corrupt.size(), &decoded);
+  CHECK(errors::IsInvalidArgument(s),
+        "data_size 2^40: " << s.error_message());
+
+  corrupt.assign(payload.data(), payload.size());
+  const uint32_t num_records = UINT32_MAX;
+  memcpy(&corrupt[num_records_offset], &num_records, sizeof(num_records));
+  s = decoder.Decode(corrupt.data(), corrupt.size(), &decoded);
+  CHECK(errors::IsInvalidArgument(s),
+        "num_records 2^32-1: " << s.error_message());
+
+  s = decoder.Decode(payload.data(), data_size_offset, &decoded);
+  CHECK(!s.ok(), "truncated header decoded");
+
+  s = decoder.Decode(payload.data(), payload.size(), &decoded);
+  CHECK(s.ok(), "intact payload: " << s.error_message());
+}
+
+}  // namespace
+
+int main() {
+  using format::IndexEncoding;
+  // varying lengths are VARINT_DELTA encoded, equal ones CONSTANT_LENGTH
+  const auto bases = RandomRecords("ACGTN", 3000, 50, 151);
+  const auto fixed_bases = RandomRecords("ACGTN", 3000, 150, 150);
+  const auto quals = RandomRecords(QualityAlphabet(), 3000, 50, 151);
+  const auto fixed_quals = RandomRecords(QualityAlphabet(), 3000, 150, 150);
+  const auto names = ReadNames(3000);
+  const auto illumina_names = IlluminaNames(3000);
+
+  auto binned = quals;
+  for (auto& r : binned) {
+    for (auto& q : r) q = BinQuality(q);
+  }
+
+  for (bool compact : {false, true}) {
+    for (const char* spec : {"gzip", "gzip:1", "libdeflate", "libdeflate:12",
+                             "zstd", "zstd:19", "none"}) {
+      Roundtrip(spec, compact, IndexEncoding::VARINT_DELTA, bases, bases);
+      Roundtrip(spec, compact, IndexEncoding::CONSTANT_LENGTH, fixed_bases,
+                fixed_bases);
+      Roundtrip(spec, compact, IndexEncoding::VARINT_DELTA, quals, quals);
+      Roundtrip(spec, compact, IndexEncoding::VARINT_DELTA, bases, bases,
+                true);
+      Roundtrip(spec, compact, IndexEncoding::CONSTANT_LENGTH, fixed_bases,
+                fixed_bases, true);
+    }
+    // the quality and meta codecs store record lengths themselves, their
+    // header index is always RELATIVE_INDEX
+    Roundtrip("quality", compact, IndexEncoding::RELATIVE_INDEX, quals, quals);
+    Roundtrip("quality", compact, IndexEncoding::RELATIVE_INDEX, fixed_quals,
+              fixed_quals);
+    // lossy, decodes to the binned scores, which the checksum must cover
+    Roundtrip("quality:bin", compact, IndexEncoding::RELATIVE_INDEX, quals,
+              binned);
+    Roundtrip("meta", compact, IndexEncoding::RELATIVE_INDEX, names, names);
+    Roundtrip("meta:19", compact, IndexEncoding::RELATIVE_INDEX, names, names);
+    Roundtrip("meta", compact, IndexEncoding::RELATIVE_INDEX, illumina_names,
+              illumina_names);
+    Roundtrip("meta:19", compact, IndexEncoding::RELATIVE_INDEX,
+              illumina_names, illumina_names);
+  }
+  CorruptQualityHeader(quals);
+
+  if (failures > 0) {
+    std::cerr << failures << " failures\n";
+    return 1;
+  }
+  std::cout << "all codecs roundtrip\n";
+  return 0;
+}
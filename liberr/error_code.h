@@ -9,7 +9,8 @@ enum Code {
   INTERNAL,
   NOT_FOUND,
   INVALID_ARGUMENT,
-  UNAVAILABLE
+  UNAVAILABLE,
+  DATA_LOSS
 };
 
 }  // namespace errors
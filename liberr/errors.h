@@ -108,7 +108,7 @@ DECLARE_ERROR(OutOfRange, OUT_OF_RANGE)
 DECLARE_ERROR(Internal, INTERNAL)
 //DECLARE_ERROR(Aborted, ABORTED)
 //DECLARE_ERROR(DeadlineExceeded, DEADLINE_EXCEEDED)
-//DECLARE_ERROR(DataLoss, DATA_LOSS)
+DECLARE_ERROR(DataLoss, DATA_LOSS)
 DECLARE_ERROR(Unknown, UNKNOWN)
 //DECLARE_ERROR(PermissionDenied, PERMISSION_DENIED)
 //DECLARE_ERROR(Unauthenticated, UNAUTHENTICATED)
@@ -99,9 +99,9 @@ string Status::ToString() const {
       case errors::UNAVAILABLE:
         type = "Unavailable";
         break;
-      /*case tensorflow::error::DATA_LOSS:
+      case errors::DATA_LOSS:
         type = "Data loss";
-        break;*/
+        break;
       default:
         snprintf(tmp, sizeof(tmp), "Unknown code(%d)",
                  static_cast<int>(code()));
@@ -116,7 +116,8 @@ Status SampleSeparator::Separate(const BarcodeMap& barcode_map) {
       auto out_dir = absl::StrCat(output_dir_, name, "/");
 
       ERR_RETURN_IF_ERROR(agd::DatasetWriter::CreateDatasetWriter(
-          1, 1, name, out_dir, {"base", "qual", "meta"}, writer, &buf_pool_));
+          1, 1, name, out_dir, {"base", "qual", "meta"}, writer, &buf_pool_,
+          codecs_));
 
       writer_map_.insert_or_assign(sample_key, std::move(writer));
     }
@@ -18,13 +18,16 @@ class SampleSeparator {
 
   SampleSeparator(FastqParser* fastq_parser, FastqParser* sample_fastq_parser,
                   size_t chunk_size, const std::string& output_dir,
-                  BarcodeIndices indices)
+                  BarcodeIndices indices, bool compact_bases = false,
+                  bool compact_index = false)
       : fastq_parser_(fastq_parser),
         sample_fastq_parser_(sample_fastq_parser),
         chunk_size_(chunk_size),
         output_dir_(output_dir),
         barcode_indices_(indices) {
     barcode_length_ = indices.second - indices.first;
+    codecs_.set_compact_bases(compact_bases);
+    codecs_.set_compact_index(compact_index);
   }
 
   Status Separate(const BarcodeMap& barcode_map);
@@ -60,6 +63,7 @@ class SampleSeparator {
 
   size_t chunk_size_;
   std::string output_dir_;
+  agd::ColumnCodecs codecs_;
 
   BarcodeIndices barcode_indices_;
   uint32_t barcode_length_;
@@ -75,6 +75,16 @@ int main(int argc, char **argv) {
   args::ValueFlag<unsigned int> chunk_size_arg(parser, "chunksize",
                                                "AGD output chunk size [100000]",
                                                {'c', "chunksize"});
+  args::Flag compact_bases_arg(
+      parser, "compact bases",
+      "Store bases packed 3 bits per base (COMPACTED_BASES) instead of text",
+      {"compact_bases"});
+  args::Flag compact_index_arg(
+      parser, "compact index",
+      "Store the record index of chunks whose records are (nearly) the same "
+      "length as a single length or varint deltas. Needs readers of format "
+      "version 0.2",
+      {"compact_index"});
   args::PositionalList<std::string> fastq_files(parser, "data and sample",
                                                 "Sample/barcode first, then reads");
 
@@ -133,7 +143,9 @@ int main(int argc, char **argv) {
 
   SampleSeparator::BarcodeIndices indices = std::make_pair(0, barcode_len);
   SampleSeparator separator(&read_parser, &sample_parser, chunk_size,
-                            output_dir, indices);
+                            output_dir, indices,
+                            args::get(compact_bases_arg),
+                            args::get(compact_index_arg));
 
   s = separator.Separate(barcode_map);
 
@@ -1,7 +1,6 @@
 import argparse
 import subprocess
 import os
-import redis
 import json
 
 def count_chunks(metadata_path):
@@ -11,7 +10,7 @@ def count_chunks(metadata_path):
         
 def main():
     parser = argparse.ArgumentParser(
-        description="Tool to easily run the viralign pipeline. Assumes Redis server and viralign-core containers are already running."
+        description="Tool to easily run the viralign pipeline. Assumes Redis server and viralign-core containers are already running, unless --local_genome is given."
     )
     parser.add_argument("barcodes", help="The input multiplexed fastq dataset barcodes")
     parser.add_argument("reads", help="The input multiplexed fastq dataset reads")
@@ -48,6 +47,12 @@ def main():
         default="",
         help="The GTF file defining the genes to map reads to",
     )
+    parser.add_argument(
+        "-L",
+        "--local_genome",
+        default="",
+        help="SNAP genome index location. Align on this host with one viralign-core, without Redis",
+    )
     parser.add_argument(
         "-o",
         "--output_dir",
@@ -86,13 +91,6 @@ def main():
     total_chunks = 0
     datasets = []
     
-    host, port = args.redis_addr.split(':')
-
-    print("[viralign] Connecting to redis server at {}:{}".format(host, port))
-
-    r = redis.Redis(host=host, port=int(port))
-    r.delete(args.queue_name) # clear the queue / list
-
     with open("samplesep_datasets.csv") as f:
         lines = f.readlines()
         # first line is Name, Path
@@ -110,22 +108,40 @@ def main():
                 chunks = count_chunks(metadata_path)
                 total_chunks += chunks
                 print("[viralign] Pushing dataset {} to alignment, had {} chunks".format(metadata_path, chunks))
-                push_cmd = ["./bazel-bin/viralign_push/viralign-push", "-r", args.redis_addr, "-q", args.queue_name, metadata_path]
-                print("[viralign] Push cmd: {}".format(push_cmd))
                 datasets.append(metadata_path)
-                subprocess.run(push_cmd)
 
     print("[viralign] All datasets: {}".format(datasets))
 
-    return_queue = args.queue_name + "_return"
-    for c in range(total_chunks):
-        resp, other = r.blpop(return_queue)
-        print("[viralign] Got alignment response {}, {}".format(resp, other))
+    with open("aligned_datasets.json", "w") as f:
+        json.dump(datasets, f)
 
-    print("[viralign] All chunks aligned.")
+    if args.local_genome:
+        # one pipeline for all datasets, each is finished as soon as its
+        # chunks are aligned
+        core_cmd = ["./bazel-bin/viralign_core/viralign-core", "-g", args.local_genome, "--input_list", "aligned_datasets.json"]
+        print("[viralign] Core cmd: {}".format(core_cmd))
+        subprocess.run(core_cmd)
+    else:
+        import redis
 
-    with open("aligned_datasets.json") as f:
-        json.dump(datasets, f)
+        host, port = args.redis_addr.split(':')
+
+        print("[viralign] Connecting to redis server at {}:{}".format(host, port))
+
+        r = redis.Redis(host=host, port=int(port))
+        r.delete(args.queue_name) # clear the queue / list
+
+        # one push for all datasets, batched
+        push_cmd = ["./bazel-bin/viralign_push/viralign-push", "-r", args.redis_addr, "-q", args.queue_name] + datasets
+        print("[viralign] Push cmd: {}".format(push_cmd))
+        subprocess.run(push_cmd)
+
+        return_queue = args.queue_name + "_return"
+        for c in range(total_chunks):
+            resp, other = r.blpop(return_queue)
+            print("[viralign] Got alignment response {}, {}".format(resp, other))
+
+    print("[viralign] All chunks aligned.")
 
     # count covid genes
     # call viralign genecount 
@@ -0,0 +1,215 @@
+#include "alignment_cache.h"
+
+#include <cstring>
+
+using namespace errors;
+
+namespace {
+
+inline uint64_t Mix(uint64_t x) {
+  // splitmix64 finalizer
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// two independently seeded and combined 64 bit lanes
+struct Hasher {
+  uint64_t a = 0x243f6a8885a308d3ULL;
+  uint64_t b = 0x13198a2e03707344ULL;
+
+  void Add(uint64_t w) {
+    a = Mix(a ^ w);
+    b = Mix(b + w * 0x9e3779b97f4a7c15ULL);
+  }
+
+  void Add(const char* data, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+      uint64_t w;
+      memcpy(&w, data + i, 8);
+      Add(w);
+    }
+    if (i < len) {
+      uint64_t w = 0;
+      memcpy(&w, data + i, len - i);
+      Add(w);
+    }
+  }
+};
+
+}  // namespace
+
+Status AlignmentCache::Create(size_t max_bytes,
+                              std::unique_ptr<AlignmentCache>& cache) {
+  const size_t shard_bytes = max_bytes / kNumShards;
+  if (shard_bytes < 16 * (sizeof(Entry) + 64)) {
+    return InvalidArgument("[AlignmentCache] ", max_bytes,
+                           " bytes is too small for a cache of ", kNumShards,
+                           " shards");
+  }
+  cache.reset(new AlignmentCache(shard_bytes));
+  // reserved, not touched, so address space only until entries are added.
+  // Entries are then never moved and the clock hand can sweep the vector
+  for (auto& shard : cache->shards_) {
+    shard.entries.reserve(shard_bytes / EntryBytes(Entry()) + 1);
+  }
+  return Status::OK();
+}
+
+AlignmentCache::Key AlignmentCache::MakeKey(const char* const* bases,
+                                            const char* const* quals,
+                                            const size_t* lens,
+                                            int num_reads) {
+  Hasher h;
+  h.Add(num_reads);
+  for (int i = 0; i < num_reads; i++) {
+    h.Add(lens[i]);
+    h.Add(bases[i], lens[i]);
+    h.Add(quals[i], lens[i]);
+  }
+  return {h.a, h.b};
+}
+
+size_t AlignmentCache::EntryBytes(const Entry& entry) {
+  // map slot and control byte, and any cigar too long for the string itself
+  size_t bytes = sizeof(Entry) + sizeof(Key) + sizeof(uint32_t) + 1;
+  for (const auto& cigar : entry.cigars) {
+    if (cigar.size() >= sizeof(std::string)) bytes += cigar.capacity() + 1;
+  }
+  return bytes;
+}
+
+bool AlignmentCache::Lookup(const Key& key, int num_reads,
+                            agd::format::BinaryAlignment* results,
+                            std::string* cigars) {
+  Shard& shard = ShardFor(key);
+  absl::MutexLock l(&shard.mu);
+  auto it = shard.slots.find(key);
+  if (it == shard.slots.end()) {
+    shard.misses++;
+    return false;
+  }
+  Entry& entry = shard.entries[it->second];
+  if (entry.num_reads != num_reads) {
+    shard.misses++;
+    return false;
+  }
+  entry.referenced = true;
+  for (int i = 0; i < num_reads; i++) {
+    results[i] = entry.results[i];
+    cigars[i] = entry.cigars[i];
+  }
+  shard.hits++;
+  return true;
+}
+
+void AlignmentCache::Insert(const Key& key, int num_reads,
+                            const agd::format::BinaryAlignment* results,
+                            const std::string* cigars) {
+  Shard& shard = ShardFor(key);
+  absl::MutexLock l(&shard.mu);
+  // another thread aligned the same read meanwhile
+  if (shard.slots.contains(key)) return;
+
+  uint32_t slot;
+  if (!shard.free.empty()) {
+    slot = shard.free.back();
+    shard.free.pop_back();
+  } else {
+    slot = shard.entries.size();
+    shard.entries.emplace_back();
+  }
+  Entry& entry = shard.entries[slot];
+  entry.key = key;
+  entry.num_reads = num_reads;
+  entry.used = true;
+  entry.referenced = false;
+  for (int i = 0; i < num_reads; i++) {
+    entry.results[i] = results[i];
+    entry.cigars[i] = cigars[i];
+  }
+  const size_t entry_bytes = EntryBytes(entry);
+  // keep the new entry out of the sweep until there's room for it
+  shard.bytes += entry_bytes;
+  entry.used = false;
+  while (shard.bytes > shard_bytes_ && !shard.slots.empty()) {
+    EvictOne(shard);
+  }
+  if (shard.bytes > shard_bytes_) {
+    // larger than the whole shard
+    shard.bytes -= entry_bytes;
+    entry = Entry();
+    shard.free.push_back(slot);
+    return;
+  }
+  entry.used = true;
+  shard.slots.emplace(key, slot);
+}
+
+void AlignmentCache::EvictOne(Shard& shard) {
+  while (true) {
+    if (shard.hand >= shard.entries.size()) shard.hand = 0;
+    Entry& entry = shard.entries[shard.hand];
+    const uint32_t slot = shard.hand++;
+    if (!entry.used) continue;
+    if (entry.referenced) {
+      entry.referenced = false;
+      continue;
+    }
+    shard.bytes -= EntryBytes(entry);
+    shard.slots.erase(entry.key);
+    entry = Entry();
+    shard.free.push_back(slot);
+    shard.evictions++;
+    return;
+  }
+}
+
+uint64_t AlignmentCache::hits() const {
+  uint64_t n = 0;
+  for (const auto& shard : shards_) {
+    absl::MutexLock l(&shard.mu);
+    n += shard.hits;
+  }
+  return n;
+}
+
+uint64_t AlignmentCache::misses() const {
+  uint64_t n = 0;
+  for (const auto& shard : shards_) {
+    absl::MutexLock l(&shard.mu);
+    n += shard.misses;
+  }
+  return n;
+}
+
+uint64_t AlignmentCache::evictions() const {
+  uint64_t n = 0;
+  for (const auto& shard : shards_) {
+    absl::MutexLock l(&shard.mu);
+    n += shard.evictions;
+  }
+  return n;
+}
+
+size_t AlignmentCache::NumEntries() const {
+  size_t n = 0;
+  for (const auto& shard : shards_) {
+    absl::MutexLock l(&shard.mu);
+    n += shard.slots.size();
+  }
+  return n;
+}
+
+size_t AlignmentCache::SizeBytes() const {
+  size_t n = 0;
+  for (const auto& shard : shards_) {
+    absl::MutexLock l(&shard.mu);
+    n += shard.bytes;
+  }
+  return n;
+}
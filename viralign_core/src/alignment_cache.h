@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "libagd/src/format.h"
+#include "liberr/errors.h"
+
+// Caches the alignment results of reads (or pairs) so duplicate reads, very
+// common in e.g. BRB-seq libraries, cost a hash lookup instead of an
+// alignment. Reads are keyed by a 128 bit hash of their bases and
+// qualities: SNAP clips reads on their qualities and scores mismatches with
+// them into the MAPQ, so reads with equal bases but different qualities can
+// align differently. A cache is only valid for one index and set of aligner
+// options. Memory is bounded, entries are evicted with the clock algorithm
+// so frequently seen reads stay. Thread safe, the cache is split into shards
+// with a lock each.
+class AlignmentCache {
+ public:
+  struct Key {
+    uint64_t lo, hi;
+
+    friend bool operator==(const Key& a, const Key& b) {
+      return a.lo == b.lo && a.hi == b.hi;
+    }
+    template <typename H>
+    friend H AbslHashValue(H h, const Key& k) {
+      return H::combine(std::move(h), k.lo, k.hi);
+    }
+  };
+
+  // max_bytes bounds the memory of the cached entries, roughly
+  static errors::Status Create(size_t max_bytes,
+                               std::unique_ptr<AlignmentCache>& cache);
+
+  // key of num_reads reads, at most 2, each of lens[i] bases and qualities
+  static Key MakeKey(const char* const* bases, const char* const* quals,
+                     const size_t* lens, int num_reads);
+
+  // if key is cached, copy its results and cigars for num_reads reads
+  bool Lookup(const Key& key, int num_reads,
+              agd::format::BinaryAlignment* results, std::string* cigars);
+
+  // cache the results and cigars of num_reads reads, evicting others if full
+  void Insert(const Key& key, int num_reads,
+              const agd::format::BinaryAlignment* results,
+              const std::string* cigars);
+
+  uint64_t hits() const;
+  uint64_t misses() const;
+  uint64_t evictions() const;
+  size_t NumEntries() const;
+  size_t SizeBytes() const;
+
+ private:
+  static constexpr size_t kNumShards = 64;
+
+  struct Entry {
+    Key key;
+    uint8_t num_reads = 0;
+    bool used = false;
+    // set on hits, cleared as the clock hand passes
+    bool referenced = false;
+    agd::format::BinaryAlignment results[2];
+    std::string cigars[2];
+  };
+
+  struct alignas(64) Shard {
+    mutable absl::Mutex mu;
+    absl::flat_hash_map<Key, uint32_t> slots;
+    std::vector<Entry> entries;
+    std::vector<uint32_t> free;
+    size_t hand = 0;
+    size_t bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+  };
+
+  explicit AlignmentCache(size_t shard_bytes) : shard_bytes_(shard_bytes) {}
+
+  Shard& ShardFor(const Key& key) { return shards_[key.hi >> 58]; }
+
+  // about the memory an entry takes, with its map slot
+  static size_t EntryBytes(const Entry& entry);
+
+  // evict the next entry the clock hand finds unreferenced
+  void EvictOne(Shard& shard);
+
+  size_t shard_bytes_;
+  Shard shards_[kNumShards];
+};
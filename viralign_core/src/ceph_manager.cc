@@ -7,6 +7,7 @@
 
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
+#include "libagd/src/metrics.h"
 #include "json.hpp"
 #include "libagd/src/agd_ceph_reader.h"
 #include "libagd/src/agd_ceph_writer.h"
@@ -37,31 +38,45 @@ Status CephManager::Run(const CephManagerParams& params) {
   std::unique_ptr<agd::AGDCephReader> reader;
   ERR_RETURN_IF_ERROR(agd::AGDCephReader::Create(
       columns, cluster_name, username, name_space, ceph_conf_file,
-      params.input_queue, params.reader_threads, buf_pool, reader));
+      params.input_queue, params.reader_threads, buf_pool, reader,
+      !params.packed_bases));
 
   auto chunk_queue = reader->GetOutputQueue();
 
   std::unique_ptr<ParallelAligner> aligner;
 
   ERR_RETURN_IF_ERROR(ParallelAligner::Create(/*threads*/ params.aligner_threads, params.index, params.options,
-                                              chunk_queue, params.filter_contig_index, aligner));
+                                              chunk_queue, params.targets,
+                                              params.kmer_filter,
+                                              params.binary_output, params.paired,
+                                              aligner, params.aln_cache));
 
   auto aln_queue = aligner->GetOutputQueue();
 
   std::unique_ptr<agd::AGDCephWriter> writer;
   ERR_RETURN_IF_ERROR(agd::AGDCephWriter::Create(
     {"aln"}, cluster_name, username, name_space, ceph_conf_file,
-    aln_queue, params.writer_threads, buf_pool, writer));
+    aln_queue, params.writer_threads, buf_pool, *params.codecs, writer));
+
+  agd::ScopedQueueMetrics queue_metrics;
+  queue_metrics.Add("input", params.input_queue);
+  queue_metrics.Add("chunk", chunk_queue);
+  queue_metrics.Add("aligned", aln_queue);
+  queue_metrics.Add("written", writer->GetOutputQueue());
 
   if (params.max_records > 0) {
-    while (writer->GetNumWritten() != params.max_records) {
-      std::this_thread::sleep_for(500ms);
+    // the fetcher closes the input queue once all chunks are queued, the
+    // pipeline then drains and closes the writer output
+    agd::OutputQueueItem item;
+    while (writer->GetOutputQueue()->pop(item)) {
+      if (params.chunk_written) params.chunk_written(item);
     }
   } else {
-    // else run forever and 
-    // TODO respond to stop signals
-    RedisPusher pusher(writer->GetOutputQueue(), params.redis_addr, params.queue_name);
-    pusher.Run(); // never stops
+    // runs until the fetcher is stopped and the pipeline drains
+    RedisPusher pusher(writer->GetOutputQueue(), params.redis_addr,
+                       params.queue_name, params.work_queue_name,
+                       params.worker_id);
+    pusher.Run();
   }
 
   reader->Stop();
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <functional>
+
 #include "libagd/src/agd_record_reader.h"
+#include "libagd/src/compression.h"
 #include "liberr/errors.h"
 #include "parallel_aligner.h"
 
@@ -8,14 +11,28 @@ struct CephManagerParams {
   agd::ReadQueueType* input_queue;
   uint32_t max_records;
   absl::string_view ceph_config_json_path;
-  int filter_contig_index;
+  const TargetSet* targets;
+  const KmerFilter* kmer_filter;
+  // duplicate reads get the cached alignment, if not null
+  AlignmentCache* aln_cache = nullptr;
+  bool binary_output;
+  const agd::ColumnCodecs* codecs;
+  // hand compacted bases to the aligner packed
+  bool packed_bases;
+  bool paired;
   GenomeIndex* index;
   AlignerOptions* options;
   size_t aligner_threads;
   size_t reader_threads;
   size_t writer_threads;
   absl::string_view redis_addr;
+  // return queue for completed chunk names
   absl::string_view queue_name;
+  // the RedisFetcher's queue and worker, to ack chunks with
+  absl::string_view work_queue_name;
+  absl::string_view worker_id;
+  // with max_records, called for each chunk once it is written
+  std::function<void(const agd::OutputQueueItem&)> chunk_written;
 };
 
 class CephManager {
@@ -7,6 +7,7 @@
 
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
+#include "libagd/src/metrics.h"
 #include "snap-master/SNAPLib/Bam.h"
 #include "snap-master/SNAPLib/Read.h"
 
@@ -20,30 +21,45 @@ Status FileSystemManager::Run(const FileSystemManagerParams& params) {
   agd::ObjectPool<agd::Buffer> buf_pool;
   std::unique_ptr<agd::AGDFileSystemReader> reader;
   ERR_RETURN_IF_ERROR(agd::AGDFileSystemReader::Create(
-      columns, params.input_queue, params.reader_threads, buf_pool, reader));
+      columns, params.input_queue, params.reader_threads, buf_pool, reader,
+      !params.packed_bases, params.io_engine));
 
   auto chunk_queue = reader->GetOutputQueue();
 
   std::unique_ptr<ParallelAligner> aligner;
 
   ERR_RETURN_IF_ERROR(ParallelAligner::Create(params.aligner_threads, params.index, params.options,
-                                              chunk_queue, params.filter_contig_index, aligner));
+                                              chunk_queue, params.targets,
+                                              params.kmer_filter,
+                                              params.binary_output, params.paired,
+                                              aligner, params.aln_cache));
 
   auto aln_queue = aligner->GetOutputQueue();
 
   std::unique_ptr<agd::AGDFileSystemWriter> writer;
-  ERR_RETURN_IF_ERROR(agd::AGDFileSystemWriter::Create({"aln"}, aln_queue, 10,
-                                                       buf_pool, writer));
+  ERR_RETURN_IF_ERROR(agd::AGDFileSystemWriter::Create(
+      {"aln"}, aln_queue, 10, buf_pool, *params.codecs, writer,
+      params.io_engine));
+
+  agd::ScopedQueueMetrics queue_metrics;
+  queue_metrics.Add("input", params.input_queue);
+  queue_metrics.Add("chunk", chunk_queue);
+  queue_metrics.Add("aligned", aln_queue);
+  queue_metrics.Add("written", writer->GetOutputQueue());
 
   if (params.max_records > 0) {
-    while (writer->GetNumWritten() != params.max_records) {
-      std::this_thread::sleep_for(500ms);
+    // the fetcher closes the input queue once all chunks are queued, the
+    // pipeline then drains and closes the writer output
+    agd::OutputQueueItem item;
+    while (writer->GetOutputQueue()->pop(item)) {
+      if (params.chunk_written) params.chunk_written(item);
     }
   } else {
-    // else run forever 
-    // TODO respond to stop signals
-    RedisPusher pusher(writer->GetOutputQueue(), params.redis_addr, params.queue_name);
-    pusher.Run(); // never stops
+    // runs until the fetcher is stopped and the pipeline drains
+    RedisPusher pusher(writer->GetOutputQueue(), params.redis_addr,
+                       params.queue_name, params.work_queue_name,
+                       params.worker_id);
+    pusher.Run();
   }
 
   reader->Stop();
@@ -0,0 +1,124 @@
+#include "kmer_filter.h"
+
+#include <algorithm>
+#include <array>
+
+using namespace errors;
+
+namespace {
+
+// 2 bit base codes, 4 for anything that is not ACGT
+const std::array<uint8_t, 256> kBaseCodes = [] {
+  std::array<uint8_t, 256> codes;
+  codes.fill(4);
+  codes['A'] = codes['a'] = 0;
+  codes['C'] = codes['c'] = 1;
+  codes['G'] = codes['g'] = 2;
+  codes['T'] = codes['t'] = 3;
+  return codes;
+}();
+
+inline uint64_t Mix(uint64_t x) {
+  // splitmix64 finalizer
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// call f with each canonical k-mer in bases, k-mers containing a non ACGT
+// base are skipped. Stops early if f returns false.
+template <typename F>
+void ForEachKmer(const char* bases, size_t len, uint32_t k, F&& f) {
+  const uint64_t mask = (k == 32) ? ~0ULL : (1ULL << (2 * k)) - 1;
+  const uint32_t rc_shift = 2 * (k - 1);
+  uint64_t fwd = 0, rev = 0;
+  uint32_t valid = 0;
+  for (size_t i = 0; i < len; i++) {
+    uint64_t c = kBaseCodes[static_cast<uint8_t>(bases[i])];
+    if (c > 3) {
+      valid = 0;
+      continue;
+    }
+    fwd = ((fwd << 2) | c) & mask;
+    rev = (rev >> 2) | ((3 - c) << rc_shift);
+    if (++valid >= k) {
+      if (!f(std::min(fwd, rev))) return;
+    }
+  }
+}
+
+}  // namespace
+
+Status KmerFilter::Create(const Genome* genome, const std::vector<int>& contigs,
+                          uint32_t k, uint32_t min_hits,
+                          std::unique_ptr<KmerFilter>& filter) {
+  if (k == 0 || k > 32) {
+    return InvalidArgument("k-mer size must be in [1, 32], got ", k);
+  }
+  if (contigs.empty()) {
+    return InvalidArgument("k-mer filter needs at least one target contig");
+  }
+
+  const Genome::Contig* genome_contigs = genome->getContigs();
+  auto num_contigs = genome->getNumContigs();
+
+  size_t total_kmers = 0;
+  for (auto c : contigs) {
+    if (c < 0 || c >= num_contigs) {
+      return InvalidArgument("Invalid contig index for k-mer filter: ", c);
+    }
+    if (genome_contigs[c].length >= k) {
+      total_kmers += genome_contigs[c].length - k + 1;
+    }
+  }
+
+  filter.reset(new KmerFilter(k, min_hits == 0 ? 1 : min_hits));
+  size_t num_words = 1;
+  while (num_words * 64 < total_kmers * kBitsPerKmer) num_words <<= 1;
+  filter->words_.resize(num_words, 0);
+  filter->word_mask_ = num_words - 1;
+
+  for (auto c : contigs) {
+    const auto& contig = genome_contigs[c];
+    const char* bases =
+        genome->getSubstring(contig.beginningLocation, contig.length);
+    if (bases == nullptr) {
+      return Internal("Could not get bases for contig ",
+                      std::string(contig.name, contig.nameLength));
+    }
+    ForEachKmer(bases, contig.length, k, [&filter](uint64_t kmer) {
+      filter->Insert(kmer);
+      return true;
+    });
+  }
+  filter->num_kmers_ = total_kmers;
+
+  return Status::OK();
+}
+
+void KmerFilter::Insert(uint64_t kmer) {
+  uint64_t h = Mix(kmer);
+  uint64_t& word = words_[h & word_mask_];
+  // 3 probes within the word from the high bits of the hash
+  word |= (1ULL << ((h >> 40) & 63)) | (1ULL << ((h >> 46) & 63)) |
+          (1ULL << ((h >> 52) & 63));
+}
+
+bool KmerFilter::Contains(uint64_t kmer) const {
+  uint64_t h = Mix(kmer);
+  uint64_t probes = (1ULL << ((h >> 40) & 63)) | (1ULL << ((h >> 46) & 63)) |
+                    (1ULL << ((h >> 52) & 63));
+  return (words_[h & word_mask_] & probes) == probes;
+}
+
+bool KmerFilter::Screen(const char* bases, size_t len) const {
+  uint32_t hits = 0;
+  ForEachKmer(bases, len, k_, [this, &hits](uint64_t kmer) {
+    if (Contains(kmer)) hits++;
+    return hits < min_hits_;
+  });
+  return hits >= min_hits_;
+}
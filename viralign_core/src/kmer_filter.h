@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "liberr/errors.h"
+#include "snap-master/SNAPLib/Genome.h"
+
+// Screens reads before alignment by looking up their k-mers in a compact
+// bloom filter built from the target contig(s). Reads sharing fewer than
+// min_hits k-mers with the targets cannot map to them and can skip SNAP.
+// k-mers are canonical (the min of the k-mer and its reverse complement), so
+// reads from either strand pass. False positives only cost an alignment.
+// Thread safe once created, Screen() is read only.
+class KmerFilter {
+ public:
+  static errors::Status Create(const Genome* genome,
+                               const std::vector<int>& contigs, uint32_t k,
+                               uint32_t min_hits,
+                               std::unique_ptr<KmerFilter>& filter);
+
+  // true if the read may map to one of the target contigs
+  bool Screen(const char* bases, size_t len) const;
+
+  size_t NumKmers() const { return num_kmers_; }
+  size_t SizeBytes() const { return words_.size() * sizeof(uint64_t); }
+
+ private:
+  KmerFilter(uint32_t k, uint32_t min_hits) : k_(k), min_hits_(min_hits) {}
+
+  void Insert(uint64_t kmer);
+  bool Contains(uint64_t kmer) const;
+
+  // bloom bits per target k-mer, gives a false positive rate around 1e-4
+  static constexpr size_t kBitsPerKmer = 64;
+
+  uint32_t k_;
+  uint32_t min_hits_;
+  size_t num_kmers_ = 0;
+  // all probes for a k-mer fall in the same word, one cache miss per lookup
+  std::vector<uint64_t> words_;
+  uint64_t word_mask_ = 0;
+};
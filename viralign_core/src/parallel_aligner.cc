@@ -5,6 +5,7 @@
 
 #include "libagd/src/agd_record_reader.h"
 #include "libagd/src/column_builder.h"
+#include "libagd/src/compacted_bases.h"
 
 using namespace std::chrono_literals;
 using namespace errors;
@@ -12,27 +13,51 @@ using namespace errors;
 Status ParallelAligner::Create(size_t threads, GenomeIndex* index,
                                AlignerOptions* options,
                                InputQueueType* input_queue,
-                               int filter_contig_index,
-                               std::unique_ptr<ParallelAligner>& aligner) {
-  aligner.reset(
-      new ParallelAligner(index, options, input_queue, filter_contig_index));
+                               const TargetSet* targets,
+                               const KmerFilter* kmer_filter,
+                               bool binary_output, bool paired,
+                               std::unique_ptr<ParallelAligner>& aligner,
+                               AlignmentCache* cache) {
+  aligner.reset(new ParallelAligner(index, options, input_queue,
+                                    targets, kmer_filter,
+                                    binary_output, paired, cache));
   ERR_RETURN_IF_ERROR(aligner->Init(threads));
   return Status::OK();
 }
 
 Status ParallelAligner::Init(size_t threads) {
   aligner_threads_.resize(threads);
+  max_chunks_in_flight_ = kChunksPerThread * threads;
   output_queue_ = std::make_unique<OutputQueueType>(5);
+  range_queue_ = std::make_unique<WorkStealingQueue<ReadRange>>(threads);
 
-  auto aligner_func = [this]() {
-    const char *base, *qual;
-    size_t base_len, qual_len;
-
-    SingleAligner aligner(genome_index_, options_);
+  auto& metrics = agd::MetricsRegistry::Global();
+  metric_chunks_ = metrics.GetCounter("aligner_chunks");
+  metric_failed_chunks_ = metrics.GetCounter("aligner_failed_chunks");
+  metric_reads_ = metrics.GetCounter("aligner_reads");
+  metric_bases_ = metrics.GetCounter("aligner_bases");
+  metric_mapped_ = metrics.GetCounter("aligner_mapped");
+  metric_cache_hits_ = metrics.GetCounter("aligner_cache_hits");
+  metric_cache_misses_ = metrics.GetCounter("aligner_cache_misses");
+  metric_chunk_latency_ = metrics.GetHistogram("aligner_chunk_latency_us");
+  metric_range_time_ = metrics.GetHistogram("aligner_range_us");
+  if (targets_) {
+    target_mapped_.resize(threads,
+                          std::vector<uint64_t>(targets_->size(), 0));
+  }
 
-    while (!done_) {
-      InputQueueItem item;
-      if (!input_queue_->pop(item)) continue;
+  auto dispatch_func = [this]() {
+    InputQueueItem item;
+    while (true) {
+      {
+        // the range queue and buffer pool are unbounded, so this is what
+        // holds back the reader
+        absl::MutexLock l(&in_flight_mu_);
+        while (chunks_in_flight_ >= max_chunks_in_flight_) {
+          in_flight_cv_.Wait(&in_flight_mu_);
+        }
+      }
+      if (!input_queue_->pop(item)) break;
 
       if (item.col_bufs.size() != 2) {
         std::cout << "[ParallelAligner] Error: Expected 2 columns but got "
@@ -40,80 +65,357 @@ Status ParallelAligner::Init(size_t threads) {
         continue;
       }
 
-      agd::AGDRecordReader base_reader(item.col_bufs[0]->data(),
-                                       item.chunk_size);
-      agd::AGDRecordReader qual_reader(item.col_bufs[1]->data(),
-                                       item.chunk_size);
+      {
+        absl::MutexLock l(&in_flight_mu_);
+        chunks_in_flight_++;
+      }
+      DispatchChunk(std::move(item));
+    }
+    // workers drain the remaining ranges before exiting
+    range_queue_->close();
+  };
+
+  auto aligner_func = [this](size_t worker) {
+    const char *base, *qual;
+    size_t base_len, qual_len;
+
+    std::unique_ptr<SingleAligner> single_aligner;
+    std::unique_ptr<PairedAligner> paired_aligner;
+    if (paired_) {
+      paired_aligner = std::make_unique<PairedAligner>(
+          genome_index_, static_cast<PairedAlignerOptions*>(options_));
+    } else {
+      single_aligner = std::make_unique<SingleAligner>(genome_index_, options_);
+    }
+    const Genome* genome = genome_index_->getGenome();
+
+    Read reads[2];
+    // the unclipped reads, to key the cache with
+    const char* key_bases[2];
+    const char* key_quals[2];
+    size_t key_lens[2];
+    // bases of packed reads, unpacked one read at a time
+    std::vector<char> unpacked[2];
+    agd::format::BinaryAlignment results[2];
+    std::string cigars[2];
+    std::vector<uint32_t> cigar_ops;
+    cigar_ops.reserve(20);
+    Alignment aln;
+    uint64_t* target_mapped =
+        targets_ ? target_mapped_[worker].data() : nullptr;
+
+    ReadRange range;
+    while (range_queue_->pop(worker, range)) {
+      agd::ScopedLatency range_latency(metric_range_time_);
+      uint64_t range_bases = 0, range_mapped = 0, range_cache_hits = 0,
+               range_cache_misses = 0;
+      agd::AGDRecordReader base_reader(range.base_index, range.base_data,
+                                       range.num_records);
+      agd::AGDRecordReader qual_reader(range.qual_index, range.qual_data,
+                                       range.num_records);
+      const auto& record_types = range.chunk->item.record_types;
+      const bool packed_bases =
+          !record_types.empty() &&
+          record_types[0] == agd::format::RecordType::COMPACTED_BASES;
 
       auto out_buf_pair = bufpair_pool_.get();
       agd::AlignmentResultBuilder builder;
       builder.SetBufferPair(out_buf_pair.get());
 
-      Status s = base_reader.GetNextRecord(&base, &base_len);
+      const int reads_per_align = paired_ ? 2 : 1;
+      Status s = Status::OK();
+      // fails the range's chunk, the thread goes on with the next range
+      Status range_error = Status::OK();
       while (s.ok()) {
-        s = qual_reader.GetNextRecord(&qual, &qual_len);
-        if (!s.ok()) {
-          std::cout << "[ParallelAligner] no corresponding qual for base, "
-                       "thread ending ...\n";
-          return;
+        int num_reads = 0;
+        for (; num_reads < reads_per_align; num_reads++) {
+          s = base_reader.GetNextRecord(&base, &base_len);
+          if (!s.ok()) break;
+          if (packed_bases) {
+            auto& bases = unpacked[num_reads];
+            bases.resize(agd::MaxUnpackedBases(base_len));
+            s = agd::UnpackBases(base, base_len, bases.data(), &base_len);
+            if (!s.ok()) {
+              range_error = s;
+              break;
+            }
+            base = bases.data();
+          }
+          s = qual_reader.GetNextRecord(&qual, &qual_len);
+          if (!s.ok()) {
+            range_error = Internal("no corresponding qual for base");
+            break;
+          }
+          // std::cout << "[ParallelAligner] Aligning read: \n"
+          //<< std::string(base, base_len) << "\n"
+          //<< std::string(qual, qual_len) << "\n\n";
+          reads[num_reads].init("", 0, base, qual, base_len);
+          key_bases[num_reads] = base;
+          key_quals[num_reads] = qual;
+          key_lens[num_reads] = base_len;
+          range_bases += base_len;
+        }
+        if (!range_error.ok() || num_reads == 0) break;
+        if (num_reads != reads_per_align) {
+          std::cout << "[ParallelAligner] Warning: odd number of records in "
+                       "paired chunk "
+                    << range.chunk->item.name << ", last read is unaligned\n";
+          builder.AppendEmpty();
+          break;
         }
-        // std::cout << "[ParallelAligner] Aligning read: \n"
-        //<< std::string(base, base_len) << "\n"
-        //<< std::string(qual, qual_len) << "\n\n";
-
-        Read read;
-        read.init("", 0, base, qual, base_len);
-        Alignment aln;
-        GenomeLocation loc;
 
-        s = aligner.AlignRead(read, aln, loc);
+        if (kmer_filter_) {
+          bool pass = false;
+          for (int i = 0; i < num_reads && !pass; i++) {
+            pass = kmer_filter_->Screen(reads[i].getData(),
+                                        reads[i].getDataLength());
+          }
+          if (!pass) {
+            for (int i = 0; i < num_reads; i++) {
+              builder.AppendEmpty();
+            }
+            num_screened_ += num_reads;
+            continue;
+          }
+        }
 
-        // std::cout << "[ParallelAligner] aligned to location: " <<
-        // aln.DebugString() << "\n";
-        if (filter_contig_index_ >= 0 &&
-            aln.position().ref_index() != filter_contig_index_) {
-          builder.AppendEmpty();
+        AlignmentCache::Key key{};
+        bool cached = false;
+        if (cache_) {
+          key = AlignmentCache::MakeKey(key_bases, key_quals, key_lens,
+                                        num_reads);
+          cached = cache_->Lookup(key, num_reads, results, cigars);
+        }
+        if (cached) {
+          range_cache_hits += num_reads;
         } else {
-          builder.AppendAlignmentResult(aln);
-          // here we could check which gene(s) the read mapped to
+          if (paired_) {
+            s = paired_aligner->AlignPair(reads, results, cigars);
+          } else {
+            s = single_aligner->AlignRead(reads[0], results[0], cigars[0]);
+          }
+          if (!s.ok()) {
+            range_error = s;
+            break;
+          }
+          if (cache_) {
+            cache_->Insert(key, num_reads, results, cigars);
+            range_cache_misses += num_reads;
+          }
         }
 
-        if (aln.position().ref_index() != -1) {
-          num_mapped_++;
-        }
+        for (int i = 0; i < num_reads; i++) {
+          const auto& result = results[i];
+          if (targets_ && !targets_->Contains(result.ref_index)) {
+            builder.AppendEmpty();
+          } else if (binary_output_) {
+            cigar_ops.clear();
+            if (cigars[i] != "*") {
+              s = agd::format::PackCigar(cigars[i].data(), cigars[i].size(),
+                                         cigar_ops);
+              if (!s.ok()) {
+                range_error = s;
+                break;
+              }
+            }
+            builder.AppendBinaryAlignment(result, cigar_ops.data(),
+                                          cigar_ops.size());
+          } else {
+            aln.Clear();
+            ToAlignment(genome, result, cigars[i], aln);
+            builder.AppendAlignmentResult(aln);
+            // here we could check which gene(s) the read mapped to
+          }
 
-        num_aligned_++;
-        s = base_reader.GetNextRecord(&base, &base_len);
+          if (result.ref_index != -1) {
+            num_mapped_++;
+            range_mapped++;
+            if (targets_ && targets_->Contains(result.ref_index)) {
+              target_mapped[targets_->Slot(result.ref_index)]++;
+            }
+          }
+          num_aligned_++;
+        }
+        if (!range_error.ok()) break;
       }
 
-      OutputQueueItem out_item;
-      out_item.col_buf_pairs.push_back(std::move(out_buf_pair));
-      out_item.chunk_size = item.chunk_size;
-      out_item.pool = item.pool;
-      out_item.first_ordinal = item.first_ordinal;
-      out_item.name = std::move(item.name);
-      output_queue_->push(std::move(out_item));
+      range_latency.Stop();
+      metric_reads_->Add(range.num_records);
+      metric_bases_->Add(range_bases);
+      metric_mapped_->Add(range_mapped);
+      metric_cache_hits_->Add(range_cache_hits);
+      metric_cache_misses_->Add(range_cache_misses);
+
+      auto& chunk = *range.chunk;
+      if (!range_error.ok()) {
+        std::cout << "[ParallelAligner] Error aligning chunk "
+                  << chunk.item.name << ": " << range_error.error_message()
+                  << "\n";
+        chunk.failed = true;
+      }
+      chunk.results[range.range_index] = std::move(out_buf_pair);
+      // the last range to finish pushes the whole chunk
+      if (chunk.ranges_remaining.fetch_sub(1) == 1) {
+        PushChunkResult(chunk);
+      }
+      range.chunk.reset();
     }
   };
 
-  for (auto& t : aligner_threads_) {
-    t = std::thread(aligner_func);
+  running_aligners_ = aligner_threads_.size();
+  for (size_t i = 0; i < aligner_threads_.size(); i++) {
+    aligner_threads_[i] = std::thread([this, aligner_func, i]() {
+      aligner_func(i);
+      if (running_aligners_.fetch_sub(1) == 1) output_queue_->close();
+    });
   }
+  dispatch_thread_ = std::thread(dispatch_func);
 
   return Status::OK();
 }
 
-void ParallelAligner::Stop() {
-  while (!input_queue_->empty()) std::this_thread::sleep_for(1ms);
+void ParallelAligner::DispatchChunk(InputQueueItem&& item) {
+  auto chunk = std::make_shared<ChunkState>();
+  chunk->start = absl::Now();
+  chunk->item = std::move(item);
+  const auto chunk_size = chunk->item.chunk_size;
+
+  uint32_t num_ranges = (chunk_size + kRangeSize - 1) / kRangeSize;
+  if (num_ranges == 0) num_ranges = 1;
+  chunk->results.resize(num_ranges);
+  chunk->ranges_remaining = num_ranges;
+
+  auto base_index = reinterpret_cast<const agd::format::RelativeIndex*>(
+      chunk->item.col_bufs[0]->data());
+  auto qual_index = reinterpret_cast<const agd::format::RelativeIndex*>(
+      chunk->item.col_bufs[1]->data());
+  const char* base_data = chunk->item.col_bufs[0]->data() +
+                          chunk_size * sizeof(agd::format::RelativeIndex);
+  const char* qual_data = chunk->item.col_bufs[1]->data() +
+                          chunk_size * sizeof(agd::format::RelativeIndex);
+
+  uint32_t first = 0;
+  for (uint32_t i = 0; i < num_ranges; i++) {
+    ReadRange range;
+    range.chunk = chunk;
+    range.range_index = i;
+    range.num_records = std::min(kRangeSize, chunk_size - first);
+    range.base_index = base_index + first;
+    range.qual_index = qual_index + first;
+    range.base_data = base_data;
+    range.qual_data = qual_data;
+
+    for (uint32_t j = first; j < first + range.num_records; j++) {
+      base_data += base_index[j];
+      qual_data += qual_index[j];
+    }
+    first += range.num_records;
+
+    range_queue_->push(next_worker_++ % aligner_threads_.size(),
+                       std::move(range));
+  }
+}
 
-  input_queue_->unblock();
-  done_ = true;
+void ParallelAligner::PushChunkResult(ChunkState& chunk) {
+  // lets the dispatcher start another chunk once this one is out
+  auto release = [this]() {
+    {
+      absl::MutexLock l(&in_flight_mu_);
+      chunks_in_flight_--;
+    }
+    in_flight_cv_.Signal();
+  };
 
+  if (chunk.failed) {
+    std::cout << "[ParallelAligner] Dropping chunk " << chunk.item.name
+              << ", it failed to align\n";
+    num_failed_chunks_++;
+    metric_failed_chunks_->Add();
+    chunk.results.clear();
+    release();
+    return;
+  }
+
+  agd::ObjectPool<agd::BufferPair>::ptr_type out_buf_pair;
+  if (chunk.results.size() == 1) {
+    out_buf_pair = std::move(chunk.results[0]);
+  } else {
+    size_t index_size = 0, data_size = 0;
+    for (auto& r : chunk.results) {
+      index_size += r->index().size();
+      data_size += r->data().size();
+    }
+    out_buf_pair = bufpair_pool_.get();
+    out_buf_pair->reset();
+    out_buf_pair->index().reserve(index_size);
+    out_buf_pair->data().reserve(data_size);
+    for (auto& r : chunk.results) {
+      out_buf_pair->index().AppendBuffer(r->index().data(), r->index().size());
+      out_buf_pair->data().AppendBuffer(r->data().data(), r->data().size());
+      r.reset();  // back to the pool
+    }
+  }
+
+  OutputQueueItem out_item;
+  out_item.col_buf_pairs.push_back(std::move(out_buf_pair));
+  out_item.record_types.push_back(
+      binary_output_ ? agd::format::RecordType::BINARY_ALIGNMENT
+                     : agd::format::RecordType::STRUCTURED);
+  out_item.chunk_size = chunk.item.chunk_size;
+  out_item.pool = chunk.item.pool;
+  out_item.first_ordinal = chunk.item.first_ordinal;
+  out_item.name = std::move(chunk.item.name);
+  metric_chunks_->Add();
+  metric_chunk_latency_->Observe(
+      absl::ToInt64Microseconds(absl::Now() - chunk.start));
+  if (!output_queue_->push(std::move(out_item))) {
+    // the writer failed and closed its input, unblock the reader too
+    std::cout << "[ParallelAligner] Output queue closed, the pipeline "
+                 "failed\n";
+    input_queue_->close();
+  }
+  release();
+}
+
+void ParallelAligner::Stop() {
+  dispatch_thread_.join();
   for (auto& t : aligner_threads_) {
     t.join();
   }
 
   std::cout << "[ParallelAligner] aligned " << num_aligned_.load() << " reads, "
             << num_mapped_.load() << " successfully mapped ("
-            << (float(num_mapped_.load()) / float(num_aligned_.load()))*100.0f << "%)\n";
+            << (float(num_mapped_.load()) / float(num_aligned_.load()))*100.0f << "%), "
+            << range_queue_->num_steals() << " ranges stolen\n";
+  if (num_failed_chunks_ > 0) {
+    std::cout << "[ParallelAligner] " << num_failed_chunks_.load()
+              << " chunks failed to align and were dropped\n";
+  }
+  if (targets_) {
+    for (size_t t = 0; t < targets_->size(); t++) {
+      uint64_t mapped = 0;
+      for (const auto& worker_counts : target_mapped_) {
+        mapped += worker_counts[t];
+      }
+      std::cout << "[ParallelAligner] " << mapped << " reads mapped to target "
+                << targets_->names()[t] << "\n";
+    }
+  }
+  if (kmer_filter_) {
+    auto screened = num_screened_.load();
+    std::cout << "[ParallelAligner] k-mer filter screened out " << screened
+              << " reads ("
+              << (float(screened) / float(screened + num_aligned_.load())) *
+                     100.0f
+              << "% of input) without aligning\n";
+  }
+  if (cache_) {
+    const auto hits = cache_->hits(), misses = cache_->misses();
+    std::cout << "[ParallelAligner] alignment cache hit " << hits << " of "
+              << hits + misses << " lookups ("
+              << (float(hits) / float(hits + misses)) * 100.0f << "%), "
+              << cache_->NumEntries() << " entries ("
+              << cache_->SizeBytes() / (1024 * 1024) << " MB), "
+              << cache_->evictions() << " evicted\n";
+  }
 }
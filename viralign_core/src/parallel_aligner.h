@@ -1,12 +1,28 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <thread>
+#include "absl/synchronization/mutex.h"
+#include "alignment_cache.h"
+#include "concurrent_queue/work_stealing_queue.h"
+#include "kmer_filter.h"
+#include "snap_paired_aligner.h"
 #include "snap_single_aligner.h"
+#include "target_set.h"
 #include "libagd/src/queue_defs.h"
 #include "libagd/src/buffer_pair.h"
+#include "libagd/src/metrics.h"
 #include "liberr/errors.h"
 // class to manage aligning chunks in parallel
+// chunks are split into ranges of reads that are distributed over per thread
+// work stealing deques, so that a large chunk is aligned by all threads. The
+// range results are stitched back into one output item per chunk. A few
+// chunks per thread are in flight at once, so a slow aligner still holds
+// back the reader. A chunk with a read that fails to align is dropped.
+// The output queue is closed once the input queue is closed and all of its
+// chunks are aligned.
 
 class ParallelAligner {
  public:
@@ -15,21 +31,78 @@ class ParallelAligner {
   using OutputQueueItem = agd::WriteQueueItem;
   using OutputQueueType = agd::WriteQueueType;
 
+  // if binary_output, results are written as format::BinaryAlignment records
+  // (RecordType::BINARY_ALIGNMENT) instead of serialized Alignment protobufs
+  // if paired, records are interleaved pairs and are aligned two at a time,
+  // options must then be PairedAlignerOptions
+  // if targets is not null, only alignments to target contigs are output,
+  // others get an empty result
+  // if kmer_filter is not null, reads (or pairs) it screens out are not
+  // aligned and get an empty result
+  // if cache is not null, reads (or pairs) found in it are not aligned and
+  // get the cached result, others are added once aligned. It must be for the
+  // same index and options
   static errors::Status Create(size_t threads, GenomeIndex* index,
-                       AlignerOptions* options, InputQueueType* input_queue, int filter_contig_index,
-                       std::unique_ptr<ParallelAligner>& aligner);
+                       AlignerOptions* options, InputQueueType* input_queue, const TargetSet* targets,
+                       const KmerFilter* kmer_filter, bool binary_output, bool paired,
+                       std::unique_ptr<ParallelAligner>& aligner,
+                       AlignmentCache* cache = nullptr);
 
   OutputQueueType* GetOutputQueue() { return output_queue_.get(); }
 
+  // wait for all chunks to be aligned, the input queue must be closed by its
+  // producer
   void Stop();
 
 
  private:
-  ParallelAligner(GenomeIndex* index, AlignerOptions* options, InputQueueType* input_queue,  size_t filter_contig_index)
-      : genome_index_(index), options_(options), input_queue_(input_queue), filter_contig_index_(filter_contig_index) {}
+  ParallelAligner(GenomeIndex* index, AlignerOptions* options, InputQueueType* input_queue, const TargetSet* targets,
+                  const KmerFilter* kmer_filter, bool binary_output, bool paired,
+                  AlignmentCache* cache)
+      : genome_index_(index), options_(options), input_queue_(input_queue), targets_(targets),
+        kmer_filter_(kmer_filter), cache_(cache), binary_output_(binary_output), paired_(paired) {}
 
   errors::Status Init(size_t threads);
 
+  // reads per range, kept even so that interleaved pairs stay together
+  static constexpr uint32_t kRangeSize = 2048;
+  // chunks dispatched and not yet output, per aligner thread
+  static constexpr size_t kChunksPerThread = 2;
+
+  // a chunk being aligned, shared by all of its ranges
+  struct ChunkState {
+    InputQueueItem item;
+    std::vector<agd::ObjectPool<agd::BufferPair>::ptr_type> results;
+    std::atomic_uint32_t ranges_remaining{0};
+    // a range failed, the chunk is not output
+    std::atomic_bool failed{false};
+    absl::Time start;
+  };
+
+  // a range of reads within a chunk, the unit of work for aligner threads
+  struct ReadRange {
+    std::shared_ptr<ChunkState> chunk;
+    uint32_t range_index;
+    uint32_t num_records;
+    const agd::format::RelativeIndex *base_index, *qual_index;
+    const char *base_data, *qual_data;
+  };
+
+  // split an input chunk into ranges and distribute them
+  void DispatchChunk(InputQueueItem&& item);
+
+  // concatenate the range results of a completed chunk in order and push
+  // them to the output queue, or drop it if it failed
+  void PushChunkResult(ChunkState& chunk);
+
+  std::thread dispatch_thread_;
+  absl::Mutex in_flight_mu_;
+  absl::CondVar in_flight_cv_;
+  size_t chunks_in_flight_ = 0;
+  size_t max_chunks_in_flight_;
+  std::unique_ptr<WorkStealingQueue<ReadRange>> range_queue_;
+  size_t next_worker_ = 0;
+
   std::vector<std::thread> aligner_threads_;
   agd::ObjectPool<agd::BufferPair> bufpair_pool_;
 
@@ -37,11 +110,33 @@ class ParallelAligner {
   AlignerOptions* options_;
   InputQueueType* input_queue_;
   std::unique_ptr<OutputQueueType> output_queue_;
-  volatile bool done_ = false;
+  // the last aligner thread to exit closes the output queue
+  std::atomic_uint32_t running_aligners_{0};
 
   std::atomic_uint64_t num_aligned_{0};
   std::atomic_uint64_t num_mapped_{0};
+  std::atomic_uint64_t num_screened_{0};
+  std::atomic_uint64_t num_failed_chunks_{0};
+
+  agd::Counter* metric_chunks_;
+  agd::Counter* metric_failed_chunks_;
+  agd::Counter* metric_reads_;
+  agd::Counter* metric_bases_;
+  agd::Counter* metric_mapped_;
+  agd::Counter* metric_cache_hits_;
+  agd::Counter* metric_cache_misses_;
+  agd::Histogram* metric_chunk_latency_;
+  agd::Histogram* metric_range_time_;
+
+  // if not null, output 0 entry for any alignment not mapping to a target
+  const TargetSet* targets_ = nullptr;
+  // per worker counts of reads mapped to each target, indexed by target slot
+  std::vector<std::vector<uint64_t>> target_mapped_;
+
+  const KmerFilter* kmer_filter_ = nullptr;
+
+  AlignmentCache* cache_ = nullptr;
 
-  // if not -1, output 0 entry for any alignment not mapping to this contig
-  int filter_contig_index_ = -1;
+  bool binary_output_ = false;
+  bool paired_ = false;
 };
\ No newline at end of file
@@ -1,22 +1,42 @@
-
 #include "redis_pusher.h"
 
+#include "absl/time/clock.h"
 
 errors::Status RedisPusher::Run() {
 
   agd::OutputQueueItem item;
-  while (true) {
-    if (!input_queue_->pop(item)) {
-      continue;
+  std::vector<std::string> names;
+  while (input_queue_->pop(item)) {
+    // this is the only consumer, so an empty queue flushes the batch rather
+    // than waiting for it to fill
+    names.clear();
+    names.push_back(std::move(item.objName));
+    while (names.size() < batch_ && !input_queue_->empty() &&
+           input_queue_->pop(item)) {
+      names.push_back(std::move(item.objName));
     }
 
-    // why doesn't it work with absl::string_view ???? :-(
-    sw::redis::StringView name(item.objName);
-    sw::redis::StringView queue_name(queue_name_.data(), queue_name_.size());
-    auto ret = redis_->rpush(queue_name, name);
-
-    std::cout << "[RedisPusher] Pushed chunk name " << item.objName << " to queue " << queue_name_ << "\n";
+    // unacked chunks would only be requeued once this worker exits, so keep
+    // trying
+    std::vector<std::string> acked;
+    while (true) {
+      try {
+        acked = work_queue_->Ack(names, queue_name_);
+        break;
+      } catch (const sw::redis::Error& e) {
+        std::cout << "[RedisPusher] Couldn't ack " << names.size()
+                  << " chunks, retrying: " << e.what() << "\n";
+        absl::SleepFor(absl::Seconds(1));
+      }
+    }
+    std::cout << "[RedisPusher] Pushed " << acked.size()
+              << " chunk names to queue " << queue_name_ << "\n";
+    if (acked.size() < names.size()) {
+      std::cout << "[RedisPusher] " << names.size() - acked.size()
+                << " chunks were requeued after the lease expired, not "
+                   "pushing them\n";
+    }
   }
 
   return errors::Status::OK();
-}
\ No newline at end of file
+}
@@ -1,29 +1,35 @@
 #pragma once
 
 #include "libagd/src/queue_defs.h"
-#include "src/sw/redis++/redis++.h"
+#include "libagd/src/redis_work_queue.h"
 #include "absl/strings/str_cat.h"
 
 using namespace sw::redis;
 
+// acks the chunks of a RedisFetcher's worker once they are written, pushing
+// their names to the return queue. Chunks written together are acked in one
+// round trip, up to batch at a time
 class RedisPusher {
  public:
-  RedisPusher(agd::OutputQueueType* input_queue, absl::string_view redis_addr, absl::string_view queue_name)
-      : input_queue_(input_queue), queue_name_(queue_name) {
+  RedisPusher(agd::OutputQueueType* input_queue, absl::string_view redis_addr,
+              absl::string_view queue_name, absl::string_view work_queue_name,
+              absl::string_view worker_id, size_t batch = 64)
+      : input_queue_(input_queue), queue_name_(queue_name), batch_(batch) {
 
-    auto full_addr = absl::StrCat("tcp://", redis_addr);
-    std::cout << "[RedisPusher] Creating and connecting to " << full_addr
-              << "\n";
+    std::cout << "[RedisPusher] Creating and connecting to tcp://"
+              << redis_addr << "\n";
 
-    redis_.reset(new Redis(full_addr));
+    work_queue_.reset(new RedisWorkQueue(std::string(redis_addr),
+                                         std::string(work_queue_name),
+                                         std::string(worker_id)));
   }
 
+  // ack completed chunks until the input queue is closed and drained
   errors::Status Run();
 
-  void Stop() { std::cout << "[RedisPusher] stop not implemented\n"; };
-
  private:
-  std::unique_ptr<sw::redis::Redis> redis_;
+  std::unique_ptr<RedisWorkQueue> work_queue_;
   agd::OutputQueueType* input_queue_;
-  absl::string_view queue_name_;
-};
\ No newline at end of file
+  std::string queue_name_;
+  size_t batch_;
+};
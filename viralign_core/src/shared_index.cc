@@ -0,0 +1,231 @@
+#include "shared_index.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "absl/strings/str_cat.h"
+
+namespace fs = std::filesystem;
+using namespace errors;
+using namespace std::chrono_literals;
+
+namespace {
+
+const char* kSharedIndexRoot = "/dev/shm";
+// written last, workers only attach to an index once it exists. Holds the
+// server's PID and PID namespace, to tell whether the server is still alive
+const char* kReadyFile = "READY";
+
+std::string PidNamespace() {
+  std::error_code ec;
+  auto ns = fs::read_symlink("/proc/self/ns/pid", ec);
+  return ec ? "" : ns.string();
+}
+
+// whether the index in dir was left behind by a server that was killed: it
+// has no READY file, or its server ran in our PID namespace and has exited.
+// Servers in other PID namespaces, e.g. other containers sharing /dev/shm,
+// can't be checked and are taken to be alive
+bool IsStaleIndex(const fs::path& dir, pid_t* owner) {
+  *owner = 0;
+  std::ifstream ready(dir / kReadyFile);
+  if (!ready) return true;
+  std::string ns;
+  if (!(ready >> *owner >> ns)) {
+    // not written by this version, can't tell
+    return false;
+  }
+  if (ns != PidNamespace()) return false;
+  return kill(*owner, 0) != 0 && errno == ESRCH;
+}
+
+Status CopyFileToShm(const fs::path& src, const fs::path& dst,
+                     bool use_hugepages) {
+  int in_fd = open(src.c_str(), O_RDONLY);
+  if (in_fd < 0) {
+    return Internal("Could not open index file ", src.string(), ", errno ",
+                    errno);
+  }
+
+  struct stat st;
+  fstat(in_fd, &st);
+  size_t size = st.st_size;
+
+  int out_fd = open(dst.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (out_fd < 0) {
+    close(in_fd);
+    return Internal("Could not create shared index file ", dst.string(),
+                    ", errno ", errno);
+  }
+
+  Status s = Status::OK();
+  if (size > 0) {
+    if (ftruncate(out_fd, size) != 0) {
+      s = Internal("Could not size shared index file ", dst.string(), " to ",
+                   size, " bytes, errno ", errno);
+    }
+
+    char* out = nullptr;
+    if (s.ok()) {
+      out = static_cast<char*>(
+          mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0));
+      if (out == MAP_FAILED) {
+        s = Internal("Could not map shared index file ", dst.string(),
+                     ", errno ", errno);
+      }
+    }
+
+    if (s.ok()) {
+      if (use_hugepages && madvise(out, size, MADV_HUGEPAGE) != 0) {
+        std::cout << "[viralign-core] madvise(MADV_HUGEPAGE) failed for "
+                  << dst.string() << ", using regular pages\n";
+      }
+
+      size_t copied = 0;
+      while (copied < size) {
+        auto ret = read(in_fd, out + copied, size - copied);
+        if (ret <= 0) {
+          s = Internal("Failed reading index file ", src.string(), " at ",
+                       copied, " bytes, errno ", errno);
+          break;
+        }
+        copied += ret;
+      }
+      munmap(out, size);
+    }
+  }
+
+  close(out_fd);
+  close(in_fd);
+  return s;
+}
+
+}  // namespace
+
+std::string SharedIndexPath(const std::string& name) {
+  return absl::StrCat(kSharedIndexRoot, "/viralign-index-", name);
+}
+
+Status ServeIndex(const std::string& index_dir, const std::string& name,
+                  bool use_hugepages) {
+  fs::path final_dir(SharedIndexPath(name));
+  fs::path tmp_dir(absl::StrCat(final_dir.string(), ".tmp.", getpid()));
+
+  if (fs::exists(final_dir)) {
+    pid_t owner;
+    if (!IsStaleIndex(final_dir, &owner)) {
+      return InvalidArgument("Shared index ", name, " already exists at ",
+                             final_dir.string(),
+                             ", is another server running?");
+    }
+    std::cout << "[viralign-core] Replacing stale shared index "
+              << final_dir.string();
+    if (owner > 0) std::cout << " of exited server " << owner;
+    std::cout << "\n";
+    std::error_code ec;
+    fs::remove_all(final_dir, ec);
+    if (ec) {
+      return Internal("Could not remove stale shared index ",
+                      final_dir.string(), ": ", ec.message());
+    }
+  }
+
+  // block the signals before starting any threads, so sigwait gets them
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+  std::error_code ec;
+  fs::create_directories(tmp_dir, ec);
+  if (ec) {
+    return Internal("Could not create ", tmp_dir.string(), ": ",
+                    ec.message());
+  }
+
+  size_t total_bytes = 0;
+  for (const auto& entry : fs::directory_iterator(index_dir)) {
+    if (!entry.is_regular_file()) continue;
+    auto dst = tmp_dir / entry.path().filename();
+    std::cout << "[viralign-core] Copying " << entry.path().string()
+              << " into shared memory ...\n";
+    Status s = CopyFileToShm(entry.path(), dst, use_hugepages);
+    if (!s.ok()) {
+      fs::remove_all(tmp_dir, ec);
+      return s;
+    }
+    total_bytes += entry.file_size();
+  }
+
+  std::ofstream ready(tmp_dir / kReadyFile);
+  ready << getpid() << " " << PidNamespace() << "\n";
+  ready.close();
+  if (!ready) {
+    fs::remove_all(tmp_dir, ec);
+    return Internal("Could not write ", (tmp_dir / kReadyFile).string());
+  }
+
+  // rename is atomic, workers never see a partially copied index, and it
+  // is never in place without its READY file
+  fs::rename(tmp_dir, final_dir, ec);
+  if (ec) {
+    fs::remove_all(tmp_dir, ec);
+    return Internal("Could not rename shared index into place: ",
+                    ec.message());
+  }
+
+  auto t2 = std::chrono::high_resolution_clock::now();
+  auto ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+  std::cout << "[viralign-core] Serving " << total_bytes / (1024 * 1024)
+            << " MB index " << name << " from " << final_dir.string()
+            << " (copied in " << float(ms) / 1000.0f
+            << " seconds). Stop with SIGINT or SIGTERM.\n";
+
+  int sig;
+  sigwait(&sigs, &sig);
+
+  std::cout << "[viralign-core] Got signal " << sig
+            << ", removing shared index " << name << "\n";
+  // processes that still map the index keep their pages until they exit
+  fs::remove_all(final_dir, ec);
+  if (ec) {
+    return Internal("Could not remove shared index ", final_dir.string(), ": ",
+                    ec.message());
+  }
+  return Status::OK();
+}
+
+Status AttachSharedIndex(const std::string& name, int timeout_secs,
+                         std::string& path) {
+  path = SharedIndexPath(name);
+  auto ready = fs::path(path) / kReadyFile;
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(timeout_secs);
+  bool waiting = false;
+  while (!fs::exists(ready)) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return Unavailable("Shared index ", name, " was not served at ", path,
+                         " within ", timeout_secs, " seconds");
+    }
+    if (!waiting) {
+      std::cout << "[viralign-core] Waiting for shared index " << name
+                << " at " << path << " ...\n";
+      waiting = true;
+    }
+    std::this_thread::sleep_for(500ms);
+  }
+  return Status::OK();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+
+#include "liberr/errors.h"
+
+// Sharing one copy of a SNAP genome index between viralign-core processes on
+// a host. SNAP owns the index layout and loads it from a directory, so the
+// index files are copied once into a tmpfs directory under /dev/shm. Workers
+// then load that directory with SNAP's mapped (mmap) load, so all processes
+// map the same shared memory pages instead of reading and holding a private
+// copy. Containers must share the host /dev/shm (e.g. --ipc=host).
+
+// the directory a shared index called `name` is served from
+std::string SharedIndexPath(const std::string& name);
+
+// Copy the index in index_dir into shared memory as `name`, then block until
+// SIGINT or SIGTERM and remove it. An index left in place by a server that
+// was killed is replaced, one whose server is still running is an error.
+// Index files are mapped with MADV_HUGEPAGE when use_hugepages is set, which
+// takes effect if the tmpfs allows huge pages (shmem_enabled=advise or huge=
+// mount option).
+errors::Status ServeIndex(const std::string& index_dir, const std::string& name,
+                          bool use_hugepages);
+
+// Wait up to timeout_secs for the shared index `name` to be served and set
+// path to its directory.
+errors::Status AttachSharedIndex(const std::string& name, int timeout_secs,
+                                 std::string& path);
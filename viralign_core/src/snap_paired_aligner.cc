@@ -0,0 +1,89 @@
+#include "snap_paired_aligner.h"
+
+PairedAligner::PairedAligner(GenomeIndex *index, PairedAlignerOptions *options)
+    : index_(index), options_(options) {
+  genome_ = index_->getGenome();
+
+  if (options_->maxSecondaryAlignmentAdditionalEditDistance < 0) {
+    max_paired_secondary_hits_ = 0;
+    max_single_secondary_hits_ = 0;
+  } else {
+    max_paired_secondary_hits_ =
+        IntersectingPairedEndAligner::getMaxSecondaryResults(
+            options_->numSeedsFromCommandLine, options_->seedCoverage,
+            MAX_READ_LENGTH, options_->maxHits, index_->getSeedLength(),
+            options_->minSpacing, options_->maxSpacing);
+    max_single_secondary_hits_ = BaseAligner::getMaxSecondaryResults(
+        options_->numSeedsFromCommandLine, options_->seedCoverage,
+        MAX_READ_LENGTH, options_->maxHits, index_->getSeedLength());
+  }
+
+  size_t memory_pool_size =
+      IntersectingPairedEndAligner::getBigAllocatorReservation(
+          index_, options_->intersectingAlignerMaxHits, MAX_READ_LENGTH,
+          index_->getSeedLength(), options_->numSeedsFromCommandLine,
+          options_->seedCoverage, options_->maxDist, options_->extraSearchDepth,
+          options_->maxCandidatePoolSize,
+          options_->maxSecondaryAlignmentsPerContig) +
+      ChimericPairedEndAligner::getBigAllocatorReservation(
+          index_, MAX_READ_LENGTH, options_->maxHits, index_->getSeedLength(),
+          options_->numSeedsFromCommandLine, options_->seedCoverage,
+          options_->maxDist, options_->extraSearchDepth,
+          options_->maxCandidatePoolSize,
+          options_->maxSecondaryAlignmentsPerContig) +
+      (1 + max_paired_secondary_hits_) * sizeof(PairedAlignmentResult) +
+      max_single_secondary_hits_ * sizeof(SingleAlignmentResult);
+
+  allocator_.reset(new BigAllocator(memory_pool_size));
+
+  intersecting_aligner_ = new (allocator_.get()) IntersectingPairedEndAligner(
+      index_, MAX_READ_LENGTH, options_->maxHits, index_->getSeedLength(),
+      options_->numSeedsFromCommandLine, options_->seedCoverage,
+      options_->minSpacing, options_->maxSpacing,
+      options_->intersectingAlignerMaxHits, options_->extraSearchDepth,
+      options_->maxCandidatePoolSize, options_->maxSecondaryAlignmentsPerContig,
+      allocator_.get(), options_->noUkkonen, options_->noOrderedEvaluation,
+      options_->noTruncation);
+
+  aligner_ = new (allocator_.get()) ChimericPairedEndAligner(
+      index_, MAX_READ_LENGTH, options_->maxHits, index_->getSeedLength(),
+      options_->numSeedsFromCommandLine, options_->seedCoverage,
+      options_->minWeightToCheck, options_->forceSpacing,
+      options_->extraSearchDepth, options_->noUkkonen,
+      options_->noOrderedEvaluation, options_->noTruncation,
+      intersecting_aligner_, options_->minReadLength,
+      options_->maxSecondaryAlignmentsPerContig, allocator_.get());
+
+  secondary_results_ = (PairedAlignmentResult *)allocator_->allocate(
+      max_paired_secondary_hits_ * sizeof(PairedAlignmentResult));
+  secondary_single_results_ = (SingleAlignmentResult *)allocator_->allocate(
+      max_single_secondary_hits_ * sizeof(SingleAlignmentResult));
+
+  allocator_->checkCanaries();
+}
+
+errors::Status PairedAligner::AlignPair(Read *snap_reads,
+                                        agd::format::BinaryAlignment *results,
+                                        std::string *cigars) {
+  for (int i = 0; i < 2; i++) {
+    snap_reads[i].clip(options_->clipping);
+  }
+
+  int num_secondary_results, num_single_results_first,
+      num_single_results_second;
+  aligner_->align(&snap_reads[0], &snap_reads[1], &result_,
+                  options_->maxSecondaryAlignmentAdditionalEditDistance,
+                  max_paired_secondary_hits_, &num_secondary_results,
+                  secondary_results_, max_single_secondary_hits_,
+                  0,  // maximum number of secondary results
+                  &num_single_results_first, &num_single_results_second,
+                  secondary_single_results_);
+
+  for (int i = 0; i < 2; i++) {
+    ERR_RETURN_IF_ERROR(WritePairedResult(snap_reads, result_, i, results[i],
+                                          cigars[i], genome_, &lvc_, false,
+                                          options_->useM));
+  }
+
+  return errors::Status::OK();
+}
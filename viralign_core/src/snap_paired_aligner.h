@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "libagd/src/format.h"
+#include "liberr/errors.h"
+#include "snap-master/SNAPLib/AlignerOptions.h"
+#include "snap-master/SNAPLib/ChimericPairedEndAligner.h"
+#include "snap-master/SNAPLib/GenomeIndex.h"
+#include "snap-master/SNAPLib/IntersectingPairedEndAligner.h"
+#include "snap-master/SNAPLib/PairedAligner.h"
+#include "snap-master/SNAPLib/SAM.h"
+#include "snap_results.h"
+
+// Aligns read pairs using SNAP's intersecting paired end aligner, falling
+// back to aligning each end separately through the chimeric aligner.
+class PairedAligner {
+ public:
+  PairedAligner(GenomeIndex* index, PairedAlignerOptions* options);
+
+  // align snap_reads[0] and snap_reads[1] as a pair. results and cigars must
+  // have space for two entries, one per read. cigar is "*" if unmapped
+  errors::Status AlignPair(Read* snap_reads,
+                           agd::format::BinaryAlignment* results,
+                           std::string* cigars);
+
+ private:
+  GenomeIndex* index_;
+  const Genome* genome_;
+  PairedAlignerOptions* options_;
+  std::unique_ptr<BigAllocator> allocator_;
+  // both allocated from allocator_
+  IntersectingPairedEndAligner* intersecting_aligner_;
+  ChimericPairedEndAligner* aligner_;
+
+  int max_paired_secondary_hits_;
+  int max_single_secondary_hits_;
+  PairedAlignmentResult* secondary_results_;
+  SingleAlignmentResult* secondary_single_results_;
+
+  PairedAlignmentResult result_;
+  LandauVishkinWithCigar lvc_;
+};
@@ -0,0 +1,393 @@
+#include "snap_results.h"
+
+void ToAlignment(const Genome *genome,
+                 const agd::format::BinaryAlignment &result,
+                 const std::string &cigar, Alignment &format_result) {
+  const Genome::Contig *contigs = genome->getContigs();
+  const char *contig_name =
+      result.ref_index >= 0 ? contigs[result.ref_index].name : "*";
+  const char *mate_contig_name = "";
+  if (result.flag & SAM_MULTI_SEGMENT) {
+    // SAM Spec uses "=" when the mate is on the same contig
+    if (result.next_ref_index == result.ref_index) {
+      mate_contig_name = "=";
+    } else {
+      mate_contig_name = result.next_ref_index >= 0
+                             ? contigs[result.next_ref_index].name
+                             : "*";
+    }
+  }
+
+  format_result.set_mapping_quality(result.mapping_quality);
+  format_result.set_flag(result.flag);
+  format_result.set_template_length(result.template_length);
+  format_result.mutable_position()->set_position(result.position);
+  format_result.mutable_position()->set_ref_index(result.ref_index);
+  format_result.mutable_position()->set_contig(contig_name);
+  format_result.mutable_next_position()->set_position(result.next_position);
+  format_result.mutable_next_position()->set_ref_index(result.next_ref_index);
+  format_result.mutable_next_position()->set_contig(mate_contig_name);
+  if (cigar != "*") {
+    format_result.set_cigar(cigar);
+  }
+}
+
+errors::Status WriteSingleResult(Read &snap_read, SingleAlignmentResult &result,
+                                 agd::format::BinaryAlignment &format_result,
+                                 std::string &cigar, const Genome *genome,
+                                 LandauVishkinWithCigar *lvc, bool is_secondary,
+                                 bool use_m) {
+  // Alignment format_result;
+  snap_read.setAdditionalFrontClipping(0);
+
+  int addFrontClipping = -1;
+  GenomeLocation finalLocation =
+      result.status != NotFound ? result.location : InvalidGenomeLocation;
+  unsigned nAdjustments = 0;
+  int cumulativeAddFrontClipping = 0;
+  while (addFrontClipping != 0) {
+    addFrontClipping = 0;
+    errors::Status s =
+        PostProcess(genome, lvc, &snap_read, result.status, result.mapq,
+                    finalLocation, result.direction, is_secondary,
+                    format_result, cigar, &addFrontClipping, use_m);
+    // redo if read modified (e.g. to add soft clipping, or move alignment for a
+    // leading I.
+    if (addFrontClipping != 0) {
+      nAdjustments++;
+      const Genome::Contig *originalContig =
+          result.status == NotFound
+              ? NULL
+              : genome->getContigAtLocation(result.location);
+      const Genome::Contig *newContig =
+          result.status == NotFound
+              ? NULL
+              : genome->getContigAtLocation(result.location + addFrontClipping);
+      if (newContig == NULL || newContig != originalContig ||
+          finalLocation + addFrontClipping >
+              originalContig->beginningLocation + originalContig->length -
+                  genome->getChromosomePadding() ||
+          nAdjustments > snap_read.getDataLength()) {
+        //
+        // Altering this would push us over a contig boundary, or we're stuck in
+        // a loop.  Just give up on the read.
+        //
+        result.status = NotFound;
+        result.location = InvalidGenomeLocation;
+        finalLocation = InvalidGenomeLocation;
+      } else {
+        cumulativeAddFrontClipping += addFrontClipping;
+        if (addFrontClipping > 0) {
+          snap_read.setAdditionalFrontClipping(cumulativeAddFrontClipping);
+        }
+        finalLocation = result.location + cumulativeAddFrontClipping;
+      }
+    }
+  }
+
+  // format_result.set_cigar(cigar);
+  // result_column.AppendAlignmentResult(format_result);
+  return errors::Status::OK();
+}
+
+errors::Status WritePairedResult(Read *snap_reads, PairedAlignmentResult &result,
+                                 int which_read,
+                                 agd::format::BinaryAlignment &format_result,
+                                 std::string &cigar, const Genome *genome,
+                                 LandauVishkinWithCigar *lvc, bool is_secondary,
+                                 bool use_m) {
+  Read &snap_read = snap_reads[which_read];
+  Read &mate_read = snap_reads[1 - which_read];
+  const int mate = 1 - which_read;
+  snap_read.setAdditionalFrontClipping(0);
+
+  GenomeLocation locations[2];
+  for (int i = 0; i < 2; i++) {
+    locations[i] = result.status[i] != NotFound ? result.location[i]
+                                                : InvalidGenomeLocation;
+  }
+
+  int addFrontClipping = -1;
+  unsigned nAdjustments = 0;
+  int cumulativeAddFrontClipping = 0;
+  while (addFrontClipping != 0) {
+    addFrontClipping = 0;
+    errors::Status s = PostProcess(
+        genome, lvc, &snap_read, result.status[which_read],
+        result.mapq[which_read], locations[which_read],
+        result.direction[which_read], is_secondary, format_result, cigar,
+        &addFrontClipping, use_m, true, which_read == 0, &mate_read,
+        result.status[mate], locations[mate], result.direction[mate],
+        result.alignedAsPair);
+    // redo if read modified (e.g. to add soft clipping, or move alignment for a
+    // leading I.
+    if (addFrontClipping != 0) {
+      nAdjustments++;
+      const Genome::Contig *originalContig =
+          result.status[which_read] == NotFound
+              ? NULL
+              : genome->getContigAtLocation(result.location[which_read]);
+      const Genome::Contig *newContig =
+          result.status[which_read] == NotFound
+              ? NULL
+              : genome->getContigAtLocation(result.location[which_read] +
+                                            addFrontClipping);
+      if (newContig == NULL || newContig != originalContig ||
+          locations[which_read] + addFrontClipping >
+              originalContig->beginningLocation + originalContig->length -
+                  genome->getChromosomePadding() ||
+          nAdjustments > snap_read.getDataLength()) {
+        //
+        // Altering this would push us over a contig boundary, or we're stuck in
+        // a loop.  Just give up on the read.
+        //
+        result.status[which_read] = NotFound;
+        result.location[which_read] = InvalidGenomeLocation;
+        locations[which_read] = InvalidGenomeLocation;
+      } else {
+        cumulativeAddFrontClipping += addFrontClipping;
+        if (addFrontClipping > 0) {
+          snap_read.setAdditionalFrontClipping(cumulativeAddFrontClipping);
+        }
+        locations[which_read] =
+            result.location[which_read] + cumulativeAddFrontClipping;
+      }
+    }
+  }
+
+  return errors::Status::OK();
+}
+
+errors::Status PostProcess(
+    const Genome *genome, LandauVishkinWithCigar *lv, Read *read,
+    AlignmentResult result, int mapQuality, GenomeLocation genomeLocation,
+    Direction direction, bool secondaryAlignment,
+    agd::format::BinaryAlignment &finalResult,
+    std::string &cigar, int *addFrontClipping, bool useM, bool hasMate,
+    bool firstInPair, Read *mate, AlignmentResult mateResult,
+    GenomeLocation mateLocation, Direction mateDirection, bool alignedAsPair) {
+  cigar = "*";
+  const int MAX_READ = MAX_READ_LENGTH;
+  char data[MAX_READ];
+  char quality[MAX_READ];
+  /*const int cigarBufSize = MAX_READ * 2;
+  char cigarBuf[cigarBufSize];
+  const int cigarBufWithClippingSize = MAX_READ * 2 + 32;
+  char cigarBufWithClipping[cigarBufWithClippingSize];
+  int flags = 0;
+  const char *cigar = "*";
+  const char *matecontigName = "*";
+  int mateContigIndex = -1;
+  GenomeDistance matePositionInContig = 0;
+  _int64 templateLength = 0;
+  char data[MAX_READ];
+  char quality[MAX_READ];
+  const char* clippedData;
+  unsigned fullLength;
+  unsigned clippedLength;
+  unsigned basesClippedBefore;
+  GenomeDistance extraBasesClippedBefore;   // Clipping added if we align before
+  the beginning of a chromosome unsigned basesClippedAfter; int editDistance =
+  -1;*/
+
+  *addFrontClipping = 0;
+  const char *contigName = "*";
+  const char *matecontigName = "*";
+  int contigIndex = -1;
+  GenomeDistance positionInContig = 0;
+  int mateContigIndex = -1;
+  GenomeDistance matePositionInContig = 0;
+
+  GenomeDistance extraBasesClippedBefore;  // Clipping added if we align before
+                                           // the beginning of a chromosome
+  _int64 templateLength = 0;
+  const char *clippedData;
+  unsigned fullLength;
+  unsigned clippedLength;
+  unsigned basesClippedBefore;
+  unsigned basesClippedAfter;
+  int editDistance = -1;
+  uint16_t flags = 0;
+  GenomeLocation orig_location = genomeLocation;
+
+  if (secondaryAlignment) {
+    flags |= SAM_SECONDARY;
+  }
+
+  //
+  // If the aligner said it didn't find anything, treat it as such.  Sometimes
+  // it will emit the best match that it found, even if it's not within the
+  // maximum edit distance limit (but will then say NotFound).  Here, we force
+  // that to be SAM_UNMAPPED.
+  //
+  if (NotFound == result) {
+    genomeLocation = InvalidGenomeLocation;
+  }
+
+  if (InvalidGenomeLocation == genomeLocation) {
+    //
+    // If it's unmapped, then always emit it in the forward direction.  This is
+    // necessary because we don't even include the SAM_REVERSE_COMPLEMENT flag
+    // for unmapped reads, so there's no way to tell that we reversed it.
+    //
+    direction = FORWARD;
+  }
+
+  clippedLength = read->getDataLength();
+  fullLength = read->getUnclippedLength();
+
+  if (direction == RC) {
+    for (unsigned i = 0; i < fullLength; i++) {
+      data[fullLength - 1 - i] = COMPLEMENT[read->getUnclippedData()[i]];
+      quality[fullLength - 1 - i] = read->getUnclippedQuality()[i];
+    }
+    clippedData =
+        &data[fullLength - clippedLength - read->getFrontClippedLength()];
+    basesClippedBefore =
+        fullLength - clippedLength - read->getFrontClippedLength();
+    basesClippedAfter = read->getFrontClippedLength();
+  } else {
+    clippedData = read->getData();
+    basesClippedBefore = read->getFrontClippedLength();
+    basesClippedAfter = fullLength - clippedLength - basesClippedBefore;
+  }
+
+  if (genomeLocation != InvalidGenomeLocation) {
+    if (direction == RC) {
+      flags |= SAM_REVERSE_COMPLEMENT;
+    }
+    const Genome::Contig *contig = genome->getContigForRead(
+        genomeLocation, read->getDataLength(), &extraBasesClippedBefore);
+    _ASSERT(NULL != contig && contig->length > genome->getChromosomePadding());
+    genomeLocation += extraBasesClippedBefore;
+
+    contigName = contig->name;
+    contigIndex = (int)(contig - genome->getContigs());
+    positionInContig =
+        genomeLocation - contig->beginningLocation;  // SAM is 1-based
+    mapQuality = max(0, min(70, mapQuality));  // FIXME: manifest constant.
+  } else {
+    flags |= SAM_UNMAPPED;
+    mapQuality = 0;
+    extraBasesClippedBefore = 0;
+  }
+
+  finalResult.next_position = -1;
+  finalResult.next_ref_index = -1;
+
+  if (hasMate) {
+    flags |= SAM_MULTI_SEGMENT;
+    flags |= (firstInPair ? SAM_FIRST_SEGMENT : SAM_LAST_SEGMENT);
+    if (mateLocation != InvalidGenomeLocation) {
+      GenomeDistance mateExtraBasesClippedBefore;
+      const Genome::Contig *mateContig = genome->getContigForRead(
+          mateLocation, mate->getDataLength(), &mateExtraBasesClippedBefore);
+      mateLocation += mateExtraBasesClippedBefore;
+      matecontigName = mateContig->name;
+      mateContigIndex = (int)(mateContig - genome->getContigs());
+      matePositionInContig = mateLocation - mateContig->beginningLocation;
+
+      if (mateDirection == RC) {
+        flags |= SAM_NEXT_REVERSED;
+      }
+
+      if (genomeLocation == InvalidGenomeLocation) {
+        //
+        // The SAM spec says that for paired reads where exactly one end is
+        // unmapped that the unmapped half should just have RNAME and POS copied
+        // from the mate.
+        //
+        contigName = matecontigName;
+        contigIndex = mateContigIndex;
+        matecontigName = "=";
+        positionInContig = matePositionInContig;
+      }
+
+    } else {
+      flags |= SAM_NEXT_UNMAPPED;
+      //
+      // The mate's unmapped, so point it at us.
+      //  in AGD this doesnt matter
+      matecontigName = "=";
+      mateContigIndex = contigIndex;
+      matePositionInContig = positionInContig;
+    }
+
+    if (genomeLocation != InvalidGenomeLocation &&
+        mateLocation != InvalidGenomeLocation) {
+      if (alignedAsPair) {
+        flags |= SAM_ALL_ALIGNED;
+      }
+      // Also compute the length of the whole paired-end string whose ends we
+      // saw. This is slightly tricky because (a) we may have clipped some bases
+      // before/after each end and (b) we need to give a signed result based on
+      // whether our read is first or second in the pair.
+      GenomeLocation myStart = genomeLocation - basesClippedBefore;
+      GenomeLocation myEnd = genomeLocation + clippedLength + basesClippedAfter;
+      _int64 mateBasesClippedBefore = mate->getFrontClippedLength();
+      _int64 mateBasesClippedAfter = mate->getUnclippedLength() -
+                                     mate->getDataLength() -
+                                     mateBasesClippedBefore;
+      GenomeLocation mateStart =
+          mateLocation - (mateDirection == RC ? mateBasesClippedAfter
+                                              : mateBasesClippedBefore);
+      GenomeLocation mateEnd =
+          mateLocation + mate->getDataLength() +
+          (mateDirection == FORWARD ? mateBasesClippedAfter
+                                    : mateBasesClippedBefore);
+      if (contigName ==
+          matecontigName) {  // pointer (not value) comparison, but that's OK.
+        if (myStart < mateStart) {
+          templateLength = mateEnd - myStart;
+        } else {
+          templateLength = -(myEnd - mateStart);
+        }
+      }  // otherwise leave TLEN as zero.
+    }
+
+    if (contigName == matecontigName) {
+      matecontigName =
+          "=";  // SAM Spec says to do this when they're equal (and not *, which
+                // won't happen because this is a pointer, not string, compare)
+    }
+    finalResult.next_position = matePositionInContig;
+    finalResult.next_ref_index = mateContigIndex;
+  }
+
+  finalResult.mapping_quality = mapQuality;
+  finalResult.flag = flags;
+  finalResult._padding = 0;
+  finalResult.template_length = templateLength;
+  finalResult.position = positionInContig;
+  finalResult.ref_index = contigIndex;
+  finalResult.num_cigar_ops = 0;
+
+  const int cigarBufSize = MAX_READ * 2;
+  char cigarBuf[cigarBufSize];
+
+  const int cigarBufWithClippingSize = MAX_READ * 2 + 32;
+  char cigarBufWithClipping[cigarBufWithClippingSize];
+
+  if (orig_location != InvalidGenomeLocation) {
+    const char *thecigar = SAMFormat::computeCigarString(
+        genome, lv, cigarBuf, cigarBufSize, cigarBufWithClipping,
+        cigarBufWithClippingSize, clippedData, clippedLength,
+        basesClippedBefore, extraBasesClippedBefore, basesClippedAfter,
+        read->getOriginalFrontHardClipping(),
+        read->getOriginalBackHardClipping(), orig_location, direction, useM,
+        &editDistance, addFrontClipping);
+
+    // VLOG(INFO) << "cigar output was : " << thecigar << " and frontclipping
+    // was " << *addFrontClipping;
+
+    if (*addFrontClipping != 0) {
+      // higher up the call stack deals with this
+      // return errors::Internal("something went horribly wrong creating a cigar
+      // string");
+    } else {
+      cigar = thecigar;
+    }
+  }
+
+  return errors::Status::OK();
+}
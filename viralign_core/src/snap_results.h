@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+
+#include "libagd/src/format.h"
+#include "libagd/src/proto/alignment.pb.h"
+#include "liberr/errors.h"
+#include "snap-master/SNAPLib/AlignmentResult.h"
+#include "snap-master/SNAPLib/Genome.h"
+#include "snap-master/SNAPLib/Read.h"
+#include "snap-master/SNAPLib/SAM.h"
+
+// Conversion of SNAP alignment results into AGD results, shared by the single
+// and paired aligners. Adapted from the SAM writer in SNAP.
+// cigar is set to "*" if the read is unmapped.
+
+errors::Status WriteSingleResult(Read& snap_read, SingleAlignmentResult& result,
+                                 agd::format::BinaryAlignment& format_result,
+                                 std::string& cigar, const Genome* genome,
+                                 LandauVishkinWithCigar* lvc, bool is_secondary,
+                                 bool use_m);
+
+// write the result for snap_reads[which_read] of a pair
+errors::Status WritePairedResult(Read* snap_reads, PairedAlignmentResult& result,
+                                 int which_read,
+                                 agd::format::BinaryAlignment& format_result,
+                                 std::string& cigar, const Genome* genome,
+                                 LandauVishkinWithCigar* lvc, bool is_secondary,
+                                 bool use_m);
+
+errors::Status PostProcess(const Genome* genome, LandauVishkinWithCigar* lv,
+                           Read* read, AlignmentResult result, int mapQuality,
+                           GenomeLocation genomeLocation, Direction direction,
+                           bool secondaryAlignment,
+                           agd::format::BinaryAlignment& finalResult,
+                           std::string& cigar, int* addFrontClipping, bool useM,
+                           bool hasMate = false, bool firstInPair = false,
+                           Read* mate = NULL, AlignmentResult mateResult = NotFound,
+                           GenomeLocation mateLocation = 0,
+                           Direction mateDirection = FORWARD,
+                           bool alignedAsPair = false);
+
+// fill in the protobuf result, with contig names from the genome
+void ToAlignment(const Genome* genome,
+                 const agd::format::BinaryAlignment& result,
+                 const std::string& cigar, Alignment& format_result);
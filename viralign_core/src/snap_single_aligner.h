@@ -1,7 +1,10 @@
+#pragma once
+
 
 #include <memory>
 #include <string>
 
+#include "libagd/src/format.h"
 #include "libagd/src/proto/alignment.pb.h"
 #include "liberr/errors.h"
 #include "snap-master/SNAPLib/AlignerOptions.h"
@@ -10,6 +13,7 @@
 #include "snap-master/SNAPLib/SeedSequencer.h"
 #include "snap-master/SNAPLib/SAM.h"
 #include "snap-master/SNAPLib/AlignmentResult.h"
+#include "snap_results.h"
 
 
 class SingleAligner {
@@ -18,6 +22,11 @@ class SingleAligner {
 
   errors::Status AlignRead(Read& snap_read, Alignment& result, GenomeLocation& loc);
 
+  // align and produce a binary AGD result, without building a protobuf.
+  // cigar is "*" if unmapped
+  errors::Status AlignRead(Read& snap_read, agd::format::BinaryAlignment& result,
+                           std::string& cigar);
+
  private:
   GenomeIndex* index_;
   const Genome* genome_;
@@ -29,20 +38,5 @@ class SingleAligner {
   SingleAlignmentResult primaryResult_;
   std::vector<SingleAlignmentResult> secondaryResults_;
   LandauVishkinWithCigar lvc_;
-
-  errors::Status WriteSingleResult(Read& snap_read, SingleAlignmentResult& result,
-                           Alignment& format_result,
-                           const Genome* genome, LandauVishkinWithCigar* lvc,
-                           bool is_secondary, bool use_m);
-
-  errors::Status PostProcess(const Genome* genome, LandauVishkinWithCigar* lv,
-                     Read* read, AlignmentResult result, int mapQuality,
-                     GenomeLocation genomeLocation, Direction direction,
-                     bool secondaryAlignment, Alignment& finalResult,
-                     std::string& cigar, int* addFrontClipping, bool useM,
-                     bool hasMate = false, bool firstInPair = false,
-                     Read* mate = NULL, AlignmentResult mateResult = NotFound,
-                     GenomeLocation mateLocation = 0,
-                     Direction mateDirection = FORWARD,
-                     bool alignedAsPair = false);
+  std::string cigar_;
 };
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "target_set.h"
+
+#include <regex>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_join.h"
+
+using namespace errors;
+
+Status TargetSet::Create(const Genome* genome,
+                         const std::vector<std::string>& names,
+                         const std::string& regex,
+                         std::unique_ptr<TargetSet>& targets) {
+  std::regex re;
+  if (!regex.empty()) {
+    try {
+      re = std::regex(regex);
+    } catch (const std::regex_error& e) {
+      return InvalidArgument("Invalid target contig regex ", regex, ": ",
+                             e.what());
+    }
+  }
+
+  const Genome::Contig* contigs = genome->getContigs();
+  auto num_contigs = genome->getNumContigs();
+
+  targets.reset(new TargetSet());
+  targets->bitmap_.resize((num_contigs + 63) / 64, 0);
+  targets->slots_.resize(num_contigs, 0);
+
+  for (int i = 0; i < num_contigs; i++) {
+    std::string contig_name(contigs[i].name, contigs[i].nameLength);
+    bool selected = false;
+    for (const auto& name : names) {
+      if (absl::StrContains(contig_name, name)) {
+        selected = true;
+        break;
+      }
+    }
+    if (!selected && !regex.empty()) {
+      selected = std::regex_search(contig_name, re);
+    }
+    if (!selected) continue;
+
+    targets->bitmap_[i >> 6] |= 1ULL << (i & 63);
+    targets->slots_[i] = targets->contigs_.size();
+    targets->contigs_.push_back(i);
+    targets->names_.push_back(std::move(contig_name));
+  }
+
+  if (targets->contigs_.empty()) {
+    return ObjNotFound("No contigs matched targets [", absl::StrJoin(names, ","),
+                    "]", regex.empty() ? "" : " or regex ", regex);
+  }
+
+  return Status::OK();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "liberr/errors.h"
+#include "snap-master/SNAPLib/Genome.h"
+
+// The set of contigs whose alignments are kept, e.g. the viruses of a panel
+// in a combined index. Contigs are selected by name and/or regex and compiled
+// into a bitmap indexed by ref_index, so checking a result is O(1).
+class TargetSet {
+ public:
+  // select contigs whose name contains any of names, or matches regex (if not
+  // empty). Error if nothing is selected.
+  static errors::Status Create(const Genome* genome,
+                               const std::vector<std::string>& names,
+                               const std::string& regex,
+                               std::unique_ptr<TargetSet>& targets);
+
+  // true if ref_index is a target contig. -1 (unmapped) is never a target
+  bool Contains(int ref_index) const {
+    return ref_index >= 0 && (bitmap_[ref_index >> 6] >> (ref_index & 63)) & 1;
+  }
+
+  // index of a target contig within the set, for per target stats.
+  // ref_index must be a target
+  size_t Slot(int ref_index) const { return slots_[ref_index]; }
+
+  size_t size() const { return contigs_.size(); }
+  // genome contig indexes of the targets, in slot order
+  const std::vector<int>& contigs() const { return contigs_; }
+  const std::vector<std::string>& names() const { return names_; }
+
+ private:
+  TargetSet() = default;
+
+  std::vector<uint64_t> bitmap_;
+  std::vector<uint32_t> slots_;
+  std::vector<int> contigs_;
+  std::vector<std::string> names_;
+};
@@ -1,4 +1,6 @@
 
+#include <signal.h>
+
 #include <algorithm>
 #include <fstream>
 #include <iomanip>
@@ -12,8 +14,12 @@
 #include "filesystem_manager.h"
 #include "json.hpp"
 #include "libagd/src/local_fetcher.h"
+#include "libagd/src/metrics.h"
+#include "libagd/src/object_store.h"
 #include "libagd/src/redis_fetcher.h"
+#include "libagd/src/resume_filter.h"
 #include "parallel_aligner.h"
+#include "shared_index.h"
 
 using json = nlohmann::json;
 using namespace errors;
@@ -69,7 +75,7 @@ int main(int argc, char** argv) {
   args::ArgumentParser parser(
       "viralign-core",
       "Align reads using SNAP from either Ceph or Local disk AGD files, only "
-      "logging SarsCov2 mapping reads (for now).");
+      "logging reads mapping to target contigs (SarsCov2 by default).");
   args::HelpFlag help(parser, "help", "Display this help menu", {'h', "help"});
   args::ValueFlag<unsigned int> threads_arg(
       parser, "threads",
@@ -96,10 +102,105 @@ int main(int argc, char** argv) {
       parser, "snap args", "Any args to pass to SNAP", {'s', "snap_args"});
   args::ValueFlag<std::string> genome_location_arg(
       parser, "genomeloc", "SNAP Genome Index location", {'g', "genome_loc"});
-  args::ValueFlag<std::string> agd_metadata_args(
+  args::ValueFlagList<std::string> agd_metadata_args(
       parser, "agd args",
-      "For testing, an AGD metadata to align some stuff. Overrides -r.",
+      "AGD metadata of a dataset to align, without Redis. Can be repeated, "
+      "the chunks of all datasets share one pipeline and each dataset gets "
+      "its aln column as soon as all its chunks are written. Overrides -r.",
       {'i', "input_metadata"});
+  args::ValueFlag<std::string> input_list_arg(
+      parser, "input list",
+      "JSON list of AGD metadata files to align like -i, as written for "
+      "viralign-genecount",
+      {"input_list"});
+  args::Flag binary_aln_arg(
+      parser, "binary alignments",
+      "Write alignment results as fixed layout binary records instead of "
+      "protobufs. Readable by agd2bam and viralign-genecount.",
+      {'b', "binary_aln"});
+  args::ValueFlag<std::string> codec_arg(
+      parser, "codec",
+      "Compression for written results, <codec>[:<level>] where codec is "
+      "gzip, libdeflate, zstd or none [gzip]",
+      {"codec"});
+  args::ValueFlag<std::string> io_engine_arg(
+      parser, "io engine",
+      "File I/O engine without Ceph, sync or io_uring. io_uring keeps the "
+      "column files of several chunks in flight, for NVMe and NFS [sync]",
+      {"io_engine"});
+  args::Flag resume_arg(
+      parser, "resume",
+      "Skip chunks that already have an aln column for the same records as "
+      "their base column, to resume an interrupted run",
+      {"resume"});
+  args::Flag packed_bases_arg(
+      parser, "packed bases",
+      "Keep COMPACTED_BASES input columns packed until each read is aligned, "
+      "instead of unpacking whole chunks in the reader",
+      {"packed_bases"});
+  args::Flag paired_arg(
+      parser, "paired",
+      "Input datasets contain interleaved paired reads, align them as pairs. "
+      "Paired SNAP args (e.g. -s <min> <max>) may be passed with -s.",
+      {'p', "paired"});
+  args::ValueFlag<std::string> targets_arg(
+      parser, "target contigs",
+      "Comma separated names of the contigs to keep alignments for, a contig "
+      "is a target if its name contains one of them [MN985325]",
+      {"targets"});
+  args::ValueFlag<std::string> target_regex_arg(
+      parser, "target regex",
+      "Also keep alignments for contigs whose name matches this regex",
+      {"target_regex"});
+  args::Flag kmer_filter_arg(
+      parser, "kmer filter",
+      "Screen reads with a k-mer filter built from the target contigs and "
+      "skip aligning reads that cannot map to them.",
+      {'k', "kmer_filter"});
+  args::ValueFlag<unsigned int> kmer_size_arg(
+      parser, "kmer size", "k-mer size for the k-mer filter, max 32 [20]",
+      {"kmer_size"});
+  args::ValueFlag<unsigned int> kmer_hits_arg(
+      parser, "kmer hits",
+      "Minimum k-mers a read must share with the target to be aligned [2]",
+      {"kmer_hits"});
+  args::ValueFlag<size_t> dup_cache_arg(
+      parser, "duplicate cache MB",
+      "Cache alignments of reads by their bases and qualities in up to this "
+      "many MB, so duplicate reads are aligned once [0, off]",
+      {"dup_cache_mb"});
+  args::ValueFlag<std::string> metrics_json_arg(
+      parser, "metrics json",
+      "Append pipeline metrics (stage throughput, latency, queue occupancy "
+      "and waits) as JSON lines to this file",
+      {"metrics_json"});
+  args::ValueFlag<int> metrics_port_arg(
+      parser, "metrics port",
+      "Serve pipeline metrics in Prometheus text format on 127.0.0.1:<port>",
+      {"metrics_port"});
+  args::ValueFlag<int> metrics_interval_arg(
+      parser, "metrics interval",
+      "Seconds between metrics JSON lines [10]", {"metrics_interval"});
+  args::ValueFlag<std::string> serve_index_arg(
+      parser, "serve index",
+      "Copy the genome index at -g into shared memory under this name and "
+      "serve it until SIGINT/SIGTERM, for other viralign-core processes on "
+      "this host to attach to with --shm_index. Does not align.",
+      {"serve_index"});
+  args::ValueFlag<std::string> shm_index_arg(
+      parser, "shared index",
+      "Map the genome index served under this name by --serve_index instead "
+      "of loading a private copy with -g. Processes attached to the same "
+      "index share its memory.",
+      {"shm_index"});
+  args::ValueFlag<int> shm_wait_arg(
+      parser, "shared index wait",
+      "Seconds to wait for the shared index to be served [300]",
+      {"shm_wait"});
+  args::Flag hugepages_arg(
+      parser, "hugepages",
+      "Advise the kernel to back the served index with huge pages",
+      {"hugepages"});
 
   try {
     parser.ParseCLI(argc, argv);
@@ -128,23 +229,50 @@ int main(int argc, char** argv) {
   std::cout << "[viralign-core] Using " << threads
             << " threads for alignment\n";
 
+  agd::ColumnCodecs codecs;
+  if (codec_arg) {
+    Status s = agd::ColumnCodecs::Parse(args::get(codec_arg), codecs);
+    CheckStatus(s);
+  }
+
+  agd::IoEngine io_engine = agd::IoEngine::SYNC;
+  if (io_engine_arg) {
+    Status s = agd::ParseIoEngine(args::get(io_engine_arg), &io_engine);
+    CheckStatus(s);
+  }
+
   std::string snap_cmd("");
   if (snap_args_arg) {
     snap_cmd = args::get(snap_args_arg);
   }
 
   std::string genome_location;
-  if (!genome_location_arg) {
+  // a served index is already resident in shared memory, no need to prefetch
+  bool prefetch = true;
+  if (shm_index_arg) {
+    int wait_secs = shm_wait_arg ? args::get(shm_wait_arg) : 300;
+    Status s = AttachSharedIndex(args::get(shm_index_arg), wait_secs,
+                                 genome_location);
+    CheckStatus(s);
+    prefetch = false;
+  } else if (!genome_location_arg) {
     std::cout << "[viralign-core] Genome index is required\n";
     exit(0);
   } else {
     genome_location = args::get(genome_location_arg);
   }
 
+  if (serve_index_arg) {
+    Status s = ServeIndex(genome_location, args::get(serve_index_arg),
+                          args::get(hugepages_arg));
+    CheckStatus(s);
+    return 0;
+  }
+
   std::cout << "[viralign-core] Loading genome index: " << genome_location
             << " ...\n";
   GenomeIndex* genome_index = GenomeIndex::loadFromDirectory(
-      const_cast<char*>(genome_location.c_str()), true, true);
+      const_cast<char*>(genome_location.c_str()), true, prefetch);
 
   if (!genome_index) {
     std::cout << "[viralign-core] Index load failed.\n";
@@ -159,25 +287,61 @@ int main(int argc, char** argv) {
   std::cout << "[viralign-core] Genome loaded, there are " << num_contigs
             << " contigs.\n";
 
-  int sars_cov2_contig_idx = -1;
-  for (int i = 0; i < num_contigs; i++) {
-    auto contig_name =
-        absl::string_view(contigs[i].name, contigs[i].nameLength);
-    if (absl::StrContains(contig_name, SarsCov2Contig)) {
-      sars_cov2_contig_idx = i;
-      break;
+  // keep alignments to the target contigs, SarsCov2 unless given
+  std::vector<std::string> target_names;
+  if (targets_arg) {
+    target_names = absl::StrSplit(args::get(targets_arg), ',',
+                                  absl::SkipEmpty());
+  } else if (!target_regex_arg) {
+    target_names.push_back(std::string(SarsCov2Contig));
+  }
+  std::string target_regex = target_regex_arg ? args::get(target_regex_arg) : "";
+
+  std::unique_ptr<TargetSet> targets;
+  Status ts = TargetSet::Create(genome, target_names, target_regex, targets);
+  if (!ts.ok()) {
+    if (targets_arg || target_regex_arg) CheckStatus(ts);
+    std::cout << "[viralign-core] did not find covid contig index, not "
+                 "filtering alignments\n";
+    targets.reset();
+  } else {
+    for (size_t t = 0; t < targets->size(); t++) {
+      std::cout << "[viralign-core] Target contig " << targets->names()[t]
+                << " has index " << targets->contigs()[t] << "\n";
     }
   }
 
-  if (sars_cov2_contig_idx == -1) {
-    std::cout << "[viralign-core] did not find covid contig index\n";
-  } else {
-    std::cout << "[viralign-core] SarsCov2 contig index is "
-              << sars_cov2_contig_idx << "\n";
+  std::unique_ptr<KmerFilter> kmer_filter;
+  if (kmer_filter_arg) {
+    if (!targets) {
+      std::cout << "[viralign-core] k-mer filter needs target contigs, "
+                   "not filtering\n";
+    } else {
+      uint32_t k = kmer_size_arg ? args::get(kmer_size_arg) : 20;
+      uint32_t min_hits = kmer_hits_arg ? args::get(kmer_hits_arg) : 2;
+      Status s = KmerFilter::Create(genome, targets->contigs(), k, min_hits,
+                                    kmer_filter);
+      CheckStatus(s);
+      std::cout << "[viralign-core] Built k-mer filter with "
+                << kmer_filter->NumKmers() << " " << k << "-mers ("
+                << kmer_filter->SizeBytes() / 1024 << " KB)\n";
+    }
   }
 
-  std::unique_ptr<AlignerOptions> options =
-      std::make_unique<AlignerOptions>("-=");
+  std::unique_ptr<AlignmentCache> aln_cache;
+  if (dup_cache_arg && args::get(dup_cache_arg) > 0) {
+    Status s = AlignmentCache::Create(args::get(dup_cache_arg) * 1024 * 1024,
+                                      aln_cache);
+    CheckStatus(s);
+  }
+
+  bool paired = args::get(paired_arg);
+  std::unique_ptr<AlignerOptions> options;
+  if (paired) {
+    options = std::make_unique<PairedAlignerOptions>("-=");
+  } else {
+    options = std::make_unique<AlignerOptions>("-=");
+  }
 
   std::vector<std::string> split_cmd = absl::StrSplit(snap_cmd, ' ');
   const char* snapargv[split_cmd.size()];
@@ -200,8 +364,9 @@ int main(int argc, char** argv) {
 
   std::string redis_addr("");
   if (redis_arg) {
-    std::string redis_addr = args::get(redis_arg);
+    redis_addr = args::get(redis_arg);
   }
+  const std::string worker_id = RedisWorkQueue::NewWorkerId();
 
   std::string queue_name("queue:viralign");
   std::string return_queue_name("queue:viralign_return");
@@ -211,20 +376,75 @@ int main(int argc, char** argv) {
     return_queue_name = absl::StrCat(queue_name, "_return");
   }
 
+  std::vector<std::string> agd_meta_paths = args::get(agd_metadata_args);
+  if (input_list_arg) {
+    std::ifstream i(args::get(input_list_arg));
+    if (!i.good()) {
+      std::cout << "[viralign-core] Couldn't open input list "
+                << args::get(input_list_arg) << "\n";
+      exit(0);
+    }
+    json input_list;
+    i >> input_list;
+    for (const auto& meta : input_list) {
+      agd_meta_paths.push_back(meta.get<std::string>());
+    }
+  }
+
+  // with --resume, the fetcher skips chunks already aligned
+  auto make_resume_filter = [&]() -> std::unique_ptr<agd::ResumeFilter> {
+    if (!resume_arg) return nullptr;
+    std::unique_ptr<agd::ObjectStore> store;
+    if (ceph_json_arg) {
+      std::ifstream ci(args::get(ceph_json_arg));
+      json ceph_config_json;
+      ci >> ceph_config_json;
+      Status cs = agd::RadosObjectStore::Create(
+          ceph_config_json["cluster"], ceph_config_json["client"],
+          ceph_config_json["namespace"], ceph_config_json["conf_file"],
+          store);
+      CheckStatus(cs);
+    }
+    return std::make_unique<agd::ResumeFilter>("aln", "base",
+                                               std::move(store));
+  };
+
   // determine source for data input (-i or -r)
-  if (agd_metadata_args) {
-    // create local fetcher and run
-    std::string agd_meta_path = args::get(agd_metadata_args);
-    fetcher.reset(new LocalFetcher(agd_meta_path));
+  LocalFetcher* local_fetcher = nullptr;
+  Status dataset_status = Status::OK();
+  if (!agd_meta_paths.empty()) {
+    // create local fetcher and run. Datasets are finished as their last
+    // chunk is written, while the others are still aligning
+    local_fetcher = new LocalFetcher(
+        agd_meta_paths, [&](const std::string& agd_meta_path) {
+          Status s = AddColumnAndRef(agd_meta_path, genome_index);
+          if (!s.ok()) {
+            std::cout << "[viralign-core] Error: " << s.error_message()
+                      << "\n";
+            dataset_status = s;
+          }
+        },
+        make_resume_filter());
+    fetcher.reset(local_fetcher);
     Status fs = fetcher->Run();
     if (!fs.ok()) {
       std::cout << "[viralign-core] Unable to create fetcher: "
                 << fs.error_message() << "\n";
+      exit(0);
     }
   } else {
-    // this is the "run forever" case
+    // this is the "run forever" case, until SIGINT or SIGTERM
     if (redis_arg) {
-      Status rs = RedisFetcher::Create(redis_addr, queue_name, fetcher);
+      // block the signals in all threads, they are handled by sigwait below
+      sigset_t stop_signals;
+      sigemptyset(&stop_signals);
+      sigaddset(&stop_signals, SIGINT);
+      sigaddset(&stop_signals, SIGTERM);
+      pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
+      Status rs =
+          RedisFetcher::Create(redis_addr, queue_name, worker_id, fetcher,
+                               make_resume_filter(), return_queue_name);
 
       if (!rs.ok()) {
         std::cout << "[viralign-core] Unable to create redox fetcher: "
@@ -240,6 +460,16 @@ int main(int argc, char** argv) {
         exit(0);
       }
 
+      // stopping the fetcher closes the input queue, chunks already fetched
+      // are finished and the pipeline drains and exits
+      std::thread([&fetcher, stop_signals]() {
+        int sig;
+        sigwait(&stop_signals, &sig);
+        std::cout << "[viralign-core] Got signal " << sig
+                  << ", finishing fetched chunks ...\n";
+        fetcher->Stop();
+      }).detach();
+
     } else {
       std::cout << "[viralign-core] Need either -i or -r for data input. "
                    "Exiting ... \n";
@@ -247,11 +477,25 @@ int main(int argc, char** argv) {
     }
   }
 
+  std::unique_ptr<agd::MetricsReporter> metrics_reporter;
+  if (metrics_json_arg || metrics_port_arg) {
+    Status ms = agd::MetricsReporter::Create(
+        &agd::MetricsRegistry::Global(),
+        metrics_json_arg ? args::get(metrics_json_arg) : "",
+        metrics_port_arg ? args::get(metrics_port_arg) : 0,
+        metrics_interval_arg ? args::get(metrics_interval_arg) : 10,
+        metrics_reporter);
+    CheckStatus(ms);
+  }
+
   auto input_queue = fetcher->GetInputQueue();
   auto max_records = fetcher->MaxRecords();  // run forever
 
   Status s = Status::OK();
-  if (ceph_json_arg) {
+  if (local_fetcher && max_records == 0) {
+    // resumed with everything done, 0 would mean running forever
+    std::cout << "[viralign-core] All chunks already aligned.\n";
+  } else if (ceph_json_arg) {
     // we will do IO from ceph
 
     const auto& ceph_conf_json_path = args::get(ceph_json_arg);
@@ -259,12 +503,25 @@ int main(int argc, char** argv) {
     CephManagerParams params;
     params.aligner_threads = threads;
     params.ceph_config_json_path = ceph_conf_json_path;
-    params.filter_contig_index = sars_cov2_contig_idx;
+    params.targets = targets.get();
+    params.kmer_filter = kmer_filter.get();
+    params.aln_cache = aln_cache.get();
+    params.binary_output = args::get(binary_aln_arg);
+    params.codecs = &codecs;
+    params.packed_bases = args::get(packed_bases_arg);
+    params.paired = paired;
     params.index = genome_index;
     params.max_records = max_records;
     params.options = options.get();
     params.input_queue = input_queue;
     params.queue_name = return_queue_name;
+    if (local_fetcher) {
+      params.chunk_written = [local_fetcher](const agd::OutputQueueItem& item) {
+        local_fetcher->ChunkWritten(item.objName);
+      };
+    }
+    params.work_queue_name = queue_name;
+    params.worker_id = worker_id;
     params.reader_threads = 4;
     params.writer_threads = 4;
     params.redis_addr = redis_addr;
@@ -274,27 +531,47 @@ int main(int argc, char** argv) {
     // we will IO from file system
     FileSystemManagerParams params;
     params.aligner_threads = threads;
-    params.filter_contig_index = sars_cov2_contig_idx;
+    params.targets = targets.get();
+    params.kmer_filter = kmer_filter.get();
+    params.aln_cache = aln_cache.get();
+    params.binary_output = args::get(binary_aln_arg);
+    params.codecs = &codecs;
+    params.packed_bases = args::get(packed_bases_arg);
+    params.paired = paired;
     params.index = genome_index;
     params.max_records = max_records;
     params.options = options.get();
     params.input_queue = input_queue;
     params.queue_name = return_queue_name;
+    if (local_fetcher) {
+      params.chunk_written = [local_fetcher](const agd::OutputQueueItem& item) {
+        local_fetcher->ChunkWritten(item.objName);
+      };
+    }
+    params.work_queue_name = queue_name;
+    params.worker_id = worker_id;
     params.reader_threads = 4;
     params.writer_threads = 4;
     params.redis_addr = redis_addr;
+    params.io_engine = io_engine;
 
     s = FileSystemManager::Run(params);
   }
 
+  if (local_fetcher) fetcher->Stop();
+  if (metrics_reporter) metrics_reporter->Stop();
+
   if (!s.ok()) {
     std::cout << "[viralign-core] Error: " << s.error_message() << "\n";
     return 0;
   }
 
-  if (agd_metadata_args) {
-    std::string agd_meta_path = args::get(agd_metadata_args);
-    s = AddColumnAndRef(agd_meta_path, genome_index);
+  if (local_fetcher) {
+    for (const auto& agd_meta_path : local_fetcher->Incomplete()) {
+      std::cout << "[viralign-core] Not all chunks of " << agd_meta_path
+                << " were written, its metadata is not updated\n";
+    }
+    s = dataset_status;
   }
 
   if (!s.ok()) {
@@ -39,7 +39,8 @@ Status CephManager::Run(const CephManagerParams& params) {
 
   auto chunk_queue = reader->GetOutputQueue();
   
-  Status s = CountGenes(params.max_chunks, chunk_queue, params.interval_forest, *params.genes);
+  Status s = CountGenes(params.max_chunks, chunk_queue, params.interval_forest,
+                        *params.genes, *params.ref_names);
 
   reader->Stop();
 
@@ -13,6 +13,8 @@ struct CephManagerParams {
   uint32_t max_chunks;
   const IntervalForest* interval_forest;
   const GeneIdMap* genes;
+  // contig names by ref index, to resolve binary alignment results
+  const std::vector<std::string>* ref_names;
 };
 
 class CephManager {
@@ -20,11 +20,13 @@ Status FileSystemManager::Run(const FileSystemManagerParams& params) {
   agd::ObjectPool<agd::Buffer> buf_pool;
   std::unique_ptr<agd::AGDFileSystemReader> reader;
   ERR_RETURN_IF_ERROR(agd::AGDFileSystemReader::Create(
-      columns, params.input_queue, params.reader_threads, buf_pool, reader));
+      columns, params.input_queue, params.reader_threads, buf_pool, reader,
+      true, params.io_engine));
 
   auto chunk_queue = reader->GetOutputQueue();
 
-  Status s = CountGenes(params.max_chunks, chunk_queue, params.interval_forest, *params.genes);
+  Status s = CountGenes(params.max_chunks, chunk_queue, params.interval_forest,
+                        *params.genes, *params.ref_names);
 
   reader->Stop();
 
@@ -12,6 +12,9 @@ struct FileSystemManagerParams {
   uint32_t max_chunks;
   const IntervalForest* interval_forest;
   const GeneIdMap* genes;
+  // contig names by ref index, to resolve binary alignment results
+  const std::vector<std::string>* ref_names;
+  agd::IoEngine io_engine;
 };
 
 class FileSystemManager {
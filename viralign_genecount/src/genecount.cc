@@ -37,8 +37,28 @@ uint32_t ParseCigarLen(const char* cigar, size_t cigar_len) {
   return total_len;
 }
 
+// same as above, for BAM packed cigar ops (M, I, S, =, X)
+uint32_t CigarOpsLen(const uint32_t* ops, size_t num_ops) {
+  uint32_t total_len = 0;
+  for (size_t i = 0; i < num_ops; i++) {
+    switch (ops[i] & 0xf) {
+      case 0:
+      case 1:
+      case 4:
+      case 7:
+      case 8:
+        total_len += ops[i] >> 4;
+        break;
+      default:
+        break;
+    }
+  }
+  return total_len;
+}
+
 errors::Status CountGenes(uint32_t max_chunks, agd::ChunkQueueType* input_queue,
-                          const IntervalForest* interval_forest, const GeneIdMap& genes) {
+                          const IntervalForest* interval_forest, const GeneIdMap& genes,
+                          const std::vector<std::string>& ref_names) {
   // get chunk
   // for each alignment
   // process based on cigar string, looking up intervals
@@ -50,6 +70,8 @@ errors::Status CountGenes(uint32_t max_chunks, agd::ChunkQueueType* input_queue,
 
   agd::ChunkQueueItem item;
   Alignment aln;
+  const agd::format::BinaryAlignment* bin_aln;
+  const std::string unknown_contig;
 
   std::vector<const TreeValue*> found_intervals;
   found_intervals.reserve(15);
@@ -57,12 +79,18 @@ errors::Status CountGenes(uint32_t max_chunks, agd::ChunkQueueType* input_queue,
   uint64_t num_alignments = 0;
   uint64_t num_mapped_alignments = 0;
   uint64_t num_samples = 0;
-  for (uint32_t i = 0; i < max_chunks; i++) {
-    input_queue->pop(item);
+  uint32_t num_chunks = 0;
+  for (; num_chunks < max_chunks; num_chunks++) {
+    // the reader closes its output early if it failed
+    if (!input_queue->pop(item)) break;
 
     assert(item.col_bufs.size() == 1);
 
-    agd::AGDResultReader aln_reader(item.col_bufs[0]->data(), item.chunk_size);
+    auto aln_type = item.record_types.empty()
+                        ? agd::format::RecordType::STRUCTURED
+                        : item.record_types[0];
+    agd::AGDResultReader aln_reader(item.col_bufs[0]->data(), item.chunk_size,
+                                    nullptr, aln_type);
 
     if (!sample_genecount_map.contains(item.name)) {
       sample_genecount_map.insert_or_assign(
@@ -75,7 +103,12 @@ errors::Status CountGenes(uint32_t max_chunks, agd::ChunkQueueType* input_queue,
     bool done_chunk = false;
     while (!done_chunk) {
       // process this alignment
-      Status s = aln_reader.GetNextResult(aln);
+      Status s;
+      if (aln_reader.IsBinary()) {
+        s = aln_reader.GetNextBinaryResult(&bin_aln);
+      } else {
+        s = aln_reader.GetNextResult(aln);
+      }
       if (IsResourceExhausted(s)) {
         done_chunk = true;
         continue;
@@ -85,13 +118,28 @@ errors::Status CountGenes(uint32_t max_chunks, agd::ChunkQueueType* input_queue,
 
       num_alignments++;
 
-      const auto& cigar = aln.cigar();
-      auto cigar_len = ParseCigarLen(cigar.data(), cigar.size());
-      std::cout << "[viralign-countgenes] Alignment length for cigar " << cigar
-                << " was " << cigar_len << "\n";
+      uint32_t cigar_len;
+      int start;
+      const std::string* contig;
+      if (aln_reader.IsBinary()) {
+        cigar_len = CigarOpsLen(bin_aln->cigar(), bin_aln->num_cigar_ops);
+        start = bin_aln->position;
+        contig = bin_aln->ref_index >= 0 &&
+                         static_cast<size_t>(bin_aln->ref_index) <
+                             ref_names.size()
+                     ? &ref_names[bin_aln->ref_index]
+                     : &unknown_contig;
+      } else {
+        const auto& cigar = aln.cigar();
+        cigar_len = ParseCigarLen(cigar.data(), cigar.size());
+        start = aln.position().position();  // + 1 ?
+        contig = &aln.position().contig();
+        // binary records aren't unpacked to a cigar string just to print it
+        std::cout << "[viralign-countgenes] Alignment length for cigar "
+                  << cigar << " was " << cigar_len << "\n";
+      }
 
-      const auto& contig_name = aln.position().contig();
-      int start = aln.position().position();  // + 1 ?
+      const auto& contig_name = *contig;
       int end = start + cigar_len;
 
       if (!interval_forest->contains(contig_name)) {
@@ -154,7 +202,11 @@ errors::Status CountGenes(uint32_t max_chunks, agd::ChunkQueueType* input_queue,
       i++;
     }
   }
-  
+
+  if (num_chunks < max_chunks) {
+    return DataLoss("[viralign-genecount] Only read ", num_chunks, " of ",
+                    max_chunks, " chunks, counts are partial");
+  }
   return Status::OK();
 
 }
\ No newline at end of file
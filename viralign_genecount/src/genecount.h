@@ -7,4 +7,5 @@
 
 errors::Status CountGenes(uint32_t max_chunks, agd::ChunkQueueType* input_queue,
                           const IntervalForest* interval_forest,
-                          const GeneIdMap& genes);
\ No newline at end of file
+                          const GeneIdMap& genes,
+                          const std::vector<std::string>& ref_names);
\ No newline at end of file
@@ -17,11 +17,18 @@ errors::Status MultiFetcher::Run() {
     i.close();
 
     max_records_ += agd_metadata["records"].size();
+
+    if (ref_names_.empty() && agd_metadata.contains("ref_genome")) {
+      for (const auto& ref : agd_metadata["ref_genome"]) {
+        ref_names_.push_back(ref["name"].get<std::string>());
+      }
+    }
   }
 
   std::cout << "[MultiFetcher] Max chunks: " << max_records_ << "\n";
 
-  auto run_func = [this]() {
+  // false if the pipeline failed and closed the input queue
+  auto fetch_func = [this]() {
     for (const auto& meta : metadata_list_) {
       json agd_metadata;
       const auto& meta_path = meta.get<std::string>();
@@ -59,9 +66,18 @@ errors::Status MultiFetcher::Run() {
         std::cout << "[MultiFetcher] chunk path / obj name is: " << item.objName
                   << ", pool name is: " << item.pool << "\n";
 
-        input_queue_->push(std::move(item));
+        if (!input_queue_->push(std::move(item))) return false;
       }
     }
+    return true;
+  };
+
+  auto run_func = [this, fetch_func]() {
+    if (!fetch_func()) {
+      std::cout << "[MultiFetcher] Input queue closed, the pipeline failed\n";
+    }
+    // all chunks fetched, lets the pipeline drain and stop
+    input_queue_->close();
   };
 
   fetch_thread_ = std::thread(run_func);
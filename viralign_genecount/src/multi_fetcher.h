@@ -17,9 +17,13 @@ class MultiFetcher : public InputFetcher {
   void Stop() override { fetch_thread_.join(); };
   uint32_t MaxRecords() const override { return max_records_; }
 
+  // contig names from the first dataset with a ref_genome, valid after Run()
+  const std::vector<std::string>& RefNames() const { return ref_names_; }
+
  private:
   absl::string_view metadata_list_json_path_;
-  uint32_t max_records_;
+  uint32_t max_records_ = 0;
   json metadata_list_;
+  std::vector<std::string> ref_names_;
   std::thread fetch_thread_;
 };
\ No newline at end of file
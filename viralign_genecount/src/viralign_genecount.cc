@@ -139,6 +139,11 @@ int main(int argc, char** argv) {
       "cluster name>, \"client\": <ceph client name>, \"namespace\": <required "
       "namespace if any>}",
       {'c', "ceph_config"});
+  args::ValueFlag<std::string> io_engine_arg(
+      parser, "io engine",
+      "File I/O engine without Ceph, sync or io_uring. io_uring keeps the "
+      "column files of several chunks in flight, for NVMe and NFS [sync]",
+      {"io_engine"});
   args::Positional<std::string> input_arg(
       parser, "input datasets",
       "Input json file containing a list of datasets with aligned reads");
@@ -186,8 +191,8 @@ int main(int argc, char** argv) {
 
   const auto& input_list_json_path = args::get(input_arg);
 
-  std::unique_ptr<InputFetcher> input_fetcher(
-      new MultiFetcher(absl::string_view(input_list_json_path)));
+  auto multi_fetcher = new MultiFetcher(absl::string_view(input_list_json_path));
+  std::unique_ptr<InputFetcher> input_fetcher(multi_fetcher);
 
   input_fetcher->Run();
   std::cout << "[viralign-genecount] Max chunks is " << input_fetcher->MaxRecords() << "\n";
@@ -202,6 +207,7 @@ int main(int argc, char** argv) {
     params.input_queue = input_fetcher->GetInputQueue();
     params.max_chunks = input_fetcher->MaxRecords();
     params.interval_forest = interval_forest.get();
+    params.ref_names = &multi_fetcher->RefNames();
     params.output_filename = "genecount.csv";
     params.reader_threads = threads;
 
@@ -216,9 +222,17 @@ int main(int argc, char** argv) {
     params.input_queue = input_fetcher->GetInputQueue();
     params.max_chunks = input_fetcher->MaxRecords();
     params.interval_forest = interval_forest.get();
+    params.ref_names = &multi_fetcher->RefNames();
     params.output_filename = "genecount.csv";
     params.reader_threads = threads;
-    Status s = FileSystemManager::Run(params);
+    params.io_engine = agd::IoEngine::SYNC;
+    Status s = Status::OK();
+    if (io_engine_arg) {
+      s = agd::ParseIoEngine(args::get(io_engine_arg), &params.io_engine);
+    }
+    if (s.ok()) {
+      s = FileSystemManager::Run(params);
+    }
     if (!s.ok()) {
       std::cout << "[viralign-genecount] Error: " << s.error_message() << "\n";
     }
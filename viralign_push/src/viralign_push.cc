@@ -1,3 +1,6 @@
+#include <glob.h>
+
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -10,6 +13,38 @@
 using json = nlohmann::json;
 namespace fs = std::filesystem;
 
+// the metadata files arg names: a metadata file, a directory to search for
+// metadata.json files, e.g. a samplesep output directory, or a glob pattern
+// of either
+std::vector<std::string> ExpandDatasets(const std::string& arg) {
+  std::vector<std::string> matches;
+  glob_t g;
+  if (glob(arg.c_str(), GLOB_NOCHECK, nullptr, &g) == 0) {
+    for (size_t i = 0; i < g.gl_pathc; i++) {
+      matches.push_back(g.gl_pathv[i]);
+    }
+  }
+  globfree(&g);
+
+  std::vector<std::string> datasets;
+  for (const auto& match : matches) {
+    if (fs::is_directory(match)) {
+      std::vector<std::string> found;
+      for (const auto& entry : fs::recursive_directory_iterator(match)) {
+        if (entry.is_regular_file() &&
+            entry.path().filename() == "metadata.json") {
+          found.push_back(entry.path().string());
+        }
+      }
+      std::sort(found.begin(), found.end());
+      datasets.insert(datasets.end(), found.begin(), found.end());
+    } else {
+      datasets.push_back(match);
+    }
+  }
+  return datasets;
+}
+
 int main(int argc, char** argv) {
   args::ArgumentParser parser("viralign-push",
                               "Push AGD dataset chunknames to queue.");
@@ -21,8 +56,12 @@ int main(int argc, char** argv) {
       parser, "redis queue resource name",
       "Name of the redis resource to push stuff to [queue:viralign]",
       {'q', "queue_name"});
-  args::Positional<std::string> agd_metadata_arg(parser, "agd args",
-                                                 "The AGD dataset to push");
+  args::ValueFlag<size_t> batch_arg(
+      parser, "batch", "Chunk names per RPUSH [1000]", {'b', "batch"});
+  args::PositionalList<std::string> agd_metadata_arg(
+      parser, "agd args",
+      "The AGD datasets to push: metadata files, directories to search for "
+      "metadata.json files, or glob patterns of either");
 
   try {
     parser.ParseCLI(argc, argv);
@@ -38,12 +77,16 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  std::string agd_meta_path;
+  std::vector<std::string> agd_meta_paths;
+  for (const auto& arg : args::get(agd_metadata_arg)) {
+    auto expanded = ExpandDatasets(arg);
+    agd_meta_paths.insert(agd_meta_paths.end(), expanded.begin(),
+                          expanded.end());
+  }
 
-  if (agd_metadata_arg) {
-    agd_meta_path = args::get(agd_metadata_arg);
-  } else {
+  if (agd_meta_paths.empty()) {
     std::cout << "[viralign-push] AGD metadata JSON file is required.\n";
+    return 1;
   }
 
   std::string queue_name("queue:viralign");
@@ -58,53 +101,67 @@ int main(int argc, char** argv) {
     redis_addr = args::get(redis_arg);
   }
 
+  const size_t batch = batch_arg ? std::max<size_t>(args::get(batch_arg), 1)
+                                 : 1000;
+
   auto full_addr = absl::StrCat("tcp://", redis_addr);
   sw::redis::Redis redis(full_addr);
 
-  std::ifstream i(agd_meta_path);
-  json agd_metadata;
-  i >> agd_metadata;
-  i.close();
-
-  const auto& records = agd_metadata["records"];
+  size_t num_chunks = 0;
+  for (const auto& agd_meta_path : agd_meta_paths) {
+    std::ifstream i(agd_meta_path);
+    if (!i.good()) {
+      std::cout << "[viralign-push] Couldn't open " << agd_meta_path << "\n";
+      return 1;
+    }
+    json agd_metadata;
+    i >> agd_metadata;
+    i.close();
 
-  fs::path path(agd_meta_path);
+    const auto& records = agd_metadata["records"];
 
-  fs::path abs_path = fs::absolute(path);
-  fs::path abs_dir = abs_path.parent_path();
+    fs::path path(agd_meta_path);
 
-  //std::cout << "[viralign-push] Absolute path is " << abs_path << "\n";
-  //std::cout << "[viralign-push] Absolute dir path is " << abs_dir << "\n";
+    fs::path abs_path = fs::absolute(path);
+    fs::path abs_dir = abs_path.parent_path();
 
-  std::string pool("");
+    std::string pool("");
 
-  try {
-    pool = agd_metadata["pool"];
-  } catch (...) {
-    // no pool exists, its fine
-    pool = "";
-  }
+    try {
+      pool = agd_metadata["pool"];
+    } catch (...) {
+      // no pool exists, its fine
+      pool = "";
+    }
 
-  size_t num_chunks = 0;
-  json j;
-  for (const auto& record : records) {
-    j["obj_name"] =
-        absl::StrCat(abs_dir.c_str(), "/", record["path"].get<std::string>());
-    j["pool"] = pool;
-    auto to_send = j.dump();
-    std::cout << "[viralign-push] Pushing: " << j["obj_name"] << " to queue " << queue_name << "\n";
+    std::vector<std::string> values;
+    json j;
+    for (const auto& record : records) {
+      j["obj_name"] = absl::StrCat(abs_dir.c_str(), "/",
+                                   record["path"].get<std::string>());
+      j["pool"] = pool;
+      values.push_back(j.dump());
+    }
 
+    // a multi-value RPUSH per batch, all sent in one round trip
     try {
-      auto resp = redis.rpush(queue_name, {to_send});
-      std::cout << "[viralign-push] Response was " << resp << "\n";
-      num_chunks++;
+      auto pipe = redis.pipeline();
+      for (size_t start = 0; start < values.size(); start += batch) {
+        auto end = std::min(values.size(), start + batch);
+        pipe.rpush(queue_name, values.begin() + start, values.begin() + end);
+      }
+      pipe.exec();
     } catch (...) {
       std::cout << "[viralign-push] Push failed!\n";
       exit(0);
     }
+    num_chunks += values.size();
+    std::cout << "[viralign-push] Pushed " << values.size() << " chunks of "
+              << agd_meta_path << " to queue " << queue_name << "\n";
   }
 
-  //std::cout << "[viralign-push] Pushed all values.\n";
+  std::cout << "[viralign-push] Pushed " << num_chunks << " chunks of "
+            << agd_meta_paths.size() << " datasets.\n";
 
   return 0;
-}
\ No newline at end of file
+}